@@ -4,7 +4,10 @@
 #include "PopulationData/populationData.hpp"
 #include "common/csvParser.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/trace.hpp"
+#include "common/metrics.hpp"
 #include <iostream>
+#include <iterator>
 #include <filesystem>
 #include <mutex>
 #include <thread>
@@ -17,14 +20,48 @@
 // namespace alias so we dont have to type std::filesystem every time
 namespace fs = std::filesystem;
 
-PopulationData::PopulationData() : recordCount(0) {}
+// bytes one copied record takes: the object, its string buffers too long for sso and the yearly values
+static size_t recordBytes(const PopulationRecord& r) {
+    return sizeof(PopulationRecord) + stringHeapBytes(r.getCountryName()) +
+           stringHeapBytes(r.getCountryCode()) + stringHeapBytes(r.getIndicatorName()) +
+           stringHeapBytes(r.getIndicatorCode()) + stringHeapBytes(r.getRegion()) +
+           stringHeapBytes(r.getIncomeGroup()) + stringHeapBytes(r.getSpecialNotes()) +
+           vectorBytes(r.getYearlyValues());
+}
+
+// bytes of rows[from, end), what a query charges to options.stop.memory for them
+static size_t recordsBytes(const std::vector<PopulationRecord>& rows, size_t from) {
+    size_t bytes = 0;
+    for (size_t i = from; i < rows.size(); ++i) bytes += recordBytes(rows[i]);
+    return bytes;
+}
+
+
+PopulationData::PopulationData() : recordCount(0), slowLog(nullptr) {}
 
 PopulationData::~PopulationData() { 
     clear(); 
 }
 
+// query text for the profile and the slow-query log, makeQuery only runs when one of them wants it
+template<typename MakeQuery>
+void PopulationData::finishQuery(const QueryOptions& options, uint64_t elapsedNs, size_t rows,
+                                 MakeQuery makeQuery) const {
+    int logReason = slowLog ? slowLog->shouldLog(elapsedNs) : 0;
+    if (options.profile == nullptr && logReason == 0) return;
+
+    std::string text = makeQuery().toString();
+    if (options.profile) {
+        options.profile->query = text;
+        options.profile->totalNs = elapsedNs;
+        if (options.stop.memory) options.profile->peakBytes = options.stop.memory->peakBytes();
+    }
+    if (logReason != 0) slowLog->record("population", text, elapsedNs, rows, logReason);
+}
+
 // main load function, handles both single files and directories
-void PopulationData::loadFromDirectory(const std::string& dirpath, ParallelStrategy strategy) {
+void PopulationData::loadFromDirectory(const std::string& dirpath, ParallelStrategy strategy,
+                                       const StopCondition& stop) {
     std::vector<std::string> csvFiles;
 
     // make filesystem path object to work with the path easier
@@ -55,266 +92,107 @@ void PopulationData::loadFromDirectory(const std::string& dirpath, ParallelStrat
     printf("Found %zu CSV files to load using %s strategy...\n", 
            csvFiles.size(), strategyToString(strategy));
 
-    // pick which loading method based on strategy
-    switch (strategy) {
-        case ParallelStrategy::OPENMP:
-            loadWithOpenMP(csvFiles);
-            break;
-        case ParallelStrategy::CENTRALIZED_QUEUE:
-            loadWithCentralizedQueue(csvFiles);
-            break;
-        case ParallelStrategy::ROUND_ROBIN:
-            loadWithRoundRobin(csvFiles);
-            break;
-    }
+    uint64_t loadStart = steadyNowNs();
+    loadFiles(csvFiles, strategy, stop);
 
     recordCount = records.size();
     // build indexes now that all data is loaded, makes queries faster
     buildIndexes();
+
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    registry.histogram("population_load_seconds", "Time to load and index a dataset",
+                       {{"strategy", strategyLabel(strategy)}},
+                       {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120})
+        .observe((steadyNowNs() - loadStart) / 1e9);
+    registry.gauge("population_records", "Records currently loaded").set(static_cast<double>(recordCount));
 }
 
 // ============================================================================
-// strategy 1: openmp implementation
+// loading: every csv file is one task for the chosen strategy
 // ============================================================================
-void PopulationData::loadWithOpenMP(const std::vector<std::string>& csvFiles) {
-#ifdef _OPENMP
-    // parallel file loading using openmp
-    std::mutex recordsMutex;
-
-    // openmp automatically splits loop iterations across threads
-    #pragma omp parallel for
-    for (size_t f = 0; f < csvFiles.size(); ++f) {
-        // skip metadata files, we only want the actual data
-        if (csvFiles[f].find("Metadata_") != std::string::npos) {
-            continue;
-        }
-        
-        auto data = CSVParser::readFile(csvFiles[f], false, ',');
-        // each thread gets its own vector to avoid race conditions
-        std::vector<PopulationRecord> localRecords;
-
-        for (const auto& row : data) {
-            // skip rows without enough columns, need at least 4
-            if (row.size() < 4) continue;
-            
-            // skip header and empty rows
-            if (row[0] == "Data Source" || row[0] == "Country Name" || row[0].empty()) {
-                continue;
-            }
+void PopulationData::parseFile(const std::string& filename, std::vector<PopulationRecord>& out) {
+    // skip metadata files, we only want the actual data
+    if (filename.find("Metadata_") != std::string::npos) {
+        return;
+    }
 
-            PopulationRecord record;
-            
-            // set the basic info from first 4 columns
-            record.setCountryName(row[0]);
-            record.setCountryCode(row[1]);
-            record.setIndicatorName(row[2]);
-            record.setIndicatorCode(row[3]);
-
-            // parse the yearly values starting at column 4, goes from 1960-2023
-            std::vector<double> yearlyValues;
-            for (size_t i = 4; i < row.size() && i < 68; ++i) { // 64 years total
-                double value = CSVParser::toDouble(row[i]);
-                yearlyValues.push_back(value);
-            }
-            record.setYearlyValues(yearlyValues);
+    TraceSpan span("parse file", "load");
+    span.detail("%s", fs::path(filename).filename().string().c_str());
 
-            localRecords.push_back(record);
-        }
+    // resolved once, the counters themselves are lock free
+    static Counter& rowsLoaded = MetricsRegistry::instance().counter(
+        "population_rows_loaded_total", "Rows parsed from csv files");
+    static Counter& bytesParsed = MetricsRegistry::instance().counter(
+        "population_bytes_parsed_total", "Bytes of csv read by the loader");
 
-        // critical section so only one thread writes at a time
-        #pragma omp critical
-        {
-            // merge local results into main vector
-            records.insert(records.end(), localRecords.begin(), localRecords.end());
-        }
-    }
-#else
-    // serial version if openmp isnt available
-    for (const auto& filename : csvFiles) {
-        // skip metadata files
-        if (filename.find("Metadata_") != std::string::npos) {
-            continue;
-        }
-        
-        auto data = CSVParser::readFile(filename, false, ',');
-
-        for (const auto& row : data) {
-            // need at least 4 columns
-            if (row.size() < 4) continue;
-            
-            // skip headers and empty rows
-            if (row[0] == "Data Source" || row[0] == "Country Name" || row[0].empty()) {
-                continue;
-            }
+    auto data = CSVParser::readFile(filename, false, ',');
+    std::error_code ec;
+    uintmax_t fileBytes = fs::file_size(filename, ec);
+    if (!ec) bytesParsed.add(fileBytes);
+    size_t before = out.size();
 
-            PopulationRecord record;
-            
-            // basic info
-            record.setCountryName(row[0]);
-            record.setCountryCode(row[1]);
-            record.setIndicatorName(row[2]);
-            record.setIndicatorCode(row[3]);
-
-            // yearly values 1960-2023
-            std::vector<double> yearlyValues;
-            for (size_t i = 4; i < row.size() && i < 68; ++i) {
-                double value = CSVParser::toDouble(row[i]);
-                yearlyValues.push_back(value);
-            }
-            record.setYearlyValues(yearlyValues);
+    for (const auto& row : data) {
+        // skip rows without enough columns, need at least 4
+        if (row.size() < 4) continue;
 
-            records.push_back(record);
+        // skip header and empty rows
+        if (row[0] == "Data Source" || row[0] == "Country Name" || row[0].empty()) {
+            continue;
         }
-    }
-#endif
-}
 
-// ============================================================================
-// strategy 2: leader-worker with centralized queue
-// ============================================================================
-void PopulationData::loadWithCentralizedQueue(const std::vector<std::string>& csvFiles) {
-    // one shared queue that all workers pull from
-    TaskQueue<std::string> taskQueue;
-    std::mutex recordsMutex;
-    
-    unsigned int numWorkers = getOptimalThreadCount();
-    printf("Using %u worker threads with centralized queue\n", numWorkers);
-    
-    // worker function, each worker pulls from same queue
-    auto workerFunc = [&](int workerId) {
-        std::string filename;
-        std::vector<PopulationRecord> localRecords;
-        
-        // keep getting tasks until queue is done
-        while (taskQueue.pop(filename)) {
-            // skip metadata files
-            if (filename.find("Metadata_") != std::string::npos) {
-                continue;
-            }
-            
-            auto data = CSVParser::readFile(filename, false, ',');
-            
-            for (const auto& row : data) {
-                if (row.size() < 4) continue;
-                if (row[0] == "Data Source" || row[0] == "Country Name" || row[0].empty()) {
-                    continue;
-                }
+        PopulationRecord record;
 
-                PopulationRecord record;
-                record.setCountryName(row[0]);
-                record.setCountryCode(row[1]);
-                record.setIndicatorName(row[2]);
-                record.setIndicatorCode(row[3]);
+        // set the basic info from first 4 columns
+        record.setCountryName(row[0]);
+        record.setCountryCode(row[1]);
+        record.setIndicatorName(row[2]);
+        record.setIndicatorCode(row[3]);
 
-                std::vector<double> yearlyValues;
-                for (size_t i = 4; i < row.size() && i < 68; ++i) {
-                    double value = CSVParser::toDouble(row[i]);
-                    yearlyValues.push_back(value);
-                }
-                record.setYearlyValues(yearlyValues);
-                localRecords.push_back(record);
-            }
+        // parse the yearly values starting at column 4, goes from 1960-2023
+        std::vector<double> yearlyValues;
+        for (size_t i = 4; i < row.size() && i < 68; ++i) { // 64 years total
+            double value = CSVParser::toDouble(row[i]);
+            yearlyValues.push_back(value);
         }
-        
-        // done processing, merge results back
-        std::lock_guard<std::mutex> lock(recordsMutex);
-        records.insert(records.end(), localRecords.begin(), localRecords.end());
-    };
-    
-    // leader creates all the worker threads
-    std::vector<std::thread> workers;
-    for (unsigned int i = 0; i < numWorkers; ++i) {
-        workers.emplace_back(workerFunc, i);
-    }
-    
-    // leader pushes all files to queue
-    for (const auto& file : csvFiles) {
-        taskQueue.push(file);
-    }
-    taskQueue.markFinished();
-    
-    // wait for workers to finish
-    for (auto& worker : workers) {
-        worker.join();
+        record.setYearlyValues(yearlyValues);
+
+        out.push_back(record);
     }
+    rowsLoaded.add(out.size() - before);
 }
 
-// ============================================================================
-// strategy 3: leader-worker with round-robin
-// ============================================================================
-void PopulationData::loadWithRoundRobin(const std::vector<std::string>& csvFiles) {
-    unsigned int numWorkers = getOptimalThreadCount();
-    printf("Using %u worker threads with round-robin distribution\n", numWorkers);
-    
-    // each worker gets their own queue so no contention
-    std::vector<WorkerQueue<std::string>> workerQueues(numWorkers);
-    std::mutex recordsMutex;
-    
-    // worker only reads from its own queue
-    auto workerFunc = [&](int workerId) {
-        std::string filename;
-        std::vector<PopulationRecord> localRecords;
-        
-        // no contention since each worker has own queue
-        while (workerQueues[workerId].pop(filename)) {
-            // skip metadata
-            if (filename.find("Metadata_") != std::string::npos) {
-                continue;
-            }
-            
-            auto data = CSVParser::readFile(filename, false, ',');
-            
-            for (const auto& row : data) {
-                if (row.size() < 4) continue;
-                if (row[0] == "Data Source" || row[0] == "Country Name" || row[0].empty()) {
-                    continue;
-                }
-
-                PopulationRecord record;
-                record.setCountryName(row[0]);
-                record.setCountryCode(row[1]);
-                record.setIndicatorName(row[2]);
-                record.setIndicatorCode(row[3]);
+void PopulationData::loadFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy,
+                               const StopCondition& stop) {
+    if (strategy == ParallelStrategy::CENTRALIZED_QUEUE) {
+        printf("Using %u worker threads with centralized queue\n", getOptimalThreadCount());
+    } else if (strategy == ParallelStrategy::ROUND_ROBIN) {
+        printf("Using %u worker threads with round-robin distribution\n", getOptimalThreadCount());
+    }
 
-                std::vector<double> yearlyValues;
-                for (size_t i = 4; i < row.size() && i < 68; ++i) {
-                    double value = CSVParser::toDouble(row[i]);
-                    yearlyValues.push_back(value);
+    // chunk size 1 so each file is its own task
+    // each worker collects into its own vector to avoid race conditions, merged at the end
+    size_t before = records.size();
+    try {
+        StopScope scope(stop);
+        parallelScan<std::vector<PopulationRecord>>(csvFiles.size(), 1, strategy,
+            [&](std::vector<PopulationRecord>& localRecords, size_t start, size_t end) {
+                for (size_t f = start; f < end; ++f) {
+                    parseFile(csvFiles[f], localRecords);
                 }
-                record.setYearlyValues(yearlyValues);
-                localRecords.push_back(record);
-            }
-        }
-        
-        // merge results
-        std::lock_guard<std::mutex> lock(recordsMutex);
-        records.insert(records.end(), localRecords.begin(), localRecords.end());
-    };
-    
-    // create worker threads
-    std::vector<std::thread> workers;
-    for (unsigned int i = 0; i < numWorkers; ++i) {
-        workers.emplace_back(workerFunc, i);
-    }
-    
-    // distribute files round robin style to each worker queue
-    for (size_t i = 0; i < csvFiles.size(); ++i) {
-        int targetWorker = i % numWorkers;  // goes 0,1,2...n-1,0,1,2...
-        workerQueues[targetWorker].push(csvFiles[i]);
-    }
-    
-    // tell all queues were done adding work
-    for (auto& queue : workerQueues) {
-        queue.markFinished();
-    }
-    
-    // wait for all workers
-    for (auto& worker : workers) {
-        worker.join();
+            },
+            [&](std::vector<PopulationRecord>& localRecords) {
+                records.insert(records.end(), std::make_move_iterator(localRecords.begin()),
+                               std::make_move_iterator(localRecords.end()));
+            });
+    } catch (const QueryCancelled&) {
+        // workers still merge the files they finished, drop them again
+        records.erase(records.begin() + before, records.end());
+        throw;
     }
 }
 
 void PopulationData::buildIndexes() {
+    TraceSpan span("build indexes", "load");
     countryIndex.clear();
     regionIndex.clear();
     incomeGroupIndex.clear();
@@ -339,177 +217,155 @@ void PopulationData::buildIndexes() {
             incomeGroupIndex.insert({records[i].getIncomeGroup(), i});
         }
     #endif
+
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    const char* help = "Entries per secondary index";
+    registry.gauge("population_index_entries", help, {{"index", "country"}})
+        .set(static_cast<double>(countryIndex.size()));
+    registry.gauge("population_index_entries", help, {{"index", "region"}})
+        .set(static_cast<double>(regionIndex.size()));
+    registry.gauge("population_index_entries", help, {{"index", "incomeGroup"}})
+        .set(static_cast<double>(incomeGroupIndex.size()));
 }
 
-std::vector<PopulationRecord> PopulationData::queryByCountry(const std::string& countryCode) const {
+// ============================================================================
+// index lookups
+// ============================================================================
+std::vector<PopulationRecord> PopulationData::lookupIndex(const std::multimap<std::string, size_t>& index,
+                                                          const std::string& key, const char* indexName,
+                                                          const QueryOptions& options) const {
     std::vector<PopulationRecord> results;
     // equal_range gets all matching records from index
-    auto range = countryIndex.equal_range(countryCode);
+    auto range = index.equal_range(key);
     // iterate through matches
     for (auto it = range.first; it != range.second; ++it) {
         // it->second has the index
         results.push_back(records[it->second]);
     }
+    if (options.stop.memory) options.stop.memory->charge(recordsBytes(results, 0));
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = std::string("index(") + indexName + ")";
+        // every index entry in the range is read and matches
+        profile.rowsScanned = results.size();
+        profile.rowsMatched = results.size();
+        for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
+    }
     return results;
 }
 
-std::vector<PopulationRecord> PopulationData::queryByRegion(const std::string& region) const {
-    std::vector<PopulationRecord> results;
-    auto range = regionIndex.equal_range(region);
-    for (auto it = range.first; it != range.second; ++it) {
-        results.push_back(records[it->second]);
-    }
+std::vector<PopulationRecord> PopulationData::queryByCountry(const std::string& countryCode,
+                                                             const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    static QueryMetrics metrics("population", "country", true);
+    uint64_t start = steadyNowNs();
+    std::vector<PopulationRecord> results = lookupIndex(countryIndex, countryCode, "country", options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return PopulationQuery::country(countryCode);
+    });
     return results;
 }
 
-std::vector<PopulationRecord> PopulationData::queryByIncomeGroup(const std::string& incomeGroup) const {
-    std::vector<PopulationRecord> results;
-    auto range = incomeGroupIndex.equal_range(incomeGroup);
-    for (auto it = range.first; it != range.second; ++it) {
-        results.push_back(records[it->second]);
-    }
+std::vector<PopulationRecord> PopulationData::queryByRegion(const std::string& region,
+                                                            const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    static QueryMetrics metrics("population", "region", true);
+    uint64_t start = steadyNowNs();
+    std::vector<PopulationRecord> results = lookupIndex(regionIndex, region, "region", options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return PopulationQuery::region(region);
+    });
+    return results;
+}
+
+std::vector<PopulationRecord> PopulationData::queryByIncomeGroup(const std::string& incomeGroup,
+                                                                 const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    static QueryMetrics metrics("population", "incomeGroup", true);
+    uint64_t start = steadyNowNs();
+    std::vector<PopulationRecord> results = lookupIndex(incomeGroupIndex, incomeGroup, "incomeGroup", options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return PopulationQuery::incomeGroup(incomeGroup);
+    });
     return results;
 }
 
 // ============================================================================
-// query by population range using different strategies
+// shared scan for the filter queries, works with every strategy
 // ============================================================================
-std::vector<PopulationRecord> PopulationData::queryByPopulationRange(
-    double minPopulation, double maxPopulation, int year, ParallelStrategy strategy) const {
-    
+template<typename Predicate>
+std::vector<PopulationRecord> PopulationData::collectMatching(ParallelStrategy strategy,
+                                                              Predicate predicate,
+                                                              const QueryOptions& options) const {
     std::vector<PopulationRecord> results;
-    
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            // parallelize search with openmp
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                double population = records[i].getPopulationForYear(year);
-                if (population >= minPopulation && population <= maxPopulation) {
-                    #pragma omp critical
-                    {
-                        results.push_back(records[i]);
-                    }
-                }
-            }
-#else
-            // serial version
-            for (const auto& record : records) {
-                double population = record.getPopulationForYear(year);
-                if (population >= minPopulation && population <= maxPopulation) {
-                    results.push_back(record);
-                }
-            }
-#endif
-            break;
-        }
-        
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            // centralized queue approach, split records into chunks
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;  // <start, end>
-            std::mutex resultsMutex;
-            
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);  // make more chunks for load balancing
-            if (chunkSize == 0) chunkSize = 1;
-            
-            // Worker function
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<PopulationRecord> localResults;
-                
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double population = records[i].getPopulationForYear(year);
-                        if (population >= minPopulation && population <= maxPopulation) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
+    std::vector<std::vector<PopulationRecord>> workerResults;
+    size_t mergedRows = 0;
+
+    // each worker collects its own matches so there is no lock per hit, merged at the end
+    parallelScan<std::vector<PopulationRecord>>(records.size(), defaultChunkSize(records.size()), strategy,
+        [&](std::vector<PopulationRecord>& localResults, size_t start, size_t end) {
+            size_t before = localResults.size();
+            for (size_t i = start; i < end; ++i) {
+                if (predicate(records[i])) {
+                    localResults.push_back(records[i]);
                 }
-                
-                // Merge local results
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-            
-            // Start workers
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
-            
-            // Push chunks to queue
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
-            
-            // Wait for workers
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
-        }
-        
-        case ParallelStrategy::ROUND_ROBIN: {
-            // Round-robin: each worker gets its own subset
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-            
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-            
-            // Worker function
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<PopulationRecord> localResults;
-                
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double population = records[i].getPopulationForYear(year);
-                        if (population >= minPopulation && population <= maxPopulation) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
-                
-                // Merge local results
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-            
-            // Start workers
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-            
-            // Distribute chunks in round-robin
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-            
-            // Mark queues as finished
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
-            
-            // Wait for workers
-            for (auto& worker : workers) {
-                worker.join();
             }
-            break;
+            if (options.stop.memory) options.stop.memory->charge(recordsBytes(localResults, before));
+        },
+        [&](std::vector<PopulationRecord>& localResults) {
+            mergedRows += localResults.size();
+            workerResults.push_back(std::move(localResults));
+        });
+    // joined once the total is known, a single worker's vector is taken as it is
+    if (workerResults.size() == 1) {
+        results.swap(workerResults[0]);
+    } else {
+        results.reserve(mergedRows);
+        for (auto& part : workerResults) {
+            results.insert(results.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
         }
     }
-    
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "scan";
+        profile.rowsScanned = records.size();
+        profile.rowsMatched = results.size();
+        profile.addRun(lastParallelRun());
+        for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
+    }
+    return results;
+}
+
+// ============================================================================
+// query by population range using different strategies
+// ============================================================================
+std::vector<PopulationRecord> PopulationData::queryByPopulationRange(
+    double minPopulation, double maxPopulation, int year, ParallelStrategy strategy,
+    const QueryOptions& options) const {
+
+    StopScope stop(options.stop);
+    TraceSpan span("queryByPopulationRange", "query");
+    static QueryMetrics metrics("population", "populationRange");
+    uint64_t start = steadyNowNs();
+    std::vector<PopulationRecord> results = collectMatching(strategy, [&](const PopulationRecord& record) {
+        double population = record.getPopulationForYear(year);
+        return population >= minPopulation && population <= maxPopulation;
+    }, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return PopulationQuery::populationRange(minPopulation, maxPopulation, year, strategy);
+    });
     return results;
 }
 
@@ -517,155 +373,121 @@ std::vector<PopulationRecord> PopulationData::queryByPopulationRange(
 // Query: Year Range with Multiple Strategies
 // ============================================================================
 std::vector<PopulationRecord> PopulationData::queryByYearRange(
-    int startYear, int endYear, ParallelStrategy strategy) const {
-    
-    std::vector<PopulationRecord> results;
-    
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                // Check if record has data for the specified year range
-                bool hasData = false;
-                for (int year = startYear; year <= endYear; year++) {
-                    if (records[i].getPopulationForYear(year) > 0) {
-                        hasData = true;
-                        break;
-                    }
-                }
-                if (hasData) {
-                    #pragma omp critical
-                    {
-                        results.push_back(records[i]);
-                    }
-                }
-            }
-#else
-            // Serial fallback
-            for (const auto& record : records) {
-                bool hasData = false;
-                for (int year = startYear; year <= endYear; year++) {
-                    if (record.getPopulationForYear(year) > 0) {
-                        hasData = true;
-                        break;
-                    }
-                }
-                if (hasData) {
-                    results.push_back(record);
-                }
+    int startYear, int endYear, ParallelStrategy strategy, const QueryOptions& options) const {
+
+    StopScope stop(options.stop);
+    TraceSpan span("queryByYearRange", "query");
+    static QueryMetrics metrics("population", "yearRange");
+    uint64_t start = steadyNowNs();
+    std::vector<PopulationRecord> results = collectMatching(strategy, [&](const PopulationRecord& record) {
+        // Check if record has data for the specified year range
+        for (int year = startYear; year <= endYear; year++) {
+            if (record.getPopulationForYear(year) > 0) {
+                return true;
             }
-#endif
-            break;
-        }
-        
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
-            
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-            
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<PopulationRecord> localResults;
-                
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        bool hasData = false;
-                        for (int year = startYear; year <= endYear; year++) {
-                            if (records[i].getPopulationForYear(year) > 0) {
-                                hasData = true;
-                                break;
-                            }
-                        }
-                        if (hasData) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
-                
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-            
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
-            
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
-            
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
-        }
-        
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-            
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-            
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<PopulationRecord> localResults;
-                
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        bool hasData = false;
-                        for (int year = startYear; year <= endYear; year++) {
-                            if (records[i].getPopulationForYear(year) > 0) {
-                                hasData = true;
-                                break;
-                            }
-                        }
-                        if (hasData) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
-                
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-            
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-            
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-            
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
-            
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
         }
-    }
-    
+        return false;
+    }, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return PopulationQuery::yearRange(startYear, endYear, strategy);
+    });
     return results;
 }
 
+// ============================================================================
+// execute: run a query given as a spec
+// ============================================================================
+std::vector<PopulationRecord> PopulationData::execute(const PopulationQuery& query,
+                                                      const QueryOptions& options) const {
+    switch (query.type) {
+        case PopulationQueryType::COUNTRY:
+            return queryByCountry(query.text, options);
+        case PopulationQueryType::REGION:
+            return queryByRegion(query.text, options);
+        case PopulationQueryType::INCOME_GROUP:
+            return queryByIncomeGroup(query.text, options);
+        case PopulationQueryType::POPULATION_RANGE:
+            return queryByPopulationRange(query.minPopulation, query.maxPopulation, query.year,
+                                          query.strategy, options);
+        case PopulationQueryType::YEAR_RANGE:
+            return queryByYearRange(query.startYear, query.endYear, query.strategy, options);
+    }
+    return {};
+}
+
+// ============================================================================
+// explain: what a query would do, without running it
+// ============================================================================
+std::string PopulationData::explain(const PopulationQuery& query) const {
+    std::string plan = "Query: " + query.toString() + "\n";
+    char line[256];
+
+    if (query.isIndexLookup()) {
+        // the index gives the exact row count for free
+        const std::multimap<std::string, size_t>& index =
+            query.type == PopulationQueryType::COUNTRY ? countryIndex :
+            query.type == PopulationQueryType::REGION ? regionIndex : incomeGroupIndex;
+        snprintf(line, sizeof(line), "Access path: index(%s), equal_range on the multimap\n",
+                 populationQueryTypeName(query.type));
+        plan += line;
+        snprintf(line, sizeof(line), "Rows: %zu of %zu (exact, from the index)\n",
+                 index.count(query.text), records.size());
+        plan += line;
+        plan += "Output: matching records copied\n";
+        return plan;
+    }
+
+    size_t chunkSize = defaultChunkSize(records.size());
+    size_t chunks = (records.size() + chunkSize - 1) / chunkSize;
+    plan += "Access path: scan (no index covers this predicate)\n";
+    snprintf(line, sizeof(line), "Rows to scan: %zu in %zu blocks of up to %zu rows\n",
+             records.size(), chunks, chunkSize);
+    plan += line;
+    snprintf(line, sizeof(line), "Strategy: %s, %u workers\n", strategyToString(query.strategy),
+             strategyWorkerCount(query.strategy));
+    plan += line;
+
+    if (query.type == PopulationQueryType::POPULATION_RANGE) {
+        snprintf(line, sizeof(line), "Predicate: %g <= population[%d] <= %g\n",
+                 query.minPopulation, query.year, query.maxPopulation);
+    } else {
+        snprintf(line, sizeof(line), "Predicate: population[y] > 0 for some %d <= y <= %d\n",
+                 query.startYear, query.endYear);
+    }
+    plan += line;
+    plan += "Output: matching records copied, per-worker vectors merged at the end\n";
+    return plan;
+}
+
+// ============================================================================
+// memory accounting
+// ============================================================================
+MemoryUsage PopulationData::memoryUsage() const {
+    MemoryUsage usage;
+    usage.recordCount = records.size();
+
+    usage.add("records", vectorBytes(records));
+
+    size_t stringBytes = 0;
+    size_t valueBytes = 0;
+    for (const auto& r : records) {
+        stringBytes += stringHeapBytes(r.getCountryName()) + stringHeapBytes(r.getCountryCode()) +
+                       stringHeapBytes(r.getIndicatorName()) + stringHeapBytes(r.getIndicatorCode()) +
+                       stringHeapBytes(r.getRegion()) + stringHeapBytes(r.getIncomeGroup()) +
+                       stringHeapBytes(r.getSpecialNotes());
+        valueBytes += vectorBytes(r.getYearlyValues());
+    }
+    usage.add("record strings", stringBytes);
+    usage.add("yearly values", valueBytes);
+
+    usage.add("countryIndex", multimapBytes(countryIndex));
+    usage.add("regionIndex", multimapBytes(regionIndex));
+    usage.add("incomeGroupIndex", multimapBytes(incomeGroupIndex));
+    return usage;
+}
+
 void PopulationData::clear() {
     // Free memory by clearing all containers
     records.clear();
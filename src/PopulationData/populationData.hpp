@@ -7,6 +7,10 @@
 #include <map>
 #include "PopulationData/populationRecord.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/memoryUsage.hpp"
+#include "common/queryProfile.hpp"
+#include "common/slowQueryLog.hpp"
+#include "PopulationData/populationQuery.hpp"
 
 class PopulationData {
 private:
@@ -19,14 +23,32 @@ private:
     // income group index map
     std::multimap<std::string, size_t> incomeGroupIndex;
     size_t recordCount;
+    // slow-query log, not owned (see setSlowQueryLog)
+    SlowQueryLog* slowLog;
 
     // helper function to build the indexes after loading, makes queries way faster
     void buildIndexes();
     
-    // different implementations for each strategy
-    void loadWithOpenMP(const std::vector<std::string>& csvFiles);
-    void loadWithCentralizedQueue(const std::vector<std::string>& csvFiles);
-    void loadWithRoundRobin(const std::vector<std::string>& csvFiles);
+    // loads the files in parallel with the given strategy, one file is one task
+    void loadFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy, const StopCondition& stop);
+    // parses one csv file and appends its records to out
+    static void parseFile(const std::string& filename, std::vector<PopulationRecord>& out);
+
+    // fills the query text of options.profile and writes the slow-query log entry of a finished query
+    // makeQuery returns the query spec and is only called when one of them needs it
+    template<typename MakeQuery>
+    void finishQuery(const QueryOptions& options, uint64_t elapsedNs, size_t rows, MakeQuery makeQuery) const;
+
+    // shared scan behind the filter queries, returns copies of every record matching the predicate
+    // and fills options.profile when it is set
+    template<typename Predicate>
+    std::vector<PopulationRecord> collectMatching(ParallelStrategy strategy, Predicate predicate,
+                                                  const QueryOptions& options) const;
+
+    // shared by the three index lookups
+    std::vector<PopulationRecord> lookupIndex(const std::multimap<std::string, size_t>& index,
+                                              const std::string& key, const char* indexName,
+                                              const QueryOptions& options) const;
 
 public:
     // constructor and destructor
@@ -34,21 +56,44 @@ public:
     ~PopulationData();
 
     // main loading function, can load single file or whole directory
-    // strategy parameter picks which parallelization method to use
+    // strategy parameter picks which parallelization method to use. a load stopped by stop (checked
+    // between files) throws QueryCancelled and leaves the data as it was before
     void loadFromDirectory(const std::string& dirpath, 
-                          ParallelStrategy strategy = ParallelStrategy::OPENMP);
+                          ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                          const StopCondition& stop = StopCondition());
     
     // these query methods return vectors of matching records
-    std::vector<PopulationRecord> queryByCountry(const std::string& countryCode) const;
-    std::vector<PopulationRecord> queryByRegion(const std::string& region) const;
-    std::vector<PopulationRecord> queryByIncomeGroup(const std::string& incomeGroup) const;
+    // every query takes optional QueryOptions last, set options.profile to get an execution profile
+    // and options.stop to make it cancellable or give it a deadline (it throws QueryCancelled)
+    std::vector<PopulationRecord> queryByCountry(const std::string& countryCode,
+                                                 const QueryOptions& options = QueryOptions()) const;
+    std::vector<PopulationRecord> queryByRegion(const std::string& region,
+                                                const QueryOptions& options = QueryOptions()) const;
+    std::vector<PopulationRecord> queryByIncomeGroup(const std::string& incomeGroup,
+                                                     const QueryOptions& options = QueryOptions()) const;
     
     // these queries can use different parallel strategies too
     std::vector<PopulationRecord> queryByPopulationRange(double minPopulation, double maxPopulation, 
                                                          int year = 2020,
-                                                         ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                                         ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                         const QueryOptions& options = QueryOptions()) const;
     std::vector<PopulationRecord> queryByYearRange(int startYear, int endYear,
-                                                    ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                                    ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                    const QueryOptions& options = QueryOptions()) const;
+
+    // runs the query described by a spec (parsed from text, read from a workload file, ...)
+    std::vector<PopulationRecord> execute(const PopulationQuery& query,
+                                          const QueryOptions& options = QueryOptions()) const;
+
+    // the plan the query would run with (access path, rows and blocks to scan, workers), without running it
+    std::string explain(const PopulationQuery& query) const;
+
+    // queries over the log's threshold (and its sampled share of the rest) are written to log
+    // the log isn't owned and has to outlive this object, nullptr turns logging off again
+    void setSlowQueryLog(SlowQueryLog* log) { slowLog = log; }
+
+    // breakdown of the memory held by records, their strings, yearly values and the indexes
+    MemoryUsage memoryUsage() const;
 
     // inline getter returns number of records
     size_t size() const { return recordCount; }
@@ -0,0 +1,133 @@
+// Description of one PopulationData query (type, parameters and strategy)
+// used by explain() / execute() and wherever a query has to be logged, shown or read back as text
+#ifndef POPULATION_QUERY_HPP
+#define POPULATION_QUERY_HPP
+
+#include <string>
+#include "common/parallelStrategy.hpp"
+#include "common/queryText.hpp"
+
+enum class PopulationQueryType {
+    COUNTRY,            // index lookups
+    REGION,
+    INCOME_GROUP,
+    POPULATION_RANGE,   // scans
+    YEAR_RANGE
+};
+
+inline const char* populationQueryTypeName(PopulationQueryType type) {
+    switch (type) {
+        case PopulationQueryType::COUNTRY: return "country";
+        case PopulationQueryType::REGION: return "region";
+        case PopulationQueryType::INCOME_GROUP: return "incomeGroup";
+        case PopulationQueryType::POPULATION_RANGE: return "populationRange";
+        case PopulationQueryType::YEAR_RANGE: return "yearRange";
+        default: return "unknown";
+    }
+}
+
+struct PopulationQuery {
+    PopulationQueryType type = PopulationQueryType::POPULATION_RANGE;
+    ParallelStrategy strategy = ParallelStrategy::OPENMP;
+    std::string text;            // country code, region or income group
+    double minPopulation = 0.0, maxPopulation = 0.0;
+    int year = 2020;
+    int startYear = 0, endYear = 0;
+
+    // ========================================================================
+    // one factory per query method, same parameters in the same order
+    // ========================================================================
+    static PopulationQuery country(const std::string& countryCode) {
+        PopulationQuery q;
+        q.type = PopulationQueryType::COUNTRY;
+        q.text = countryCode;
+        return q;
+    }
+
+    static PopulationQuery region(const std::string& region) {
+        PopulationQuery q;
+        q.type = PopulationQueryType::REGION;
+        q.text = region;
+        return q;
+    }
+
+    static PopulationQuery incomeGroup(const std::string& incomeGroup) {
+        PopulationQuery q;
+        q.type = PopulationQueryType::INCOME_GROUP;
+        q.text = incomeGroup;
+        return q;
+    }
+
+    static PopulationQuery populationRange(double minPopulation, double maxPopulation, int year = 2020,
+                                           ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        PopulationQuery q;
+        q.type = PopulationQueryType::POPULATION_RANGE;
+        q.minPopulation = minPopulation;
+        q.maxPopulation = maxPopulation;
+        q.year = year;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static PopulationQuery yearRange(int startYear, int endYear,
+                                     ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        PopulationQuery q;
+        q.type = PopulationQueryType::YEAR_RANGE;
+        q.startYear = startYear;
+        q.endYear = endYear;
+        q.strategy = strategy;
+        return q;
+    }
+
+    bool isIndexLookup() const {
+        return type == PopulationQueryType::COUNTRY || type == PopulationQueryType::REGION ||
+               type == PopulationQueryType::INCOME_GROUP;
+    }
+
+    // text form: the type followed by key=value pairs, e.g. "yearRange start=2000 end=2010 strategy=openmp"
+    std::string toString() const {
+        std::string out = populationQueryTypeName(type);
+        switch (type) {
+            case PopulationQueryType::COUNTRY:
+                out += " code=" + escapeQueryValue(text);
+                break;
+            case PopulationQueryType::REGION:
+                out += " region=" + escapeQueryValue(text);
+                break;
+            case PopulationQueryType::INCOME_GROUP:
+                out += " incomeGroup=" + escapeQueryValue(text);
+                break;
+            case PopulationQueryType::POPULATION_RANGE:
+                out += " min=" + formatQueryNumber(minPopulation) + " max=" + formatQueryNumber(maxPopulation) +
+                       " year=" + std::to_string(year);
+                break;
+            case PopulationQueryType::YEAR_RANGE:
+                out += " start=" + std::to_string(startYear) + " end=" + std::to_string(endYear);
+                break;
+        }
+        // index lookups don't use a strategy
+        if (!isIndexLookup()) {
+            out += std::string(" strategy=") + strategyLabel(strategy);
+        }
+        return out;
+    }
+
+    // reads the text form back, throws std::runtime_error on unknown types or missing parameters
+    static PopulationQuery parse(const std::string& line) {
+        QueryText parsed = QueryText::parse(line);
+        const std::string& type = parsed.type;
+        ParallelStrategy strategy = parsed.strategy();
+
+        if (type == "country") return country(parsed.text("code"));
+        if (type == "region") return region(parsed.text("region"));
+        if (type == "incomeGroup") return incomeGroup(parsed.text("incomeGroup"));
+        if (type == "populationRange") {
+            int year = parsed.has("year") ? parsed.integer("year") : 2020;
+            return populationRange(parsed.number("min"), parsed.number("max"), year, strategy);
+        }
+        if (type == "yearRange") return yearRange(parsed.integer("start"), parsed.integer("end"), strategy);
+        throw std::runtime_error("Unknown population query type: " + type);
+    }
+};
+
+#endif
@@ -0,0 +1,63 @@
+// global operator new/delete replacements that feed AllocTracker
+// only linked into the benchmarks when configured with -DTRACK_ALLOCATIONS=ON
+//
+// every block gets a small header holding the requested size so delete can report bytes freed
+// even when the unsized delete is called. aligned new/delete (align_val_t) are left alone, the
+// library versions pair with each other and none of our containers use over-aligned types.
+
+#include "common/allocTracker.hpp"
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+namespace {
+
+// keeps the returned pointer aligned like malloc's
+const size_t HEADER_SIZE = alignof(std::max_align_t);
+
+void* trackedAlloc(size_t size) {
+    void* raw = std::malloc(size + HEADER_SIZE);
+    if (raw == nullptr) return nullptr;
+    *static_cast<size_t*>(raw) = size;
+    AllocTracker::recordAlloc(size);
+    return static_cast<char*>(raw) + HEADER_SIZE;
+}
+
+void trackedFree(void* ptr) {
+    if (ptr == nullptr) return;
+    char* raw = static_cast<char*>(ptr) - HEADER_SIZE;
+    AllocTracker::recordFree(*reinterpret_cast<size_t*>(raw));
+    std::free(raw);
+}
+
+// runs during static initialization so installed() is true before main
+[[maybe_unused]] const bool registered = (AllocTracker::markInstalled(), true);
+
+}  // namespace
+
+void* operator new(size_t size) {
+    void* ptr = trackedAlloc(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    void* ptr = trackedAlloc(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return trackedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return trackedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { trackedFree(ptr); }
@@ -0,0 +1,157 @@
+// Heap allocation counting for the benchmarks
+// the counters live here, the global operator new/delete replacements that feed them are in
+// allocTracker.cpp and are only linked in when the build enables TRACK_ALLOCATIONS
+#ifndef ALLOC_TRACKER_HPP
+#define ALLOC_TRACKER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// counters of one thread, only the owning thread writes them so relaxed atomics are enough
+// (atomics are still needed so a reporting thread can read them while workers run)
+struct AllocSlot {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytesAllocated;
+    std::atomic<uint64_t> bytesFreed;
+};
+
+// totals of one thread (or of the whole process) at one point in time
+struct AllocCounts {
+    int thread = -1;  // slot number, -1 for the process total
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t bytesAllocated = 0;
+    uint64_t bytesFreed = 0;
+};
+
+class AllocTracker {
+public:
+    // threads get slots in the order they first allocate, slot 0 is usually the main thread
+    // threads past the limit all share the last slot
+    static const int MAX_THREAD_SLOTS = 1024;
+
+    // called from the operator new/delete replacements, must never allocate themselves
+    static void recordAlloc(size_t bytes) {
+        AllocSlot* slot = currentSlot();
+        slot->allocs.fetch_add(1, std::memory_order_relaxed);
+        slot->bytesAllocated.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void recordFree(size_t bytes) {
+        AllocSlot* slot = currentSlot();
+        slot->frees.fetch_add(1, std::memory_order_relaxed);
+        slot->bytesFreed.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // true when allocTracker.cpp is linked in, otherwise all counts stay zero
+    static bool installed() { return hooksInstalled; }
+    static void markInstalled() { hooksInstalled = true; }
+
+    // per-thread counters for every thread that has allocated so far
+    static std::vector<AllocCounts> snapshot() {
+        int used = nextSlot.load(std::memory_order_acquire);
+        if (used > MAX_THREAD_SLOTS) used = MAX_THREAD_SLOTS;
+        std::vector<AllocCounts> result;
+        result.reserve(used);
+        for (int i = 0; i < used; ++i) {
+            AllocCounts c;
+            c.thread = i;
+            c.allocs = slots[i].allocs.load(std::memory_order_relaxed);
+            c.frees = slots[i].frees.load(std::memory_order_relaxed);
+            c.bytesAllocated = slots[i].bytesAllocated.load(std::memory_order_relaxed);
+            c.bytesFreed = slots[i].bytesFreed.load(std::memory_order_relaxed);
+            result.push_back(c);
+        }
+        return result;
+    }
+
+private:
+    static inline AllocSlot slots[MAX_THREAD_SLOTS] = {};
+    static inline std::atomic<int> nextSlot{0};
+    static inline bool hooksInstalled = false;
+    static inline thread_local AllocSlot* threadSlot = nullptr;
+
+    static AllocSlot* currentSlot() {
+        if (threadSlot == nullptr) {
+            int index = nextSlot.fetch_add(1, std::memory_order_acq_rel);
+            threadSlot = &slots[index < MAX_THREAD_SLOTS ? index : MAX_THREAD_SLOTS - 1];
+        }
+        return threadSlot;
+    }
+};
+
+// ============================================================================
+// Counts allocations between construction and stop(), process wide and per thread
+// usage:
+//   AllocPhase phase("load");
+//   data.loadFromDirectory(path);
+//   phase.stop();
+//   phase.print(data.size(), "row");
+// ============================================================================
+class AllocPhase {
+private:
+    std::string name;
+    std::vector<AllocCounts> before;
+    std::vector<AllocCounts> delta;  // per thread, only threads that allocated in the phase
+    AllocCounts total;
+    bool stopped;
+
+public:
+    AllocPhase(const std::string& phaseName)
+        : name(phaseName), before(AllocTracker::snapshot()), stopped(false) {}
+
+    void stop() {
+        if (stopped) return;
+        stopped = true;
+        std::vector<AllocCounts> after = AllocTracker::snapshot();
+        for (const auto& a : after) {
+            AllocCounts d = a;
+            // threads that first allocated during the phase have no "before" entry
+            if (a.thread < static_cast<int>(before.size())) {
+                const AllocCounts& b = before[a.thread];
+                d.allocs -= b.allocs;
+                d.frees -= b.frees;
+                d.bytesAllocated -= b.bytesAllocated;
+                d.bytesFreed -= b.bytesFreed;
+            }
+            if (d.allocs == 0 && d.frees == 0) continue;
+            total.allocs += d.allocs;
+            total.frees += d.frees;
+            total.bytesAllocated += d.bytesAllocated;
+            total.bytesFreed += d.bytesFreed;
+            delta.push_back(d);
+        }
+    }
+
+    const AllocCounts& totals() const { return total; }
+    const std::vector<AllocCounts>& perThread() const { return delta; }
+
+    // units is what the phase processed (rows loaded, queries run) for the per-unit figures
+    void print(size_t units = 0, const char* unitName = "op", bool showThreads = true) const {
+        if (!AllocTracker::installed()) {
+            printf("Allocations (%s): tracking not compiled in (configure with -DTRACK_ALLOCATIONS=ON)\n",
+                   name.c_str());
+            return;
+        }
+        printf("Allocations (%s): %llu allocs / %.2f MB, %llu frees / %.2f MB\n", name.c_str(),
+               (unsigned long long)total.allocs, total.bytesAllocated / (1024.0 * 1024.0),
+               (unsigned long long)total.frees, total.bytesFreed / (1024.0 * 1024.0));
+        if (units > 0) {
+            printf("  per %s: %.2f allocs, %.1f bytes\n", unitName,
+                   static_cast<double>(total.allocs) / units,
+                   static_cast<double>(total.bytesAllocated) / units);
+        }
+        if (showThreads && delta.size() > 1) {
+            for (const auto& d : delta) {
+                printf("  thread %-4d %10llu allocs %10.2f MB\n", d.thread,
+                       (unsigned long long)d.allocs, d.bytesAllocated / (1024.0 * 1024.0));
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,82 @@
+// Early termination for queries that only want the first N matches
+//
+// a MatchLimit is shared by the workers of one scan. they report their matches as they go, a batch
+// of rows at a time, and ask it before every batch whether the rows from there on still matter.
+//
+// ANY mode: a shared atomic counter, once N matches were found anywhere every worker stops, the
+// result is N of the matches but which ones depends on the timing of the workers.
+//
+// PREFIX mode: the first N matches in row order, the same ones whatever the strategy. here the
+// scan stops at a bound, rows before it are all read and rows from it on are skipped. the bound moves
+// down when a single chunk has N matches by itself (nothing after the batch it got there in can be
+// one of the first N) or when the chunks completed from row 0 on without a gap already hold N. the
+// caller keeps the matches before the bound in row order and cuts them to N
+#ifndef MATCH_LIMIT_HPP
+#define MATCH_LIMIT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+enum class LimitMode { ANY, PREFIX };
+
+class MatchLimit {
+private:
+    size_t limit;
+    LimitMode mode;
+    std::atomic<size_t> matched{0};
+    std::atomic<size_t> bound{SIZE_MAX};
+    // PREFIX: completed chunks past the gapless prefix (start -> end, matches)
+    std::mutex chunkMutex;
+    std::map<size_t, std::pair<size_t, size_t>> completed;
+    size_t prefixEnd = 0;
+    size_t prefixMatches = 0;
+
+    void lowerBound(size_t position) {
+        size_t seen = bound.load(std::memory_order_relaxed);
+        while (position < seen && !bound.compare_exchange_weak(seen, position, std::memory_order_relaxed)) {}
+    }
+
+public:
+    // 0 rows is no limit, every call below is then a no-op
+    explicit MatchLimit(size_t rows = 0, LimitMode limitMode = LimitMode::ANY) : limit(rows), mode(limitMode) {}
+
+    bool active() const { return limit != 0; }
+    size_t rows() const { return limit; }
+    LimitMode limitMode() const { return mode; }
+
+    // true when the rows from position on can't change the result any more
+    bool reached(size_t position) const {
+        if (limit == 0) return false;
+        if (mode == LimitMode::ANY) return matched.load(std::memory_order_relaxed) >= limit;
+        return position >= bound.load(std::memory_order_relaxed);
+    }
+
+    // a worker found matches in the batch ending at position, chunkMatches in its chunk so far
+    void add(size_t matches, size_t chunkMatches, size_t position) {
+        if (limit == 0 || matches == 0) return;
+        matched.fetch_add(matches, std::memory_order_relaxed);
+        if (mode == LimitMode::PREFIX && chunkMatches >= limit) lowerBound(position);
+    }
+
+    // PREFIX: the chunk [start, end) was read to its end and had matches in it. chunks that stopped at
+    // the bound don't report, the prefix can't usefully grow past the bound anyway
+    void chunkDone(size_t start, size_t end, size_t matches) {
+        if (limit == 0 || mode != LimitMode::PREFIX) return;
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        completed[start] = {end, matches};
+        for (auto it = completed.find(prefixEnd); it != completed.end(); it = completed.find(prefixEnd)) {
+            prefixEnd = it->second.first;
+            prefixMatches += it->second.second;
+            completed.erase(it);
+        }
+        if (prefixMatches >= limit) lowerBound(prefixEnd);
+    }
+
+    // matches reported so far, the scans keep a few more than rows() when workers raced to the end
+    size_t matchedRows() const { return matched.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,130 @@
+// Memory footprint accounting helpers
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <fstream>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#ifndef __APPLE__
+#include <unistd.h>
+#endif
+
+// ============================================================================
+// Per-component memory breakdown of a dataset
+// ============================================================================
+struct MemoryUsage {
+    // component name -> bytes, kept in insertion order so printouts are stable
+    std::vector<std::pair<std::string, size_t>> components;
+    size_t recordCount = 0;
+
+    void add(const std::string& component, size_t bytes) {
+        components.push_back({component, bytes});
+    }
+
+    size_t total() const {
+        size_t sum = 0;
+        for (const auto& c : components) sum += c.second;
+        return sum;
+    }
+
+    double bytesPerRecord() const {
+        return recordCount > 0 ? static_cast<double>(total()) / recordCount : 0.0;
+    }
+
+    void print(const std::string& title) const {
+        printf("\n=== Memory: %s ===\n", title.c_str());
+        for (const auto& c : components) {
+            printf("%-24s %12.2f MB  (%.1f B/record)\n", c.first.c_str(),
+                   c.second / (1024.0 * 1024.0),
+                   recordCount > 0 ? static_cast<double>(c.second) / recordCount : 0.0);
+        }
+        printf("%-24s %12.2f MB  (%.1f B/record, %zu records)\n", "Total",
+               total() / (1024.0 * 1024.0), bytesPerRecord(), recordCount);
+        printf("================================\n\n");
+    }
+};
+
+// ============================================================================
+// Size estimates for standard containers
+// these are estimates of what the allocator hands out, not exact malloc overhead
+// ============================================================================
+
+// Heap bytes owned by a string, 0 when the text fits in the small string buffer
+// (if data() points inside the string object itself there is no heap allocation)
+inline size_t stringHeapBytes(const std::string& s) {
+    const char* data = s.data();
+    const char* self = reinterpret_cast<const char*>(&s);
+    if (data >= self && data < self + sizeof(std::string)) return 0;
+    return s.capacity() + 1;  // +1 for the null terminator
+}
+
+// Bytes of a vector's buffer (capacity, not size, since that's what was allocated)
+template<typename T>
+size_t vectorBytes(const std::vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+// Red-black tree nodes carry color + parent/left/right pointers on top of the value
+const size_t TREE_NODE_OVERHEAD = 4 * sizeof(void*);
+
+// Nodes of a string-keyed multimap plus the heap bytes of the key strings
+template<typename V>
+size_t multimapBytes(const std::multimap<std::string, V>& index) {
+    size_t bytes = index.size() * (TREE_NODE_OVERHEAD + sizeof(std::pair<const std::string, V>));
+    for (const auto& entry : index) {
+        bytes += stringHeapBytes(entry.first);
+    }
+    return bytes;
+}
+
+// Nodes of a string-keyed map plus the heap bytes of the key strings
+template<typename V>
+size_t mapBytes(const std::map<std::string, V>& index) {
+    size_t bytes = index.size() * (TREE_NODE_OVERHEAD + sizeof(std::pair<const std::string, V>));
+    for (const auto& entry : index) {
+        bytes += stringHeapBytes(entry.first);
+    }
+    return bytes;
+}
+
+// ============================================================================
+// Process resident set size
+// ============================================================================
+
+// Peak resident set size of this process in bytes (high-water mark since start)
+inline size_t peakRSSBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);         // macOS reports bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;  // linux reports kilobytes
+#endif
+}
+
+// Current resident set size in bytes, 0 if the platform doesn't tell us
+inline size_t currentRSSBytes() {
+#ifdef __APPLE__
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return static_cast<size_t>(info.resident_size);
+#else
+    // second field of /proc/self/statm is resident pages
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    if (!(statm >> totalPages >> residentPages)) return 0;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#endif
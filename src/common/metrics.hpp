@@ -0,0 +1,415 @@
+// Runtime metrics: counters, gauges and latency histograms with Prometheus text exposition
+//
+// updates are lock free: every metric is split into a few cache-line sized shards and each
+// thread always writes the same shard with relaxed atomics, readers sum the shards. the registry
+// itself takes a mutex, so look metrics up once (e.g. in a function-local static) and keep the
+// reference, not on every call.
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "common/parallelStrategy.hpp"
+
+// label set as written in the exposition, e.g. {{"query", "valueRange"}, {"strategy", "openmp"}}
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+// number of shards per metric, threads are spread over them
+const int METRIC_SHARDS = 16;
+
+// shard used by the calling thread, handed out round robin the first time a thread records
+inline int metricShard() {
+    static std::atomic<int> nextShard{0};
+    thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+// lock-free add for atomic<double> (fetch_add on doubles is C++20)
+inline void atomicAddDouble(std::atomic<double>& target, double value) {
+    double current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+// ============================================================================
+// Counter: monotonically increasing value
+// ============================================================================
+class Counter {
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard shards[METRIC_SHARDS];
+
+public:
+    void add(uint64_t n = 1) {
+        shards[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& shard : shards) total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// ============================================================================
+// Gauge: value that goes up and down (sizes, counts of resident things)
+// ============================================================================
+class Gauge {
+private:
+    std::atomic<double> current{0.0};
+
+public:
+    void set(double value) { current.store(value, std::memory_order_relaxed); }
+    void add(double value) { atomicAddDouble(current, value); }
+    double value() const { return current.load(std::memory_order_relaxed); }
+};
+
+// ============================================================================
+// Histogram: cumulative buckets like Prometheus expects, plus sum and count
+// ============================================================================
+class Histogram {
+private:
+    struct alignas(64) Shard {
+        std::unique_ptr<std::atomic<uint64_t>[]> buckets;  // one per bound plus +Inf
+        std::atomic<double> sum{0.0};
+        std::atomic<uint64_t> count{0};
+    };
+    std::vector<double> bounds;
+    Shard shards[METRIC_SHARDS];
+
+public:
+    // default bounds are query latencies in seconds, 100us to 30s
+    static std::vector<double> latencyBounds() {
+        return {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0};
+    }
+
+    Histogram(const std::vector<double>& upperBounds = latencyBounds()) : bounds(upperBounds) {
+        for (auto& shard : shards) {
+            shard.buckets.reset(new std::atomic<uint64_t>[bounds.size() + 1]);
+            for (size_t i = 0; i <= bounds.size(); ++i) shard.buckets[i].store(0);
+        }
+    }
+
+    void observe(double value) {
+        // bucket counts are stored non-cumulative and summed up when exporting
+        size_t bucket = 0;
+        while (bucket < bounds.size() && value > bounds[bucket]) bucket++;
+        Shard& shard = shards[metricShard()];
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        atomicAddDouble(shard.sum, value);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const std::vector<double>& getBounds() const { return bounds; }
+
+    // per-bucket counts summed over shards, last entry is the +Inf bucket
+    std::vector<uint64_t> bucketCounts() const {
+        std::vector<uint64_t> counts(bounds.size() + 1, 0);
+        for (const auto& shard : shards) {
+            for (size_t i = 0; i <= bounds.size(); ++i) {
+                counts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+        return counts;
+    }
+
+    double sum() const {
+        double total = 0.0;
+        for (const auto& shard : shards) total += shard.sum.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto& shard : shards) total += shard.count.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // quantile estimate with linear interpolation inside the bucket (same as histogram_quantile)
+    double quantile(double q) const {
+        std::vector<uint64_t> counts = bucketCounts();
+        uint64_t total = 0;
+        for (uint64_t c : counts) total += c;
+        if (total == 0) return 0.0;
+
+        double rank = q * total;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (seen + counts[i] >= rank && counts[i] > 0) {
+                if (i == bounds.size()) return bounds.empty() ? 0.0 : bounds.back();
+                double lower = i == 0 ? 0.0 : bounds[i - 1];
+                double fraction = (rank - seen) / counts[i];
+                return lower + (bounds[i] - lower) * fraction;
+            }
+            seen += counts[i];
+        }
+        return bounds.empty() ? 0.0 : bounds.back();
+    }
+};
+
+// ============================================================================
+// Registry: owns every metric and writes the Prometheus text format
+// ============================================================================
+class MetricsRegistry {
+private:
+    enum Kind { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Family {
+        Kind kind;
+        std::string help;
+        // formatted label string -> metric, map keeps the exposition order stable
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    mutable std::mutex mtx;
+    std::map<std::string, Family> families;
+
+    // http exporter state
+    std::thread httpThread;
+    std::atomic<bool> httpRunning{false};
+    int httpSocket = -1;
+    static const int HTTP_CLIENT_TIMEOUT_MS = 1000;
+
+    static std::string formatLabels(const MetricLabels& labels) {
+        if (labels.empty()) return "";
+        std::string out = "{";
+        for (size_t i = 0; i < labels.size(); ++i) {
+            if (i > 0) out += ",";
+            out += labels[i].first + "=\"";
+            // the exposition format escapes backslashes, quotes and newlines in label values
+            for (char c : labels[i].second) {
+                if (c == '\n') {
+                    out += "\\n";
+                    continue;
+                }
+                if (c == '"' || c == '\\') out += '\\';
+                out += c;
+            }
+            out += "\"";
+        }
+        return out + "}";
+    }
+
+    // adds le="..." to an existing label string for histogram buckets
+    static std::string withLe(const std::string& labels, const std::string& le) {
+        if (labels.empty()) return "{le=\"" + le + "\"}";
+        return labels.substr(0, labels.size() - 1) + ",le=\"" + le + "\"}";
+    }
+
+    Family& family(const std::string& name, const std::string& help, Kind kind) {
+        Family& f = families[name];
+        if (f.help.empty()) {
+            f.help = help;
+            f.kind = kind;
+        }
+        return f;
+    }
+
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    ~MetricsRegistry() { stopHttpServer(); }
+
+    // get-or-create, the returned reference stays valid for the life of the registry
+    Counter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = {}) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& slot = family(name, help, COUNTER).counters[formatLabels(labels)];
+        if (!slot) slot.reset(new Counter());
+        return *slot;
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = {}) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& slot = family(name, help, GAUGE).gauges[formatLabels(labels)];
+        if (!slot) slot.reset(new Gauge());
+        return *slot;
+    }
+
+    Histogram& histogram(const std::string& name, const std::string& help, const MetricLabels& labels = {},
+                         const std::vector<double>& bounds = Histogram::latencyBounds()) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& slot = family(name, help, HISTOGRAM).histograms[formatLabels(labels)];
+        if (!slot) slot.reset(new Histogram(bounds));
+        return *slot;
+    }
+
+    // Prometheus text exposition format 0.0.4
+    std::string toPrometheus() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::ostringstream out;
+        out.precision(10);
+        for (const auto& pair : families) {
+            const std::string& name = pair.first;
+            const Family& f = pair.second;
+            const char* type = f.kind == COUNTER ? "counter" : f.kind == GAUGE ? "gauge" : "histogram";
+            out << "# HELP " << name << " " << f.help << "\n";
+            out << "# TYPE " << name << " " << type << "\n";
+
+            for (const auto& c : f.counters) {
+                out << name << c.first << " " << c.second->value() << "\n";
+            }
+            for (const auto& g : f.gauges) {
+                out << name << g.first << " " << g.second->value() << "\n";
+            }
+            for (const auto& h : f.histograms) {
+                const Histogram& hist = *h.second;
+                std::vector<uint64_t> counts = hist.bucketCounts();
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < counts.size(); ++i) {
+                    cumulative += counts[i];
+                    std::ostringstream le;
+                    le.precision(10);
+                    if (i < hist.getBounds().size()) le << hist.getBounds()[i];
+                    else le << "+Inf";
+                    out << name << "_bucket" << withLe(h.first, le.str()) << " " << cumulative << "\n";
+                }
+                out << name << "_sum" << h.first << " " << hist.sum() << "\n";
+                out << name << "_count" << h.first << " " << hist.count() << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    bool writeToFile(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) return false;
+        file << toPrometheus();
+        return true;
+    }
+
+    // serves the exposition on http://127.0.0.1:port/ (any path) from a background thread
+    // returns false if the port couldn't be bound
+    bool startHttpServer(int port) {
+        if (httpRunning) return true;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // local only, no auth on this endpoint
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            return false;
+        }
+
+        httpSocket = fd;
+        httpRunning = true;
+        httpThread = std::thread([this]() {
+            while (httpRunning) {
+                int client = accept(httpSocket, nullptr, nullptr);
+                if (client < 0) continue;
+                // one client at a time, so one that connects and sends nothing (or stops reading) may
+                // only hold up the other scrapes and stopHttpServer() for the timeout
+                timeval timeout;
+                timeout.tv_sec = HTTP_CLIENT_TIMEOUT_MS / 1000;
+                timeout.tv_usec = (HTTP_CLIENT_TIMEOUT_MS % 1000) * 1000;
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                // we answer every request the same way, just drain what the client sent
+                char request[1024];
+                ssize_t ignored = recv(client, request, sizeof(request), 0);
+                (void)ignored;
+                std::string body = toPrometheus();
+                std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                       "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+                size_t sent = 0;
+                while (sent < response.size()) {
+                    ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                    if (n <= 0) break;
+                    sent += n;
+                }
+                close(client);
+            }
+        });
+        return true;
+    }
+
+    void stopHttpServer() {
+        if (!httpRunning) return;
+        httpRunning = false;
+        // unblock accept(), a client being served lets go within HTTP_CLIENT_TIMEOUT_MS
+        shutdown(httpSocket, SHUT_RDWR);
+        close(httpSocket);
+        if (httpThread.joinable()) httpThread.join();
+        httpSocket = -1;
+    }
+};
+
+// ============================================================================
+// Latency and row metrics of one query type, resolved once so recording never locks
+// scans get one series per strategy, index lookups (no strategy) a single "index" series
+// ============================================================================
+class QueryMetrics {
+private:
+    static const int SLOTS = 3;  // one per strategy, index lookups use slot 0
+    Histogram* latency[SLOTS] = {};
+    Counter* rows[SLOTS] = {};
+
+    void resolve(int slot, const std::string& dataset, const std::string& query, const char* strategy) {
+        MetricsRegistry& registry = MetricsRegistry::instance();
+        MetricLabels labels = {{"query", query}, {"strategy", strategy}};
+        latency[slot] = &registry.histogram(dataset + "_query_latency_seconds",
+                                            "Query latency by query type and strategy", labels);
+        rows[slot] = &registry.counter(dataset + "_query_rows_returned_total",
+                                       "Rows returned by queries", labels);
+    }
+
+public:
+    // queries that don't run with a strategy (index lookups, sample lookups) have one series labelled
+    // strategy=lookupLabel and record with recordIndex
+    QueryMetrics(const std::string& dataset, const std::string& query, bool indexLookup = false,
+                 const char* lookupLabel = "index") {
+        if (indexLookup) {
+            resolve(0, dataset, query, lookupLabel);
+            return;
+        }
+        const ParallelStrategy strategies[SLOTS] = {ParallelStrategy::OPENMP,
+                                                    ParallelStrategy::CENTRALIZED_QUEUE,
+                                                    ParallelStrategy::ROUND_ROBIN};
+        for (int i = 0; i < SLOTS; ++i) {
+            resolve(static_cast<int>(strategies[i]), dataset, query, strategyLabel(strategies[i]));
+        }
+    }
+
+    void record(ParallelStrategy strategy, double seconds, size_t resultRows) {
+        int slot = static_cast<int>(strategy);
+        latency[slot]->observe(seconds);
+        rows[slot]->add(resultRows);
+    }
+
+    // for metrics constructed with indexLookup = true
+    void recordIndex(double seconds, size_t resultRows) {
+        latency[0]->observe(seconds);
+        rows[0]->add(resultRows);
+    }
+};
+
+#endif
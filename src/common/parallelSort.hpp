@@ -0,0 +1,146 @@
+// Parallel sorts on top of parallelScan
+//
+// both sort positions (row ids, result indexes) rather than records: moving a 4 byte id is cheap,
+// the caller moves every record once at the end, into its sorted place.
+//
+// parallelRadixSort   integer and floating point keys, LSD radix 8 bits at a time. every pass
+//                     counts digits per chunk in parallel, turns the counts into a start position
+//                     per (chunk, digit) and scatters the chunks in parallel. passes whose digit is
+//                     the same for every key are skipped, small keys cost a pass or two
+// parallelMergeSort   any comparison (string and composite keys). chunks are sorted in parallel,
+//                     then merged pairwise in rounds; every round splits the output into chunks and
+//                     finds where each starts in the two inputs (merge path), so the last rounds
+//                     with one or two big merges keep every worker busy too
+//
+// both are stable: equal keys keep their input order
+#ifndef PARALLEL_SORT_HPP
+#define PARALLEL_SORT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "common/parallelStrategy.hpp"
+
+// unsigned keys that sort like the values, for parallelRadixSort
+inline uint64_t radixKey(int64_t value) {
+    return static_cast<uint64_t>(value) ^ (1ull << 63);
+}
+
+inline uint64_t radixKey(int value) {
+    return radixKey(static_cast<int64_t>(value));
+}
+
+// negative numbers have every bit flipped (more negative = smaller), positive ones just the sign bit
+// -0.0 becomes 0.0, they compare equal and have to keep their order
+inline uint64_t radixKey(double value) {
+    if (value == 0.0) value = 0.0;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & (1ull << 63)) ? ~bits : bits | (1ull << 63);
+}
+
+// sorts ids by keys (keys[i] belongs to ids[i], both are permuted), ascending and stable
+template<typename Id>
+void parallelRadixSort(std::vector<uint64_t>& keys, std::vector<Id>& ids,
+                       ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+    const size_t count = keys.size();
+    if (count < 2) return;
+    const size_t chunkSize = defaultChunkSize(count);
+    const size_t chunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<uint64_t> keysOut(count);
+    std::vector<Id> idsOut(count);
+    std::vector<std::array<size_t, 256>> positions(chunks);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        // digit counts of every chunk
+        parallelScan<int>(count, chunkSize, strategy,
+            [&](int&, size_t start, size_t end) {
+                std::array<size_t, 256>& counts = positions[start / chunkSize];
+                counts.fill(0);
+                for (size_t i = start; i < end; ++i) counts[(keys[i] >> shift) & 0xff]++;
+            },
+            [](int&) {});
+
+        // digit by digit, chunk by chunk: where each chunk writes its keys with that digit
+        size_t next = 0;
+        bool oneDigit = false;
+        for (int digit = 0; digit < 256; ++digit) {
+            size_t digitStart = next;
+            for (size_t c = 0; c < chunks; ++c) {
+                size_t n = positions[c][digit];
+                positions[c][digit] = next;
+                next += n;
+            }
+            if (next - digitStart == count) oneDigit = true;
+        }
+        if (oneDigit) continue;
+
+        parallelScan<int>(count, chunkSize, strategy,
+            [&](int&, size_t start, size_t end) {
+                std::array<size_t, 256>& position = positions[start / chunkSize];
+                for (size_t i = start; i < end; ++i) {
+                    size_t to = position[(keys[i] >> shift) & 0xff]++;
+                    keysOut[to] = keys[i];
+                    idsOut[to] = ids[i];
+                }
+            },
+            [](int&) {});
+        keys.swap(keysOut);
+        ids.swap(idsOut);
+    }
+}
+
+// writes the outputs [from, to) of the stable merge of a[0, na) and b[0, nb) to out[from, to)
+// a comes first on ties
+template<typename T, typename Less>
+void mergeRange(const T* a, size_t na, const T* b, size_t nb, T* out, size_t from, size_t to, Less less) {
+    // how many of the first diagonal outputs come from a
+    auto split = [&](size_t diagonal) {
+        size_t low = diagonal > nb ? diagonal - nb : 0;
+        size_t high = std::min(diagonal, na);
+        while (low < high) {
+            size_t i = (low + high) / 2;
+            if (less(b[diagonal - i - 1], a[i])) {
+                high = i;
+            } else {
+                low = i + 1;
+            }
+        }
+        return low;
+    };
+    size_t aFrom = split(from), aTo = split(to);
+    std::merge(a + aFrom, a + aTo, b + (from - aFrom), b + (to - aTo), out + from, less);
+}
+
+// sorts items with less, stable
+template<typename T, typename Less>
+void parallelMergeSort(std::vector<T>& items, Less less, ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+    const size_t count = items.size();
+    if (count < 2) return;
+    const size_t chunkSize = defaultChunkSize(count);
+
+    parallelScan<int>(count, chunkSize, strategy,
+        [&](int&, size_t start, size_t end) {
+            std::stable_sort(items.begin() + start, items.begin() + end, less);
+        },
+        [](int&) {});
+
+    // runs are chunkSize long and double every round, so an output chunk never spans two merges
+    std::vector<T> merged(count);
+    for (size_t width = chunkSize; width < count; width *= 2) {
+        parallelScan<int>(count, chunkSize, strategy,
+            [&](int&, size_t start, size_t end) {
+                size_t low = start / (2 * width) * (2 * width);
+                size_t middle = std::min(low + width, count);
+                size_t high = std::min(low + 2 * width, count);
+                mergeRange(items.data() + low, middle - low, items.data() + middle, high - middle,
+                           merged.data() + low, start - low, end - low, less);
+            },
+            [](int&) {});
+        items.swap(merged);
+    }
+}
+
+#endif
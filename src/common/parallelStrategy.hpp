@@ -3,11 +3,25 @@
 #define PARALLEL_STRATEGY_HPP
 
 #include <queue>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include "common/trace.hpp"
+#include "common/queryMemory.hpp"
+
+// only include openmp if we compiled with it
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // Enum defining different parallelization strategies
 enum class ParallelStrategy {
@@ -26,6 +40,42 @@ inline const char* strategyToString(ParallelStrategy strategy) {
     }
 }
 
+// short lowercase names for metric labels and query text (strategyToString is meant for humans)
+inline const char* strategyLabel(ParallelStrategy strategy) {
+    switch (strategy) {
+        case ParallelStrategy::OPENMP: return "openmp";
+        case ParallelStrategy::CENTRALIZED_QUEUE: return "centralized_queue";
+        case ParallelStrategy::ROUND_ROBIN: return "round_robin";
+        default: return "unknown";
+    }
+}
+
+// monotonic nanoseconds, used for the queue and worker counters
+inline uint64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Contention counters kept by TaskQueue / WorkerQueue
+// ============================================================================
+struct QueueStats {
+    size_t pushes = 0;
+    size_t pops = 0;             // successful pops (a task was handed out)
+    uint64_t blockedNs = 0;      // time workers spent sleeping in cv.wait for work
+    uint64_t lockWaitNs = 0;     // time spent acquiring the queue mutex (push + pop)
+    size_t maxDepth = 0;         // most tasks ever waiting in the queue at once
+
+    // sums counters of several queues (round robin has one per worker)
+    void add(const QueueStats& other) {
+        pushes += other.pushes;
+        pops += other.pops;
+        blockedNs += other.blockedNs;
+        lockWaitNs += other.lockWaitNs;
+        maxDepth = std::max(maxDepth, other.maxDepth);
+    }
+};
+
 // ============================================================================
 // Task Queue for Centralized Leader-Worker Pattern
 // ============================================================================
@@ -36,22 +86,33 @@ private:
     mutable std::mutex mtx;
     std::condition_variable cv;
     bool finished;
+    QueueStats counters;  // only touched while holding mtx
 
 public:
     TaskQueue() : finished(false) {}
 
     // Leader pushes tasks into the queue
     void push(const TaskType& task) {
+        uint64_t lockStart = steadyNowNs();
         std::lock_guard<std::mutex> lock(mtx);
+        counters.lockWaitNs += steadyNowNs() - lockStart;
         tasks.push(task);
+        counters.pushes++;
+        counters.maxDepth = std::max(counters.maxDepth, tasks.size());
         cv.notify_one();  // Wake up one waiting worker
     }
 
     // Worker tries to pop a task 
     bool pop(TaskType& task) {
+        uint64_t lockStart = steadyNowNs();
         std::unique_lock<std::mutex> lock(mtx);
+        counters.lockWaitNs += steadyNowNs() - lockStart;
         // wating for queue to be finished and not empty
-        cv.wait(lock, [this]() { return !tasks.empty() || finished; });
+        if (tasks.empty() && !finished) {
+            uint64_t waitStart = steadyNowNs();
+            cv.wait(lock, [this]() { return !tasks.empty() || finished; });
+            counters.blockedNs += steadyNowNs() - waitStart;
+        }
         
         if (tasks.empty()) {
             return false;  // No more tasks and we're done
@@ -59,6 +120,7 @@ public:
         
         task = tasks.front();
         tasks.pop();
+        counters.pops++;
         return true;
     }
 
@@ -74,6 +136,12 @@ public:
         std::lock_guard<std::mutex> lock(mtx);
         return tasks.size();
     }
+
+    // Copy of the contention counters so far
+    QueueStats stats() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return counters;
+    }
 };
 
 // ============================================================================
@@ -86,21 +154,32 @@ private:
     mutable std::mutex mtx;
     std::condition_variable cv;
     bool finished;
+    QueueStats counters;  // only touched while holding mtx
 
 public:
     WorkerQueue() : finished(false) {}
 
     // Leader pushes task to this specific worker's queue
     void push(const TaskType& task) {
+        uint64_t lockStart = steadyNowNs();
         std::lock_guard<std::mutex> lock(mtx);
+        counters.lockWaitNs += steadyNowNs() - lockStart;
         tasks.push(task);
+        counters.pushes++;
+        counters.maxDepth = std::max(counters.maxDepth, tasks.size());
         cv.notify_one();
     }
 
     // Worker pops from its own queue (no contention with other workers!)
     bool pop(TaskType& task) {
+        uint64_t lockStart = steadyNowNs();
         std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [this]() { return !tasks.empty() || finished; });
+        counters.lockWaitNs += steadyNowNs() - lockStart;
+        if (tasks.empty() && !finished) {
+            uint64_t waitStart = steadyNowNs();
+            cv.wait(lock, [this]() { return !tasks.empty() || finished; });
+            counters.blockedNs += steadyNowNs() - waitStart;
+        }
         
         if (tasks.empty()) {
             return false;
@@ -108,6 +187,7 @@ public:
         
         task = tasks.front();
         tasks.pop();
+        counters.pops++;
         return true;
     }
 
@@ -121,6 +201,11 @@ public:
         std::lock_guard<std::mutex> lock(mtx);
         return tasks.size();
     }
+
+    QueueStats stats() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return counters;
+    }
 };
 
 // ============================================================================
@@ -131,5 +216,360 @@ inline unsigned int getOptimalThreadCount() {
     return hwThreads > 0 ? hwThreads : 4;  // Default to 4 if detection fails
 }
 
+// number of workers a scan with this strategy runs on
+inline unsigned int strategyWorkerCount(ParallelStrategy strategy) {
+#ifdef _OPENMP
+    if (strategy == ParallelStrategy::OPENMP) return static_cast<unsigned int>(omp_get_max_threads());
+#else
+    if (strategy == ParallelStrategy::OPENMP) return 1;
+#endif
+    return getOptimalThreadCount();
+}
+
+// Default chunk size for scans: about 4 chunks per worker so the queue strategies can balance
+inline size_t defaultChunkSize(size_t count) {
+    size_t chunkSize = count / (getOptimalThreadCount() * 4);
+    return chunkSize > 0 ? chunkSize : 1;
+}
+
+// ============================================================================
+// Utilization of one parallelScan call
+// ============================================================================
+struct WorkerStats {
+    size_t chunks = 0;
+    uint64_t busyNs = 0;  // scanning chunks and merging
+    uint64_t mergeNs = 0; // the merging part of busyNs
+    uint64_t idleNs = 0;  // everything else between scan start and end (queue waits, lock waits, done early)
+};
+
+struct ParallelRunStats {
+    ParallelStrategy strategy = ParallelStrategy::OPENMP;
+    size_t chunks = 0;
+    uint64_t wallNs = 0;
+    QueueStats queue;              // summed over all queues, zero for openmp
+    std::vector<WorkerStats> workers;
+
+    void print() const {
+        double wallMs = wallNs / 1e6;
+        printf("--- Parallel run (%s): %zu chunks, %zu workers, wall %.3f ms ---\n",
+               strategyToString(strategy), chunks, workers.size(), wallMs);
+        if (strategy != ParallelStrategy::OPENMP) {
+            printf("Queue:  %zu pushes, %zu pops, max depth %zu, blocked %.3f ms, lock wait %.3f ms\n",
+                   queue.pushes, queue.pops, queue.maxDepth, queue.blockedNs / 1e6, queue.lockWaitNs / 1e6);
+        }
+        double totalBusy = 0.0;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            const WorkerStats& w = workers[i];
+            totalBusy += w.busyNs;
+            printf("Worker %-3zu %6zu chunks  busy %9.3f ms  idle %9.3f ms  (%5.1f%% busy)\n", i, w.chunks,
+                   w.busyNs / 1e6, w.idleNs / 1e6, wallNs > 0 ? 100.0 * w.busyNs / wallNs : 0.0);
+        }
+        if (!workers.empty() && wallNs > 0) {
+            printf("Average utilization: %.1f%%\n", 100.0 * totalBusy / (workers.size() * (double)wallNs));
+        }
+    }
+};
+
+// stats of the most recent parallelScan on the calling thread
+// (thread local so concurrent callers don't overwrite each other's numbers)
+inline ParallelRunStats& lastParallelRun() {
+    thread_local ParallelRunStats stats;
+    return stats;
+}
+
+// ============================================================================
+// Cancellation and deadlines
+//
+// a query or load stops early when its token is cancelled (from any thread), its deadline passes or
+// it goes over its memory limit (see QueryMemory).
+// the StopCondition is installed for the calling thread with a StopScope, parallelScan checks it
+// before every chunk: once it triggers the workers skip the chunks they have left, and after all of
+// them are back parallelScan throws QueryCancelled on the calling thread. no chunk is cut off half
+// way and nothing is thrown across a worker thread or out of an omp region, the query unwinds like
+// on any other error. a stop lands within one chunk per worker (a quarter of its share by default)
+// ============================================================================
+class CancellationToken {
+private:
+    std::atomic<bool> requested{false};
+
+public:
+    void cancel() { requested.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return requested.load(std::memory_order_relaxed); }
+    void reset() { requested.store(false, std::memory_order_relaxed); }
+};
+
+enum class StopReason { NONE, CANCELLED, DEADLINE, MEMORY_LIMIT };
+
+struct StopCondition {
+    const CancellationToken* token = nullptr;  // not owned, has to outlive the query
+    uint64_t deadlineNs = 0;                   // steadyNowNs() time, 0 for none
+    QueryMemory* memory = nullptr;             // not owned, charged by the query and checked here
+
+    bool active() const { return token != nullptr || deadlineNs != 0 || memory != nullptr; }
+
+    StopReason check() const {
+        if (token && token->cancelled()) return StopReason::CANCELLED;
+        if (memory && memory->overLimit()) return StopReason::MEMORY_LIMIT;
+        if (deadlineNs != 0 && steadyNowNs() >= deadlineNs) return StopReason::DEADLINE;
+        return StopReason::NONE;
+    }
+
+    // a deadline ms milliseconds from now, e.g. a per-request time budget
+    static StopCondition timeout(double ms, const CancellationToken* token = nullptr) {
+        StopCondition stop;
+        stop.token = token;
+        stop.deadlineNs = steadyNowNs() + static_cast<uint64_t>(ms * 1e6);
+        return stop;
+    }
+};
+
+// thrown by a query or load that was stopped, with how far it got. the partial result is dropped:
+// half an aggregate looks just like a whole one, so what comes back is how many chunks were done
+class QueryCancelled : public std::runtime_error {
+private:
+    StopReason stopReason;
+    size_t done;
+    size_t total;
+
+    static std::string message(StopReason reason, size_t chunksDone, size_t chunksTotal) {
+        std::string text = reason == StopReason::DEADLINE ? "deadline exceeded"
+                         : reason == StopReason::MEMORY_LIMIT ? "memory limit exceeded" : "query cancelled";
+        // StopScope and the checks outside parallelScan have no chunks to count
+        if (chunksTotal == 0) return text;
+        return text + " after " + std::to_string(chunksDone) + " of " + std::to_string(chunksTotal) + " chunks";
+    }
+
+public:
+    QueryCancelled(StopReason reason, size_t chunksDone, size_t chunksTotal)
+        : std::runtime_error(message(reason, chunksDone, chunksTotal)),
+          stopReason(reason), done(chunksDone), total(chunksTotal) {}
+    // a stop reported by someone else (a shard's answer), with their message
+    QueryCancelled(StopReason reason, const std::string& text)
+        : std::runtime_error(text), stopReason(reason), done(0), total(0) {}
+
+    StopReason reason() const { return stopReason; }
+    size_t chunksDone() const { return done; }
+    size_t chunksTotal() const { return total; }
+};
+
+// the StopCondition of the calling thread, nullptr outside any StopScope
+inline const StopCondition*& currentStopCondition() {
+    thread_local const StopCondition* current = nullptr;
+    return current;
+}
+
+// installs stop for the calling thread until the end of the scope. an inactive condition keeps the
+// one already installed, so a query run from inside another one (executeCached -> execute) stays
+// under the outer budget. throws QueryCancelled right away if stop already triggered, which also
+// covers the index lookups that never reach parallelScan
+class StopScope {
+private:
+    const StopCondition* previous;
+
+public:
+    explicit StopScope(const StopCondition& stop) : previous(currentStopCondition()) {
+        StopReason reason = stop.check();
+        if (reason != StopReason::NONE) throw QueryCancelled(reason, 0, 0);
+        if (stop.active()) currentStopCondition() = &stop;
+    }
+    ~StopScope() { currentStopCondition() = previous; }
+
+    StopScope(const StopScope&) = delete;
+    StopScope& operator=(const StopScope&) = delete;
+};
+
+// ============================================================================
+// Runs a chunked scan over [0, count) with the chosen strategy
+//
+//   scan(local, start, end)  processes one chunk into the worker's own Local state (value initialized,
+//                            a plain size_t or double starts at 0)
+//   merge(local)             folds a worker's state into the shared result, called under a lock
+//                            once per worker after it ran out of chunks
+//
+// OPENMP             - omp parallel region, static schedule over the chunks
+// CENTRALIZED_QUEUE  - leader pushes every chunk into one TaskQueue, workers pull until empty
+// ROUND_ROBIN        - leader deals chunks to per-worker WorkerQueues in turn
+//
+// queue counters and per-worker busy/idle times end up in lastParallelRun(). under a StopScope that
+// triggers, the remaining chunks are skipped, every worker still merges what it has (callers that
+// append to shared state roll it back) and QueryCancelled is thrown once the workers are done
+// ============================================================================
+template<typename Local, typename Scan, typename Merge>
+void parallelScan(size_t count, size_t chunkSize, ParallelStrategy strategy, Scan scan, Merge merge) {
+    if (chunkSize == 0) chunkSize = 1;
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    ParallelRunStats run;
+    run.strategy = strategy;
+    run.chunks = numChunks;
+    uint64_t runStart = steadyNowNs();
+
+    // the workers don't see the caller's thread locals, so the condition is read here
+    const StopCondition* stop = currentStopCondition();
+    std::atomic<int> stopped{static_cast<int>(StopReason::NONE)};
+
+    // traced and timed version of a single chunk, a no-op once the scan was stopped
+    auto runChunk = [&](Local& local, WorkerStats& worker, size_t start, size_t end) {
+        if (stop) {
+            if (stopped.load(std::memory_order_relaxed) != static_cast<int>(StopReason::NONE)) return;
+            StopReason reason = stop->check();
+            if (reason != StopReason::NONE) {
+                stopped.store(static_cast<int>(reason), std::memory_order_relaxed);
+                return;
+            }
+        }
+        TraceSpan span("scan chunk");
+        span.detail("%zu-%zu", start, end);
+        uint64_t chunkStart = steadyNowNs();
+        scan(local, start, end);
+        worker.busyNs += steadyNowNs() - chunkStart;
+        worker.chunks++;
+    };
+
+    // timed merge, the caller already holds the lock
+    auto runMerge = [&](Local& local, WorkerStats& worker) {
+        TraceSpan span("merge");
+        uint64_t mergeStart = steadyNowNs();
+        merge(local);
+        uint64_t mergeNs = steadyNowNs() - mergeStart;
+        worker.mergeNs += mergeNs;
+        worker.busyNs += mergeNs;
+    };
+
+    switch (strategy) {
+        case ParallelStrategy::OPENMP: {
+#ifdef _OPENMP
+            run.workers.resize(omp_get_max_threads());
+            size_t teamSize = 1;
+
+            #pragma omp parallel
+            {
+                Local local{};
+                WorkerStats& worker = run.workers[omp_get_thread_num()];
+
+                #pragma omp single nowait
+                teamSize = omp_get_num_threads();
+
+                #pragma omp for schedule(static) nowait
+                for (size_t c = 0; c < numChunks; ++c) {
+                    runChunk(local, worker, c * chunkSize, std::min(count, (c + 1) * chunkSize));
+                }
+
+                #pragma omp critical
+                runMerge(local, worker);
+            }
+            run.workers.resize(teamSize);
+#else
+            // serial version if openmp isnt available
+            run.workers.resize(1);
+            Local local{};
+            for (size_t c = 0; c < numChunks; ++c) {
+                runChunk(local, run.workers[0], c * chunkSize, std::min(count, (c + 1) * chunkSize));
+            }
+            runMerge(local, run.workers[0]);
+#endif
+            break;
+        }
+
+        case ParallelStrategy::CENTRALIZED_QUEUE: {
+            // one shared queue that all workers pull from
+            TaskQueue<std::pair<size_t, size_t>> taskQueue;  // <start, end>
+            std::mutex mergeMutex;
+            unsigned int numWorkers = getOptimalThreadCount();
+            run.workers.resize(numWorkers);
+
+            auto workerFunc = [&](unsigned int workerId) {
+                Local local{};
+                WorkerStats& worker = run.workers[workerId];
+                std::pair<size_t, size_t> chunk;
+                while (true) {
+                    {
+                        TraceSpan wait("queue wait");
+                        if (!taskQueue.pop(chunk)) break;
+                    }
+                    runChunk(local, worker, chunk.first, chunk.second);
+                }
+
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                runMerge(local, worker);
+            };
+
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < numWorkers; ++i) {
+                workers.emplace_back(workerFunc, i);
+            }
+
+            // leader pushes all chunks, then tells workers no more are coming
+            for (size_t c = 0; c < numChunks; ++c) {
+                taskQueue.push({c * chunkSize, std::min(count, (c + 1) * chunkSize)});
+            }
+            taskQueue.markFinished();
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            run.queue = taskQueue.stats();
+            break;
+        }
+
+        case ParallelStrategy::ROUND_ROBIN: {
+            // each worker gets its own queue so no contention
+            unsigned int numWorkers = getOptimalThreadCount();
+            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
+            std::mutex mergeMutex;
+            run.workers.resize(numWorkers);
+
+            auto workerFunc = [&](unsigned int workerId) {
+                Local local{};
+                WorkerStats& worker = run.workers[workerId];
+                std::pair<size_t, size_t> chunk;
+                while (true) {
+                    {
+                        TraceSpan wait("queue wait");
+                        if (!workerQueues[workerId].pop(chunk)) break;
+                    }
+                    runChunk(local, worker, chunk.first, chunk.second);
+                }
+
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                runMerge(local, worker);
+            };
+
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < numWorkers; ++i) {
+                workers.emplace_back(workerFunc, i);
+            }
+
+            // deal chunks out round robin style, goes 0,1,2...n-1,0,1,2...
+            for (size_t c = 0; c < numChunks; ++c) {
+                workerQueues[c % numWorkers].push({c * chunkSize, std::min(count, (c + 1) * chunkSize)});
+            }
+            for (auto& queue : workerQueues) {
+                queue.markFinished();
+            }
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            for (const auto& queue : workerQueues) {
+                run.queue.add(queue.stats());
+            }
+            break;
+        }
+    }
+
+    run.wallNs = steadyNowNs() - runStart;
+    for (auto& worker : run.workers) {
+        worker.idleNs = run.wallNs > worker.busyNs ? run.wallNs - worker.busyNs : 0;
+    }
+    lastParallelRun() = run;
+
+    if (stopped.load() != static_cast<int>(StopReason::NONE)) {
+        size_t chunksDone = 0;
+        for (const auto& worker : run.workers) chunksDone += worker.chunks;
+        throw QueryCancelled(static_cast<StopReason>(stopped.load()), chunksDone, numChunks);
+    }
+}
+
 #endif 
 
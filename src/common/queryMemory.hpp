@@ -0,0 +1,67 @@
+// Per-query memory accounting
+//
+// a QueryMemory counts the bytes one query holds: its result buffers and what its workers collect
+// into their thread local scratch before the merge. queries charge it as they copy rows out, workers
+// once per chunk, so the counter is touched a few times per chunk and not per row. with a limit, the
+// charge that goes over it marks the query as exceeded: set as options.stop.memory the query is then
+// stopped like on a deadline (the workers skip their remaining chunks and it throws QueryCancelled),
+// long before the whole result would have been copied. peakBytes is the most the query held at once.
+// streamed queries hold their batches instead of charging them: they show in the peak, but a stream
+// isn't failed by a limit smaller than one of its batches.
+//
+// the numbers are the bytes of the copied data (objects plus the string buffers too long for sso),
+// not allocator overhead or the unused capacity of vectors
+#ifndef QUERY_MEMORY_HPP
+#define QUERY_MEMORY_HPP
+
+#include <atomic>
+#include <cstddef>
+
+class QueryMemory {
+private:
+    std::atomic<size_t> current{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<bool> exceeded{false};
+    size_t limit;
+
+public:
+    // 0 only counts, without a limit
+    explicit QueryMemory(size_t limitBytes = 0) : limit(limitBytes) {}
+
+    // adds bytes, false once the query is over its limit. safe from any worker
+    bool charge(size_t bytes) {
+        size_t now = hold(bytes);
+        if (limit != 0 && now > limit) exceeded.store(true, std::memory_order_relaxed);
+        return !overLimit();
+    }
+
+    // counts bytes toward the current and peak numbers without checking them against the limit, for the
+    // batches of streamed queries: a batch is bounded by design and handed on right away, so a limit
+    // below one batch must not fail the stream (charge would mark the query exceeded for good).
+    // returns the bytes held now
+    size_t hold(size_t bytes) {
+        size_t now = current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t seen = peak.load(std::memory_order_relaxed);
+        while (now > seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+        return now;
+    }
+
+    // scratch that was handed on or freed (a streamed batch, a worker's buffer after the merge)
+    void release(size_t bytes) {
+        current.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    bool overLimit() const { return exceeded.load(std::memory_order_relaxed); }
+    size_t currentBytes() const { return current.load(std::memory_order_relaxed); }
+    size_t peakBytes() const { return peak.load(std::memory_order_relaxed); }
+    size_t limitBytes() const { return limit; }
+
+    // for the next query, the limit stays
+    void reset() {
+        current = 0;
+        peak = 0;
+        exceeded = false;
+    }
+};
+
+#endif
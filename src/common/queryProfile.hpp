@@ -0,0 +1,61 @@
+// Per-query options and execution profiles
+//
+// every query takes an optional QueryOptions as its last argument. when options.profile points
+// at a QueryProfile the query fills it in: which access path it took, how much it scanned and
+// matched, how many bytes it copied into the result and where the time went. options.stop gives it
+// a cancellation token, a deadline and / or a memory budget (see StopCondition and QueryMemory), a
+// stopped query throws QueryCancelled.
+#ifndef QUERY_PROFILE_HPP
+#define QUERY_PROFILE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common/parallelStrategy.hpp"
+
+struct QueryProfile {
+    std::string query;        // the query in its text form, e.g. "valueRange min=5 max=15 strategy=openmp"
+    std::string accessPath;   // "index(<name>)", "scan" or "scan (zone maps)"
+    size_t rowsScanned = 0;   // rows the predicate was evaluated on (index entries for lookups)
+    size_t blocksScanned = 0; // chunks handed to the workers, zone map blocks for the filter scans
+    size_t blocksSkipped = 0; // blocks ruled out without reading their rows
+    size_t rowsMatched = 0;
+    size_t bytesMaterialized = 0;  // bytes copied into the result (records plus their string buffers)
+    uint64_t totalNs = 0;
+    uint64_t mergeNs = 0;     // summed over workers
+    uint64_t sortNs = 0;      // orderBy, part of totalNs
+    size_t peakBytes = 0;     // most memory the query held at once, counted with options.stop.memory
+    ParallelRunStats run;     // per-worker times, empty for index lookups
+
+    // takes the chunk and worker numbers of the parallelScan the query just ran
+    void addRun(const ParallelRunStats& scanRun) {
+        run = scanRun;
+        blocksScanned += scanRun.chunks;
+        for (const auto& worker : scanRun.workers) mergeNs += worker.mergeNs;
+    }
+
+    void print() const {
+        printf("--- Query profile: %s ---\n", query.c_str());
+        printf("Access path:        %s\n", accessPath.c_str());
+        printf("Rows scanned:       %zu\n", rowsScanned);
+        printf("Blocks scanned:     %zu (%zu skipped)\n", blocksScanned, blocksSkipped);
+        printf("Rows matched:       %zu\n", rowsMatched);
+        printf("Bytes materialized: %zu\n", bytesMaterialized);
+        printf("Total time:         %.3f ms (merge %.3f ms)\n", totalNs / 1e6, mergeNs / 1e6);
+        if (sortNs > 0) printf("Sort time:          %.3f ms\n", sortNs / 1e6);
+        if (peakBytes > 0) printf("Peak memory:        %.3f MB\n", peakBytes / (1024.0 * 1024.0));
+        for (size_t i = 0; i < run.workers.size(); ++i) {
+            const WorkerStats& w = run.workers[i];
+            printf("  worker %-3zu %6zu chunks  busy %9.3f ms  merge %9.3f ms\n", i, w.chunks,
+                   w.busyNs / 1e6, w.mergeNs / 1e6);
+        }
+    }
+};
+
+struct QueryOptions {
+    QueryProfile* profile = nullptr;  // filled in when set
+    StopCondition stop;               // none by default
+};
+
+#endif
@@ -0,0 +1,126 @@
+// Helpers for the text form of queries ("<type> key=value ... strategy=<name>")
+// shared by FireQuery and PopulationQuery, parse errors throw std::runtime_error
+#ifndef QUERY_TEXT_HPP
+#define QUERY_TEXT_HPP
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "common/parallelStrategy.hpp"
+
+// spaces, '%', '=' and line breaks inside string values are percent-encoded
+// so a query always splits into its pairs on whitespace
+inline std::string escapeQueryValue(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == ' ' || c == '%' || c == '=' || c == '\t' || c == '\n' || c == '\r') {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "%%%02X", static_cast<unsigned char>(c));
+            out += hex;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+inline std::string unescapeQueryValue(const std::string& value) {
+    std::string out;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '%' && i + 2 < value.size()) {
+            out += static_cast<char>(std::strtol(value.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        } else {
+            out += value[i];
+        }
+    }
+    return out;
+}
+
+// shortest form that reads back to the same double, without an exponent unless the value is tiny or
+// huge (100 rather than 1e+02)
+inline std::string formatQueryNumber(double value) {
+    char shorter[32];
+    double check = 0.0;
+    bool plain = value == 0.0 || (std::fabs(value) >= 1e-4 && std::fabs(value) < 1e15);
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(shorter, sizeof(shorter), "%.*g", precision, value);
+        if (plain && strchr(shorter, 'e') != nullptr) continue;
+        if (sscanf(shorter, "%lf", &check) == 1 && check == value) return shorter;
+    }
+    snprintf(shorter, sizeof(shorter), "%.17g", value);
+    return shorter;
+}
+
+// a query text split into its type and its (unescaped) key=value pairs
+struct QueryText {
+    std::string type;
+    std::map<std::string, std::string> params;
+
+    static QueryText parse(const std::string& text) {
+        QueryText parsed;
+        std::istringstream in(text);
+        if (!(in >> parsed.type)) {
+            throw std::runtime_error("Empty query");
+        }
+        std::string pair;
+        while (in >> pair) {
+            size_t eq = pair.find('=');
+            if (eq == std::string::npos) {
+                throw std::runtime_error("Expected key=value in query: " + pair);
+            }
+            parsed.params[pair.substr(0, eq)] = unescapeQueryValue(pair.substr(eq + 1));
+        }
+        return parsed;
+    }
+
+    bool has(const std::string& key) const { return params.count(key) > 0; }
+
+    const std::string& text(const std::string& key) const {
+        auto it = params.find(key);
+        if (it == params.end()) {
+            throw std::runtime_error("Query " + type + " is missing " + key);
+        }
+        return it->second;
+    }
+
+    double number(const std::string& key) const {
+        const std::string& value = text(key);
+        char* end = nullptr;
+        double result = std::strtod(value.c_str(), &end);
+        if (end == value.c_str() || *end != '\0') {
+            throw std::runtime_error("Not a number for " + key + ": " + value);
+        }
+        return result;
+    }
+
+    // a whole number in int range (1e3 is fine, 2.9, nan or 1e20 aren't): the text comes from clients,
+    // and casting anything else to int is undefined or silently truncates
+    int integer(const std::string& key) const {
+        double value = number(key);
+        if (!std::isfinite(value) || value != std::floor(value) || value < INT_MIN || value > INT_MAX) {
+            throw std::runtime_error("Not an integer for " + key + ": " + text(key));
+        }
+        return static_cast<int>(value);
+    }
+
+    // strategy=<label>, openmp when missing
+    ParallelStrategy strategy() const {
+        if (!has("strategy")) return ParallelStrategy::OPENMP;
+        const std::string& label = text("strategy");
+        const ParallelStrategy all[] = {ParallelStrategy::OPENMP, ParallelStrategy::CENTRALIZED_QUEUE,
+                                        ParallelStrategy::ROUND_ROBIN};
+        for (ParallelStrategy s : all) {
+            if (label == strategyLabel(s)) return s;
+        }
+        throw std::runtime_error("Unknown strategy: " + label);
+    }
+};
+
+#endif
@@ -0,0 +1,132 @@
+// Bounded LRU cache of query results
+//
+// keyed by the normalized query text, values are shared immutable results: a hit hands out
+// another shared_ptr to the same object, nothing is copied. entries are tagged with the dataset
+// version they were computed from; a load or append bumps the version, which drops every entry,
+// and a result computed from an older version is never stored. the least recently used entries
+// are evicted once their estimated bytes exceed the budget.
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "common/metrics.hpp"
+
+template<typename Value>
+class ResultCache {
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const Value> value;
+        size_t bytes;
+    };
+
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> entries;
+    size_t budgetBytes;
+    size_t usedBytes = 0;
+    uint64_t version = 0;
+    mutable std::mutex mutex;
+    // this cache's own counts, the registry counters add up every cache of the dataset
+    std::atomic<uint64_t> hitTotal{0};
+    std::atomic<uint64_t> missTotal{0};
+
+    Counter& hits;
+    Counter& misses;
+    Counter& evictions;
+    Gauge& bytesGauge;
+    Gauge& entriesGauge;
+
+    void evict(typename std::list<Entry>::iterator it) {
+        usedBytes -= it->bytes;
+        entries.erase(it->key);
+        lru.erase(it);
+    }
+
+    void updateGauges() {
+        bytesGauge.set(static_cast<double>(usedBytes));
+        entriesGauge.set(static_cast<double>(entries.size()));
+    }
+
+public:
+    // dataset labels the metrics (query_cache_hits_total{dataset="fire"}, ...)
+    ResultCache(const std::string& dataset, size_t budget)
+        : budgetBytes(budget),
+          hits(MetricsRegistry::instance().counter(
+              "query_cache_hits_total", "Queries answered from the result cache", {{"dataset", dataset}})),
+          misses(MetricsRegistry::instance().counter(
+              "query_cache_misses_total", "Cacheable queries that had to run", {{"dataset", dataset}})),
+          evictions(MetricsRegistry::instance().counter(
+              "query_cache_evictions_total", "Entries evicted to stay within the memory budget",
+              {{"dataset", dataset}})),
+          bytesGauge(MetricsRegistry::instance().gauge(
+              "query_cache_bytes", "Estimated bytes held by cached results", {{"dataset", dataset}})),
+          entriesGauge(MetricsRegistry::instance().gauge(
+              "query_cache_entries", "Results in the cache", {{"dataset", dataset}})) {}
+
+    // the cached result, or nullptr (counted as a miss) when key isn't cached for dataVersion
+    std::shared_ptr<const Value> get(const std::string& key, uint64_t dataVersion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end() || dataVersion != version) {
+            misses.add();
+            missTotal++;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        hits.add();
+        hitTotal++;
+        return it->second->value;
+    }
+
+    // stores a result computed from dataVersion, evicting from the cold end to make room
+    // results from an older version, or bigger than the whole budget, are not stored
+    void put(const std::string& key, uint64_t dataVersion, std::shared_ptr<const Value> value, size_t bytes) {
+        bytes += sizeof(Entry) + key.size();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dataVersion != version || bytes > budgetBytes) return;
+
+        auto existing = entries.find(key);
+        if (existing != entries.end()) evict(existing->second);
+        while (usedBytes + bytes > budgetBytes && !lru.empty()) {
+            evict(std::prev(lru.end()));
+            evictions.add();
+        }
+        lru.push_front(Entry{key, std::move(value), bytes});
+        entries[key] = lru.begin();
+        usedBytes += bytes;
+        updateGauges();
+    }
+
+    // the dataset changed: everything cached so far is stale
+    // results handed out earlier stay valid for whoever holds them, they are immutable
+    void invalidate(uint64_t dataVersion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        version = dataVersion;
+        lru.clear();
+        entries.clear();
+        usedBytes = 0;
+        updateGauges();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return usedBytes;
+    }
+
+    uint64_t hitCount() const { return hitTotal.load(); }
+    uint64_t missCount() const { return missTotal.load(); }
+};
+
+#endif
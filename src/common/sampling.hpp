@@ -0,0 +1,138 @@
+// Reservoir samples and estimates with confidence intervals
+//
+// ReservoirSample keeps a uniform random sample of fixed size from a stream of unknown length. it
+// uses algorithm L: once the reservoir is full it draws how many items to skip before the next one
+// replaces a random slot, so a long stream costs one comparison per item and only a few thousand
+// random numbers in total. the generator has a fixed seed, the same data gives the same sample.
+//
+// the estimates use the normal approximation with the finite population correction: a sample that
+// holds the whole population gives the exact answer with an interval of zero width.
+#ifndef SAMPLING_HPP
+#define SAMPLING_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+template<typename T>
+class ReservoirSample {
+private:
+    size_t capacity;
+    uint64_t seen = 0;
+    uint64_t next = 0;    // position in the stream of the next item that goes into the reservoir
+    double w = 1.0;
+    std::mt19937_64 rng;
+    std::vector<T> items;
+
+    // uniform in (0, 1), log() of it is finite
+    double uniform() {
+        return std::uniform_real_distribution<double>(std::nextafter(0.0, 1.0), 1.0)(rng);
+    }
+
+    void drawNext() {
+        w *= std::exp(std::log(uniform()) / capacity);
+        double skip = std::floor(std::log(uniform()) / std::log1p(-w));
+        // w so small the reservoir is practically done, keep the cast defined
+        next = skip < 1e18 ? seen + static_cast<uint64_t>(skip) + 1 : UINT64_MAX;
+    }
+
+public:
+    explicit ReservoirSample(size_t capacity, uint64_t seed = 0x5eed) : capacity(capacity), rng(seed) {
+        items.reserve(capacity);
+    }
+
+    void offer(const T& item) {
+        ++seen;
+        if (items.size() < capacity) {
+            items.push_back(item);
+            if (items.size() == capacity) drawNext();
+            return;
+        }
+        if (seen != next) return;
+        items[std::uniform_int_distribution<size_t>(0, capacity - 1)(rng)] = item;
+        drawNext();
+    }
+
+    const std::vector<T>& sample() const { return items; }
+    std::vector<T>& sample() { return items; }
+    // items offered so far, the population the sample stands for
+    uint64_t population() const { return seen; }
+};
+
+// an approximate answer: value lies in [lower, upper] with the given confidence
+struct Estimate {
+    double value = 0.0;
+    double lower = 0.0, upper = 0.0;
+    double confidence = 0.0;
+    size_t sampleRows = 0;       // rows the estimate was computed from
+    size_t populationRows = 0;   // rows it stands for
+
+    double halfWidth() const { return (upper - lower) / 2.0; }
+    // half width relative to the value, 0.01 means +-1%
+    double relativeError() const { return value != 0.0 ? halfWidth() / std::fabs(value) : 0.0; }
+    bool exact() const { return sampleRows == populationRows; }
+};
+
+// z such that a standard normal value lies in [-z, z] with probability confidence (1.96 for 0.95)
+inline double normalQuantile(double confidence) {
+    double low = 0.0, high = 40.0;
+    for (int i = 0; i < 100; ++i) {
+        double mid = (low + high) / 2.0;
+        if (std::erf(mid / std::sqrt(2.0)) < confidence) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return (low + high) / 2.0;
+}
+
+// standard error of a sample statistic with variance/n, corrected for sampling without replacement
+inline double finitePopulationError(double variance, size_t sampleRows, size_t populationRows) {
+    if (sampleRows == 0 || sampleRows >= populationRows) return 0.0;
+    double correction = 1.0 - static_cast<double>(sampleRows) / populationRows;
+    return std::sqrt(variance / sampleRows * correction);
+}
+
+// mean of a population of populationRows values, from a uniform sample of them
+inline Estimate estimateMean(const std::vector<double>& values, size_t populationRows, double confidence) {
+    Estimate estimate;
+    estimate.confidence = confidence;
+    estimate.sampleRows = values.size();
+    estimate.populationRows = populationRows;
+    if (values.empty()) return estimate;
+
+    double sum = 0.0;
+    for (double v : values) sum += v;
+    double mean = sum / values.size();
+    double squares = 0.0;
+    for (double v : values) squares += (v - mean) * (v - mean);
+    double variance = values.size() > 1 ? squares / (values.size() - 1) : 0.0;
+
+    double margin = normalQuantile(confidence) * finitePopulationError(variance, values.size(), populationRows);
+    estimate.value = mean;
+    estimate.lower = mean - margin;
+    estimate.upper = mean + margin;
+    return estimate;
+}
+
+// number of rows with some property among populationRows, from hits of them in a uniform sample
+// an interval around 0 hits has zero width, rare values need a bigger sample to show up at all
+inline Estimate estimateCount(size_t hits, size_t sampleRows, size_t populationRows, double confidence) {
+    Estimate estimate;
+    estimate.confidence = confidence;
+    estimate.sampleRows = sampleRows;
+    estimate.populationRows = populationRows;
+    if (sampleRows == 0) return estimate;
+
+    double share = static_cast<double>(hits) / sampleRows;
+    double variance = sampleRows > 1 ? share * (1.0 - share) * sampleRows / (sampleRows - 1) : 0.0;
+    double margin = normalQuantile(confidence) * finitePopulationError(variance, sampleRows, populationRows);
+    estimate.value = share * populationRows;
+    estimate.lower = std::fmax(0.0, (share - margin) * populationRows);
+    estimate.upper = std::fmin(static_cast<double>(populationRows), (share + margin) * populationRows);
+    return estimate;
+}
+
+#endif
@@ -0,0 +1,107 @@
+// Vectorized predicates over column batches
+//
+// a batch is up to SELECTION_BATCH_ROWS values of one column in a plain array. a predicate writes one
+// mask byte per row (1 passes, 0 doesn't) in a loop of compares without branches, which compiles to
+// SIMD compares (SSE/AVX on x86, NEON on arm). a byte per row instead of a bit: every compare lane
+// maps onto one byte, nothing has to be shifted or packed. AND, OR and NOT of predicates combine
+// their masks byte by byte, also SIMD.
+//
+// compactMask turns a mask into a selection vector, the positions of the passing rows. it is branch
+// free too: every slot is written, only the passing rows advance the end, so the time doesn't depend
+// on how many rows pass or how they are spread.
+#ifndef SELECTION_VECTOR_HPP
+#define SELECTION_VECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// rows per batch: a few columns of a batch plus its masks and selection vector stay in L1
+static const size_t SELECTION_BATCH_ROWS = 1024;
+
+#ifdef _OPENMP
+#define SELECTION_SIMD _Pragma("omp simd")
+#else
+#define SELECTION_SIMD
+#endif
+
+// mask[i] = low <= values[i] <= high
+template<typename T>
+inline void maskRange(const T* values, size_t n, T low, T high, uint8_t* mask) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] = (values[i] >= low) & (values[i] <= high);
+}
+
+// mask[i] = values[i] == value
+template<typename T>
+inline void maskEquals(const T* values, size_t n, T value, uint8_t* mask) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] = values[i] == value;
+}
+
+inline void maskAnd(uint8_t* mask, const uint8_t* other, size_t n) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] &= other[i];
+}
+
+inline void maskOr(uint8_t* mask, const uint8_t* other, size_t n) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] |= other[i];
+}
+
+inline void maskNot(uint8_t* mask, size_t n) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] ^= 1;
+}
+
+inline void maskFill(uint8_t* mask, size_t n, uint8_t value) {
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) mask[i] = value;
+}
+
+// rows passing, a batch with none skips the compaction
+inline size_t maskCount(const uint8_t* mask, size_t n) {
+    size_t count = 0;
+    SELECTION_SIMD
+    for (size_t i = 0; i < n; ++i) count += mask[i];
+    return count;
+}
+
+// positions of the set bytes for every pattern of 8 mask bytes (packed into a bit each)
+struct CompactTable {
+    uint8_t positions[256][8] = {};
+    uint8_t counts[256] = {};
+
+    constexpr CompactTable() {
+        for (int pattern = 0; pattern < 256; ++pattern) {
+            for (int bit = 0; bit < 8; ++bit) {
+                if (pattern & (1 << bit)) positions[pattern][counts[pattern]++] = static_cast<uint8_t>(bit);
+            }
+        }
+    }
+};
+static constexpr CompactTable COMPACT_TABLE{};
+
+// writes the positions of the passing rows to selection (room for n), returns how many there are.
+// 8 rows per step: their mask bytes are packed into one byte (bit k = byte k, by a multiply), which
+// picks the positions to write from the table
+inline size_t compactMask(const uint8_t* mask, size_t n, uint32_t* selection) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t bytes;
+        std::memcpy(&bytes, mask + i, sizeof(bytes));
+        unsigned pattern = static_cast<unsigned>((bytes * 0x0102040810204080ull) >> 56);
+        const uint8_t* positions = COMPACT_TABLE.positions[pattern];
+        // all 8 slots are written, only the first counts[pattern] of them are kept
+        for (int k = 0; k < 8; ++k) selection[count + k] = static_cast<uint32_t>(i + positions[k]);
+        count += COMPACT_TABLE.counts[pattern];
+    }
+    for (; i < n; ++i) {
+        selection[count] = static_cast<uint32_t>(i);
+        count += mask[i];
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,190 @@
+// Slow-query log: queries over a latency threshold, plus a sampled fraction of all queries
+//
+// queries hand their entries to a bounded lock-free ring buffer (never blocks, drops the entry
+// and counts it when the buffer is full) and a background thread writes them to the file.
+// each line is tab separated:
+//
+//   timestamp_ms  dataset  latency_ms  rows  reason  query
+//
+// where query is the text form of FireQuery / PopulationQuery, so the file can be fed back to
+// the replay tool as is. lines starting with '#' are comments.
+#ifndef SLOW_QUERY_LOG_HPP
+#define SLOW_QUERY_LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdexcept>
+
+struct SlowQueryConfig {
+    double thresholdMs = 100.0;   // always log queries at least this slow
+    double sampleRate = 0.0;      // fraction of all other queries to log, 0 = none, 1 = every query
+    size_t bufferCapacity = 4096; // entries kept in memory between flushes, rounded up to a power of two
+    int flushIntervalMs = 200;
+};
+
+class SlowQueryLog {
+private:
+    struct Entry {
+        uint64_t timestampMs;
+        double latencyMs;
+        uint64_t rows;
+        bool sampled;           // false when it went over the threshold
+        char dataset[16];
+        char query[496];        // longer queries are truncated
+    };
+
+    // one slot of the ring, sequence tells producers and the consumer whose turn it is
+    // (bounded mpmc queue after Dmitry Vyukov, used here with a single consumer)
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        Entry entry;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> enqueuePos{0};
+    alignas(64) uint64_t dequeuePos = 0;  // only the flusher touches it
+
+    SlowQueryConfig config;
+    FILE* file;
+    std::atomic<uint64_t> logged{0};
+    std::atomic<uint64_t> dropped{0};
+
+    std::thread flusher;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    bool tryPush(const Entry& entry) {
+        uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.entry = entry;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(Entry& entry) {
+        Slot& slot = slots[dequeuePos & mask];
+        uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<int64_t>(seq) - static_cast<int64_t>(dequeuePos + 1) < 0) return false;  // empty
+        entry = slot.entry;
+        slot.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    // writes everything currently in the ring
+    void drain() {
+        Entry entry;
+        bool wrote = false;
+        while (tryPop(entry)) {
+            fprintf(file, "%llu\t%s\t%.3f\t%llu\t%s\t%s\n", (unsigned long long)entry.timestampMs,
+                    entry.dataset, entry.latencyMs, (unsigned long long)entry.rows,
+                    entry.sampled ? "sampled" : "slow", entry.query);
+            wrote = true;
+        }
+        if (wrote) fflush(file);
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        while (!stopping) {
+            wake.wait_for(lock, std::chrono::milliseconds(config.flushIntervalMs));
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+        lock.unlock();
+        drain();
+    }
+
+    // cheap per-thread random number in [0, 1) for sampling
+    static double sampleRandom() {
+        thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^
+            reinterpret_cast<uintptr_t>(&state);  // different seed per thread
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (state >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+public:
+    // opens (appends to) the log file and starts the flusher thread
+    SlowQueryLog(const std::string& path, const SlowQueryConfig& slowConfig = SlowQueryConfig())
+        : config(slowConfig) {
+        size_t capacity = 2;
+        while (capacity < config.bufferCapacity) capacity <<= 1;
+        slots.reset(new Slot[capacity]);
+        mask = capacity - 1;
+        for (size_t i = 0; i < capacity; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+
+        file = fopen(path.c_str(), "a");
+        if (file == nullptr) {
+            throw std::runtime_error("Could not open slow query log: " + path);
+        }
+        fprintf(file, "# timestamp_ms\tdataset\tlatency_ms\trows\treason\tquery\n");
+        flusher = std::thread(&SlowQueryLog::flushLoop, this);
+    }
+
+    ~SlowQueryLog() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        fclose(file);
+    }
+
+    SlowQueryLog(const SlowQueryLog&) = delete;
+    SlowQueryLog& operator=(const SlowQueryLog&) = delete;
+
+    // decides whether a finished query gets logged, 0 = no, 1 = over the threshold, 2 = sampled
+    // split from record() so callers only build the query text when it is needed
+    int shouldLog(uint64_t latencyNs) const {
+        if (latencyNs / 1e6 >= config.thresholdMs) return 1;
+        if (config.sampleRate > 0.0 && sampleRandom() < config.sampleRate) return 2;
+        return 0;
+    }
+
+    void record(const char* dataset, const std::string& query, uint64_t latencyNs, size_t rows, int reason) {
+        Entry entry;
+        entry.timestampMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        entry.latencyMs = latencyNs / 1e6;
+        entry.rows = rows;
+        entry.sampled = reason == 2;
+        snprintf(entry.dataset, sizeof(entry.dataset), "%s", dataset);
+        snprintf(entry.query, sizeof(entry.query), "%s", query.c_str());
+        if (tryPush(entry)) {
+            logged.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // entries accepted / dropped because the ring was full
+    uint64_t loggedCount() const { return logged.load(std::memory_order_relaxed); }
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,185 @@
+// Lightweight span tracing with Chrome trace-event JSON export (chrome://tracing, ui.perfetto.dev)
+//
+// each thread records into its own fixed-size ring buffer, so recording never takes a lock and
+// never allocates after the buffer exists. when tracing is disabled a span costs one relaxed
+// atomic load. enable() / clear() / writeChromeJson() should be called while no parallel work
+// is running.
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+
+struct TraceEvent {
+    const char* name;      // must be a string literal (stored by pointer)
+    const char* category;
+    char detail[48];       // optional free text, shown as args.detail
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+// one thread's ring buffer, oldest events get overwritten once it's full
+struct TraceBuffer {
+    int tid;
+    std::vector<TraceEvent> events;
+    size_t written = 0;  // total events ever recorded, next slot is written % capacity
+
+    TraceBuffer(int threadId, size_t capacity) : tid(threadId), events(capacity) {}
+};
+
+class Tracer {
+public:
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // perThreadCapacity events are kept per thread, the newest ones win
+    // worker threads are created per load/query, so trace a few runs rather than a whole benchmark
+    static void enable(size_t perThreadCapacity = 4096) {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        capacity = perThreadCapacity;
+        active.store(true, std::memory_order_relaxed);
+    }
+
+    static void disable() { active.store(false, std::memory_order_relaxed); }
+
+    // drops all recorded events and buffers
+    static void clear() {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        buffers().clear();
+        generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // nanoseconds since the first call, the common time base of all threads
+    static uint64_t nowNs() {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    static void record(const char* name, const char* category, const char* detail,
+                       uint64_t startNs, uint64_t endNs) {
+        TraceBuffer* buffer = threadBuffer();
+        if (buffer == nullptr) return;  // out of thread buffers, event dropped
+        TraceEvent& event = buffer->events[buffer->written % buffer->events.size()];
+        event.name = name;
+        event.category = category;
+        snprintf(event.detail, sizeof(event.detail), "%s", detail ? detail : "");
+        event.startNs = startNs;
+        event.durationNs = endNs - startNs;
+        buffer->written++;
+    }
+
+    // writes every buffered event as complete ("X") events, one track per thread
+    static bool writeChromeJson(const std::string& path) {
+        std::ofstream out(path);
+        if (!out.is_open()) return false;
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& buffer : buffers()) {
+            // thread name metadata so perfetto labels the tracks
+            out << (first ? "" : ",\n")
+                << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+                << ", \"args\": {\"name\": \"thread " << buffer->tid << "\"}}";
+            first = false;
+
+            size_t count = std::min(buffer->written, buffer->events.size());
+            size_t begin = buffer->written - count;
+            for (size_t i = begin; i < buffer->written; ++i) {
+                const TraceEvent& e = buffer->events[i % buffer->events.size()];
+                // details are often file paths, keep quotes and backslashes from breaking the json
+                char detail[sizeof(e.detail)];
+                for (size_t c = 0; c < sizeof(detail); ++c) {
+                    detail[c] = (e.detail[c] == '"' || e.detail[c] == '\\') ? '/' : e.detail[c];
+                    if (e.detail[c] == '\0') break;
+                }
+                char line[256];
+                snprintf(line, sizeof(line),
+                         ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"detail\": \"%s\"}}",
+                         e.name, e.category, buffer->tid, e.startNs / 1000.0, e.durationNs / 1000.0,
+                         detail);
+                out << line;
+            }
+        }
+        out << "\n]}\n";
+        return true;
+    }
+
+private:
+    static inline std::atomic<bool> active{false};
+    static inline std::atomic<uint64_t> generation{0};
+    static inline size_t capacity = 4096;
+    // upper bound on buffers so a long traced run can't eat all memory
+    static const size_t MAX_THREAD_BUFFERS = 1024;
+
+    static std::mutex& registryMutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    // buffers outlive their threads, workers are short lived but we want their events afterwards
+    static std::vector<std::unique_ptr<TraceBuffer>>& buffers() {
+        static std::vector<std::unique_ptr<TraceBuffer>> all;
+        return all;
+    }
+
+    static TraceBuffer* threadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        thread_local uint64_t bufferGeneration = 0;
+        uint64_t current = generation.load(std::memory_order_relaxed);
+        if (buffer == nullptr || bufferGeneration != current) {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            if (buffers().size() >= MAX_THREAD_BUFFERS) return nullptr;
+            int tid = static_cast<int>(buffers().size());
+            buffers().push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(tid, capacity)));
+            buffer = buffers().back().get();
+            bufferGeneration = current;
+        }
+        return buffer;
+    }
+};
+
+// RAII span, records [construction, destruction) when tracing is on
+class TraceSpan {
+private:
+    const char* name;
+    const char* category;
+    uint64_t start;
+    bool active;
+    char detailText[48];
+
+public:
+    TraceSpan(const char* spanName, const char* spanCategory = "parallel")
+        : name(spanName), category(spanCategory), start(0), active(Tracer::enabled()) {
+        detailText[0] = '\0';
+        if (active) start = Tracer::nowNs();
+    }
+
+    ~TraceSpan() {
+        if (active) Tracer::record(name, category, detailText, start, Tracer::nowNs());
+    }
+
+    // printf-style detail, only formatted when tracing is on
+    void detail(const char* format, ...) {
+        if (!active) return;
+        va_list args;
+        va_start(args, format);
+        vsnprintf(detailText, sizeof(detailText), format, args);
+        va_end(args);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#endif
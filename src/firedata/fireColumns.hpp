@@ -0,0 +1,109 @@
+// Projection of fire records onto some of their columns, stored column by column
+//
+// a FireColumns holds only the columns that were asked for: numbers in plain vectors, strings of a
+// column packed back to back into one buffer. a map that needs latitude, longitude and concentration
+// gets 24 bytes per row instead of a FireRecord with seven strings.
+#ifndef FIRE_COLUMNS_HPP
+#define FIRE_COLUMNS_HPP
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// one bit per FireRecord field, or them together to pick columns
+enum FireColumn : uint32_t {
+    FIRE_LATITUDE = 1u << 0,
+    FIRE_LONGITUDE = 1u << 1,
+    FIRE_UTC = 1u << 2,
+    FIRE_POLLUTANT = 1u << 3,
+    FIRE_CONCENTRATION = 1u << 4,
+    FIRE_UNIT = 1u << 5,
+    FIRE_RAW_CONCENTRATION = 1u << 6,
+    FIRE_AQI = 1u << 7,
+    FIRE_CATEGORY = 1u << 8,
+    FIRE_SITE = 1u << 9,
+    FIRE_AGENCY = 1u << 10,
+    FIRE_AQS_ID = 1u << 11,
+    FIRE_FULL_AQS_ID = 1u << 12,
+    FIRE_ALL_COLUMNS = (1u << 13) - 1
+};
+
+// names in the text form, in bit order
+static const char* const FIRE_COLUMN_NAMES[] = {
+    "latitude", "longitude", "utc", "pollutant", "concentration", "unit", "rawConcentration",
+    "aqi", "category", "site", "agency", "aqsId", "fullAqsId"
+};
+static const int FIRE_COLUMN_COUNT = 13;
+
+// "latitude,longitude,concentration" -> FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION
+// throws std::runtime_error on unknown names
+inline uint32_t parseFireColumns(const std::string& list) {
+    uint32_t columns = 0;
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        if (name.empty()) continue;
+        int column = 0;
+        while (column < FIRE_COLUMN_COUNT && name != FIRE_COLUMN_NAMES[column]) ++column;
+        if (column == FIRE_COLUMN_COUNT) throw std::runtime_error("Unknown fire column: " + name);
+        columns |= 1u << column;
+    }
+    return columns;
+}
+
+inline std::string fireColumnsToString(uint32_t columns) {
+    std::string out;
+    for (int column = 0; column < FIRE_COLUMN_COUNT; ++column) {
+        if (!(columns & (1u << column))) continue;
+        if (!out.empty()) out += ",";
+        out += FIRE_COLUMN_NAMES[column];
+    }
+    return out;
+}
+
+// one string column: the characters of every row back to back, row i is chars[offsets[i], offsets[i + 1])
+class StringColumn {
+private:
+    std::vector<char> chars;
+    std::vector<uint32_t> offsets{0};
+
+public:
+    void reserve(size_t rows) { offsets.reserve(rows + 1); }
+
+    void push_back(std::string_view value) {
+        if (chars.size() + value.size() > UINT32_MAX) throw std::runtime_error("string column over 4 GB");
+        chars.insert(chars.end(), value.begin(), value.end());
+        offsets.push_back(static_cast<uint32_t>(chars.size()));
+    }
+
+    std::string_view operator[](size_t row) const {
+        return std::string_view(chars.data() + offsets[row], offsets[row + 1] - offsets[row]);
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+    size_t bytes() const { return chars.capacity() + offsets.capacity() * sizeof(uint32_t); }
+};
+
+// result of FireData::project, only the vectors of the requested columns are filled
+struct FireColumns {
+    uint32_t columns = 0;   // FireColumn bits
+    size_t rows = 0;
+    std::vector<double> latitude, longitude, concentration, rawConcentration;
+    std::vector<int> aqi, category;
+    StringColumn utc, pollutant, unit, site, agency, aqsId, fullAqsId;
+
+    bool has(FireColumn column) const { return (columns & column) != 0; }
+
+    // bytes held by the column buffers
+    size_t bytes() const {
+        return (latitude.capacity() + longitude.capacity() + concentration.capacity() +
+                rawConcentration.capacity()) * sizeof(double) +
+               (aqi.capacity() + category.capacity()) * sizeof(int) + utc.bytes() + pollutant.bytes() +
+               unit.bytes() + site.bytes() + agency.bytes() + aqsId.bytes() + fullAqsId.bytes();
+    }
+};
+
+#endif
@@ -4,7 +4,15 @@
 #include "firedata/fireData.hpp"
 #include "common/csvParser.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/trace.hpp"
+#include "common/metrics.hpp"
+#include "common/parallelSort.hpp"
+#include "common/selectionVector.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <limits>
 #include <iostream>
+#include <iterator>
 #include <filesystem>
 #include <mutex>
 #include <thread>
@@ -17,14 +25,83 @@
 // namespace alias so we dont have to type std::filesystem every time
 namespace fs = std::filesystem;
 
-FireData::FireData() : recordCount(0) {}
+// bytes one copied record takes: the object plus the string buffers too long for sso
+static size_t recordBytes(const FireRecord& r) {
+    return sizeof(FireRecord) + stringHeapBytes(r.getUTC()) + stringHeapBytes(r.getPollutantType()) +
+           stringHeapBytes(r.getUnit()) + stringHeapBytes(r.getSiteName()) +
+           stringHeapBytes(r.getAgencyName()) + stringHeapBytes(r.getAqsId()) +
+           stringHeapBytes(r.getFullAqsId());
+}
+
+size_t FireData::chargeRecords(const QueryOptions& options, const std::vector<FireRecord>& rows, size_t from,
+                               bool streamed) {
+    if (options.stop.memory == nullptr) return 0;
+    size_t bytes = 0;
+    for (size_t i = from; i < rows.size(); ++i) bytes += recordBytes(rows[i]);
+    if (streamed) {
+        options.stop.memory->hold(bytes);
+    } else {
+        options.stop.memory->charge(bytes);
+    }
+    return bytes;
+}
+
+
+// text of the queries without a FireQuery spec (approximate aggregates, projections) in profiles and
+// the slow-query log
+struct QuerySpecText {
+    std::string text;
+    const std::string& toString() const { return text; }
+};
+
+FireData::FireData() : recordCount(0), slowLog(nullptr), version(0), sampleRows(10000) {}
 
 FireData::~FireData() {
     clear();
 }
 
-// main load function, handles both single files and directories
-void FireData::loadFromDirectory(const std::string& dirpath, ParallelStrategy strategy) {
+// query text for the profile and the slow-query log, makeQuery only runs when one of them wants it
+template<typename MakeQuery>
+void FireData::finishQuery(const QueryOptions& options, uint64_t elapsedNs, size_t rows,
+                           MakeQuery makeQuery) const {
+    int logReason = slowLog ? slowLog->shouldLog(elapsedNs) : 0;
+    if (options.profile == nullptr && logReason == 0) return;
+
+    std::string text = makeQuery().toString();
+    if (options.profile) {
+        options.profile->query = text;
+        options.profile->totalNs = elapsedNs;
+        if (options.stop.memory) options.profile->peakBytes = options.stop.memory->peakBytes();
+    }
+    if (logReason != 0) slowLog->record("fire", text, elapsedNs, rows, logReason);
+}
+
+void FireData::finishWhere(WhereOutput output, const std::string& text, ParallelStrategy strategy,
+                           uint64_t elapsedNs, size_t rowsMatched, const std::vector<FireRecord>* selected,
+                           const QueryOptions& options) const {
+    static QueryMetrics countMetrics("fire", "countWhere");
+    static QueryMetrics aggregateMetrics("fire", "aggregateWhere");
+    static QueryMetrics selectMetrics("fire", "selectWhere");
+    QueryMetrics& metrics = output == WhereOutput::COUNT ? countMetrics
+                          : output == WhereOutput::AGGREGATE ? aggregateMetrics : selectMetrics;
+    metrics.record(strategy, elapsedNs / 1e9, rowsMatched);
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "scan (compiled predicate)";
+        profile.rowsScanned = recordCount;
+        profile.rowsMatched = rowsMatched;
+        profile.addRun(lastParallelRun());
+        if (selected) {
+            for (const auto& r : *selected) profile.bytesMaterialized += recordBytes(r);
+        }
+    }
+    finishQuery(options, elapsedNs, rowsMatched, [&]() { return QuerySpecText{text}; });
+}
+
+// finds the csv files of a single file or a whole directory tree
+std::vector<std::string> FireData::findCsvFiles(const std::string& dirpath) {
     std::vector<std::string> csvFiles;
 
     // make filesystem path object to work with the path easier
@@ -52,406 +129,530 @@ void FireData::loadFromDirectory(const std::string& dirpath, ParallelStrategy st
         }
     }
 
+    // by file name, not path, so the date order holds whatever directory a file sits in (the directory
+    // iterator's order depends on the file system)
+    std::sort(csvFiles.begin(), csvFiles.end(), [](const std::string& a, const std::string& b) {
+        return fs::path(a).filename() < fs::path(b).filename();
+    });
+    return csvFiles;
+}
+
+// main load function, handles both single files and directories
+void FireData::loadFromDirectory(const std::string& dirpath, ParallelStrategy strategy,
+                                 const StopCondition& stop) {
+    loadCsvFiles(findCsvFiles(dirpath), strategy, stop);
+}
+
+void FireData::loadShard(const std::string& dirpath, size_t shardIndex, size_t shardCount,
+                         ParallelStrategy strategy, const StopCondition& stop) {
+    if (shardCount == 0 || shardIndex >= shardCount) {
+        throw std::runtime_error("invalid shard " + std::to_string(shardIndex) + "/" + std::to_string(shardCount));
+    }
+    // in file name order, so the shards hold contiguous date ranges
+    std::vector<std::string> allFiles = findCsvFiles(dirpath);
+
+    // a file goes to the shard its middle byte falls into, which keeps the ranges contiguous and
+    // about equally large even when files differ in size
+    std::vector<uintmax_t> sizes(allFiles.size());
+    uintmax_t totalBytes = 0;
+    for (size_t i = 0; i < allFiles.size(); ++i) {
+        std::error_code ec;
+        sizes[i] = fs::file_size(allFiles[i], ec);
+        if (ec) sizes[i] = 0;
+        totalBytes += sizes[i];
+    }
+    std::vector<std::string> csvFiles;
+    uintmax_t offset = 0;
+    for (size_t i = 0; i < allFiles.size(); ++i) {
+        uintmax_t middle = offset + sizes[i] / 2;
+        size_t shard = totalBytes > 0 ? static_cast<size_t>(middle * shardCount / totalBytes)
+                                      : i * shardCount / allFiles.size();
+        if (std::min(shard, shardCount - 1) == shardIndex) csvFiles.push_back(allFiles[i]);
+        offset += sizes[i];
+    }
+
+    if (csvFiles.empty()) {
+        printf("Shard %zu of %zu: no files\n", shardIndex, shardCount);
+    } else {
+        printf("Shard %zu of %zu: %s .. %s\n", shardIndex, shardCount,
+               fs::path(csvFiles.front()).filename().string().c_str(),
+               fs::path(csvFiles.back()).filename().string().c_str());
+    }
+    loadCsvFiles(csvFiles, strategy, stop);
+}
+
+void FireData::loadCsvFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy,
+                            const StopCondition& stop) {
     printf("Found %zu CSV files to load using %s strategy...\n",
            csvFiles.size(), strategyToString(strategy));
 
-    // pick which loading method based on strategy
-    switch (strategy) {
-        case ParallelStrategy::OPENMP:
-            loadWithOpenMP(csvFiles);
-            break;
-        case ParallelStrategy::CENTRALIZED_QUEUE:
-            loadWithCentralizedQueue(csvFiles);
-            break;
-        case ParallelStrategy::ROUND_ROBIN:
-            loadWithRoundRobin(csvFiles);
-            break;
-    }
+    uint64_t loadStart = steadyNowNs();
+    loadFiles(csvFiles, strategy, stop);
+    // loaded data replaces an attached image (only once the load went through, a stopped one keeps it)
+    shared.reset();
+    // a second load appends, either way earlier results are stale
+    dataChanged();
 
     recordCount = records.size();
     // build indexes now that all data is loaded, makes queries faster
     buildIndexes();
+    buildSamples();
+    buildZoneMaps();
+
+    MetricsRegistry& registry = MetricsRegistry::instance();
+    registry.histogram("fire_load_seconds", "Time to load and index a dataset",
+                       {{"strategy", strategyLabel(strategy)}},
+                       {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120})
+        .observe((steadyNowNs() - loadStart) / 1e9);
+    registry.gauge("fire_records", "Records currently loaded").set(static_cast<double>(recordCount));
 }
 
 // ============================================================================
-// strategy 1: openmp implementation
+// loading: every csv file is one task for the chosen strategy
 // ============================================================================
-void FireData::loadWithOpenMP(const std::vector<std::string>& csvFiles) {
-#ifdef _OPENMP
-    // parallel file loading using openmp
-    std::mutex recordsMutex;
-
-    // openmp automatically splits loop iterations across threads
-    #pragma omp parallel for
-    for (size_t f = 0; f < csvFiles.size(); ++f) {
-        auto data = CSVParser::readFile(csvFiles[f], false, ',');
-        // each thread gets its own vector to avoid race conditions
-        std::vector<FireRecord> localRecords;
-
-        for (const auto& row : data) {
-            // skip rows without enough columns, need at least 13
-            if (row.size() < 13) continue;
-
-            FireRecord record;
-            // row[0] is first column, row[1] is second, etc.
-            record.setLatitude(CSVParser::toDouble(row[0]));
-            record.setLongitude(CSVParser::toDouble(row[1]));
-            record.setUTC(row[2]);
-            record.setPollutantType(row[3]);
-            record.setConcentration(CSVParser::toDouble(row[4]));
-            record.setUnit(row[5]);
-            record.setRawConcentration(CSVParser::toDouble(row[6]));
-            record.setAqi(CSVParser::toInt(row[7]));
-            record.setCategory(CSVParser::toInt(row[8]));
-            record.setSiteName(row[9]);
-            record.setAgencyName(row[10]);
-            record.setAqsId(row[11]);
-            record.setFullAqsId(row[12]);
-
-            localRecords.push_back(record);
-        }
+void FireData::parseFile(const std::string& filename, std::vector<FireRecord>& out) {
+    TraceSpan span("parse file", "load");
+    span.detail("%s", fs::path(filename).filename().string().c_str());
+
+    // resolved once, the counters themselves are lock free
+    static Counter& rowsLoaded = MetricsRegistry::instance().counter(
+        "fire_rows_loaded_total", "Rows parsed from csv files");
+    static Counter& bytesParsed = MetricsRegistry::instance().counter(
+        "fire_bytes_parsed_total", "Bytes of csv read by the loader");
+
+    auto data = CSVParser::readFile(filename, false, ',');
+    std::error_code ec;
+    uintmax_t fileBytes = fs::file_size(filename, ec);
+    if (!ec) bytesParsed.add(fileBytes);
+    size_t before = out.size();
+
+    for (const auto& row : data) {
+        // skip rows without enough columns, need at least 13
+        if (row.size() < 13) continue;
+
+        FireRecord record;
+        // row[0] is first column, row[1] is second, etc.
+        record.setLatitude(CSVParser::toDouble(row[0]));
+        record.setLongitude(CSVParser::toDouble(row[1]));
+        record.setUTC(row[2]);
+        record.setPollutantType(row[3]);
+        record.setConcentration(CSVParser::toDouble(row[4]));
+        record.setUnit(row[5]);
+        record.setRawConcentration(CSVParser::toDouble(row[6]));
+        record.setAqi(CSVParser::toInt(row[7]));
+        record.setCategory(CSVParser::toInt(row[8]));
+        record.setSiteName(row[9]);
+        record.setAgencyName(row[10]);
+        record.setAqsId(row[11]);
+        record.setFullAqsId(row[12]);
+
+        out.push_back(record);
+    }
+    rowsLoaded.add(out.size() - before);
+}
 
-        // critical section so only one thread writes at a time
-        #pragma omp critical
-        {
-            // merge local results into main vector
-            records.insert(records.end(), localRecords.begin(), localRecords.end());
-        }
+void FireData::loadFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy,
+                         const StopCondition& stop) {
+    if (strategy == ParallelStrategy::CENTRALIZED_QUEUE) {
+        printf("Using %u worker threads with centralized queue\n", getOptimalThreadCount());
+    } else if (strategy == ParallelStrategy::ROUND_ROBIN) {
+        printf("Using %u worker threads with round-robin distribution\n", getOptimalThreadCount());
     }
-#else
-    // serial version if openmp isnt available
-    for (const auto& filename : csvFiles) {
-        auto data = CSVParser::readFile(filename, false, ',');
-
-        for (const auto& row : data) {
-            if (row.size() < 13) continue;
-
-            FireRecord record;
-            record.setLatitude(CSVParser::toDouble(row[0]));
-            record.setLongitude(CSVParser::toDouble(row[1]));
-            record.setUTC(row[2]);
-            record.setPollutantType(row[3]);
-            record.setConcentration(CSVParser::toDouble(row[4]));
-            record.setUnit(row[5]);
-            record.setRawConcentration(CSVParser::toDouble(row[6]));
-            record.setAqi(CSVParser::toInt(row[7]));
-            record.setCategory(CSVParser::toInt(row[8]));
-            record.setSiteName(row[9]);
-            record.setAgencyName(row[10]);
-            record.setAqsId(row[11]);
-            record.setFullAqsId(row[12]);
-
-            records.push_back(record);
-        }
+
+    // chunk size 1 so each file is its own task
+    // each file is parsed into its own slot so there is no race, the slots are appended in file order
+    // afterwards: the load order doesn't depend on which worker got to the merge first
+    std::vector<std::vector<FireRecord>> fileRecords(csvFiles.size());
+    {
+        StopScope scope(stop);
+        parallelScan<int>(csvFiles.size(), 1, strategy,
+            [&](int&, size_t start, size_t end) {
+                for (size_t f = start; f < end; ++f) {
+                    parseFile(csvFiles[f], fileRecords[f]);
+                }
+            },
+            [](int&) {});
+    }
+    // a stopped load threw above, before anything was appended
+    size_t total = records.size();
+    for (const auto& file : fileRecords) total += file.size();
+    records.reserve(total);
+    for (auto& file : fileRecords) {
+        records.insert(records.end(), std::make_move_iterator(file.begin()), std::make_move_iterator(file.end()));
+        std::vector<FireRecord>().swap(file);
     }
-#endif
 }
 
-// ============================================================================
-// strategy 2: leader-worker with centralized queue
-// ============================================================================
-void FireData::loadWithCentralizedQueue(const std::vector<std::string>& csvFiles) {
-    // one shared queue that all workers pull from
-    TaskQueue<std::string> taskQueue;
-    std::mutex recordsMutex;
-
-    unsigned int numWorkers = getOptimalThreadCount();
-    printf("Using %u worker threads with centralized queue\n", numWorkers);
-
-    // worker function, each worker pulls from same queue
-    auto workerFunc = [&](int workerId) {
-        std::string filename;
-        std::vector<FireRecord> localRecords;
-
-        // keep getting tasks until queue is done
-        while (taskQueue.pop(filename)) {
-            auto data = CSVParser::readFile(filename, false, ',');
-
-            for (const auto& row : data) {
-                if (row.size() < 13) continue;
-
-                FireRecord record;
-                record.setLatitude(CSVParser::toDouble(row[0]));
-                record.setLongitude(CSVParser::toDouble(row[1]));
-                record.setUTC(row[2]);
-                record.setPollutantType(row[3]);
-                record.setConcentration(CSVParser::toDouble(row[4]));
-                record.setUnit(row[5]);
-                record.setRawConcentration(CSVParser::toDouble(row[6]));
-                record.setAqi(CSVParser::toInt(row[7]));
-                record.setCategory(CSVParser::toInt(row[8]));
-                record.setSiteName(row[9]);
-                record.setAgencyName(row[10]);
-                record.setAqsId(row[11]);
-                record.setFullAqsId(row[12]);
-
-                localRecords.push_back(record);
+void FireData::buildIndexes() {
+    TraceSpan span("build indexes", "load");
+    pollutantIndex.clear();
+    pollutantRowIds.clear();
+    size_t count = records.size();
+    if (count > UINT32_MAX) throw std::runtime_error("too many rows for the pollutant index");
+
+    // a handful of pollutants: number them in name order, every row's key is its pollutant's number
+    for (const FireRecord& r : records) pollutantIndex.try_emplace(r.getPollutantType());
+    uint64_t number = 0;
+    for (auto& entry : pollutantIndex) entry.second.first = number++;
+    std::vector<uint64_t> keys(count);
+    pollutantRowIds.resize(count);
+    parallelScan<int>(count, defaultChunkSize(count), ParallelStrategy::OPENMP,
+        [&](int&, size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                keys[i] = pollutantIndex.find(records[i].getPollutantType())->second.first;
+                pollutantRowIds[i] = static_cast<uint32_t>(i);
             }
-        }
-
-        // done processing, merge results back
-        std::lock_guard<std::mutex> lock(recordsMutex);
-        records.insert(records.end(), localRecords.begin(), localRecords.end());
-    };
-
-    // leader creates all the worker threads
-    std::vector<std::thread> workers;
-    for (unsigned int i = 0; i < numWorkers; ++i) {
-        workers.emplace_back(workerFunc, i);
+        },
+        [](int&) {});
+
+    // stable, so the ids of one pollutant stay ascending: each pollutant is a range in load order
+    parallelRadixSort(keys, pollutantRowIds);
+    size_t first = 0;
+    for (auto& entry : pollutantIndex) {
+        size_t end = first;
+        while (end < count && keys[end] == entry.second.first) ++end;
+        entry.second = {first, end - first};
+        first = end;
     }
 
-    // leader pushes all files to queue
-    for (const auto& file : csvFiles) {
-        taskQueue.push(file);
-    }
-    taskQueue.markFinished();
+    MetricsRegistry::instance().gauge("fire_index_entries", "Entries per secondary index",
+                                      {{"index", "pollutant"}})
+        .set(static_cast<double>(pollutantRowIds.size()));
+}
 
-    // wait for workers to finish
-    for (auto& worker : workers) {
-        worker.join();
-    }
+std::pair<const uint32_t*, const uint32_t*> FireData::pollutantRows(const std::string& pollutant) const {
+    if (shared) return shared->pollutantRows(pollutant);
+    const uint32_t* ids = pollutantRowIds.data();
+    auto it = pollutantIndex.find(pollutant);
+    if (it == pollutantIndex.end()) return {ids, ids};
+    return {ids + it->second.first, ids + it->second.first + it->second.second};
 }
 
-// ============================================================================
-// strategy 3: leader-worker with round-robin
-// ============================================================================
-void FireData::loadWithRoundRobin(const std::vector<std::string>& csvFiles) {
-    unsigned int numWorkers = getOptimalThreadCount();
-    printf("Using %u worker threads with round-robin distribution\n", numWorkers);
-
-    // each worker gets their own queue so no contention
-    std::vector<WorkerQueue<std::string>> workerQueues(numWorkers);
-    std::mutex recordsMutex;
-
-    // worker only reads from its own queue
-    auto workerFunc = [&](int workerId) {
-        std::string filename;
-        std::vector<FireRecord> localRecords;
-
-        // no contention since each worker has own queue
-        while (workerQueues[workerId].pop(filename)) {
-            auto data = CSVParser::readFile(filename, false, ',');
-
-            for (const auto& row : data) {
-                if (row.size() < 13) continue;
-
-                FireRecord record;
-                record.setLatitude(CSVParser::toDouble(row[0]));
-                record.setLongitude(CSVParser::toDouble(row[1]));
-                record.setUTC(row[2]);
-                record.setPollutantType(row[3]);
-                record.setConcentration(CSVParser::toDouble(row[4]));
-                record.setUnit(row[5]);
-                record.setRawConcentration(CSVParser::toDouble(row[6]));
-                record.setAqi(CSVParser::toInt(row[7]));
-                record.setCategory(CSVParser::toInt(row[8]));
-                record.setSiteName(row[9]);
-                record.setAgencyName(row[10]);
-                record.setAqsId(row[11]);
-                record.setFullAqsId(row[12]);
-
-                localRecords.push_back(record);
-            }
+std::vector<FireRecord> FireData::queryByPollutant(const std::string& pollutantType,
+                                                   const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    TraceSpan span("queryByPollutant", "query");
+    static QueryMetrics metrics("fire", "pollutant", true);
+    uint64_t start = steadyNowNs();
+    std::vector<FireRecord> results;
+    // with options.stop.memory the copies are charged a block of rows at a time, a lookup whose records
+    // alone are over the limit fails before copying any and the others stop at the block crossing it
+    size_t total = 0;
+    size_t charged = 0;
+    auto startCopy = [&]() {
+        const QueryMemory* memory = options.stop.memory;
+        size_t blocks = (total + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS;
+        if (memory && memory->limitBytes() != 0 && total * sizeof(FireRecord) > memory->limitBytes()) {
+            throw QueryCancelled(StopReason::MEMORY_LIMIT, 0, blocks);
         }
-
-        // merge results
-        std::lock_guard<std::mutex> lock(recordsMutex);
-        records.insert(records.end(), localRecords.begin(), localRecords.end());
+        results.reserve(total);
     };
-
-    // create worker threads
-    std::vector<std::thread> workers;
-    for (unsigned int i = 0; i < numWorkers; ++i) {
-        workers.emplace_back(workerFunc, i);
+    auto copied = [&]() {
+        if (results.size() % ZONE_BLOCK_ROWS != 0 && results.size() != total) return;
+        chargeRecords(options, results, charged);
+        charged = results.size();
+        const StopCondition* stop = currentStopCondition();
+        StopReason reason = stop ? stop->check() : StopReason::NONE;
+        if (reason != StopReason::NONE) {
+            throw QueryCancelled(reason, (charged + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS,
+                                 (total + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS);
+        }
+    };
+    // the index keeps a run of row ids per pollutant, in load order
+    auto ids = pollutantRows(pollutantType);
+    total = ids.second - ids.first;
+    startCopy();
+    withRows([&](const auto& rows) {
+        for (const uint32_t* row = ids.first; row != ids.second; ++row) {
+            results.push_back(rows[*row]);
+            copied();
+        }
+    });
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, results.size());
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "index(pollutant)";
+        // every index entry in the range is read and matches
+        profile.rowsScanned = results.size();
+        profile.rowsMatched = results.size();
+        for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
     }
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return FireQuery::pollutant(pollutantType);
+    });
+    return results;
+}
 
-    // distribute files round robin style to each worker queue
-    for (size_t i = 0; i < csvFiles.size(); ++i) {
-        int targetWorker = i % numWorkers;  // goes 0,1,2...n-1,0,1,2...
-        workerQueues[targetWorker].push(csvFiles[i]);
+// ============================================================================
+// vectorized predicates: masks over batches of columns
+// ============================================================================
+// the columns the predicates compare, for one batch of rows. over the shared image they point straight
+// into its column arrays, over records the needed ones are gathered into the buffers first
+struct FireColumnBatch {
+    size_t start = 0;
+    size_t rows = 0;
+    const double* concentration = nullptr;
+    const double* latitude = nullptr;
+    const double* longitude = nullptr;
+    const int32_t* category = nullptr;
+    double concentrationBuffer[SELECTION_BATCH_ROWS];
+    double latitudeBuffer[SELECTION_BATCH_ROWS];
+    double longitudeBuffer[SELECTION_BATCH_ROWS];
+    int32_t categoryBuffer[SELECTION_BATCH_ROWS];
+};
+
+// FireColumn bits of the numeric columns a filter compares
+static uint32_t filterColumns(const FireQuery& filter) {
+    switch (filter.type) {
+        case FireQueryType::VALUE_RANGE: return FIRE_CONCENTRATION;
+        case FireQueryType::GEOGRAPHIC_BOUNDS: return FIRE_LATITUDE | FIRE_LONGITUDE;
+        case FireQueryType::AQI_CATEGORY: return FIRE_CATEGORY;
+        default: return 0;
     }
+}
 
-    // tell all queues were done adding work
-    for (auto& queue : workerQueues) {
-        queue.markFinished();
+static void loadBatch(const std::vector<FireRecord>& rows, size_t start, size_t n, uint32_t columns,
+                      FireColumnBatch& batch) {
+    batch.start = start;
+    batch.rows = n;
+    const FireRecord* row = rows.data() + start;
+    if (columns & FIRE_CONCENTRATION) {
+        for (size_t j = 0; j < n; ++j) batch.concentrationBuffer[j] = row[j].getConcentration();
+        batch.concentration = batch.concentrationBuffer;
     }
-
-    // wait for all workers
-    for (auto& worker : workers) {
-        worker.join();
+    if (columns & FIRE_LATITUDE) {
+        for (size_t j = 0; j < n; ++j) batch.latitudeBuffer[j] = row[j].getLatitude();
+        batch.latitude = batch.latitudeBuffer;
+    }
+    if (columns & FIRE_LONGITUDE) {
+        for (size_t j = 0; j < n; ++j) batch.longitudeBuffer[j] = row[j].getLongitude();
+        batch.longitude = batch.longitudeBuffer;
+    }
+    if (columns & FIRE_CATEGORY) {
+        for (size_t j = 0; j < n; ++j) batch.categoryBuffer[j] = row[j].getCategory();
+        batch.category = batch.categoryBuffer;
     }
 }
 
-void FireData::buildIndexes() {
-    pollutantIndex.clear();
+static void loadBatch(const SharedFireStore& rows, size_t start, size_t n, uint32_t, FireColumnBatch& batch) {
+    batch.start = start;
+    batch.rows = n;
+    batch.concentration = rows.concentration() + start;
+    batch.latitude = rows.latitude() + start;
+    batch.longitude = rows.longitude() + start;
+    batch.category = rows.category() + start;
+}
 
-    #ifdef _OPENMP
-        #pragma omp parallel for
-        for (size_t i = 0; i < records.size(); ++i) {
-            #pragma omp critical
-            {
-                // map pollutant type to index for fast lookup
-                pollutantIndex.insert({records[i].getPollutantType(), i});
-            }
-        }
-    #else
-        for (size_t i = 0; i < records.size(); ++i) {
-            pollutantIndex.insert({records[i].getPollutantType(), i});
+// mask of the batch's rows passing filter. the numeric filters are SIMD compares on the batch columns,
+// string equality goes row by row but writes the mask the same way
+template<typename Rows>
+static void maskFilter(const Rows& rows, const FireColumnBatch& batch, const FireQuery& filter, uint8_t* mask) {
+    const size_t n = batch.rows;
+    switch (filter.type) {
+        case FireQueryType::VALUE_RANGE:
+            maskRange(batch.concentration, n, filter.minValue, filter.maxValue, mask);
+            break;
+        case FireQueryType::GEOGRAPHIC_BOUNDS: {
+            uint8_t lonMask[SELECTION_BATCH_ROWS];
+            maskRange(batch.latitude, n, filter.minLat, filter.maxLat, mask);
+            maskRange(batch.longitude, n, filter.minLon, filter.maxLon, lonMask);
+            maskAnd(mask, lonMask, n);
+            break;
         }
-    #endif
+        case FireQueryType::AQI_CATEGORY:
+            maskEquals(batch.category, n, static_cast<int32_t>(filter.category), mask);
+            break;
+        case FireQueryType::SITE_NAME:
+            for (size_t j = 0; j < n; ++j) mask[j] = rows[batch.start + j].getSiteName() == filter.text;
+            break;
+        case FireQueryType::POLLUTANT:
+            for (size_t j = 0; j < n; ++j) mask[j] = rows[batch.start + j].getPollutantType() == filter.text;
+            break;
+        default:
+            maskFill(mask, n, 1);
+            break;
+    }
 }
 
-std::vector<FireRecord> FireData::queryByPollutant(const std::string& pollutantType) const {
-    std::vector<FireRecord> results;
-    // equal_range gets all matching records from index
-    auto range = pollutantIndex.equal_range(pollutantType);
-    // iterate through matches
-    for (auto it = range.first; it != range.second; ++it) {
-        // it->second has the index
-        results.push_back(records[it->second]);
+bool FireData::zoneMayMatch(const ZoneMap& zone, const FireQuery& filter) {
+    switch (filter.type) {
+        case FireQueryType::VALUE_RANGE:
+            return zone.maxConcentration >= filter.minValue && zone.minConcentration <= filter.maxValue;
+        case FireQueryType::GEOGRAPHIC_BOUNDS:
+            return zone.maxLat >= filter.minLat && zone.minLat <= filter.maxLat &&
+                   zone.maxLon >= filter.minLon && zone.minLon <= filter.maxLon;
+        default:
+            return true;
     }
-    return results;
 }
 
 // ============================================================================
-// query by concentration range using different strategies
+// shared scan for the filter queries, works with every strategy
 // ============================================================================
-std::vector<FireRecord> FireData::queryByValueRange(
-    double minValue, double maxValue, ParallelStrategy strategy) const {
+// chunks of the filter scans are whole zone map blocks, a block is either skipped or read by one worker
+static size_t zoneChunkSize(size_t rows, size_t blockRows) {
+    return (defaultChunkSize(rows) + blockRows - 1) / blockRows * blockRows;
+}
 
-    std::vector<FireRecord> results;
+// a worker's matches, with where its chunks start in them for limited queries that keep row order
+struct ScanMatches {
+    std::vector<FireRecord> records;
+    std::vector<std::pair<size_t, size_t>> chunks;   // (first row of the chunk, its first match in records)
+};
 
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            // parallelize search with openmp
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                double concentration = records[i].getConcentration();
-                if (concentration >= minValue && concentration <= maxValue) {
-                    #pragma omp critical
+std::vector<FireRecord> FireData::collectMatching(const FireQuery& filter, ParallelStrategy strategy,
+                                                  const QueryOptions& options, const FireRecordSink* sink) const {
+    StopScope stop(options.stop);
+    std::vector<FireRecord> results;
+    std::atomic<size_t> blocksSkipped{0};
+    std::atomic<size_t> rowsSkipped{0};
+    std::atomic<size_t> blocksCut{0};
+    std::atomic<size_t> rowsCut{0};
+    std::atomic<size_t> rowsStreamed{0};
+    std::mutex sinkMutex;
+    const uint32_t columns = filterColumns(filter);
+    // with a limit (and no order to sort every match into) the workers stop once enough are found
+    MatchLimit limit(filter.orderBy == 0 ? filter.limit : 0, filter.limitMode);
+    const bool inRowOrder = limit.active() && limit.limitMode() == LimitMode::PREFIX;
+    // PREFIX: (first row of the chunk, first match in results, matches) per chunk, to put them back in order
+    std::vector<std::tuple<size_t, size_t, size_t>> chunkOrder;
+    std::vector<std::vector<FireRecord>> workerResults;
+    size_t mergedRows = 0;
+
+    // each worker collects its own matches so there is no lock per hit, merged at the end
+    withRows([&](const auto& rows) {
+        size_t chunkSize = zoneChunkSize(rows.size(), ZONE_BLOCK_ROWS);
+        parallelScan<ScanMatches>(rows.size(), chunkSize, strategy,
+            [&](ScanMatches& local, size_t start, size_t end) {
+                std::vector<FireRecord>& localResults = local.records;
+                FireColumnBatch batch;
+                uint8_t mask[SELECTION_BATCH_ROWS];
+                uint32_t selection[SELECTION_BATCH_ROWS];
+                // matches are worker scratch until the merge. streamed, every zone map block's matches go
+                // to the sink as one batch, so a worker never holds more than a block of them
+                size_t before = localResults.size();
+                size_t chunkFirst = before;
+                if (inRowOrder) local.chunks.push_back({start, chunkFirst});
+                auto flush = [&]() {
+                    size_t bytes = chargeRecords(options, localResults, before, sink != nullptr);
+                    if (!sink || localResults.empty()) return;
                     {
-                        results.push_back(records[i]);
+                        std::lock_guard<std::mutex> lock(sinkMutex);
+                        (*sink)(localResults);
+                    }
+                    rowsStreamed += localResults.size();
+                    localResults.clear();
+                    before = 0;
+                    if (options.stop.memory) options.stop.memory->release(bytes);
+                };
+                for (size_t blockStart = start; blockStart < end; blockStart += ZONE_BLOCK_ROWS) {
+                    size_t blockEnd = std::min(end, blockStart + ZONE_BLOCK_ROWS);
+                    if (limit.reached(blockStart)) {
+                        blocksCut += (end - blockStart + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS;
+                        rowsCut += end - blockStart;
+                        break;
+                    }
+                    if (!zoneMayMatch(zoneMaps[blockStart / ZONE_BLOCK_ROWS], filter)) {
+                        blocksSkipped++;
+                        rowsSkipped += blockEnd - blockStart;
+                        continue;
                     }
+                    size_t blockFirst = localResults.size();
+                    for (size_t at = blockStart; at < blockEnd; at += SELECTION_BATCH_ROWS) {
+                        size_t n = std::min(SELECTION_BATCH_ROWS, blockEnd - at);
+                        loadBatch(rows, at, n, columns, batch);
+                        maskFilter(rows, batch, filter, mask);
+                        if (maskCount(mask, n) == 0) continue;
+                        size_t selected = compactMask(mask, n, selection);
+                        for (size_t t = 0; t < selected; ++t) localResults.push_back(rows[at + selection[t]]);
+                    }
+                    limit.add(localResults.size() - blockFirst, localResults.size() - chunkFirst, blockEnd);
+                    if (sink) flush();
                 }
-            }
-#else
-            // serial version
-            for (const auto& record : records) {
-                double concentration = record.getConcentration();
-                if (concentration >= minValue && concentration <= maxValue) {
-                    results.push_back(record);
+                if (!sink) flush();
+                if (inRowOrder && !limit.reached(end)) {
+                    limit.chunkDone(start, end, localResults.size() - chunkFirst);
                 }
-            }
-#endif
-            break;
-        }
-
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            // centralized queue approach, split records into chunks
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;  // <start, end>
-            std::mutex resultsMutex;
-
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);  // make more chunks for load balancing
-            if (chunkSize == 0) chunkSize = 1;
-
-            // Worker function
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
-
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double concentration = records[i].getConcentration();
-                        if (concentration >= minValue && concentration <= maxValue) {
-                            localResults.push_back(records[i]);
-                        }
+            },
+            [&](ScanMatches& local) {
+                if (inRowOrder) {
+                    for (size_t c = 0; c < local.chunks.size(); ++c) {
+                        size_t first = local.chunks[c].second;
+                        size_t last = local.records.size();
+                        if (c + 1 < local.chunks.size()) last = local.chunks[c + 1].second;
+                        chunkOrder.emplace_back(local.chunks[c].first, mergedRows + first, last - first);
                     }
                 }
-
-                // Merge local results
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-
-            // Start workers
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
-
-            // Push chunks to queue
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
-
-            // Wait for workers
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
+                // the vectors are only taken here, joined once every worker is done and the total is known
+                mergedRows += local.records.size();
+                workerResults.push_back(std::move(local.records));
+            });
+    });
+    // one worker's vector is handed over whole, several are moved into one reserved vector (the
+    // strings too long for sso change owner instead of being copied again)
+    if (workerResults.size() == 1) {
+        results.swap(workerResults[0]);
+    } else {
+        results.reserve(mergedRows);
+        for (auto& part : workerResults) {
+            results.insert(results.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
         }
+    }
+    workerResults.clear();
+
+    if (inRowOrder) {
+        // the chunks' matches back in row order, cut to the limit
+        std::sort(chunkOrder.begin(), chunkOrder.end());
+        std::vector<FireRecord> first;
+        first.reserve(std::min(results.size(), limit.rows()));
+        for (const auto& chunk : chunkOrder) {
+            if (first.size() == limit.rows()) break;
+            size_t take = std::min(std::get<2>(chunk), limit.rows() - first.size());
+            auto from = results.begin() + std::get<1>(chunk);
+            first.insert(first.end(), std::make_move_iterator(from), std::make_move_iterator(from + take));
+        }
+        results.swap(first);
+    } else if (limit.active() && results.size() > limit.rows()) {
+        // workers racing to the limit overshoot it by up to a block each
+        results.resize(limit.rows());
+    }
 
-        case ParallelStrategy::ROUND_ROBIN: {
-            // Round-robin: each worker gets its own subset
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            // Worker function
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
-
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double concentration = records[i].getConcentration();
-                        if (concentration >= minValue && concentration <= maxValue) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
-
-                // Merge local results
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-
-            // Start workers
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-
-            // Distribute chunks in round-robin
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-
-            // Mark queues as finished
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
-
-            // Wait for workers
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = blocksSkipped > 0 ? "scan (zone maps)" : "scan";
+        if (limit.active()) {
+            profile.accessPath += std::string(" + limit ") + std::to_string(limit.rows()) +
+                                  (inRowOrder ? " (prefix)" : " (any)");
         }
+        profile.rowsMatched = results.size() + rowsStreamed;
+        profile.addRun(lastParallelRun());
+        // counted in zone map blocks, the ones the limit cut off weren't read either
+        profile.blocksSkipped = blocksSkipped + blocksCut;
+        profile.blocksScanned = zoneMaps.size() - blocksSkipped - blocksCut;
+        profile.rowsScanned = recordCount - rowsSkipped - rowsCut;
+        for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
     }
+    return results;
+}
 
+// ============================================================================
+// query by concentration range using different strategies
+// ============================================================================
+std::vector<FireRecord> FireData::queryByValueRange(
+    double minValue, double maxValue, ParallelStrategy strategy, const QueryOptions& options) const {
+
+    TraceSpan span("queryByValueRange", "query");
+    static QueryMetrics metrics("fire", "valueRange");
+    uint64_t start = steadyNowNs();
+    FireQuery query = FireQuery::valueRange(minValue, maxValue, strategy);
+    std::vector<FireRecord> results = collectMatching(query, strategy, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() { return query; });
     return results;
 }
 
@@ -459,644 +660,1304 @@ std::vector<FireRecord> FireData::queryByValueRange(
 // query by geographic bounds using different strategies
 // ============================================================================
 std::vector<FireRecord> FireData::queryByGeographicBounds(
-    double minLat, double maxLat, double minLon, double maxLon, ParallelStrategy strategy) const {
+    double minLat, double maxLat, double minLon, double maxLon, ParallelStrategy strategy,
+    const QueryOptions& options) const {
+
+    TraceSpan span("queryByGeographicBounds", "query");
+    static QueryMetrics metrics("fire", "geographicBounds");
+    uint64_t start = steadyNowNs();
+    FireQuery query = FireQuery::geographicBounds(minLat, maxLat, minLon, maxLon, strategy);
+    std::vector<FireRecord> results = collectMatching(query, strategy, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() { return query; });
+    return results;
+}
 
-    std::vector<FireRecord> results;
+// ============================================================================
+// query by AQI category using different strategies
+// ============================================================================
+std::vector<FireRecord> FireData::queryByAQICategory(int category, ParallelStrategy strategy,
+                                                    const QueryOptions& options) const {
+    TraceSpan span("queryByAQICategory", "query");
+    static QueryMetrics metrics("fire", "aqiCategory");
+    uint64_t start = steadyNowNs();
+    FireQuery query = FireQuery::aqiCategory(category, strategy);
+    std::vector<FireRecord> results = collectMatching(query, strategy, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() { return query; });
+    return results;
+}
 
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                double lat = records[i].getLatitude();
-                double lon = records[i].getLongitude();
-                if (lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon) {
-                    #pragma omp critical
-                    {
-                        results.push_back(records[i]);
-                    }
-                }
-            }
-#else
-            // Serial fallback
-            for (const auto& record : records) {
-                double lat = record.getLatitude();
-                double lon = record.getLongitude();
-                if (lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon) {
-                    results.push_back(record);
-                }
-            }
-#endif
-            break;
-        }
+// ============================================================================
+// query by site name using different strategies
+// ============================================================================
+std::vector<FireRecord> FireData::queryBySiteName(
+    const std::string& siteName, ParallelStrategy strategy, const QueryOptions& options) const {
+
+    TraceSpan span("queryBySiteName", "query");
+    static QueryMetrics metrics("fire", "siteName");
+    uint64_t start = steadyNowNs();
+    FireQuery query = FireQuery::siteName(siteName, strategy);
+    std::vector<FireRecord> results = collectMatching(query, strategy, options);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() { return query; });
+    return results;
+}
 
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
+// ============================================================================
+// queryLimited: the first query.limit matches of a filter query
+// ============================================================================
+std::vector<FireRecord> FireData::queryLimited(const FireQuery& query, const QueryOptions& options) const {
+    if (!query.limitable()) throw std::runtime_error("only filter queries take a limit, " + query.toString());
+    StopScope stop(options.stop);
+    TraceSpan span("queryLimited", "query");
+    static QueryMetrics metrics("fire", "limit");
+    uint64_t start = steadyNowNs();
+    FireQuery unordered = query;
+    unordered.orderBy = 0;
+    std::vector<FireRecord> results;
 
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
+    if (query.type == FireQueryType::POLLUTANT) {
+        // only the row ids of the index range are read, the records copied are the ones kept
+        // each pollutant's rows are in load order, so the first ones are right for ANY and PREFIX alike
+        auto rows = pollutantRows(query.text);
+        size_t total = rows.second - rows.first;
+        std::vector<uint32_t> ids(rows.first, rows.first + (query.limit != 0 ? std::min(total, query.limit) : total));
+        size_t entries = ids.size();
+        results.reserve(ids.size());
+        withRows([&](const auto& rows) {
+            for (uint32_t id : ids) results.push_back(rows[id]);
+        });
+        chargeRecords(options, results, 0);
+        if (options.profile) {
+            QueryProfile& profile = *options.profile;
+            profile = QueryProfile();
+            profile.accessPath = "index(pollutant) + limit " + std::to_string(query.limit) +
+                                 (query.limitMode == LimitMode::PREFIX ? " (prefix)" : " (any)");
+            profile.rowsScanned = entries;
+            profile.rowsMatched = results.size();
+            for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
+        }
+    } else {
+        results = collectMatching(unordered, query.strategy, options);
+    }
 
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(query.strategy, elapsed / 1e9, results.size());
+    finishQuery(options, elapsed, results.size(), [&]() { return unordered; });
+    return results;
+}
 
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double lat = records[i].getLatitude();
-                        double lon = records[i].getLongitude();
-                        if (lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
+// ============================================================================
+// stream: the records of a filter query in batches, without a result vector
+// ============================================================================
+size_t FireData::stream(const FireQuery& query, const FireRecordSink& sink, const QueryOptions& options) const {
+    if (!canStream(query.type)) throw std::runtime_error("only filter queries stream, " + query.toString());
+    if (query.orderBy != 0) throw std::runtime_error("ordered queries can't stream, " + query.toString());
+    if (query.limit != 0) throw std::runtime_error("limited queries can't stream, " + query.toString());
+    StopScope stop(options.stop);
+    TraceSpan span("stream", "query");
+    static QueryMetrics metrics("fire", "stream");
+    uint64_t start = steadyNowNs();
+    size_t rows = 0;
+
+    switch (query.type) {
+        case FireQueryType::POLLUTANT: {
+            // index order, a block of rows per batch, the stop is checked between batches
+            std::vector<FireRecord> batch;
+            size_t blocks = 0;
+            auto flush = [&]() {
+                size_t bytes = chargeRecords(options, batch, 0, true);
+                sink(batch);
+                rows += batch.size();
+                batch.clear();
+                if (options.stop.memory) options.stop.memory->release(bytes);
+                const StopCondition* current = currentStopCondition();
+                StopReason reason = current ? current->check() : StopReason::NONE;
+                if (reason != StopReason::NONE) {
+                    throw QueryCancelled(reason, (rows + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS, blocks);
                 }
-
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
             };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
-
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
-
-            for (auto& worker : workers) {
-                worker.join();
+            auto add = [&](const FireRecord& record) {
+                batch.push_back(record);
+                if (batch.size() == ZONE_BLOCK_ROWS) flush();
+            };
+            auto ids = pollutantRows(query.text);
+            blocks = (static_cast<size_t>(ids.second - ids.first) + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS;
+            withRows([&](const auto& all) {
+                for (const uint32_t* row = ids.first; row != ids.second; ++row) add(all[*row]);
+            });
+            if (!batch.empty()) flush();
+            if (options.profile) {
+                QueryProfile& profile = *options.profile;
+                profile = QueryProfile();
+                profile.accessPath = "index(pollutant)";
+                profile.rowsScanned = rows;
+                profile.rowsMatched = rows;
             }
             break;
         }
-
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
-
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        double lat = records[i].getLatitude();
-                        double lon = records[i].getLongitude();
-                        if (lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
-
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
+        case FireQueryType::VALUE_RANGE:
+        case FireQueryType::GEOGRAPHIC_BOUNDS:
+        case FireQueryType::AQI_CATEGORY:
+        case FireQueryType::SITE_NAME: {
+            FireRecordSink counted = [&](const std::vector<FireRecord>& batch) {
+                sink(batch);
+                rows += batch.size();
             };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
-
-            for (auto& worker : workers) {
-                worker.join();
-            }
+            collectMatching(query, query.strategy, options, &counted);
             break;
         }
+        default:
+            break;
     }
 
-    return results;
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(query.strategy, elapsed / 1e9, rows);
+    finishQuery(options, elapsed, rows, [&]() { return query; });
+    return rows;
 }
 
 // ============================================================================
-// query by AQI category using different strategies
+// aggregation: calculate average concentration using different strategies
 // ============================================================================
-std::vector<FireRecord> FireData::queryByAQICategory(int category, ParallelStrategy strategy) const {
+double FireData::calculateAverageConcentrationByPollutant(
+    const std::string& pollutantType, ParallelStrategy strategy, const QueryOptions& options) const {
+    return averageConcentrationState(pollutantType, strategy, options).value();
+}
 
-    std::vector<FireRecord> results;
+AverageState FireData::averageConcentrationState(
+    const std::string& pollutantType, ParallelStrategy strategy, const QueryOptions& options) const {
+    StopScope stop(options.stop);
 
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                if (records[i].getCategory() == category) {
-                    #pragma omp critical
-                    {
-                        results.push_back(records[i]);
+    TraceSpan span("calculateAverageConcentrationByPollutant", "query");
+    static QueryMetrics metrics("fire", "averageConcentration");
+    uint64_t start = steadyNowNs();
+    double sum = 0.0;
+    size_t count = 0;
+
+    // local state is a partial <sum, count>, same idea as an openmp reduction
+    withRows([&](const auto& rows) {
+        parallelScan<std::pair<double, size_t>>(rows.size(), defaultChunkSize(rows.size()), strategy,
+            [&](std::pair<double, size_t>& local, size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i) {
+                    if (rows[i].getPollutantType() == pollutantType) {
+                        local.first += rows[i].getConcentration();
+                        local.second++;
                     }
                 }
-            }
-#else
-            // Serial fallback
-            for (const auto& record : records) {
-                if (record.getCategory() == category) {
-                    results.push_back(record);
+            },
+            [&](std::pair<double, size_t>& local) {
+                sum += local.first;
+                count += local.second;
+            });
+    });
+
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, 1);
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "scan";
+        profile.rowsScanned = recordCount;
+        profile.rowsMatched = count;
+        profile.bytesMaterialized = sizeof(double);
+        profile.addRun(lastParallelRun());
+    }
+    finishQuery(options, elapsed, 1, [&]() {
+        return FireQuery::averageConcentration(pollutantType, strategy);
+    });
+    AverageState state;
+    state.sum = sum;
+    state.count = count;
+    return state;
+}
+
+// ============================================================================
+// aggregation: count records by category using different strategies
+// ============================================================================
+std::map<int, size_t> FireData::countRecordsByCategory(ParallelStrategy strategy,
+                                                       const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    TraceSpan span("countRecordsByCategory", "query");
+    static QueryMetrics metrics("fire", "countByCategory");
+    uint64_t start = steadyNowNs();
+    std::map<int, size_t> categoryCounts;
+
+    // each worker maintains local counts, then merge
+    withRows([&](const auto& rows) {
+        parallelScan<std::map<int, size_t>>(rows.size(), defaultChunkSize(rows.size()), strategy,
+            [&](std::map<int, size_t>& localCounts, size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i) {
+                    localCounts[rows[i].getCategory()]++;
                 }
-            }
-#endif
-            break;
-        }
+            },
+            [&](std::map<int, size_t>& localCounts) {
+                for (const auto& pair : localCounts) {
+                    categoryCounts[pair.first] += pair.second;
+                }
+            });
+    });
+
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, categoryCounts.size());
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "scan";
+        profile.rowsScanned = recordCount;
+        profile.rowsMatched = recordCount;
+        profile.bytesMaterialized = categoryCounts.size() *
+                                    (sizeof(std::pair<const int, size_t>) + TREE_NODE_OVERHEAD);
+        profile.addRun(lastParallelRun());
+    }
+    finishQuery(options, elapsed, categoryCounts.size(), [&]() {
+        return FireQuery::countByCategory(strategy);
+    });
+    return categoryCounts;
+}
 
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
+// ============================================================================
+// zone maps and Z-order clustering
+// ============================================================================
+void FireData::buildZoneMaps() {
+    TraceSpan span("build zone maps", "load");
+    const double inf = std::numeric_limits<double>::infinity();
+    zoneMaps.assign((recordCount + ZONE_BLOCK_ROWS - 1) / ZONE_BLOCK_ROWS,
+                    ZoneMap{inf, -inf, inf, -inf, inf, -inf});
+
+    withRows([&](const auto& rows) {
+        parallelScan<int>(rows.size(), zoneChunkSize(rows.size(), ZONE_BLOCK_ROWS), ParallelStrategy::OPENMP,
+            [&](int&, size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i) {
+                    ZoneMap& zone = zoneMaps[i / ZONE_BLOCK_ROWS];
+                    double lat = rows[i].getLatitude();
+                    double lon = rows[i].getLongitude();
+                    double concentration = rows[i].getConcentration();
+                    zone.minLat = std::min(zone.minLat, lat);
+                    zone.maxLat = std::max(zone.maxLat, lat);
+                    zone.minLon = std::min(zone.minLon, lon);
+                    zone.maxLon = std::max(zone.maxLon, lon);
+                    zone.minConcentration = std::min(zone.minConcentration, concentration);
+                    zone.maxConcentration = std::max(zone.maxConcentration, concentration);
+                }
+            },
+            [](int&) {});
+    });
+}
 
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
+// value scaled from [low, high] to [0, 2^bits), out of range values are clamped
+static uint64_t quantize(double value, double low, double high, int bits) {
+    double scaled = (value - low) / (high - low);
+    if (!(scaled > 0.0)) return 0;
+    uint64_t top = (1ull << bits) - 1;
+    return scaled >= 1.0 ? top : std::min(top, static_cast<uint64_t>(scaled * (top + 1)));
+}
 
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
+// bit i of every coordinate goes to bit i * count + k of the code (k = coordinate), lowest bits first
+static uint64_t interleave(const uint64_t* coordinates, int count, int bits) {
+    uint64_t code = 0;
+    for (int bit = 0; bit < bits; ++bit) {
+        for (int k = 0; k < count; ++k) {
+            code |= ((coordinates[k] >> bit) & 1) << (bit * count + k);
+        }
+    }
+    return code;
+}
 
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getCategory() == category) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
+// "2020-08-10T01:00" as minutes in a calendar where every month has 31 days: not a real timestamp,
+// but it grows with the time, which is all the curve needs
+static double utcMinutes(const std::string& utc) {
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0;
+    sscanf(utc.c_str(), "%d-%d-%dT%d:%d", &year, &month, &day, &hour, &minute);
+    return ((((year * 12.0 + month) * 31.0 + day) * 24.0 + hour) * 60.0) + minute;
+}
 
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
+void FireData::clusterByLocation(bool withTime, ParallelStrategy strategy) {
+    if (shared) throw std::runtime_error("can't reorder a shared image, cluster before exportShared");
+    TraceSpan span("cluster by location", "load");
+    const size_t count = records.size();
+
+    std::vector<double> minutes;
+    double firstMinute = 0.0, lastMinute = 0.0;
+    if (withTime && count > 0) {
+        minutes.resize(count);
+        for (size_t i = 0; i < count; ++i) minutes[i] = utcMinutes(records[i].getUTC());
+        auto range = std::minmax_element(minutes.begin(), minutes.end());
+        firstMinute = *range.first;
+        lastMinute = std::max(*range.second, firstMinute + 1.0);
+    }
 
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
+    // 32 bits per coordinate, 21 with time as the third one
+    std::vector<uint64_t> keys(count);
+    std::vector<uint32_t> order(count);
+    parallelScan<int>(count, defaultChunkSize(count), strategy,
+        [&](int&, size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                int bits = withTime ? 21 : 32;
+                uint64_t coordinates[3] = {
+                    quantize(records[i].getLatitude(), -90.0, 90.0, bits),
+                    quantize(records[i].getLongitude(), -180.0, 180.0, bits),
+                    withTime ? quantize(minutes[i], firstMinute, lastMinute, bits) : 0
+                };
+                keys[i] = interleave(coordinates, withTime ? 3 : 2, bits);
+                order[i] = static_cast<uint32_t>(i);
             }
+        },
+        [](int&) {});
+    parallelRadixSort(keys, order, strategy);
+
+    // records moved once into their new place, the index is rebuilt so its runs follow the new order
+    std::vector<FireRecord> clustered(count);
+    parallelScan<int>(count, defaultChunkSize(count), strategy,
+        [&](int&, size_t start, size_t end) {
+            for (size_t p = start; p < end; ++p) clustered[p] = std::move(records[order[p]]);
+        },
+        [](int&) {});
+    records.swap(clustered);
+    buildIndexes();
 
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
+    buildZoneMaps();
+    // same rows, but ordered results and their ties follow the new order
+    dataChanged();
+}
 
-            for (auto& worker : workers) {
-                worker.join();
+// ============================================================================
+// approximate aggregates from the samples drawn at load
+// ============================================================================
+void FireData::buildSamples() {
+    TraceSpan span("build samples", "load");
+    ReservoirSample<SampledReading> uniform(sampleRows);
+    std::map<std::string, ReservoirSample<double>, std::less<>> strata;
+
+    withRows([&](const auto& rows) {
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const auto& row = rows[i];
+            uniform.offer(SampledReading{row.getConcentration(), row.getCategory()});
+            auto stratum = strata.find(row.getPollutantType());
+            if (stratum == strata.end()) {
+                // seeded apart, otherwise every stratum would keep the same positions of its rows
+                stratum = strata.emplace(std::string(row.getPollutantType()),
+                                         ReservoirSample<double>(sampleRows, 0x5eed + strata.size() + 1)).first;
             }
-            break;
+            stratum->second.offer(row.getConcentration());
         }
+    });
 
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
+    uniformSample.swap(uniform.sample());
+    pollutantSamples.clear();
+    for (auto& pair : strata) {
+        pollutantSamples[pair.first] = std::make_pair(std::move(pair.second.sample()),
+                                                      static_cast<size_t>(pair.second.population()));
+    }
+}
 
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getCategory() == category) {
-                            localResults.push_back(records[i]);
-                        }
-                    }
-                }
+void FireData::setSampleSize(size_t rows) {
+    if (rows == 0) throw std::runtime_error("sample size must be at least 1 row");
+    sampleRows = rows;
+    buildSamples();
+}
 
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
+static void checkConfidence(double confidence) {
+    if (!(confidence > 0.0 && confidence < 1.0)) {
+        throw std::runtime_error("confidence has to be between 0 and 1, got " + formatQueryNumber(confidence));
+    }
+}
 
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
+Estimate FireData::approximateAverageConcentration(const std::string& pollutantType, double confidence,
+                                                   const QueryOptions& options) const {
+    checkConfidence(confidence);
+    StopScope stop(options.stop);
+    TraceSpan span("approximateAverageConcentration", "query");
+    static QueryMetrics metrics("fire", "approximateAverage", true, "sample");
+    uint64_t start = steadyNowNs();
+
+    Estimate estimate;
+    estimate.confidence = confidence;
+    auto stratum = pollutantSamples.find(pollutantType);
+    if (stratum != pollutantSamples.end()) {
+        estimate = estimateMean(stratum->second.first, stratum->second.second, confidence);
+    }
 
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, 1);
 
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "sample(pollutant)";
+        profile.rowsScanned = estimate.sampleRows;
+        profile.rowsMatched = estimate.sampleRows;
+        profile.bytesMaterialized = sizeof(Estimate);
+    }
+    finishQuery(options, elapsed, 1, [&]() {
+        return QuerySpecText{"approximate averageConcentration pollutant=" + escapeQueryValue(pollutantType) +
+                                    " confidence=" + formatQueryNumber(confidence)};
+    });
+    return estimate;
+}
 
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
-        }
+std::map<int, Estimate> FireData::approximateCountByCategory(double confidence,
+                                                             const QueryOptions& options) const {
+    checkConfidence(confidence);
+    StopScope stop(options.stop);
+    TraceSpan span("approximateCountByCategory", "query");
+    static QueryMetrics metrics("fire", "approximateCountByCategory", true, "sample");
+    uint64_t start = steadyNowNs();
+
+    std::map<int, size_t> hits;
+    for (const SampledReading& reading : uniformSample) hits[reading.category]++;
+    std::map<int, Estimate> estimates;
+    for (const auto& pair : hits) {
+        estimates[pair.first] = estimateCount(pair.second, uniformSample.size(), recordCount, confidence);
     }
 
-    return results;
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.recordIndex(elapsed / 1e9, estimates.size());
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "sample(uniform)";
+        profile.rowsScanned = uniformSample.size();
+        profile.rowsMatched = uniformSample.size();
+        profile.bytesMaterialized = estimates.size() *
+                                    (sizeof(std::pair<const int, Estimate>) + TREE_NODE_OVERHEAD);
+    }
+    finishQuery(options, elapsed, estimates.size(), [&]() {
+        return QuerySpecText{"approximate countByCategory confidence=" + formatQueryNumber(confidence)};
+    });
+    return estimates;
 }
 
 // ============================================================================
-// query by site name using different strategies
+// top k by concentration: a bounded heap per worker, merged into one at the end
 // ============================================================================
-std::vector<FireRecord> FireData::queryBySiteName(
-    const std::string& siteName, ParallelStrategy strategy) const {
-
+std::vector<FireRecord> FireData::queryTopConcentration(size_t k, const std::string& pollutantType,
+                                                        ParallelStrategy strategy,
+                                                        const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    TraceSpan span("queryTopConcentration", "query");
+    static QueryMetrics metrics("fire", "topConcentration");
+    uint64_t start = steadyNowNs();
+
+    // candidates are (concentration, row), rows are only copied out once the final k are known
+    typedef std::pair<double, size_t> Candidate;
+    std::vector<Candidate> top;
     std::vector<FireRecord> results;
-
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            std::mutex resultsMutex;
-            #pragma omp parallel for
-            for (size_t i = 0; i < records.size(); ++i) {
-                if (records[i].getSiteName() == siteName) {
-                    #pragma omp critical
-                    {
-                        results.push_back(records[i]);
-                    }
-                }
-            }
-#else
-            // Serial fallback
-            for (const auto& record : records) {
-                if (record.getSiteName() == siteName) {
-                    results.push_back(record);
+    size_t matched = 0;
+    if (k > 0) {
+        withRows([&](const auto& rows) {
+            // the rows themselves are only looked at on equal concentrations
+            auto better = [&](const Candidate& a, const Candidate& b) {
+                if (a.first != b.first) return a.first > b.first;
+                if (higherConcentration(rows[a.second], rows[b.second])) return true;
+                if (higherConcentration(rows[b.second], rows[a.second])) return false;
+                return a.second < b.second;
+            };
+            // with better as the heap order the front is the worst candidate kept, the one to replace
+            auto offer = [&](std::vector<Candidate>& heap, const Candidate& candidate) {
+                if (heap.size() < k) {
+                    heap.push_back(candidate);
+                    std::push_heap(heap.begin(), heap.end(), better);
+                } else if (better(candidate, heap.front())) {
+                    std::pop_heap(heap.begin(), heap.end(), better);
+                    heap.back() = candidate;
+                    std::push_heap(heap.begin(), heap.end(), better);
                 }
-            }
-#endif
-            break;
-        }
-
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
-
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
+            };
 
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getSiteName() == siteName) {
-                            localResults.push_back(records[i]);
+            parallelScan<std::pair<std::vector<Candidate>, size_t>>(rows.size(), defaultChunkSize(rows.size()),
+                strategy,
+                [&](std::pair<std::vector<Candidate>, size_t>& local, size_t start, size_t end) {
+                    for (size_t i = start; i < end; ++i) {
+                        if (pollutantType.empty() || rows[i].getPollutantType() == pollutantType) {
+                            offer(local.first, Candidate(rows[i].getConcentration(), i));
+                            local.second++;
                         }
                     }
-                }
+                },
+                [&](std::pair<std::vector<Candidate>, size_t>& local) {
+                    for (const Candidate& candidate : local.first) offer(top, candidate);
+                    matched += local.second;
+                });
+
+            std::sort(top.begin(), top.end(), better);
+            results.reserve(top.size());
+            for (const Candidate& candidate : top) results.push_back(rows[candidate.second]);
+        });
+    }
 
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, results.size());
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = "scan";
+        profile.rowsScanned = k > 0 ? recordCount : 0;
+        profile.rowsMatched = matched;
+        if (k > 0) profile.addRun(lastParallelRun());
+        for (const auto& r : results) profile.bytesMaterialized += recordBytes(r);
+    }
+    finishQuery(options, elapsed, results.size(), [&]() {
+        return FireQuery::topConcentration(k, pollutantType, strategy);
+    });
+    return results;
+}
 
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
+// ============================================================================
+// orderBy: sorts positions in the result, then moves every record once into its place
+// ============================================================================
+// numeric columns as radix keys, Value is double or int
+template<typename Value>
+static std::vector<uint32_t> radixOrder(const std::vector<FireRecord>& records,
+                                        Value (FireRecord::*get)() const, bool descending,
+                                        ParallelStrategy strategy) {
+    std::vector<uint64_t> keys(records.size());
+    std::vector<uint32_t> order(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        uint64_t key = radixKey((records[i].*get)());
+        // flipped keys sort descending and stay stable, equal values keep their result order
+        keys[i] = descending ? ~key : key;
+        order[i] = static_cast<uint32_t>(i);
+    }
+    parallelRadixSort(keys, order, strategy);
+    return order;
+}
 
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
+// string columns by comparison
+static std::vector<uint32_t> mergeOrder(const std::vector<FireRecord>& records,
+                                        const std::string& (FireRecord::*get)() const, bool descending,
+                                        ParallelStrategy strategy) {
+    std::vector<uint32_t> order(records.size());
+    for (size_t i = 0; i < records.size(); ++i) order[i] = static_cast<uint32_t>(i);
+    parallelMergeSort(order, [&](uint32_t a, uint32_t b) {
+        const std::string& left = (records[a].*get)();
+        const std::string& right = (records[b].*get)();
+        return descending ? right < left : left < right;
+    }, strategy);
+    return order;
+}
 
-            for (auto& worker : workers) {
-                worker.join();
-            }
+static void orderRecords(std::vector<FireRecord>& records, uint32_t column, bool descending,
+                         ParallelStrategy strategy) {
+    if (records.size() > UINT32_MAX) throw std::runtime_error("too many records to sort");
+    std::vector<uint32_t> order;
+    switch (column) {
+        case FIRE_LATITUDE: order = radixOrder(records, &FireRecord::getLatitude, descending, strategy); break;
+        case FIRE_LONGITUDE:
+            order = radixOrder(records, &FireRecord::getLongitude, descending, strategy);
             break;
-        }
+        case FIRE_CONCENTRATION:
+            order = radixOrder(records, &FireRecord::getConcentration, descending, strategy);
+            break;
+        case FIRE_RAW_CONCENTRATION:
+            order = radixOrder(records, &FireRecord::getRawConcentration, descending, strategy);
+            break;
+        case FIRE_AQI: order = radixOrder(records, &FireRecord::getAqi, descending, strategy); break;
+        case FIRE_CATEGORY: order = radixOrder(records, &FireRecord::getCategory, descending, strategy); break;
+        case FIRE_UTC: order = mergeOrder(records, &FireRecord::getUTC, descending, strategy); break;
+        case FIRE_POLLUTANT:
+            order = mergeOrder(records, &FireRecord::getPollutantType, descending, strategy);
+            break;
+        case FIRE_UNIT: order = mergeOrder(records, &FireRecord::getUnit, descending, strategy); break;
+        case FIRE_SITE: order = mergeOrder(records, &FireRecord::getSiteName, descending, strategy); break;
+        case FIRE_AGENCY: order = mergeOrder(records, &FireRecord::getAgencyName, descending, strategy); break;
+        case FIRE_AQS_ID: order = mergeOrder(records, &FireRecord::getAqsId, descending, strategy); break;
+        case FIRE_FULL_AQS_ID:
+            order = mergeOrder(records, &FireRecord::getFullAqsId, descending, strategy);
+            break;
+        default: throw std::runtime_error("orderBy needs exactly one column");
+    }
 
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
+    std::vector<FireRecord> sorted;
+    sorted.reserve(records.size());
+    for (uint32_t i : order) sorted.push_back(std::move(records[i]));
+    records.swap(sorted);
+}
 
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
+// ============================================================================
+// execute: run a query given as a spec
+// ============================================================================
+FireQueryResult FireData::execute(const FireQuery& query, const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    FireQueryResult result;
+    if (query.limit != 0 && query.orderBy == 0) {
+        // stops as soon as it has its records, ordered ones below have to see every match first
+        result.records = queryLimited(query, options);
+        return result;
+    }
+    switch (query.type) {
+        case FireQueryType::POLLUTANT:
+            result.records = queryByPollutant(query.text, options);
+            break;
+        case FireQueryType::VALUE_RANGE:
+            result.records = queryByValueRange(query.minValue, query.maxValue, query.strategy, options);
+            break;
+        case FireQueryType::GEOGRAPHIC_BOUNDS:
+            result.records = queryByGeographicBounds(query.minLat, query.maxLat, query.minLon, query.maxLon,
+                                                     query.strategy, options);
+            break;
+        case FireQueryType::AQI_CATEGORY:
+            result.records = queryByAQICategory(query.category, query.strategy, options);
+            break;
+        case FireQueryType::SITE_NAME:
+            result.records = queryBySiteName(query.text, query.strategy, options);
+            break;
+        case FireQueryType::AVERAGE_CONCENTRATION:
+            result.averageState = averageConcentrationState(query.text, query.strategy, options);
+            result.average = result.averageState.value();
+            break;
+        case FireQueryType::COUNT_BY_CATEGORY:
+            result.categoryCounts = countRecordsByCategory(query.strategy, options);
+            break;
+        case FireQueryType::TOP_CONCENTRATION:
+            result.records = queryTopConcentration(query.k, query.text, query.strategy, options);
+            break;
+    }
+    if (query.orderBy != 0 && !result.records.empty()) {
+        static Histogram& sortTime = MetricsRegistry::instance().histogram(
+            "fire_order_by_seconds", "Time to sort query results for orderBy");
+        uint64_t sortStart = steadyNowNs();
+        orderRecords(result.records, query.orderBy, query.descending, query.strategy);
+        if (query.limit != 0 && result.records.size() > query.limit) result.records.resize(query.limit);
+        uint64_t sortNs = steadyNowNs() - sortStart;
+        sortTime.observe(sortNs / 1e9);
+        if (options.profile) {
+            options.profile->query = query.toString();
+            options.profile->sortNs = sortNs;
+            options.profile->totalNs += sortNs;
+        }
+    }
+    return result;
+}
 
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::vector<FireRecord> localResults;
+// ============================================================================
+// executeBatch: every scan query of the batch in one shared pass
+// ============================================================================
+std::vector<FireQueryResult> FireData::executeBatch(const std::vector<FireQuery>& queries,
+                                                    ParallelStrategy strategy,
+                                                    const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    TraceSpan span("executeBatch", "query");
+    static QueryMetrics metrics("fire", "batch");
+    uint64_t start = steadyNowNs();
+    std::vector<FireQueryResult> results(queries.size());
+
+    // the queries that can share the scan, the others run on their own
+    std::vector<size_t> scanned;
+    uint32_t columns = FIRE_CONCENTRATION;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        FireQueryType type = queries[q].type;
+        // a limited query stops early on its own, in the shared pass it would wait for every row
+        if (type == FireQueryType::POLLUTANT || type == FireQueryType::TOP_CONCENTRATION ||
+            queries[q].limit != 0) {
+            // under the batch's stop and memory budget, the profile is the batch's
+            QueryOptions single;
+            single.stop = options.stop;
+            results[q] = execute(queries[q], single);
+        } else {
+            scanned.push_back(q);
+            columns |= filterColumns(queries[q]);
+            if (type == FireQueryType::COUNT_BY_CATEGORY) columns |= FIRE_CATEGORY;
+        }
+    }
 
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getSiteName() == siteName) {
-                            localResults.push_back(records[i]);
+    if (!scanned.empty()) {
+        withRows([&](const auto& rows) {
+            // worker state: one partial result per scanned query, merged like shard results
+            parallelScan<std::vector<FireQueryResult>>(rows.size(), defaultChunkSize(rows.size()), strategy,
+                [&](std::vector<FireQueryResult>& local, size_t chunkStart, size_t chunkEnd) {
+                    if (local.empty()) local.resize(scanned.size());
+                    std::vector<size_t> before(scanned.size());
+                    for (size_t s = 0; s < scanned.size(); ++s) before[s] = local[s].records.size();
+                    FireColumnBatch batch;
+                    uint8_t mask[SELECTION_BATCH_ROWS];
+                    uint32_t selection[SELECTION_BATCH_ROWS];
+
+                    for (size_t batchStart = chunkStart; batchStart < chunkEnd;
+                         batchStart += SELECTION_BATCH_ROWS) {
+                        size_t n = std::min(SELECTION_BATCH_ROWS, chunkEnd - batchStart);
+                        // the one read of the batch's rows, every predicate below runs on its columns
+                        loadBatch(rows, batchStart, n, columns, batch);
+
+                        for (size_t s = 0; s < scanned.size(); ++s) {
+                            const FireQuery& query = queries[scanned[s]];
+                            FireQueryResult& out = local[s];
+                            if (query.type == FireQueryType::AVERAGE_CONCENTRATION) {
+                                for (size_t j = 0; j < n; ++j) {
+                                    if (rows[batchStart + j].getPollutantType() == query.text) {
+                                        out.averageState.sum += batch.concentration[j];
+                                        out.averageState.count++;
+                                    }
+                                }
+                                continue;
+                            }
+                            if (query.type == FireQueryType::COUNT_BY_CATEGORY) {
+                                for (size_t j = 0; j < n; ++j) out.categoryCounts[batch.category[j]]++;
+                                continue;
+                            }
+                            maskFilter(rows, batch, query, mask);
+                            if (maskCount(mask, n) == 0) continue;
+                            size_t selected = compactMask(mask, n, selection);
+                            for (size_t t = 0; t < selected; ++t) {
+                                out.records.push_back(rows[batchStart + selection[t]]);
+                            }
                         }
                     }
-                }
-
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.insert(results.end(), localResults.begin(), localResults.end());
-            };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
-
-            for (auto& worker : workers) {
-                worker.join();
+                    for (size_t s = 0; s < scanned.size(); ++s) {
+                        chargeRecords(options, local[s].records, before[s]);
+                    }
+                },
+                [&](std::vector<FireQueryResult>& local) {
+                    for (size_t s = 0; s < local.size(); ++s) {
+                        // worker results aren't sorted yet, they are concatenated and ordered below
+                        FireQuery unordered = queries[scanned[s]];
+                        unordered.orderBy = 0;
+                        results[scanned[s]].merge(unordered, std::move(local[s]));
+                    }
+                });
+        });
+        for (size_t q : scanned) {
+            if (queries[q].orderBy != 0 && !results[q].records.empty()) {
+                orderRecords(results[q].records, queries[q].orderBy, queries[q].descending, strategy);
             }
-            break;
         }
     }
 
+    size_t rowsOut = 0;
+    for (size_t q = 0; q < queries.size(); ++q) rowsOut += results[q].rows(queries[q].type);
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, rowsOut);
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        char text[64];
+        snprintf(text, sizeof(text), "batch of %zu queries", queries.size());
+        profile.query = text;
+        snprintf(text, sizeof(text), "shared scan (%zu queries)", scanned.size());
+        profile.accessPath = text;
+        profile.rowsScanned = scanned.empty() ? 0 : recordCount;
+        profile.rowsMatched = rowsOut;
+        if (!scanned.empty()) profile.addRun(lastParallelRun());
+        for (const auto& result : results) {
+            for (const auto& r : result.records) profile.bytesMaterialized += recordBytes(r);
+        }
+        profile.totalNs = elapsed;
+        if (options.stop.memory) profile.peakBytes = options.stop.memory->peakBytes();
+    }
     return results;
 }
 
 // ============================================================================
-// aggregation: calculate average concentration using different strategies
+// projection: row ids of the matches first, then only the requested columns of those rows
 // ============================================================================
-double FireData::calculateAverageConcentrationByPollutant(
-    const std::string& pollutantType, ParallelStrategy strategy) const {
-
-    double sum = 0.0;
-    size_t count = 0;
+// bytes per row of the projected columns without the string text, what project charges before gathering
+static size_t projectedRowBytes(uint32_t columns) {
+    const uint32_t doubles = FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION | FIRE_RAW_CONCENTRATION;
+    const uint32_t ints = FIRE_AQI | FIRE_CATEGORY;
+    size_t bytes = 0;
+    for (uint32_t bit = 1; bit & FIRE_ALL_COLUMNS; bit <<= 1) {
+        if (!(columns & bit)) continue;
+        // string columns keep a uint32 offset per row next to their characters
+        bytes += (bit & doubles) ? sizeof(double) : (bit & ints) ? sizeof(int) : sizeof(uint32_t);
+    }
+    return bytes;
+}
 
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            // parallel reduction - openmp automatically combines partial sums
-            #pragma omp parallel for reduction(+:sum,count)
-            for (size_t i = 0; i < records.size(); ++i) {
-                if (records[i].getPollutantType() == pollutantType) {
-                    sum += records[i].getConcentration();
-                    count++;
-                }
+// keeps the ids in selection of the rows passing filter, branch free like compactMask. the ids come
+// from the index and are spread over the rows, they are compared where they are instead of in batches
+template<typename Rows>
+static void refineSelection(const Rows& rows, const FireQuery& filter, std::vector<uint32_t>& selection) {
+    size_t kept = 0;
+    switch (filter.type) {
+        case FireQueryType::POLLUTANT:
+            for (size_t i = 0; i < selection.size(); ++i) {
+                uint32_t row = selection[i];
+                selection[kept] = row;
+                kept += rows[row].getPollutantType() == filter.text;
             }
-#else
-            for (const auto& record : records) {
-                if (record.getPollutantType() == pollutantType) {
-                    sum += record.getConcentration();
-                    count++;
-                }
+            break;
+        case FireQueryType::VALUE_RANGE:
+            for (size_t i = 0; i < selection.size(); ++i) {
+                uint32_t row = selection[i];
+                double concentration = rows[row].getConcentration();
+                selection[kept] = row;
+                kept += (concentration >= filter.minValue) & (concentration <= filter.maxValue);
             }
-#endif
             break;
-        }
-
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
-
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                double localSum = 0.0;
-                size_t localCount = 0;
-
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getPollutantType() == pollutantType) {
-                            localSum += records[i].getConcentration();
-                            localCount++;
-                        }
-                    }
-                }
-
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                sum += localSum;
-                count += localCount;
-            };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
+        case FireQueryType::GEOGRAPHIC_BOUNDS:
+            for (size_t i = 0; i < selection.size(); ++i) {
+                uint32_t row = selection[i];
+                double lat = rows[row].getLatitude();
+                double lon = rows[row].getLongitude();
+                selection[kept] = row;
+                kept += (lat >= filter.minLat) & (lat <= filter.maxLat) & (lon >= filter.minLon) &
+                        (lon <= filter.maxLon);
             }
-
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
+            break;
+        case FireQueryType::AQI_CATEGORY:
+            for (size_t i = 0; i < selection.size(); ++i) {
+                uint32_t row = selection[i];
+                selection[kept] = row;
+                kept += rows[row].getCategory() == filter.category;
             }
-            taskQueue.markFinished();
-
-            for (auto& worker : workers) {
-                worker.join();
+            break;
+        case FireQueryType::SITE_NAME:
+            for (size_t i = 0; i < selection.size(); ++i) {
+                uint32_t row = selection[i];
+                selection[kept] = row;
+                kept += rows[row].getSiteName() == filter.text;
             }
             break;
-        }
+        default:
+            break;
+    }
+    selection.resize(kept);
+}
 
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
+// copies column out of the selected rows into a vector, or a StringColumn for strings
+template<typename Rows, typename Get>
+static void gatherColumn(const Rows& rows, const std::vector<uint32_t>& selection, Get get,
+                         std::vector<double>& out) {
+    out.resize(selection.size());
+    for (size_t i = 0; i < selection.size(); ++i) out[i] = get(rows[selection[i]]);
+}
 
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
+template<typename Rows, typename Get>
+static void gatherColumn(const Rows& rows, const std::vector<uint32_t>& selection, Get get,
+                         std::vector<int>& out) {
+    out.resize(selection.size());
+    for (size_t i = 0; i < selection.size(); ++i) out[i] = get(rows[selection[i]]);
+}
 
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                double localSum = 0.0;
-                size_t localCount = 0;
+template<typename Rows, typename Get>
+static void gatherColumn(const Rows& rows, const std::vector<uint32_t>& selection, Get get,
+                         StringColumn& out) {
+    out.reserve(selection.size());
+    for (uint32_t row : selection) out.push_back(get(rows[row]));
+}
 
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        if (records[i].getPollutantType() == pollutantType) {
-                            localSum += records[i].getConcentration();
-                            localCount++;
-                        }
-                    }
+FireColumns FireData::project(const std::vector<FireQuery>& filters, uint32_t columns, size_t limit,
+                              ParallelStrategy strategy, const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    TraceSpan span("project", "query");
+    static QueryMetrics metrics("fire", "projection");
+    uint64_t start = steadyNowNs();
+
+    // a pollutant filter narrows the rows through the index, the other filters refine them
+    const FireQuery* lookup = nullptr;
+    std::vector<const FireQuery*> refine;
+    for (const FireQuery& filter : filters) {
+        switch (filter.type) {
+            case FireQueryType::POLLUTANT:
+                if (lookup == nullptr) {
+                    lookup = &filter;
+                } else {
+                    refine.push_back(&filter);
                 }
+                break;
+            case FireQueryType::VALUE_RANGE:
+            case FireQueryType::GEOGRAPHIC_BOUNDS:
+            case FireQueryType::AQI_CATEGORY:
+            case FireQueryType::SITE_NAME:
+                refine.push_back(&filter);
+                break;
+            default:
+                throw std::runtime_error(std::string("Can't project a ") + fireQueryTypeName(filter.type) +
+                                         " query, only filters");
+        }
+    }
 
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                sum += localSum;
-                count += localCount;
-            };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
-
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
-
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
+    FireColumns result;
+    result.columns = columns & FIRE_ALL_COLUMNS;
+    std::vector<uint32_t> selection;
+    size_t rowsScanned = 0;
+    withRows([&](const auto& rows) {
+        if (lookup) {
+            auto indexRows = pollutantRows(lookup->text);
+            selection.assign(indexRows.first, indexRows.second);
+            rowsScanned = selection.size();
+            for (const FireQuery* filter : refine) refineSelection(rows, *filter, selection);
+        } else {
+            // the row ids say where every match is, so the limit only has to find the scan's bound
+            MatchLimit prefix(limit, LimitMode::PREFIX);
+            std::atomic<size_t> rowsCut{0};
+            uint32_t filtered = 0;
+            for (const FireQuery* filter : refine) filtered |= filterColumns(*filter);
+            parallelScan<std::vector<uint32_t>>(rows.size(), defaultChunkSize(rows.size()), strategy,
+                [&](std::vector<uint32_t>& local, size_t chunkStart, size_t chunkEnd) {
+                    FireColumnBatch batch;
+                    uint8_t mask[SELECTION_BATCH_ROWS], filterMask[SELECTION_BATCH_ROWS];
+                    uint32_t selection[SELECTION_BATCH_ROWS];
+                    size_t before = local.size();
+                    for (size_t batchStart = chunkStart; batchStart < chunkEnd;
+                         batchStart += SELECTION_BATCH_ROWS) {
+                        if (prefix.reached(batchStart)) {
+                            rowsCut += chunkEnd - batchStart;
+                            break;
+                        }
+                        size_t n = std::min(SELECTION_BATCH_ROWS, chunkEnd - batchStart);
+                        loadBatch(rows, batchStart, n, filtered, batch);
+                        // the filters are ANDed mask by mask
+                        maskFill(mask, n, 1);
+                        for (const FireQuery* filter : refine) {
+                            maskFilter(rows, batch, *filter, filterMask);
+                            maskAnd(mask, filterMask, n);
+                        }
+                        size_t selected = compactMask(mask, n, selection);
+                        for (size_t t = 0; t < selected; ++t) {
+                            local.push_back(static_cast<uint32_t>(batchStart + selection[t]));
+                        }
+                        prefix.add(selected, local.size() - before, batchStart + n);
+                    }
+                    if (!prefix.reached(chunkEnd)) prefix.chunkDone(chunkStart, chunkEnd, local.size() - before);
+                    if (options.stop.memory) {
+                        options.stop.memory->charge((local.size() - before) * sizeof(uint32_t));
+                    }
+                },
+                [&](std::vector<uint32_t>& local) {
+                    selection.insert(selection.end(), local.begin(), local.end());
+                });
+            rowsScanned = rows.size() - rowsCut;
+        }
+        // load order whatever order the index or the workers produced them in, and the gathers
+        // below walk the rows front to back
+        std::sort(selection.begin(), selection.end());
+        if (limit != 0 && selection.size() > limit) selection.resize(limit);
+
+        // a projection whose columns can't fit fails before gathering any of them
+        QueryMemory* memory = options.stop.memory;
+        if (memory) {
+            if (lookup) memory->charge(selection.size() * sizeof(uint32_t));
+            size_t limit = memory->limitBytes();
+            if (memory->overLimit() ||
+                (limit != 0 && memory->currentBytes() + selection.size() * projectedRowBytes(columns) > limit)) {
+                throw QueryCancelled(StopReason::MEMORY_LIMIT, 0, 0);
             }
+        }
 
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
+        typedef decltype(rows[0]) Row;
+        result.rows = selection.size();
+        if (result.has(FIRE_LATITUDE)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getLatitude(); }, result.latitude);
+        }
+        if (result.has(FIRE_LONGITUDE)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getLongitude(); }, result.longitude);
+        }
+        if (result.has(FIRE_UTC)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getUTC()); }, result.utc);
+        }
+        if (result.has(FIRE_POLLUTANT)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getPollutantType()); },
+                         result.pollutant);
+        }
+        if (result.has(FIRE_CONCENTRATION)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getConcentration(); }, result.concentration);
+        }
+        if (result.has(FIRE_UNIT)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getUnit()); }, result.unit);
+        }
+        if (result.has(FIRE_RAW_CONCENTRATION)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getRawConcentration(); },
+                         result.rawConcentration);
         }
+        if (result.has(FIRE_AQI)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getAqi(); }, result.aqi);
+        }
+        if (result.has(FIRE_CATEGORY)) {
+            gatherColumn(rows, selection, [](Row r) { return r.getCategory(); }, result.category);
+        }
+        if (result.has(FIRE_SITE)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getSiteName()); },
+                         result.site);
+        }
+        if (result.has(FIRE_AGENCY)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getAgencyName()); },
+                         result.agency);
+        }
+        if (result.has(FIRE_AQS_ID)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getAqsId()); }, result.aqsId);
+        }
+        if (result.has(FIRE_FULL_AQS_ID)) {
+            gatherColumn(rows, selection, [](Row r) { return std::string_view(r.getFullAqsId()); },
+                         result.fullAqsId);
+        }
+        // the row ids are dropped on return, the columns stay with the caller
+        if (memory) {
+            memory->charge(result.bytes());
+            memory->release(selection.size() * sizeof(uint32_t));
+        }
+    });
+
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, result.rows);
+
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile = QueryProfile();
+        profile.accessPath = lookup ? "index(pollutant) + projection" : "scan + projection";
+        if (limit != 0) profile.accessPath += " + limit " + std::to_string(limit);
+        profile.rowsScanned = rowsScanned;
+        profile.rowsMatched = result.rows;
+        profile.bytesMaterialized = result.bytes();
+        if (!lookup) profile.addRun(lastParallelRun());
     }
-
-    return count > 0 ? sum / count : 0.0;
+    finishQuery(options, elapsed, result.rows, [&]() {
+        std::string text = "project";
+        for (const FireQuery& filter : filters) text += " [" + filter.toString() + "]";
+        text += " columns=" + fireColumnsToString(result.columns);
+        if (limit != 0) text += " limit=" + std::to_string(limit);
+        return QuerySpecText{text};
+    });
+    return result;
 }
 
 // ============================================================================
-// aggregation: count records by category using different strategies
+// explain: what a query would do, without running it
 // ============================================================================
-std::map<int, size_t> FireData::countRecordsByCategory(ParallelStrategy strategy) const {
-
-    std::map<int, size_t> categoryCounts;
-
-    switch (strategy) {
-        case ParallelStrategy::OPENMP: {
-#ifdef _OPENMP
-            // each thread maintains local counts, then merge
-            #pragma omp parallel
-            {
-                std::map<int, size_t> localCounts;
-
-                #pragma omp for nowait
-                for (size_t i = 0; i < records.size(); ++i) {
-                    int category = records[i].getCategory();
-                    localCounts[category]++;
-                }
+// the Limit line of a plan, empty without a limit
+static std::string explainLimit(const FireQuery& query) {
+    if (query.limit == 0) return "";
+    std::string text = "Limit: " + std::to_string(query.limit);
+    if (query.orderBy != 0) return text + " after the sort, every match is read\n";
+    if (query.type == FireQueryType::POLLUTANT) return text + " index entries, only their records are copied\n";
+    return text + (query.limitMode == LimitMode::PREFIX
+                       ? " (prefix), first matches in load order, the scan stops at the rows past them\n"
+                       : " (any), the workers share a match counter and stop once it gets there\n");
+}
 
-                // merge local counts into global map
-                #pragma omp critical
-                {
-                    for (const auto& pair : localCounts) {
-                        categoryCounts[pair.first] += pair.second;
-                    }
-                }
-            }
-#else
-            for (const auto& record : records) {
-                categoryCounts[record.getCategory()]++;
-            }
-#endif
-            break;
+std::string FireData::explain(const FireQuery& query) const {
+    std::string plan = "Query: " + query.toString() + "\n";
+    char line[256];
+
+    if (query.type == FireQueryType::POLLUTANT) {
+        // the index gives the exact row count for free
+        auto rows = pollutantRows(query.text);
+        size_t matches = rows.second - rows.first;
+        if (shared) {
+            plan += "Access path: index(pollutant), binary search over the shared image's keys\n";
+        } else {
+            plan += "Access path: index(pollutant), the pollutant's run of row ids\n";
         }
+        snprintf(line, sizeof(line), "Rows: %zu of %zu (exact, from the index)\n", matches, recordCount);
+        plan += line;
+        plan += "Output: matching records copied\n";
+        return plan + explainLimit(query);
+    }
 
-        case ParallelStrategy::CENTRALIZED_QUEUE: {
-            TaskQueue<std::pair<size_t, size_t>> taskQueue;
-            std::mutex resultsMutex;
-
-            unsigned int numWorkers = getOptimalThreadCount();
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&]() {
-                std::pair<size_t, size_t> chunk;
-                std::map<int, size_t> localCounts;
-
-                while (taskQueue.pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        int category = records[i].getCategory();
-                        localCounts[category]++;
-                    }
-                }
-
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                for (const auto& pair : localCounts) {
-                    categoryCounts[pair.first] += pair.second;
-                }
-            };
-
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc);
-            }
-
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                taskQueue.push({start, end});
-            }
-            taskQueue.markFinished();
+    // the filter scans hand out whole zone map blocks
+    bool filterScan = query.type == FireQueryType::VALUE_RANGE || query.type == FireQueryType::AQI_CATEGORY ||
+                      query.type == FireQueryType::GEOGRAPHIC_BOUNDS || query.type == FireQueryType::SITE_NAME;
+    size_t chunkSize = filterScan ? zoneChunkSize(recordCount, ZONE_BLOCK_ROWS) : defaultChunkSize(recordCount);
+    size_t chunks = (recordCount + chunkSize - 1) / chunkSize;
+    plan += shared ? "Access path: scan of the shared columnar image (no index covers this predicate)\n"
+                   : "Access path: scan (no index covers this predicate)\n";
+    snprintf(line, sizeof(line), "Rows to scan: %zu in %zu blocks of up to %zu rows\n",
+             recordCount, chunks, chunkSize);
+    plan += line;
+    snprintf(line, sizeof(line), "Strategy: %s, %u workers\n", strategyToString(query.strategy),
+             strategyWorkerCount(query.strategy));
+    plan += line;
+
+    if (query.type == FireQueryType::VALUE_RANGE || query.type == FireQueryType::GEOGRAPHIC_BOUNDS) {
+        size_t mayMatch = 0;
+        for (const ZoneMap& zone : zoneMaps) mayMatch += zoneMayMatch(zone, query);
+        snprintf(line, sizeof(line), "Zone maps: %zu of %zu blocks of %zu rows may match, the rest skipped\n",
+                 mayMatch, zoneMaps.size(), ZONE_BLOCK_ROWS);
+        plan += line;
+    }
 
-            for (auto& worker : workers) {
-                worker.join();
+    switch (query.type) {
+        case FireQueryType::VALUE_RANGE:
+            snprintf(line, sizeof(line), "Predicate: %g <= concentration <= %g\n",
+                     query.minValue, query.maxValue);
+            break;
+        case FireQueryType::GEOGRAPHIC_BOUNDS:
+            snprintf(line, sizeof(line), "Predicate: %g <= latitude <= %g and %g <= longitude <= %g\n",
+                     query.minLat, query.maxLat, query.minLon, query.maxLon);
+            break;
+        case FireQueryType::AQI_CATEGORY:
+            snprintf(line, sizeof(line), "Predicate: category == %d\n", query.category);
+            break;
+        case FireQueryType::SITE_NAME:
+            snprintf(line, sizeof(line), "Predicate: siteName == \"%s\"\n", query.text.c_str());
+            break;
+        case FireQueryType::AVERAGE_CONCENTRATION:
+            snprintf(line, sizeof(line), "Predicate: pollutantType == \"%s\"\n", query.text.c_str());
+            break;
+        case FireQueryType::TOP_CONCENTRATION:
+            if (query.text.empty()) {
+                snprintf(line, sizeof(line), "Predicate: none\n");
+            } else {
+                snprintf(line, sizeof(line), "Predicate: pollutantType == \"%s\"\n", query.text.c_str());
             }
             break;
-        }
-
-        case ParallelStrategy::ROUND_ROBIN: {
-            unsigned int numWorkers = getOptimalThreadCount();
-            std::vector<WorkerQueue<std::pair<size_t, size_t>>> workerQueues(numWorkers);
-            std::mutex resultsMutex;
-
-            size_t chunkSize = records.size() / (numWorkers * 4);
-            if (chunkSize == 0) chunkSize = 1;
-
-            auto workerFunc = [&](int workerId) {
-                std::pair<size_t, size_t> chunk;
-                std::map<int, size_t> localCounts;
+        default:
+            snprintf(line, sizeof(line), "Predicate: none\n");
+            break;
+    }
+    plan += line;
+
+    if (query.type == FireQueryType::AVERAGE_CONCENTRATION) {
+        plan += "Output: average of concentration, per-worker <sum, count> merged at the end\n";
+    } else if (query.type == FireQueryType::COUNT_BY_CATEGORY) {
+        plan += "Output: count per category, per-worker maps merged at the end\n";
+    } else if (query.type == FireQueryType::TOP_CONCENTRATION) {
+        snprintf(line, sizeof(line), "Output: %zu highest concentrations, per-worker %zu element heaps merged "
+                 "at the end, only the final rows copied\n", query.k, query.k);
+        plan += line;
+    } else {
+        plan += "Output: matching records copied, per-worker vectors merged at the end\n";
+    }
+    if (query.orderBy != 0) {
+        bool numeric = (query.orderBy & (FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION |
+                                         FIRE_RAW_CONCENTRATION | FIRE_AQI | FIRE_CATEGORY)) != 0;
+        snprintf(line, sizeof(line), "Order: %s %s, %s of result positions, records moved once\n",
+                 fireColumnsToString(query.orderBy).c_str(), query.descending ? "descending" : "ascending",
+                 numeric ? "parallel radix sort" : "parallel merge sort");
+        plan += line;
+    }
+    return plan + explainLimit(query);
+}
 
-                while (workerQueues[workerId].pop(chunk)) {
-                    for (size_t i = chunk.first; i < chunk.second && i < records.size(); ++i) {
-                        int category = records[i].getCategory();
-                        localCounts[category]++;
-                    }
-                }
+// ============================================================================
+// memory accounting
+// ============================================================================
+// the uniform and the per pollutant samples, private even when attached to a shared image
+size_t FireData::sampleBytes() const {
+    size_t bytes = vectorBytes(uniformSample);
+    for (const auto& pair : pollutantSamples) {
+        bytes += sizeof(pair) + TREE_NODE_OVERHEAD + stringHeapBytes(pair.first) + vectorBytes(pair.second.first);
+    }
+    return bytes;
+}
 
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                for (const auto& pair : localCounts) {
-                    categoryCounts[pair.first] += pair.second;
-                }
-            };
+MemoryUsage FireData::memoryUsage() const {
+    MemoryUsage usage;
+    usage.recordCount = recordCount;
+    if (shared) {
+        // mapped read-only and shared with every other attached process, not private memory
+        usage.add("shared image (mapped)", shared->bytes());
+        usage.add("samples", sampleBytes());
+        usage.add("zone maps", vectorBytes(zoneMaps));
+        return usage;
+    }
 
-            std::vector<std::thread> workers;
-            for (unsigned int i = 0; i < numWorkers; ++i) {
-                workers.emplace_back(workerFunc, i);
-            }
+    // fixed part of every record (doubles, ints and the string objects themselves)
+    usage.add("records", vectorBytes(records));
 
-            size_t chunkIdx = 0;
-            for (size_t start = 0; start < records.size(); start += chunkSize) {
-                size_t end = std::min(start + chunkSize, records.size());
-                int targetWorker = chunkIdx % numWorkers;
-                workerQueues[targetWorker].push({start, end});
-                chunkIdx++;
-            }
+    // heap buffers of strings too long for the small string optimization
+    size_t stringBytes = 0;
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(+:stringBytes)
+#endif
+    for (size_t i = 0; i < records.size(); ++i) {
+        const FireRecord& r = records[i];
+        stringBytes += stringHeapBytes(r.getUTC()) + stringHeapBytes(r.getPollutantType()) +
+                       stringHeapBytes(r.getUnit()) + stringHeapBytes(r.getSiteName()) +
+                       stringHeapBytes(r.getAgencyName()) + stringHeapBytes(r.getAqsId()) +
+                       stringHeapBytes(r.getFullAqsId());
+    }
+    usage.add("record strings", stringBytes);
 
-            for (auto& queue : workerQueues) {
-                queue.markFinished();
-            }
+    usage.add("pollutantIndex", mapBytes(pollutantIndex) + vectorBytes(pollutantRowIds));
+    usage.add("samples", sampleBytes());
+    usage.add("zone maps", vectorBytes(zoneMaps));
+    return usage;
+}
 
-            for (auto& worker : workers) {
-                worker.join();
-            }
-            break;
-        }
-    }
+// ============================================================================
+// shared columnar image for other processes
+// ============================================================================
+void FireData::exportShared(const std::string& target) const {
+    if (shared) throw std::runtime_error("already attached to a shared image, nothing loaded to export");
+    TraceSpan span("export shared image", "load");
+    SharedFireStore::build(records, target);
+}
 
-    return categoryCounts;
+void FireData::attachShared(const std::string& target) {
+    TraceSpan span("attach shared image", "load");
+    std::unique_ptr<SharedFireStore> store = SharedFireStore::attach(target);
+    // the private copy isn't needed anymore, queries read the mapping from now on
+    clear();
+    records.shrink_to_fit();
+    recordCount = store->size();
+    shared = std::move(store);
+    buildSamples();
+    buildZoneMaps();
+    dataChanged();
+    MetricsRegistry::instance().gauge("fire_records", "Records currently loaded")
+        .set(static_cast<double>(recordCount));
 }
 
 void FireData::clear() {
     // free memory by clearing all containers
     records.clear();
     pollutantIndex.clear();
+    pollutantRowIds.clear();
+    uniformSample.clear();
+    pollutantSamples.clear();
+    zoneMaps.clear();
+    shared.reset();
     recordCount = 0;
+    dataChanged();
+}
+
+void FireData::dataChanged() {
+    ++version;
+    if (cache) cache->invalidate(version);
+}
+
+// ============================================================================
+// result cache
+// ============================================================================
+void FireData::enableResultCache(size_t budgetBytes) {
+    if (budgetBytes == 0) {
+        cache.reset();
+        return;
+    }
+    cache.reset(new ResultCache<FireQueryResult>("fire", budgetBytes));
+    cache->invalidate(version);
+}
+
+std::shared_ptr<const FireQueryResult> FireData::executeCached(const FireQuery& query,
+                                                              const QueryOptions& options) const {
+    StopScope stop(options.stop);
+    if (!cache) return std::make_shared<const FireQueryResult>(execute(query, options));
+
+    // normalized key: the text form with the strategy fixed, every strategy returns the same rows
+    FireQuery normalized = query;
+    normalized.strategy = ParallelStrategy::OPENMP;
+    std::string key = normalized.toString();
+
+    uint64_t start = steadyNowNs();
+    std::shared_ptr<const FireQueryResult> result = cache->get(key, version);
+    if (result) {
+        size_t rows = result->rows(query.type);
+        if (options.profile) {
+            QueryProfile& profile = *options.profile;
+            profile = QueryProfile();
+            profile.accessPath = "cache";
+            profile.rowsMatched = rows;
+        }
+        finishQuery(options, steadyNowNs() - start, rows, [&]() { return query; });
+        return result;
+    }
+
+    uint64_t runVersion = version;
+    std::shared_ptr<const FireQueryResult> computed =
+        std::make_shared<const FireQueryResult>(execute(query, options));
+    size_t bytes = sizeof(FireQueryResult);
+    for (const auto& r : computed->records) bytes += recordBytes(r);
+    bytes += computed->categoryCounts.size() * (sizeof(std::pair<const int, size_t>) + TREE_NODE_OVERHEAD);
+    cache->put(key, runVersion, computed, bytes);
+    return computed;
 }
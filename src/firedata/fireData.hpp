@@ -5,24 +5,131 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
+#include <functional>
+#include <iterator>
 #include "firedata/fireRecord.hpp"
+#include "firedata/sharedFireStore.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/memoryUsage.hpp"
+#include "common/queryProfile.hpp"
+#include "common/slowQueryLog.hpp"
+#include "common/resultCache.hpp"
+#include "common/sampling.hpp"
+#include "firedata/fireQuery.hpp"
+#include "firedata/fireColumns.hpp"
+#include "firedata/firePredicate.hpp"
+
+// receives the matches of a streamed query (FireData::stream) a batch at a time. calls are serialized
+// but come from the worker threads, so the sink must not throw
+typedef std::function<void(const std::vector<FireRecord>& batch)> FireRecordSink;
 
 class FireData {
 private:
     // vector storing all the fire records we loaded
     std::vector<FireRecord> records;
-    // multimap lets us have multiple records with same key, maps pollutant type to record index for fast lookup
-    std::multimap<std::string, size_t> pollutantIndex;
+    // pollutant index, built like the shared image's: row ids radix sorted by pollutant, so one pollutant's
+    // rows are a range of pollutantRowIds in load order. pollutantIndex maps a pollutant to (first, count)
+    std::vector<uint32_t> pollutantRowIds;
+    std::map<std::string, std::pair<size_t, size_t>> pollutantIndex;
     size_t recordCount;
+    // slow-query log, not owned (see setSlowQueryLog)
+    SlowQueryLog* slowLog;
+    // set while attached to a shared image, records and the pollutant index are empty then
+    std::unique_ptr<SharedFireStore> shared;
+    // bumped whenever the data changes (load, append, attach, clear), cached results carry it
+    uint64_t version;
+    // optional result cache for executeCached, see enableResultCache
+    std::unique_ptr<ResultCache<FireQueryResult>> cache;
+
+    // samples behind the approximate aggregates, drawn by buildSamples after every load or attach
+    struct SampledReading {
+        double concentration;
+        int category;
+    };
+    size_t sampleRows;                                     // per sample, see setSampleSize
+    std::vector<SampledReading> uniformSample;             // over all rows
+    // one sample of concentrations per pollutant, with the number of rows it stands for
+    std::map<std::string, std::pair<std::vector<double>, size_t>, std::less<>> pollutantSamples;
+
+    // zone maps: ranges of the scanned columns per block of ZONE_BLOCK_ROWS rows, so range and bounds
+    // scans skip the blocks that can't match. they only pay off when close values sit together (see
+    // clusterByLocation), over rows in file order nearly every block spans the whole range
+    static const size_t ZONE_BLOCK_ROWS = 4096;
+    struct ZoneMap {
+        double minLat, maxLat, minLon, maxLon;
+        double minConcentration, maxConcentration;
+    };
+    std::vector<ZoneMap> zoneMaps;
+
+    // bumps the version and drops the cached results
+    void dataChanged();
+
+    void buildZoneMaps();
+    // one reservoir pass over the rows: the uniform sample and the per pollutant samples
+    void buildSamples();
+    size_t sampleBytes() const;
 
     // helper function to build the indexes after loading, makes queries way faster
     void buildIndexes();
+    // row ids of one pollutant in load order, from the shared image's index while attached
+    std::pair<const uint32_t*, const uint32_t*> pollutantRows(const std::string& pollutant) const;
+
+    // every csv under dirpath (or dirpath itself when it is a csv file), sorted by file name (the
+    // archive names them by date and hour) so every load reads them in the same order
+    static std::vector<std::string> findCsvFiles(const std::string& dirpath);
+    // loads csvFiles, builds the indexes and records the load metrics
+    void loadCsvFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy,
+                      const StopCondition& stop);
+    // loads the files in parallel with the given strategy, one file is one task. records are appended in
+    // the order of csvFiles whichever worker parsed a file when, so the load order is the same on
+    // every run, strategy and thread count
+    void loadFiles(const std::vector<std::string>& csvFiles, ParallelStrategy strategy, const StopCondition& stop);
+    // parses one csv file and appends its records to out
+    static void parseFile(const std::string& filename, std::vector<FireRecord>& out);
+
+    // fills the query text of options.profile and writes the slow-query log entry of a finished query
+    // makeQuery returns the query spec and is only called when one of them needs it
+    template<typename MakeQuery>
+    void finishQuery(const QueryOptions& options, uint64_t elapsedNs, size_t rows, MakeQuery makeQuery) const;
 
-    // different implementations for each strategy
-    void loadWithOpenMP(const std::vector<std::string>& csvFiles);
-    void loadWithCentralizedQueue(const std::vector<std::string>& csvFiles);
-    void loadWithRoundRobin(const std::vector<std::string>& csvFiles);
+    // calls visit with the rows queries read: records, or the attached image (rows are SharedFireRow
+    // views there), so every scan is written once as a generic lambda
+    template<typename Visit>
+    void withRows(Visit visit) const {
+        if (shared) {
+            visit(*shared);
+        } else {
+            visit(records);
+        }
+    }
+
+    // what a custom predicate scan returned, for its metrics
+    enum class WhereOutput { COUNT, AGGREGATE, SELECT };
+    // metrics, profile and slow-query log entry of a finished countWhere / aggregateWhere / selectWhere,
+    // text is only built when the profile or the log wants it
+    void finishWhere(WhereOutput output, const std::string& text, ParallelStrategy strategy,
+                     uint64_t elapsedNs, size_t rowsMatched, const std::vector<FireRecord>* selected,
+                     const QueryOptions& options) const;
+    bool wantsQueryText(const QueryOptions& options) const { return options.profile != nullptr || slowLog; }
+
+    // false when no row of the block can pass filter
+    static bool zoneMayMatch(const ZoneMap& zone, const FireQuery& filter);
+
+    // shared scan behind the filter queries, returns copies of every record passing filter and fills
+    // options.profile when it is set. blocks failing zoneMayMatch aren't read, the others are
+    // compared batch by batch into masks (common/selectionVector.hpp). with a sink the matches of
+    // every zone map block go to it instead and nothing is returned. filter.limit (without an orderBy)
+    // stops the workers once they have enough, see queryLimited
+    std::vector<FireRecord> collectMatching(const FireQuery& filter, ParallelStrategy strategy,
+                                            const QueryOptions& options,
+                                            const FireRecordSink* sink = nullptr) const;
+
+    // charges rows[from, end) to options.stop.memory when it is set, returns the bytes charged.
+    // false from the charge isn't checked here, the query stops at its next chunk (StopCondition).
+    // streamed batches are only held (QueryMemory::hold), they count toward the peak but not the limit
+    static size_t chargeRecords(const QueryOptions& options, const std::vector<FireRecord>& rows, size_t from,
+                                bool streamed = false);
 
 public:
     // constructor and destructor
@@ -30,32 +137,252 @@ public:
     ~FireData();
 
     // main loading function, can load single file or whole directory
-    // strategy parameter picks which parallelization method to use
+    // strategy parameter picks which parallelization method to use. files are read in file name order
+    // and appended in it, row by row. a load stopped by stop (checked between files) throws
+    // QueryCancelled and leaves the data as it was before
     void loadFromDirectory(const std::string& dirpath,
-                          ParallelStrategy strategy = ParallelStrategy::OPENMP);
+                          ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                          const StopCondition& stop = StopCondition());
+    // loads shard shardIndex of shardCount: the files are sorted by name (the archive names them by
+    // date and hour) and cut into shardCount contiguous ranges of about equal size, so every shard
+    // holds one date range
+    void loadShard(const std::string& dirpath, size_t shardIndex, size_t shardCount,
+                   ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                   const StopCondition& stop = StopCondition());
 
     // these query methods return vectors of matching records
-    std::vector<FireRecord> queryByPollutant(const std::string& pollutantType) const;
+    // every query takes optional QueryOptions last, set options.profile to get an execution profile
+    // and options.stop to make it cancellable or give it a deadline (it throws QueryCancelled)
+    std::vector<FireRecord> queryByPollutant(const std::string& pollutantType,
+                                             const QueryOptions& options = QueryOptions()) const;
 
     // these queries can use different parallel strategies too
     std::vector<FireRecord> queryByValueRange(double minValue, double maxValue,
-                                               ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                               ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                               const QueryOptions& options = QueryOptions()) const;
     std::vector<FireRecord> queryByGeographicBounds(double minLat, double maxLat,
                                                      double minLon, double maxLon,
-                                                     ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                                     ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                     const QueryOptions& options = QueryOptions()) const;
     std::vector<FireRecord> queryByAQICategory(int category,
-                                                ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                                ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                const QueryOptions& options = QueryOptions()) const;
     std::vector<FireRecord> queryBySiteName(const std::string& siteName,
-                                             ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                             ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                             const QueryOptions& options = QueryOptions()) const;
 
     // aggregation methods with parallel strategy support
     double calculateAverageConcentrationByPollutant(const std::string& pollutantType,
-                                                     ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
-    std::map<int, size_t> countRecordsByCategory(ParallelStrategy strategy = ParallelStrategy::OPENMP) const;
+                                                     ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                     const QueryOptions& options = QueryOptions()) const;
+    // sum and count behind the average, mergeable across shards
+    AverageState averageConcentrationState(const std::string& pollutantType,
+                                           ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                           const QueryOptions& options = QueryOptions()) const;
+    std::map<int, size_t> countRecordsByCategory(ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                 const QueryOptions& options = QueryOptions()) const;
+
+    // the k records with the highest concentration (of one pollutant, or all when pollutantType is
+    // empty), highest first. each worker keeps a k element heap, the heaps are merged at the end
+    std::vector<FireRecord> queryTopConcentration(size_t k, const std::string& pollutantType = "",
+                                                  ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                                  const QueryOptions& options = QueryOptions()) const;
+
+    // approximate aggregates for exploring big archives: answered in about a millisecond from samples
+    // drawn with reservoir sampling at load, with a confidence interval around the estimate
+    // the average uses the sample of its pollutant (a stratified sample, every pollutant gets the same
+    // number of rows however rare it is), the counts use the uniform sample over all rows
+    Estimate approximateAverageConcentration(const std::string& pollutantType, double confidence = 0.95,
+                                             const QueryOptions& options = QueryOptions()) const;
+    std::map<int, Estimate> approximateCountByCategory(double confidence = 0.95,
+                                                       const QueryOptions& options = QueryOptions()) const;
+    // rows kept per sample (default 10000), bigger samples give narrower intervals (the width shrinks
+    // with the square root of the size). redraws the samples of the loaded data
+    void setSampleSize(size_t rows);
+    size_t sampleSize() const { return sampleRows; }
+
+    // runs the query described by a spec (parsed from text, read from a workload file, ...)
+    FireQueryResult execute(const FireQuery& query, const QueryOptions& options = QueryOptions()) const;
+
+    // runs many queries with one pass over the data instead of one scan each (dashboards). rows go
+    // through in blocks: a block's columns are gathered once, every query's predicate runs over them
+    // into a selection vector and the selected rows go to that query's result. pollutant lookups
+    // still use the index, topConcentration its heap scan and limited queries stop early on their own.
+    // results are in the order of queries, the scan runs with strategy whatever the queries' own
+    // strategies say
+    std::vector<FireQueryResult> executeBatch(const std::vector<FireQuery>& queries,
+                                              ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                              const QueryOptions& options = QueryOptions()) const;
+
+    // the first query.limit records of a filter query (FireQuery::limitedTo), without sorting them by
+    // its orderBy. the scan stops once it has them: in ANY mode the workers share one counter of matches
+    // and all stop when it gets to the limit, in PREFIX mode they stop at the row bound past which no
+    // match can be among the first ones in load order (common/matchLimit.hpp). a probe like "any 20
+    // readings over 500" reads a few blocks instead of every row. pollutant lookups take the first
+    // index entries. throws std::runtime_error for the other query types
+    std::vector<FireRecord> queryLimited(const FireQuery& query,
+                                         const QueryOptions& options = QueryOptions()) const;
+
+    // hands the records a filter query (pollutant, valueRange, geographicBounds, aqiCategory, siteName)
+    // matches to sink in batches instead of collecting them, so a query over most of the data holds one
+    // batch per worker rather than a copy of every row: count, aggregate or write them out on the fly.
+    // batches come in no particular order, ordered or limited queries and the other types throw
+    // std::runtime_error. returns the number of records streamed
+    size_t stream(const FireQuery& query, const FireRecordSink& sink,
+                  const QueryOptions& options = QueryOptions()) const;
+    // true for the query types stream takes
+    static bool canStream(FireQueryType type) {
+        return type == FireQueryType::POLLUTANT || type == FireQueryType::VALUE_RANGE ||
+               type == FireQueryType::GEOGRAPHIC_BOUNDS || type == FireQueryType::AQI_CATEGORY ||
+               type == FireQueryType::SITE_NAME;
+    }
+
+    // only the requested columns (FireColumn bits) of the rows matching all filters, e.g. latitude,
+    // longitude and concentration of the PM2.5 readings in a box:
+    //   project({FireQuery::pollutant("PM2.5"), FireQuery::geographicBounds(...)},
+    //           FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION)
+    // the matching rows are found as row ids first (through the index when one filter is a pollutant,
+    // the scan runs with strategy otherwise), then just the requested columns of those rows are copied
+    // out. no filters selects every row, rows come back in load order. filters are pollutant,
+    // valueRange, geographicBounds, aqiCategory and siteName, throws std::runtime_error for the rest.
+    // a limit keeps the first limit rows in load order, the scan stops once no later row can be one
+    FireColumns project(const std::vector<FireQuery>& filters, uint32_t columns, size_t limit = 0,
+                        ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                        const QueryOptions& options = QueryOptions()) const;
+
+    // custom predicates built from the fire:: columns (firedata/firePredicate.hpp), e.g.
+    //   countWhere(fire::concentration > 35.0 && fire::aqi > 100 && fire::latitude.between(30.0, 45.0))
+    // the predicate's type is the template argument, so it is compiled into the scan loop like a
+    // hand-written one. every strategy works, over loaded records and attached images alike
+    template<typename Predicate>
+    size_t countWhere(const Predicate& predicate, ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                      const QueryOptions& options = QueryOptions()) const;
+    // count, sum, min and max of value (a column or an expression of columns) over the matching rows
+    template<typename Predicate, typename Value>
+    FireAggregate aggregateWhere(const Predicate& predicate, const Value& value,
+                                 ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                 const QueryOptions& options = QueryOptions()) const;
+    // copies of the matching records, in no particular order
+    template<typename Predicate>
+    std::vector<FireRecord> selectWhere(const Predicate& predicate,
+                                        ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                                        const QueryOptions& options = QueryOptions()) const;
+
+    // like execute, but answered from the result cache when the same query (strategy aside, it
+    // doesn't change the result) already ran on this version of the data. the result is shared and
+    // immutable, a hit costs a hash lookup and no copy. without a cache every call runs the query
+    std::shared_ptr<const FireQueryResult> executeCached(const FireQuery& query,
+                                                         const QueryOptions& options = QueryOptions()) const;
+    // keeps up to budgetBytes (estimated) of results for executeCached, least recently used go first
+    // 0 turns the cache off
+    void enableResultCache(size_t budgetBytes);
+    const ResultCache<FireQueryResult>* resultCache() const { return cache.get(); }
+    uint64_t dataVersion() const { return version; }
+
+    // the plan the query would run with (access path, rows and blocks to scan, workers), without running it
+    std::string explain(const FireQuery& query) const;
+
+    // queries over the log's threshold (and its sampled share of the rest) are written to log
+    // the log isn't owned and has to outlive this object, nullptr turns logging off again
+    void setSlowQueryLog(SlowQueryLog* log) { slowLog = log; }
+
+    // writes the records and the pollutant index as a columnar image other processes can attach
+    // target is a POSIX shared memory name ("/fire_data") or a file path, which gets memory mapped
+    // throws std::runtime_error when the image can't be created
+    void exportShared(const std::string& target) const;
+    // drops the loaded records and serves every query from the image at target instead, mapped
+    // read-only so all attached processes share one copy. throws std::runtime_error if it isn't valid
+    void attachShared(const std::string& target);
+    bool isShared() const { return shared != nullptr; }
+    // removes an image, attached processes keep working on their mapping
+    static bool removeShared(const std::string& target) { return SharedFireStore::remove(target); }
+
+    // reorders the records along a Z-order (Morton) curve of latitude and longitude, interleaved with
+    // time too when withTime is set, so readings close in space (and time) end up next to each other:
+    // bounds and range scans skip more zone map blocks, index lookups gather from fewer cache lines.
+    // row ids are radix sorted on the codes, the records moved once and the pollutant index rebuilt
+    // for the new positions. throws std::runtime_error while attached to a shared image, cluster
+    // before exportShared (the image keeps the order)
+    void clusterByLocation(bool withTime = false, ParallelStrategy strategy = ParallelStrategy::OPENMP);
+
+    // breakdown of the memory held by records, their strings and the indexes
+    MemoryUsage memoryUsage() const;
 
     // inline getter returns number of records
     size_t size() const { return recordCount; }
     void clear();
 };
 
+// ============================================================================
+// custom predicate scans, templates over the predicate so they live here
+// ============================================================================
+template<typename Predicate>
+size_t FireData::countWhere(const Predicate& predicate, ParallelStrategy strategy,
+                            const QueryOptions& options) const {
+    static_assert(fire::IsExpr<Predicate>::value, "countWhere takes a predicate built from fire:: columns");
+    StopScope stop(options.stop);
+    uint64_t start = steadyNowNs();
+    size_t count = 0;
+    withRows([&](const auto& rows) {
+        parallelScan<size_t>(rows.size(), defaultChunkSize(rows.size()), strategy,
+            [&](size_t& local, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) local += predicate(rows[i]);
+            },
+            [&](size_t& local) { count += local; });
+    });
+    std::string text = wantsQueryText(options) ? "countWhere " + predicate.toString() : std::string();
+    finishWhere(WhereOutput::COUNT, text, strategy, steadyNowNs() - start, count, nullptr, options);
+    return count;
+}
+
+template<typename Predicate, typename Value>
+FireAggregate FireData::aggregateWhere(const Predicate& predicate, const Value& value,
+                                       ParallelStrategy strategy, const QueryOptions& options) const {
+    static_assert(fire::IsExpr<Predicate>::value && fire::IsExpr<Value>::value,
+                  "aggregateWhere takes a predicate and a value built from fire:: columns");
+    StopScope stop(options.stop);
+    uint64_t start = steadyNowNs();
+    FireAggregate aggregate;
+    withRows([&](const auto& rows) {
+        parallelScan<FireAggregate>(rows.size(), defaultChunkSize(rows.size()), strategy,
+            [&](FireAggregate& local, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    if (predicate(rows[i])) local.add(static_cast<double>(value(rows[i])));
+                }
+            },
+            [&](FireAggregate& local) { aggregate.merge(local); });
+    });
+    std::string text;
+    if (wantsQueryText(options)) text = "aggregateWhere " + predicate.toString() + " value " + value.toString();
+    finishWhere(WhereOutput::AGGREGATE, text, strategy, steadyNowNs() - start, aggregate.count, nullptr,
+                options);
+    return aggregate;
+}
+
+template<typename Predicate>
+std::vector<FireRecord> FireData::selectWhere(const Predicate& predicate, ParallelStrategy strategy,
+                                              const QueryOptions& options) const {
+    static_assert(fire::IsExpr<Predicate>::value, "selectWhere takes a predicate built from fire:: columns");
+    StopScope stop(options.stop);
+    uint64_t start = steadyNowNs();
+    std::vector<FireRecord> results;
+    withRows([&](const auto& rows) {
+        parallelScan<std::vector<FireRecord>>(rows.size(), defaultChunkSize(rows.size()), strategy,
+            [&](std::vector<FireRecord>& local, size_t begin, size_t end) {
+                size_t before = local.size();
+                for (size_t i = begin; i < end; ++i) {
+                    if (predicate(rows[i])) local.push_back(rows[i]);
+                }
+                chargeRecords(options, local, before);
+            },
+            [&](std::vector<FireRecord>& local) {
+                results.insert(results.end(), std::make_move_iterator(local.begin()),
+                               std::make_move_iterator(local.end()));
+            });
+    });
+    std::string text = wantsQueryText(options) ? "selectWhere " + predicate.toString() : std::string();
+    finishWhere(WhereOutput::SELECT, text, strategy, steadyNowNs() - start, results.size(), &results, options);
+    return results;
+}
+
 #endif
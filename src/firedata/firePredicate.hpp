@@ -0,0 +1,263 @@
+// Custom predicates over the fire columns, as expression templates
+//
+//   using namespace fire;
+//   auto smoky = concentration > 35.0 && aqi > 100 && latitude.between(30.0, 45.0);
+//   size_t rows = fireData.countWhere(smoky);
+//   FireAggregate pm = fireData.aggregateWhere(smoky && pollutant == "PM2.5", concentration);
+//   std::vector<FireRecord> matches = fireData.selectWhere(smoky);
+//
+// every operator returns a new type holding its operands by value, so a whole predicate is one type
+// the compiler sees through: the FireData scans are templates over it, evaluation inlines into the
+// scan loop and no row pays for a virtual call or a function pointer. && and || evaluate both sides
+// and combine them with & and |, a predicate has no branches on the data. the same predicate runs
+// over loaded records and over an attached shared image (SharedFireRow).
+//
+// toString gives the text form used in profiles and the slow-query log,
+// e.g. "concentration > 35 && aqi > 100 && latitude in [30, 45]"
+#ifndef FIRE_PREDICATE_HPP
+#define FIRE_PREDICATE_HPP
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "common/queryText.hpp"
+
+namespace fire {
+
+// base of every expression, the operators below only apply to its subclasses
+template<typename Derived>
+struct Expr {};
+
+template<typename T>
+struct IsExpr : std::is_base_of<Expr<T>, T> {};
+
+// ============================================================================
+// columns
+// ============================================================================
+template<typename Get>
+struct Column : Expr<Column<Get>> {
+    template<typename Row>
+    auto operator()(const Row& row) const { return Get::get(row); }
+    std::string toString() const { return Get::name; }
+
+    // low <= column <= high
+    auto between(double low, double high) const;
+};
+
+#define FIRE_PREDICATE_COLUMN(column, Getter, type, getter)                          \
+    struct Getter {                                                                  \
+        static constexpr const char* name = #column;                                 \
+        template<typename Row>                                                       \
+        static type get(const Row& row) { return type(row.getter()); }               \
+    };                                                                               \
+    static const Column<Getter> column{};
+
+FIRE_PREDICATE_COLUMN(latitude, LatitudeColumn, double, getLatitude)
+FIRE_PREDICATE_COLUMN(longitude, LongitudeColumn, double, getLongitude)
+FIRE_PREDICATE_COLUMN(concentration, ConcentrationColumn, double, getConcentration)
+FIRE_PREDICATE_COLUMN(rawConcentration, RawConcentrationColumn, double, getRawConcentration)
+FIRE_PREDICATE_COLUMN(aqi, AqiColumn, int, getAqi)
+FIRE_PREDICATE_COLUMN(category, CategoryColumn, int, getCategory)
+FIRE_PREDICATE_COLUMN(utc, UtcColumn, std::string_view, getUTC)
+FIRE_PREDICATE_COLUMN(pollutant, PollutantColumn, std::string_view, getPollutantType)
+FIRE_PREDICATE_COLUMN(unit, UnitColumn, std::string_view, getUnit)
+FIRE_PREDICATE_COLUMN(site, SiteColumn, std::string_view, getSiteName)
+FIRE_PREDICATE_COLUMN(agency, AgencyColumn, std::string_view, getAgencyName)
+FIRE_PREDICATE_COLUMN(aqsId, AqsIdColumn, std::string_view, getAqsId)
+FIRE_PREDICATE_COLUMN(fullAqsId, FullAqsIdColumn, std::string_view, getFullAqsId)
+
+#undef FIRE_PREDICATE_COLUMN
+
+// ============================================================================
+// constants: the plain values on one side of an operator
+// ============================================================================
+template<typename T>
+struct Constant : Expr<Constant<T>> {
+    T value;
+    explicit Constant(T v) : value(std::move(v)) {}
+
+    template<typename Row>
+    const T& operator()(const Row&) const { return value; }
+    std::string toString() const { return formatQueryNumber(static_cast<double>(value)); }
+};
+
+template<>
+inline std::string Constant<std::string>::toString() const {
+    return "\"" + value + "\"";
+}
+
+// string literals are kept as std::string, everything else as its own type
+template<typename T>
+struct ConstantOf {
+    typedef std::decay_t<T> type;
+};
+template<>
+struct ConstantOf<const char*> {
+    typedef std::string type;
+};
+template<>
+struct ConstantOf<char*> {
+    typedef std::string type;
+};
+template<size_t N>
+struct ConstantOf<char[N]> {
+    typedef std::string type;
+};
+template<size_t N>
+struct ConstantOf<const char[N]> {
+    typedef std::string type;
+};
+
+template<typename T>
+using ExprOf = std::conditional_t<IsExpr<std::decay_t<T>>::value, std::decay_t<T>,
+                                  Constant<typename ConstantOf<std::remove_reference_t<T>>::type>>;
+
+template<typename T>
+ExprOf<const T&> toExpr(const T& value) {
+    return ExprOf<const T&>(value);
+}
+
+// ============================================================================
+// operators
+// ============================================================================
+// grouped operators put their text in parentheses, so "(a || b) && c" reads back the way it runs
+#define FIRE_PREDICATE_OPERATOR(Name, symbolText, isGrouped, expression)              \
+    struct Name {                                                                    \
+        static constexpr const char* symbol = symbolText;                            \
+        static constexpr bool grouped = isGrouped;                                   \
+        template<typename A, typename B>                                             \
+        static auto apply(const A& a, const B& b) { return expression; }             \
+    };
+
+FIRE_PREDICATE_OPERATOR(Less, "<", false, a < b)
+FIRE_PREDICATE_OPERATOR(LessEqual, "<=", false, a <= b)
+FIRE_PREDICATE_OPERATOR(Greater, ">", false, a > b)
+FIRE_PREDICATE_OPERATOR(GreaterEqual, ">=", false, a >= b)
+FIRE_PREDICATE_OPERATOR(Equal, "==", false, a == b)
+FIRE_PREDICATE_OPERATOR(NotEqual, "!=", false, a != b)
+// both sides always run, & and | instead of a jump on the first one
+FIRE_PREDICATE_OPERATOR(And, "&&", false, static_cast<bool>(static_cast<bool>(a) & static_cast<bool>(b)))
+FIRE_PREDICATE_OPERATOR(Or, "||", true, static_cast<bool>(static_cast<bool>(a) | static_cast<bool>(b)))
+FIRE_PREDICATE_OPERATOR(Plus, "+", true, a + b)
+FIRE_PREDICATE_OPERATOR(Minus, "-", true, a - b)
+FIRE_PREDICATE_OPERATOR(Times, "*", true, a * b)
+FIRE_PREDICATE_OPERATOR(Divide, "/", true, a / b)
+
+#undef FIRE_PREDICATE_OPERATOR
+
+template<typename Op, typename L, typename R>
+struct Binary : Expr<Binary<Op, L, R>> {
+    L left;
+    R right;
+    Binary(L l, R r) : left(std::move(l)), right(std::move(r)) {}
+
+    template<typename Row>
+    auto operator()(const Row& row) const { return Op::apply(left(row), right(row)); }
+
+    std::string toString() const {
+        std::string text = left.toString() + " " + Op::symbol + " " + right.toString();
+        return Op::grouped ? "(" + text + ")" : text;
+    }
+};
+
+template<typename E>
+struct Not : Expr<Not<E>> {
+    E operand;
+    explicit Not(E e) : operand(std::move(e)) {}
+
+    template<typename Row>
+    bool operator()(const Row& row) const { return !static_cast<bool>(operand(row)); }
+    std::string toString() const { return "!(" + operand.toString() + ")"; }
+};
+
+template<typename E>
+struct Between : Expr<Between<E>> {
+    E operand;
+    double low, high;
+    Between(E e, double lowValue, double highValue) : operand(std::move(e)), low(lowValue), high(highValue) {}
+
+    template<typename Row>
+    bool operator()(const Row& row) const {
+        auto value = operand(row);
+        return (value >= low) & (value <= high);
+    }
+    std::string toString() const {
+        return operand.toString() + " in [" + formatQueryNumber(low) + ", " + formatQueryNumber(high) + "]";
+    }
+};
+
+template<typename Get>
+auto Column<Get>::between(double low, double high) const {
+    return Between<Column<Get>>(*this, low, high);
+}
+
+// at least one side has to be an expression, 1 < 2 stays a plain comparison
+template<typename L, typename R>
+using EnableIfExpr = std::enable_if_t<IsExpr<std::decay_t<L>>::value || IsExpr<std::decay_t<R>>::value, int>;
+
+template<typename Op, typename L, typename R>
+Binary<Op, ExprOf<const L&>, ExprOf<const R&>> makeBinary(const L& left, const R& right) {
+    return Binary<Op, ExprOf<const L&>, ExprOf<const R&>>(toExpr(left), toExpr(right));
+}
+
+#define FIRE_PREDICATE_BINARY(op, Name)                                              \
+    template<typename L, typename R, EnableIfExpr<L, R> = 0>                          \
+    auto operator op(const L& left, const R& right) { return makeBinary<Name>(left, right); }
+
+FIRE_PREDICATE_BINARY(<, Less)
+FIRE_PREDICATE_BINARY(<=, LessEqual)
+FIRE_PREDICATE_BINARY(>, Greater)
+FIRE_PREDICATE_BINARY(>=, GreaterEqual)
+FIRE_PREDICATE_BINARY(==, Equal)
+FIRE_PREDICATE_BINARY(!=, NotEqual)
+FIRE_PREDICATE_BINARY(&&, And)
+FIRE_PREDICATE_BINARY(||, Or)
+FIRE_PREDICATE_BINARY(+, Plus)
+FIRE_PREDICATE_BINARY(-, Minus)
+FIRE_PREDICATE_BINARY(*, Times)
+FIRE_PREDICATE_BINARY(/, Divide)
+
+#undef FIRE_PREDICATE_BINARY
+
+template<typename E, std::enable_if_t<IsExpr<E>::value, int> = 0>
+Not<E> operator!(const E& operand) {
+    return Not<E>(operand);
+}
+
+// matches every row, for aggregates over the whole dataset
+struct All : Expr<All> {
+    template<typename Row>
+    bool operator()(const Row&) const { return true; }
+    std::string toString() const { return "true"; }
+};
+static const All all{};
+
+}  // namespace fire
+
+// result of FireData::aggregateWhere: count, sum, min and max of one expression over the matching rows
+struct FireAggregate {
+    size_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    double average() const { return count > 0 ? sum / count : 0.0; }
+
+    void add(double value) {
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    void merge(const FireAggregate& other) {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+#endif
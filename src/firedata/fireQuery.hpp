@@ -0,0 +1,386 @@
+// Description of one FireData query (type, parameters and strategy)
+// used by explain() / execute() and wherever a query has to be logged, shown or read back as text
+#ifndef FIRE_QUERY_HPP
+#define FIRE_QUERY_HPP
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include "firedata/fireRecord.hpp"
+#include "firedata/fireColumns.hpp"
+#include "common/parallelStrategy.hpp"
+#include "common/matchLimit.hpp"
+#include "common/queryText.hpp"
+
+enum class FireQueryType {
+    POLLUTANT,              // index lookup on pollutant type
+    VALUE_RANGE,
+    GEOGRAPHIC_BOUNDS,
+    AQI_CATEGORY,
+    SITE_NAME,
+    AVERAGE_CONCENTRATION,  // aggregate over one pollutant
+    COUNT_BY_CATEGORY,      // aggregate over all records
+    TOP_CONCENTRATION       // k highest readings, optionally of one pollutant
+};
+
+inline const char* fireQueryTypeName(FireQueryType type) {
+    switch (type) {
+        case FireQueryType::POLLUTANT: return "pollutant";
+        case FireQueryType::VALUE_RANGE: return "valueRange";
+        case FireQueryType::GEOGRAPHIC_BOUNDS: return "geographicBounds";
+        case FireQueryType::AQI_CATEGORY: return "aqiCategory";
+        case FireQueryType::SITE_NAME: return "siteName";
+        case FireQueryType::AVERAGE_CONCENTRATION: return "averageConcentration";
+        case FireQueryType::COUNT_BY_CATEGORY: return "countByCategory";
+        case FireQueryType::TOP_CONCENTRATION: return "topConcentration";
+        default: return "unknown";
+    }
+}
+
+struct FireQuery {
+    FireQueryType type = FireQueryType::VALUE_RANGE;
+    ParallelStrategy strategy = ParallelStrategy::OPENMP;
+    std::string text;            // pollutant type or site name, empty for topConcentration over all pollutants
+    double minValue = 0.0, maxValue = 0.0;
+    double minLat = 0.0, maxLat = 0.0, minLon = 0.0, maxLon = 0.0;
+    int category = 0;
+    size_t k = 0;                // topConcentration
+    uint32_t orderBy = 0;        // one FireColumn to sort the records by, 0 keeps their order
+    bool descending = false;
+    size_t limit = 0;            // filter queries: at most this many records, 0 for all of them
+    LimitMode limitMode = LimitMode::ANY;
+
+    // ========================================================================
+    // one factory per query method, same parameters in the same order
+    // ========================================================================
+    static FireQuery pollutant(const std::string& pollutantType) {
+        FireQuery q;
+        q.type = FireQueryType::POLLUTANT;
+        q.text = pollutantType;
+        return q;
+    }
+
+    static FireQuery valueRange(double minValue, double maxValue,
+                                ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::VALUE_RANGE;
+        q.minValue = minValue;
+        q.maxValue = maxValue;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery geographicBounds(double minLat, double maxLat, double minLon, double maxLon,
+                                      ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::GEOGRAPHIC_BOUNDS;
+        q.minLat = minLat;
+        q.maxLat = maxLat;
+        q.minLon = minLon;
+        q.maxLon = maxLon;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery aqiCategory(int category, ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::AQI_CATEGORY;
+        q.category = category;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery siteName(const std::string& siteName,
+                              ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::SITE_NAME;
+        q.text = siteName;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery averageConcentration(const std::string& pollutantType,
+                                          ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::AVERAGE_CONCENTRATION;
+        q.text = pollutantType;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery countByCategory(ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::COUNT_BY_CATEGORY;
+        q.strategy = strategy;
+        return q;
+    }
+
+    static FireQuery topConcentration(size_t k, const std::string& pollutantType = "",
+                                      ParallelStrategy strategy = ParallelStrategy::OPENMP) {
+        FireQuery q;
+        q.type = FireQueryType::TOP_CONCENTRATION;
+        q.k = k;
+        q.text = pollutantType;
+        q.strategy = strategy;
+        return q;
+    }
+
+    // the same query with its records sorted by column, e.g. valueRange(5, 15).orderedBy(FIRE_UTC)
+    FireQuery orderedBy(FireColumn column, bool descendingOrder = false) const {
+        FireQuery q = *this;
+        q.orderBy = column;
+        q.descending = descendingOrder;
+        return q;
+    }
+
+    // the same filter query cut to rows matches, e.g. valueRange(500, 1e9).limitedTo(20). the scan stops
+    // once they are found: ANY takes whichever rows matches turn up first, PREFIX the first ones in
+    // load order. with an orderBy every match is sorted and the first rows of the order are kept
+    FireQuery limitedTo(size_t rows, LimitMode mode = LimitMode::ANY) const {
+        FireQuery q = *this;
+        q.limit = rows;
+        q.limitMode = mode;
+        return q;
+    }
+
+    // filter queries (the ones FireData::stream takes too) can be limited
+    bool limitable() const {
+        return type == FireQueryType::POLLUTANT || type == FireQueryType::VALUE_RANGE ||
+               type == FireQueryType::GEOGRAPHIC_BOUNDS || type == FireQueryType::AQI_CATEGORY ||
+               type == FireQueryType::SITE_NAME;
+    }
+
+    // text form: the type followed by key=value pairs, e.g. "valueRange min=5 max=15 strategy=openmp"
+    std::string toString() const {
+        std::string out = fireQueryTypeName(type);
+        switch (type) {
+            case FireQueryType::POLLUTANT:
+            case FireQueryType::AVERAGE_CONCENTRATION:
+                out += " pollutant=" + escapeQueryValue(text);
+                break;
+            case FireQueryType::VALUE_RANGE:
+                out += " min=" + formatQueryNumber(minValue) + " max=" + formatQueryNumber(maxValue);
+                break;
+            case FireQueryType::GEOGRAPHIC_BOUNDS:
+                out += " minLat=" + formatQueryNumber(minLat) + " maxLat=" + formatQueryNumber(maxLat) +
+                       " minLon=" + formatQueryNumber(minLon) + " maxLon=" + formatQueryNumber(maxLon);
+                break;
+            case FireQueryType::AQI_CATEGORY:
+                out += " category=" + std::to_string(category);
+                break;
+            case FireQueryType::SITE_NAME:
+                out += " site=" + escapeQueryValue(text);
+                break;
+            case FireQueryType::COUNT_BY_CATEGORY:
+                break;
+            case FireQueryType::TOP_CONCENTRATION:
+                out += " k=" + std::to_string(k);
+                if (!text.empty()) out += " pollutant=" + escapeQueryValue(text);
+                break;
+        }
+        if (orderBy != 0) {
+            out += " orderBy=" + fireColumnsToString(orderBy);
+            if (descending) out += " order=desc";
+        }
+        if (limit != 0) {
+            out += " limit=" + std::to_string(limit);
+            if (limitMode == LimitMode::PREFIX) out += " limitMode=prefix";
+        }
+        // the pollutant lookup goes through the index, the strategy doesn't apply
+        if (type != FireQueryType::POLLUTANT) {
+            out += std::string(" strategy=") + strategyLabel(strategy);
+        }
+        return out;
+    }
+
+    // reads the text form back, throws std::runtime_error on unknown types or missing parameters
+    static FireQuery parse(const std::string& line) {
+        QueryText parsed = QueryText::parse(line);
+        FireQuery query = parseType(parsed);
+        if (parsed.has("orderBy")) {
+            uint32_t column = parseFireColumns(parsed.text("orderBy"));
+            if (column == 0 || (column & (column - 1)) != 0) {
+                throw std::runtime_error("orderBy takes one column, got " + parsed.text("orderBy"));
+            }
+            query.orderBy = column;
+        }
+        if (parsed.has("order")) {
+            const std::string& order = parsed.text("order");
+            if (order != "asc" && order != "desc") {
+                throw std::runtime_error("order is asc or desc, got " + order);
+            }
+            query.descending = order == "desc";
+        }
+        if (parsed.has("limit")) {
+            int rows = parsed.integer("limit");
+            if (rows <= 0) throw std::runtime_error("limit must be positive");
+            if (!query.limitable()) {
+                throw std::runtime_error(std::string("limit only applies to filter queries, not ") + parsed.type);
+            }
+            query.limit = static_cast<size_t>(rows);
+        }
+        if (parsed.has("limitMode")) {
+            const std::string& mode = parsed.text("limitMode");
+            if (mode != "any" && mode != "prefix") {
+                throw std::runtime_error("limitMode is any or prefix, got " + mode);
+            }
+            query.limitMode = mode == "prefix" ? LimitMode::PREFIX : LimitMode::ANY;
+        }
+        return query;
+    }
+
+    // the type and its parameters, parse() adds the ordering and the limit
+    static FireQuery parseType(const QueryText& parsed) {
+        const std::string& type = parsed.type;
+        ParallelStrategy strategy = parsed.strategy();
+
+        if (type == "pollutant") return pollutant(parsed.text("pollutant"));
+        if (type == "valueRange") return valueRange(parsed.number("min"), parsed.number("max"), strategy);
+        if (type == "geographicBounds") {
+            return geographicBounds(parsed.number("minLat"), parsed.number("maxLat"),
+                                    parsed.number("minLon"), parsed.number("maxLon"), strategy);
+        }
+        if (type == "aqiCategory") return aqiCategory(parsed.integer("category"), strategy);
+        if (type == "siteName") return siteName(parsed.text("site"), strategy);
+        if (type == "averageConcentration") return averageConcentration(parsed.text("pollutant"), strategy);
+        if (type == "countByCategory") return countByCategory(strategy);
+        if (type == "topConcentration") {
+            int k = parsed.integer("k");
+            if (k < 0) throw std::runtime_error("k must not be negative");
+            return topConcentration(static_cast<size_t>(k), parsed.has("pollutant") ? parsed.text("pollutant") : "",
+                                    strategy);
+        }
+        throw std::runtime_error("Unknown fire query type: " + type);
+    }
+};
+
+// orderBy comparison of two records on one FireColumn (numbers by value, strings bytewise)
+inline bool lessOnColumn(const FireRecord& a, const FireRecord& b, uint32_t column) {
+    switch (column) {
+        case FIRE_LATITUDE: return a.getLatitude() < b.getLatitude();
+        case FIRE_LONGITUDE: return a.getLongitude() < b.getLongitude();
+        case FIRE_UTC: return a.getUTC() < b.getUTC();
+        case FIRE_POLLUTANT: return a.getPollutantType() < b.getPollutantType();
+        case FIRE_CONCENTRATION: return a.getConcentration() < b.getConcentration();
+        case FIRE_UNIT: return a.getUnit() < b.getUnit();
+        case FIRE_RAW_CONCENTRATION: return a.getRawConcentration() < b.getRawConcentration();
+        case FIRE_AQI: return a.getAqi() < b.getAqi();
+        case FIRE_CATEGORY: return a.getCategory() < b.getCategory();
+        case FIRE_SITE: return a.getSiteName() < b.getSiteName();
+        case FIRE_AGENCY: return a.getAgencyName() < b.getAgencyName();
+        case FIRE_AQS_ID: return a.getAqsId() < b.getAqsId();
+        case FIRE_FULL_AQS_ID: return a.getFullAqsId() < b.getFullAqsId();
+        default: return false;
+    }
+}
+
+// true when a comes before b in the query's orderBy order
+inline bool orderedBefore(const FireQuery& query, const FireRecord& a, const FireRecord& b) {
+    return query.descending ? lessOnColumn(b, a, query.orderBy) : lessOnColumn(a, b, query.orderBy);
+}
+
+// order of topConcentration results: highest concentration first, ties broken on time, site, pollutant
+// and location so any split of the data (workers, shards) picks the same k records
+// works for FireRecord and SharedFireRow alike
+template<typename A, typename B>
+inline bool higherConcentration(const A& a, const B& b) {
+    if (a.getConcentration() != b.getConcentration()) return a.getConcentration() > b.getConcentration();
+    return std::make_tuple(std::string_view(a.getUTC()), std::string_view(a.getSiteName()),
+                           std::string_view(a.getPollutantType()), a.getLatitude(), a.getLongitude()) <
+           std::make_tuple(std::string_view(b.getUTC()), std::string_view(b.getSiteName()),
+                           std::string_view(b.getPollutantType()), b.getLatitude(), b.getLongitude());
+}
+
+// partial state of averageConcentration: unlike the average itself it can be merged across workers
+// or shards, the average is only taken at the very end
+struct AverageState {
+    double sum = 0.0;
+    size_t count = 0;
+
+    void merge(const AverageState& other) {
+        sum += other.sum;
+        count += other.count;
+    }
+    double value() const { return count > 0 ? sum / count : 0.0; }
+};
+
+// what FireData::execute() returns, only the part matching the query type is filled
+struct FireQueryResult {
+    std::vector<FireRecord> records;        // filter queries, the pollutant lookup and topConcentration
+    double average = 0.0;                   // averageConcentration
+    AverageState averageState;              // averageConcentration, before dividing
+    std::map<int, size_t> categoryCounts;   // countByCategory
+
+    // folds in the result of the same query over another part of the data (a shard): filter results
+    // are concatenated (merged when the query has an orderBy, both sides have to be sorted by it) and cut
+    // to the query's limit, top-k lists merged and cut to k, counts and average states added up
+    void merge(const FireQuery& query, FireQueryResult&& partial) {
+        switch (query.type) {
+            case FireQueryType::AVERAGE_CONCENTRATION:
+                averageState.merge(partial.averageState);
+                average = averageState.value();
+                break;
+            case FireQueryType::COUNT_BY_CATEGORY:
+                for (const auto& pair : partial.categoryCounts) categoryCounts[pair.first] += pair.second;
+                break;
+            case FireQueryType::TOP_CONCENTRATION: {
+                if (query.orderBy != 0) {
+                    // the lists come sorted by orderBy: pick the k highest again, then restore the order
+                    records.insert(records.end(), std::make_move_iterator(partial.records.begin()),
+                                   std::make_move_iterator(partial.records.end()));
+                    std::sort(records.begin(), records.end(), higherConcentration<FireRecord, FireRecord>);
+                    if (records.size() > query.k) records.resize(query.k);
+                    std::stable_sort(records.begin(), records.end(),
+                                     [&](const FireRecord& a, const FireRecord& b) {
+                                         return orderedBefore(query, a, b);
+                                     });
+                    break;
+                }
+                // both lists are already sorted, a linear merge is enough
+                std::vector<FireRecord> merged;
+                merged.reserve(records.size() + partial.records.size());
+                std::merge(std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()),
+                           std::make_move_iterator(partial.records.begin()),
+                           std::make_move_iterator(partial.records.end()),
+                           std::back_inserter(merged), higherConcentration<FireRecord, FireRecord>);
+                if (merged.size() > query.k) merged.resize(query.k);
+                records.swap(merged);
+                break;
+            }
+            default:
+                if (records.empty()) {
+                    records.swap(partial.records);
+                } else if (query.orderBy != 0) {
+                    // both sides sorted already, ties keep this side (the earlier shard) first
+                    std::vector<FireRecord> merged;
+                    merged.reserve(records.size() + partial.records.size());
+                    auto before = [&](const FireRecord& a, const FireRecord& b) {
+                        return orderedBefore(query, a, b);
+                    };
+                    std::merge(std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()),
+                               std::make_move_iterator(partial.records.begin()),
+                               std::make_move_iterator(partial.records.end()), std::back_inserter(merged), before);
+                    records.swap(merged);
+                } else {
+                    records.insert(records.end(), std::make_move_iterator(partial.records.begin()),
+                                   std::make_move_iterator(partial.records.end()));
+                }
+                // a limited query keeps its first limit records, in PREFIX mode the earlier shard's go first
+                if (query.limit != 0 && records.size() > query.limit) records.resize(query.limit);
+                break;
+        }
+    }
+
+    // result size as the slow-query log and metrics count it
+    size_t rows(FireQueryType type) const {
+        if (type == FireQueryType::AVERAGE_CONCENTRATION) return 1;
+        if (type == FireQueryType::COUNT_BY_CATEGORY) return categoryCounts.size();
+        return records.size();
+    }
+};
+
+#endif
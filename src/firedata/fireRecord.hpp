@@ -77,6 +77,18 @@ public:
     {
         return siteName;
     }
+    const std::string &getAgencyName() const
+    {
+        return agencyName;
+    }
+    const std::string &getAqsId() const
+    {
+        return aqsId;
+    }
+    const std::string &getFullAqsId() const
+    {
+        return fullAqsId;
+    }
 
     // Setter methods - modify the object's state
     void setLatitude(double lat)
@@ -0,0 +1,1017 @@
+// parser, planner and executor of the fire query language (see fireSql.hpp)
+
+#include "firedata/fireSql.hpp"
+#include "common/metrics.hpp"
+#include "common/parallelSort.hpp"
+#include "common/selectionVector.hpp"
+#include "common/trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+// ============================================================================
+// values and text forms
+// ============================================================================
+// integers as integers, everything else with up to 10 significant digits (153.33, 124.4823457)
+static std::string formatSqlNumber(double value) {
+    char out[32];
+    if (value == std::floor(value) && std::fabs(value) < 1e15) {
+        snprintf(out, sizeof(out), "%.0f", value);
+    } else {
+        snprintf(out, sizeof(out), "%.10g", value);
+    }
+    return out;
+}
+
+// a literal as it is written in a statement
+static std::string literalText(const FireSqlValue& value) {
+    if (!value.isText) return formatSqlNumber(value.number);
+    std::string out = "'";
+    for (char c : value.text) {
+        out += c;
+        if (c == '\'') out += '\'';
+    }
+    return out + "'";
+}
+
+bool FireSqlValue::operator<(const FireSqlValue& other) const {
+    if (isNull != other.isNull) return isNull;
+    if (isNull) return false;
+    if (isText != other.isText) return !isText;
+    return isText ? text < other.text : number < other.number;
+}
+
+std::string FireSqlValue::toString() const {
+    if (isNull) return "null";
+    return isText ? text : formatSqlNumber(number);
+}
+
+static const char* opSymbol(FireSqlOp op) {
+    switch (op) {
+        case FireSqlOp::EQUAL: return "=";
+        case FireSqlOp::NOT_EQUAL: return "!=";
+        case FireSqlOp::LESS: return "<";
+        case FireSqlOp::LESS_EQUAL: return "<=";
+        case FireSqlOp::GREATER: return ">";
+        case FireSqlOp::GREATER_EQUAL: return ">=";
+        default: return "?";
+    }
+}
+
+uint32_t FireSqlCondition::columns() const {
+    uint32_t used = column;
+    for (const FireSqlCondition& child : children) used |= child.columns();
+    return used;
+}
+
+std::string FireSqlCondition::toString() const {
+    switch (kind) {
+        case Kind::AND:
+        case Kind::OR: {
+            std::string out;
+            for (const FireSqlCondition& child : children) {
+                if (!out.empty()) out += kind == Kind::AND ? " AND " : " OR ";
+                out += child.toString();
+            }
+            return kind == Kind::OR ? "(" + out + ")" : out;
+        }
+        case Kind::NOT:
+            return "NOT (" + children[0].toString() + ")";
+        case Kind::COMPARE:
+            return fireColumnsToString(column) + " " + opSymbol(op) + " " + literalText(values[0]);
+        case Kind::BETWEEN:
+            return fireColumnsToString(column) + " BETWEEN " + literalText(values[0]) + " AND " +
+                   literalText(values[1]);
+        case Kind::IN: {
+            std::string out = fireColumnsToString(column) + " IN (";
+            for (size_t i = 0; i < values.size(); ++i) out += (i > 0 ? ", " : "") + literalText(values[i]);
+            return out + ")";
+        }
+        default:
+            return "?";
+    }
+}
+
+std::string FireSqlItem::toString() const {
+    const char* name = "";
+    switch (function) {
+        case Function::NONE: return fireColumnsToString(column);
+        case Function::COUNT: name = "count"; break;
+        case Function::SUM: name = "sum"; break;
+        case Function::AVG: name = "avg"; break;
+        case Function::MIN: name = "min"; break;
+        case Function::MAX: name = "max"; break;
+    }
+    return std::string(name) + "(" + (column == 0 ? "*" : fireColumnsToString(column)) + ")";
+}
+
+bool FireSqlStatement::isAggregate() const {
+    if (!groupBy.empty()) return true;
+    for (const FireSqlItem& item : items) {
+        if (item.isAggregate()) return true;
+    }
+    return false;
+}
+
+static const uint32_t NUMERIC_COLUMNS = FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION |
+                                        FIRE_RAW_CONCENTRATION | FIRE_AQI | FIRE_CATEGORY;
+
+static bool isNumericColumn(uint32_t column) {
+    return (column & NUMERIC_COLUMNS) != 0;
+}
+
+static bool sameWord(const std::string& a, const char* b) {
+    size_t n = strlen(b);
+    if (a.size() != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// FireColumn of a column name (any case, time for utc), 0 when there is none
+static uint32_t columnNamed(const std::string& name) {
+    if (sameWord(name, "time")) return FIRE_UTC;
+    for (int column = 0; column < FIRE_COLUMN_COUNT; ++column) {
+        if (sameWord(name, FIRE_COLUMN_NAMES[column])) return 1u << column;
+    }
+    return 0;
+}
+
+// ============================================================================
+// tokenizer
+// ============================================================================
+struct SqlToken {
+    enum class Kind { WORD, NUMBER, STRING, SYMBOL, END };
+    Kind kind = Kind::END;
+    std::string text;
+    double number = 0.0;
+    size_t position = 0;   // 1-based column in the statement
+};
+
+static std::vector<SqlToken> tokenize(const std::string& text) {
+    std::vector<SqlToken> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++i;
+            continue;
+        }
+        SqlToken token;
+        token.position = i + 1;
+        if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t end = i;
+            while (end < text.size() && (std::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_')) {
+                ++end;
+            }
+            token.kind = SqlToken::Kind::WORD;
+            token.text = text.substr(i, end - i);
+            i = end;
+        } else if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < text.size() &&
+                                                                  std::isdigit(static_cast<unsigned char>(text[i + 1])))) {
+            char* end = nullptr;
+            token.kind = SqlToken::Kind::NUMBER;
+            token.number = std::strtod(text.c_str() + i, &end);
+            size_t length = static_cast<size_t>(end - (text.c_str() + i));
+            token.text = text.substr(i, length);
+            i += length;
+        } else if (c == '\'') {
+            token.kind = SqlToken::Kind::STRING;
+            ++i;
+            bool closed = false;
+            while (i < text.size()) {
+                if (text[i] == '\'') {
+                    if (i + 1 < text.size() && text[i + 1] == '\'') {
+                        token.text += '\'';
+                        i += 2;
+                        continue;
+                    }
+                    ++i;
+                    closed = true;
+                    break;
+                }
+                token.text += text[i++];
+            }
+            if (!closed) {
+                throw std::runtime_error("Syntax error at " + std::to_string(token.position) +
+                                         ": string is never closed");
+            }
+        } else {
+            static const char* const symbols[] = {"<=", ">=", "!=", "<>", "(", ")", ",", "*", "=", "<", ">",
+                                                  ";", "-"};
+            token.kind = SqlToken::Kind::SYMBOL;
+            for (const char* symbol : symbols) {
+                if (text.compare(i, strlen(symbol), symbol) == 0) {
+                    token.text = symbol;
+                    break;
+                }
+            }
+            if (token.text.empty()) {
+                throw std::runtime_error("Syntax error at " + std::to_string(token.position) +
+                                         ": unexpected '" + std::string(1, c) + "'");
+            }
+            i += token.text.size();
+        }
+        tokens.push_back(token);
+    }
+    SqlToken end;
+    end.position = text.size() + 1;
+    tokens.push_back(end);
+    return tokens;
+}
+
+// ============================================================================
+// parser: recursive descent over the grammar in fireSql.hpp
+// ============================================================================
+class FireSqlParser {
+private:
+    std::vector<SqlToken> tokens;
+    size_t at = 0;
+
+    const SqlToken& peek() const { return tokens[at]; }
+
+    [[noreturn]] void fail(const std::string& expected) const {
+        const SqlToken& token = peek();
+        std::string got = token.kind == SqlToken::Kind::END ? "the end" : "'" + token.text + "'";
+        throw std::runtime_error("Syntax error at " + std::to_string(token.position) + ": expected " + expected +
+                                 ", got " + got);
+    }
+
+    bool isWord(const char* keyword) const {
+        return peek().kind == SqlToken::Kind::WORD && sameWord(peek().text, keyword);
+    }
+
+    bool acceptWord(const char* keyword) {
+        if (!isWord(keyword)) return false;
+        ++at;
+        return true;
+    }
+
+    void expectWord(const char* keyword) {
+        if (!acceptWord(keyword)) fail(keyword);
+    }
+
+    bool acceptSymbol(const char* symbol) {
+        if (peek().kind != SqlToken::Kind::SYMBOL || peek().text != symbol) return false;
+        ++at;
+        return true;
+    }
+
+    void expectSymbol(const char* symbol) {
+        if (!acceptSymbol(symbol)) fail(std::string("'") + symbol + "'");
+    }
+
+    uint32_t column() {
+        if (peek().kind != SqlToken::Kind::WORD) fail("a column");
+        uint32_t bit = columnNamed(peek().text);
+        if (bit == 0) {
+            throw std::runtime_error("Unknown column at " + std::to_string(peek().position) + ": " + peek().text);
+        }
+        ++at;
+        return bit;
+    }
+
+    FireSqlItem item() {
+        static const std::pair<const char*, FireSqlItem::Function> functions[] = {
+            {"count", FireSqlItem::Function::COUNT}, {"sum", FireSqlItem::Function::SUM},
+            {"avg", FireSqlItem::Function::AVG}, {"min", FireSqlItem::Function::MIN},
+            {"max", FireSqlItem::Function::MAX}};
+        FireSqlItem result;
+        if (peek().kind == SqlToken::Kind::WORD && tokens[at + 1].kind == SqlToken::Kind::SYMBOL &&
+            tokens[at + 1].text == "(") {
+            bool known = false;
+            for (const auto& function : functions) {
+                if (sameWord(peek().text, function.first)) {
+                    result.function = function.second;
+                    known = true;
+                }
+            }
+            if (!known) {
+                throw std::runtime_error("Unknown function at " + std::to_string(peek().position) + ": " +
+                                         peek().text);
+            }
+            at += 2;
+            if (result.function == FireSqlItem::Function::COUNT && acceptSymbol("*")) {
+                result.column = 0;
+            } else {
+                result.column = column();
+            }
+            expectSymbol(")");
+            return result;
+        }
+        result.column = column();
+        return result;
+    }
+
+    FireSqlValue literal() {
+        bool negative = acceptSymbol("-");
+        const SqlToken& token = peek();
+        if (token.kind == SqlToken::Kind::NUMBER) {
+            ++at;
+            return FireSqlValue::ofNumber(negative ? -token.number : token.number);
+        }
+        if (token.kind == SqlToken::Kind::STRING && !negative) {
+            ++at;
+            return FireSqlValue::ofText(token.text);
+        }
+        fail(negative ? "a number" : "a number or a 'string'");
+    }
+
+    static FireSqlCondition negated(FireSqlCondition condition) {
+        FireSqlCondition result;
+        result.kind = FireSqlCondition::Kind::NOT;
+        result.children.push_back(std::move(condition));
+        return result;
+    }
+
+    FireSqlCondition factor() {
+        if (acceptWord("NOT")) return negated(factor());
+        if (acceptSymbol("(")) {
+            FireSqlCondition inner = condition();
+            expectSymbol(")");
+            return inner;
+        }
+        FireSqlCondition leaf;
+        leaf.column = column();
+        bool negate = acceptWord("NOT");
+        if (acceptWord("BETWEEN")) {
+            leaf.kind = FireSqlCondition::Kind::BETWEEN;
+            leaf.values.push_back(literal());
+            expectWord("AND");
+            leaf.values.push_back(literal());
+        } else if (acceptWord("IN")) {
+            leaf.kind = FireSqlCondition::Kind::IN;
+            expectSymbol("(");
+            do {
+                leaf.values.push_back(literal());
+            } while (acceptSymbol(","));
+            expectSymbol(")");
+        } else if (negate) {
+            fail("BETWEEN or IN");
+        } else {
+            static const std::pair<const char*, FireSqlOp> ops[] = {
+                {"=", FireSqlOp::EQUAL}, {"!=", FireSqlOp::NOT_EQUAL}, {"<>", FireSqlOp::NOT_EQUAL},
+                {"<", FireSqlOp::LESS}, {"<=", FireSqlOp::LESS_EQUAL}, {">", FireSqlOp::GREATER},
+                {">=", FireSqlOp::GREATER_EQUAL}};
+            bool found = false;
+            for (const auto& op : ops) {
+                if (acceptSymbol(op.first)) {
+                    leaf.op = op.second;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) fail("a comparison, BETWEEN or IN");
+            leaf.kind = FireSqlCondition::Kind::COMPARE;
+            leaf.values.push_back(literal());
+        }
+        return negate ? negated(std::move(leaf)) : leaf;
+    }
+
+    // AND and OR chains become one node with every operand as a child
+    FireSqlCondition chain(FireSqlCondition::Kind kind, const char* keyword, FireSqlCondition first,
+                           FireSqlCondition (FireSqlParser::*next)()) {
+        if (!isWord(keyword)) return first;
+        FireSqlCondition result;
+        result.kind = kind;
+        result.children.push_back(std::move(first));
+        while (acceptWord(keyword)) result.children.push_back((this->*next)());
+        return result;
+    }
+
+    FireSqlCondition term() {
+        return chain(FireSqlCondition::Kind::AND, "AND", factor(), &FireSqlParser::factor);
+    }
+
+    FireSqlCondition condition() {
+        return chain(FireSqlCondition::Kind::OR, "OR", term(), &FireSqlParser::term);
+    }
+
+public:
+    explicit FireSqlParser(const std::string& text) : tokens(tokenize(text)) {}
+
+    FireSqlStatement statement() {
+        FireSqlStatement result;
+        result.explain = acceptWord("EXPLAIN");
+        expectWord("SELECT");
+        if (acceptSymbol("*")) {
+            for (int column = 0; column < FIRE_COLUMN_COUNT; ++column) {
+                FireSqlItem all;
+                all.column = 1u << column;
+                result.items.push_back(all);
+            }
+        } else {
+            do {
+                result.items.push_back(item());
+            } while (acceptSymbol(","));
+        }
+        expectWord("FROM");
+        if (peek().kind != SqlToken::Kind::WORD) fail("a table");
+        if (!sameWord(peek().text, "fire")) {
+            throw std::runtime_error("Unknown table: " + peek().text + ", the only table is fire");
+        }
+        ++at;
+        if (acceptWord("WHERE")) {
+            result.hasWhere = true;
+            result.where = condition();
+        }
+        if (acceptWord("GROUP")) {
+            expectWord("BY");
+            do {
+                result.groupBy.push_back(column());
+            } while (acceptSymbol(","));
+        }
+        if (acceptWord("ORDER")) {
+            expectWord("BY");
+            result.hasOrderBy = true;
+            result.orderBy = item();
+            if (acceptWord("DESC")) {
+                result.descending = true;
+            } else {
+                acceptWord("ASC");
+            }
+        }
+        if (acceptWord("LIMIT")) {
+            if (peek().kind != SqlToken::Kind::NUMBER || peek().number < 0 ||
+                peek().number != std::floor(peek().number)) {
+                fail("a row count");
+            }
+            result.limit = static_cast<size_t>(peek().number);
+            ++at;
+        }
+        acceptSymbol(";");
+        if (peek().kind != SqlToken::Kind::END) fail("the end of the statement");
+        return result;
+    }
+};
+
+FireSqlStatement FireSqlStatement::parse(const std::string& text) {
+    FireSqlStatement statement = FireSqlParser(text).statement();
+    size_t first = text.find_first_not_of(" \t\r\n");
+    size_t last = text.find_last_not_of(" \t\r\n");
+    statement.text = first == std::string::npos ? "" : text.substr(first, last - first + 1);
+    return statement;
+}
+
+// ============================================================================
+// planner
+// ============================================================================
+// numbers go with numeric columns, strings with the others
+static void checkTypes(const FireSqlCondition& condition) {
+    for (const FireSqlCondition& child : condition.children) checkTypes(child);
+    if (condition.column == 0) return;
+    for (const FireSqlValue& value : condition.values) {
+        if (value.isText == isNumericColumn(condition.column)) {
+            throw std::runtime_error("Can't compare " + fireColumnsToString(condition.column) + " with " +
+                                     literalText(value) + ", " + fireColumnsToString(condition.column) +
+                                     (value.isText ? " is a number" : " is text"));
+        }
+    }
+}
+
+// narrows [low, high] to the values passing "column op value", false for ops that aren't a range
+static bool narrowRange(FireSqlOp op, double value, double& low, double& high) {
+    const double infinity = std::numeric_limits<double>::infinity();
+    switch (op) {
+        case FireSqlOp::EQUAL: low = std::max(low, value); high = std::min(high, value); return true;
+        case FireSqlOp::LESS: high = std::min(high, std::nextafter(value, -infinity)); return true;
+        case FireSqlOp::LESS_EQUAL: high = std::min(high, value); return true;
+        case FireSqlOp::GREATER: low = std::max(low, std::nextafter(value, infinity)); return true;
+        case FireSqlOp::GREATER_EQUAL: low = std::max(low, value); return true;
+        default: return false;
+    }
+}
+
+FireSqlPlan FireSqlPlan::build(const FireSqlStatement& statement) {
+    FireSqlPlan plan;
+    plan.statement = statement;
+    const bool aggregated = statement.isAggregate();
+
+    for (const FireSqlItem& item : statement.items) {
+        if (item.isAggregate()) {
+            if (item.function != FireSqlItem::Function::COUNT && !isNumericColumn(item.column)) {
+                throw std::runtime_error(item.toString() + " needs a numeric column");
+            }
+            if (item.function != FireSqlItem::Function::COUNT) plan.columns |= item.column;
+        } else {
+            if (aggregated &&
+                std::find(statement.groupBy.begin(), statement.groupBy.end(), item.column) == statement.groupBy.end()) {
+                throw std::runtime_error(item.toString() + " has to be in GROUP BY or inside an aggregate");
+            }
+            plan.columns |= item.column;
+        }
+    }
+    for (uint32_t column : statement.groupBy) plan.columns |= column;
+    if (statement.hasOrderBy) {
+        if (aggregated) {
+            if (std::find(statement.items.begin(), statement.items.end(), statement.orderBy) ==
+                statement.items.end()) {
+                throw std::runtime_error("ORDER BY " + statement.orderBy.toString() +
+                                         " has to be one of the selected items");
+            }
+        } else {
+            if (statement.orderBy.isAggregate()) {
+                throw std::runtime_error("ORDER BY " + statement.orderBy.toString() + " needs a GROUP BY");
+            }
+            plan.columns |= statement.orderBy.column;
+        }
+    }
+    if (!statement.hasWhere) return plan;
+    checkTypes(statement.where);
+
+    // the top-level AND terms that a filter of project() can take, the rest is evaluated on the columns
+    std::vector<FireSqlCondition> terms;
+    if (statement.where.kind == FireSqlCondition::Kind::AND) {
+        terms = statement.where.children;
+    } else {
+        terms.push_back(statement.where);
+    }
+    const double infinity = std::numeric_limits<double>::infinity();
+    double minValue = -infinity, maxValue = infinity;
+    double minLat = -infinity, maxLat = infinity, minLon = -infinity, maxLon = infinity;
+    bool valueRange = false, bounds = false;
+    for (const FireSqlCondition& term : terms) {
+        bool lowered = false;
+        double* low = nullptr;
+        double* high = nullptr;
+        switch (term.column) {
+            case FIRE_CONCENTRATION: low = &minValue; high = &maxValue; break;
+            case FIRE_LATITUDE: low = &minLat; high = &maxLat; break;
+            case FIRE_LONGITUDE: low = &minLon; high = &maxLon; break;
+            default: break;
+        }
+        if (low && term.kind == FireSqlCondition::Kind::COMPARE) {
+            lowered = narrowRange(term.op, term.values[0].number, *low, *high);
+        } else if (low && term.kind == FireSqlCondition::Kind::BETWEEN) {
+            *low = std::max(*low, term.values[0].number);
+            *high = std::min(*high, term.values[1].number);
+            lowered = true;
+        } else if (term.kind == FireSqlCondition::Kind::COMPARE && term.op == FireSqlOp::EQUAL) {
+            const FireSqlValue& value = term.values[0];
+            if (term.column == FIRE_POLLUTANT) {
+                // first, so project() looks it up in the index
+                plan.filters.insert(plan.filters.begin(), FireQuery::pollutant(value.text));
+                lowered = true;
+            } else if (term.column == FIRE_SITE) {
+                plan.filters.push_back(FireQuery::siteName(value.text));
+                lowered = true;
+            } else if (term.column == FIRE_CATEGORY && value.number == std::floor(value.number)) {
+                plan.filters.push_back(FireQuery::aqiCategory(static_cast<int>(value.number)));
+                lowered = true;
+            }
+        }
+        if (lowered) {
+            valueRange |= term.column == FIRE_CONCENTRATION;
+            bounds |= term.column == FIRE_LATITUDE || term.column == FIRE_LONGITUDE;
+        } else {
+            plan.residual.push_back(term);
+            plan.columns |= term.columns();
+        }
+    }
+    if (valueRange) plan.filters.push_back(FireQuery::valueRange(minValue, maxValue));
+    if (bounds) plan.filters.push_back(FireQuery::geographicBounds(minLat, maxLat, minLon, maxLon));
+    return plan;
+}
+
+size_t FireSqlPlan::scanLimit() const {
+    const FireSqlStatement& s = statement;
+    if (s.limit == std::numeric_limits<size_t>::max() || s.isAggregate() || s.hasOrderBy || !residual.empty()) {
+        return 0;
+    }
+    // LIMIT 0 still has to come back empty, a scan limit of 0 means none
+    return std::max<size_t>(s.limit, 1);
+}
+
+std::string FireSqlPlan::toString() const {
+    const FireSqlStatement& s = statement;
+    std::string out;
+    auto line = [&](const char* step, const std::string& text) {
+        char label[16];
+        snprintf(label, sizeof(label), "%-11s", step);
+        out += std::string(label) + text + "\n";
+    };
+
+    bool lookup = !filters.empty() && filters[0].type == FireQueryType::POLLUTANT;
+    std::string access = lookup ? "index(pollutant) lookup of " + literalText(FireSqlValue::ofText(filters[0].text))
+                                : "scan of every row";
+    for (size_t i = lookup ? 1 : 0; i < filters.size(); ++i) {
+        // the scan runs with the statement's strategy, not the one in the filter's text
+        std::string text = filters[i].toString();
+        size_t strategyAt = text.find(" strategy=");
+        if (strategyAt != std::string::npos) text.erase(strategyAt);
+        access += " + " + text;
+    }
+    line("project:", access);
+    line("columns:", columns == 0 ? "none, rows are only counted" : fireColumnsToString(columns));
+    if (!residual.empty()) {
+        std::string text;
+        for (const FireSqlCondition& condition : residual) text += (text.empty() ? "" : " AND ") + condition.toString();
+        line("filter:", text + " (masks over the projected columns)");
+    }
+    if (s.isAggregate()) {
+        std::string groups;
+        for (uint32_t column : s.groupBy) groups += (groups.empty() ? "" : ",") + fireColumnsToString(column);
+        line("aggregate:", groups.empty() ? "one group" : "hash by " + groups + ", one table per worker");
+    }
+    if (s.hasOrderBy) {
+        std::string how;
+        if (s.isAggregate()) {
+            how = "sort of the groups";
+        } else {
+            how = isNumericColumn(s.orderBy.column) ? "parallel radix sort" : "parallel merge sort";
+        }
+        line("order:", s.orderBy.toString() + (s.descending ? " desc, " : " asc, ") + how);
+    } else if (!s.groupBy.empty()) {
+        line("order:", "by the group columns");
+    }
+    if (s.limit != std::numeric_limits<size_t>::max()) {
+        std::string early = scanLimit() != 0 ? ", the scan stops at the first matches" : "";
+        line("limit:", std::to_string(s.limit) + early);
+    }
+    return out;
+}
+
+// ============================================================================
+// executor
+// ============================================================================
+// one column of a FireColumns, whichever vector holds it
+struct SqlColumnRef {
+    const double* doubles = nullptr;
+    const int* ints = nullptr;
+    const StringColumn* text = nullptr;
+
+    double number(size_t row) const { return doubles ? doubles[row] : ints[row]; }
+
+    FireSqlValue value(size_t row) const {
+        if (text) return FireSqlValue::ofText(std::string((*text)[row]));
+        return FireSqlValue::ofNumber(number(row));
+    }
+
+    bool less(size_t a, size_t b) const {
+        if (text) return (*text)[a] < (*text)[b];
+        return number(a) < number(b);
+    }
+};
+
+static SqlColumnRef columnRef(const FireColumns& c, uint32_t column) {
+    SqlColumnRef ref;
+    switch (column) {
+        case FIRE_LATITUDE: ref.doubles = c.latitude.data(); break;
+        case FIRE_LONGITUDE: ref.doubles = c.longitude.data(); break;
+        case FIRE_CONCENTRATION: ref.doubles = c.concentration.data(); break;
+        case FIRE_RAW_CONCENTRATION: ref.doubles = c.rawConcentration.data(); break;
+        case FIRE_AQI: ref.ints = c.aqi.data(); break;
+        case FIRE_CATEGORY: ref.ints = c.category.data(); break;
+        case FIRE_UTC: ref.text = &c.utc; break;
+        case FIRE_POLLUTANT: ref.text = &c.pollutant; break;
+        case FIRE_UNIT: ref.text = &c.unit; break;
+        case FIRE_SITE: ref.text = &c.site; break;
+        case FIRE_AGENCY: ref.text = &c.agency; break;
+        case FIRE_AQS_ID: ref.text = &c.aqsId; break;
+        case FIRE_FULL_AQS_ID: ref.text = &c.fullAqsId; break;
+        default: throw std::runtime_error("no such column");
+    }
+    return ref;
+}
+
+// mask of a comparison, BETWEEN or IN over n values, get(i) reads the i-th one. literal turns a
+// FireSqlValue into what the values compare with (double or string_view)
+template<typename Get, typename Literal>
+static void maskLeaf(Get get, size_t n, const FireSqlCondition& condition, Literal literal, uint8_t* mask) {
+    switch (condition.kind) {
+        case FireSqlCondition::Kind::COMPARE: {
+            auto value = literal(condition.values[0]);
+            switch (condition.op) {
+                case FireSqlOp::EQUAL:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) == value;
+                    break;
+                case FireSqlOp::NOT_EQUAL:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) != value;
+                    break;
+                case FireSqlOp::LESS:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) < value;
+                    break;
+                case FireSqlOp::LESS_EQUAL:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) <= value;
+                    break;
+                case FireSqlOp::GREATER:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) > value;
+                    break;
+                case FireSqlOp::GREATER_EQUAL:
+                    SELECTION_SIMD
+                    for (size_t i = 0; i < n; ++i) mask[i] = get(i) >= value;
+                    break;
+            }
+            break;
+        }
+        case FireSqlCondition::Kind::BETWEEN: {
+            auto low = literal(condition.values[0]);
+            auto high = literal(condition.values[1]);
+            SELECTION_SIMD
+            for (size_t i = 0; i < n; ++i) mask[i] = (get(i) >= low) & (get(i) <= high);
+            break;
+        }
+        case FireSqlCondition::Kind::IN:
+            maskFill(mask, n, 0);
+            for (const FireSqlValue& each : condition.values) {
+                auto value = literal(each);
+                SELECTION_SIMD
+                for (size_t i = 0; i < n; ++i) mask[i] |= get(i) == value;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// mask of rows [start, start + n) of the projected columns passing condition
+static void maskCondition(const FireColumns& c, const FireSqlCondition& condition, size_t start, size_t n,
+                          uint8_t* mask) {
+    switch (condition.kind) {
+        case FireSqlCondition::Kind::AND:
+        case FireSqlCondition::Kind::OR: {
+            uint8_t other[SELECTION_BATCH_ROWS];
+            maskCondition(c, condition.children[0], start, n, mask);
+            for (size_t k = 1; k < condition.children.size(); ++k) {
+                maskCondition(c, condition.children[k], start, n, other);
+                if (condition.kind == FireSqlCondition::Kind::AND) {
+                    maskAnd(mask, other, n);
+                } else {
+                    maskOr(mask, other, n);
+                }
+            }
+            return;
+        }
+        case FireSqlCondition::Kind::NOT:
+            maskCondition(c, condition.children[0], start, n, mask);
+            maskNot(mask, n);
+            return;
+        default:
+            break;
+    }
+    SqlColumnRef ref = columnRef(c, condition.column);
+    auto number = [](const FireSqlValue& v) { return v.number; };
+    if (ref.doubles) {
+        const double* values = ref.doubles + start;
+        maskLeaf([values](size_t i) { return values[i]; }, n, condition, number, mask);
+    } else if (ref.ints) {
+        const int* values = ref.ints + start;
+        maskLeaf([values](size_t i) { return values[i]; }, n, condition, number, mask);
+    } else {
+        const StringColumn& values = *ref.text;
+        maskLeaf([&values, start](size_t i) { return values[start + i]; }, n, condition,
+                 [](const FireSqlValue& v) { return std::string_view(v.text); }, mask);
+    }
+}
+
+// chunks of whole batches, every chunk keeps its own ids so the result stays in row order
+static size_t batchChunkSize(size_t rows) {
+    return (defaultChunkSize(rows) + SELECTION_BATCH_ROWS - 1) / SELECTION_BATCH_ROWS * SELECTION_BATCH_ROWS;
+}
+
+// ids of the projected rows passing every residual condition
+static std::vector<uint32_t> filterRows(const FireColumns& c, const std::vector<FireSqlCondition>& residual,
+                                        ParallelStrategy strategy) {
+    std::vector<uint32_t> rows;
+    if (c.rows == 0) return rows;
+    const size_t chunkSize = batchChunkSize(c.rows);
+    std::vector<std::vector<uint32_t>> chunks((c.rows + chunkSize - 1) / chunkSize);
+    parallelScan<int>(c.rows, chunkSize, strategy,
+        [&](int&, size_t start, size_t end) {
+            std::vector<uint32_t>& out = chunks[start / chunkSize];
+            uint8_t mask[SELECTION_BATCH_ROWS], other[SELECTION_BATCH_ROWS];
+            uint32_t selection[SELECTION_BATCH_ROWS];
+            for (size_t batchStart = start; batchStart < end; batchStart += SELECTION_BATCH_ROWS) {
+                size_t n = std::min(SELECTION_BATCH_ROWS, end - batchStart);
+                maskCondition(c, residual[0], batchStart, n, mask);
+                for (size_t k = 1; k < residual.size(); ++k) {
+                    maskCondition(c, residual[k], batchStart, n, other);
+                    maskAnd(mask, other, n);
+                }
+                size_t selected = compactMask(mask, n, selection);
+                for (size_t t = 0; t < selected; ++t) out.push_back(static_cast<uint32_t>(batchStart + selection[t]));
+            }
+        },
+        [](int&) {});
+    for (const std::vector<uint32_t>& chunk : chunks) rows.insert(rows.end(), chunk.begin(), chunk.end());
+    return rows;
+}
+
+// groups of one worker, or all of them after the merge
+struct SqlGroupTable {
+    std::unordered_map<std::string, size_t> slots;   // group key -> slot
+    std::vector<uint32_t> firstRow;                  // a row of the group, for its group column values
+    std::vector<FireAggregate> aggregates;           // one per select item, slot after slot
+
+    size_t slot(const std::string& key, uint32_t row, size_t items) {
+        auto it = slots.find(key);
+        if (it != slots.end()) return it->second;
+        size_t index = firstRow.size();
+        slots.emplace(key, index);
+        firstRow.push_back(row);
+        aggregates.resize(aggregates.size() + items);
+        return index;
+    }
+};
+
+// group columns packed into a hash key: numbers as their bytes, strings with their length first
+static void appendKey(const SqlColumnRef& ref, uint32_t row, std::string& key) {
+    if (ref.text) {
+        std::string_view value = (*ref.text)[row];
+        uint32_t length = static_cast<uint32_t>(value.size());
+        key.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        key.append(value.data(), value.size());
+    } else {
+        double value = ref.number(row);
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+}
+
+static void aggregateRows(const FireSqlStatement& s, const FireColumns& c, const std::vector<uint32_t>& rows,
+                          ParallelStrategy strategy, FireSqlResult& result) {
+    const size_t items = s.items.size();
+    std::vector<SqlColumnRef> groupRefs, itemRefs(items);
+    for (uint32_t column : s.groupBy) groupRefs.push_back(columnRef(c, column));
+    for (size_t k = 0; k < items; ++k) {
+        if (s.items[k].column != 0) itemRefs[k] = columnRef(c, s.items[k].column);
+    }
+    const bool grouped = !groupRefs.empty();
+
+    SqlGroupTable groups;
+    parallelScan<SqlGroupTable>(rows.size(), defaultChunkSize(rows.size()), strategy,
+        [&](SqlGroupTable& local, size_t start, size_t end) {
+            std::string key;
+            for (size_t r = start; r < end; ++r) {
+                uint32_t row = rows[r];
+                size_t slot = 0;
+                if (grouped) {
+                    key.clear();
+                    for (const SqlColumnRef& ref : groupRefs) appendKey(ref, row, key);
+                    slot = local.slot(key, row, items);
+                } else if (local.firstRow.empty()) {
+                    local.slot(key, row, items);
+                }
+                FireAggregate* aggregates = &local.aggregates[slot * items];
+                for (size_t k = 0; k < items; ++k) {
+                    switch (s.items[k].function) {
+                        case FireSqlItem::Function::NONE: break;
+                        case FireSqlItem::Function::COUNT: aggregates[k].count++; break;
+                        default: aggregates[k].add(itemRefs[k].number(row)); break;
+                    }
+                }
+            }
+        },
+        [&](SqlGroupTable& local) {
+            for (const auto& entry : local.slots) {
+                size_t slot = groups.slot(entry.first, local.firstRow[entry.second], items);
+                groups.firstRow[slot] = std::min(groups.firstRow[slot], local.firstRow[entry.second]);
+                for (size_t k = 0; k < items; ++k) {
+                    groups.aggregates[slot * items + k].merge(local.aggregates[entry.second * items + k]);
+                }
+            }
+        });
+
+    // without GROUP BY there is one row even when nothing matched (count 0)
+    size_t groupCount = groups.firstRow.size();
+    if (!grouped && groupCount == 0) groups.aggregates.resize(items);
+    std::vector<size_t> order(grouped ? groupCount : 1);
+    for (size_t g = 0; g < order.size(); ++g) order[g] = g;
+    // the group columns' order, ORDER BY sorts stably on top of it
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        for (const SqlColumnRef& ref : groupRefs) {
+            uint32_t rowA = groups.firstRow[a], rowB = groups.firstRow[b];
+            if (ref.less(rowA, rowB)) return true;
+            if (ref.less(rowB, rowA)) return false;
+        }
+        return false;
+    });
+
+    result.aggregated = true;
+    result.values.reserve(order.size());
+    for (size_t g : order) {
+        std::vector<FireSqlValue> values;
+        for (size_t k = 0; k < items; ++k) {
+            const FireAggregate& aggregate = groups.aggregates[g * items + k];
+            switch (s.items[k].function) {
+                case FireSqlItem::Function::NONE: values.push_back(itemRefs[k].value(groups.firstRow[g])); break;
+                case FireSqlItem::Function::COUNT: values.push_back(FireSqlValue::ofNumber(aggregate.count)); break;
+                case FireSqlItem::Function::SUM: values.push_back(FireSqlValue::ofNumber(aggregate.sum)); break;
+                case FireSqlItem::Function::AVG:
+                    values.push_back(aggregate.count ? FireSqlValue::ofNumber(aggregate.average()) : FireSqlValue::null());
+                    break;
+                case FireSqlItem::Function::MIN:
+                    values.push_back(aggregate.count ? FireSqlValue::ofNumber(aggregate.min) : FireSqlValue::null());
+                    break;
+                case FireSqlItem::Function::MAX:
+                    values.push_back(aggregate.count ? FireSqlValue::ofNumber(aggregate.max) : FireSqlValue::null());
+                    break;
+            }
+        }
+        result.values.push_back(std::move(values));
+    }
+
+    if (s.hasOrderBy) {
+        size_t key = std::find(s.items.begin(), s.items.end(), s.orderBy) - s.items.begin();
+        std::stable_sort(result.values.begin(), result.values.end(),
+                         [&](const std::vector<FireSqlValue>& a, const std::vector<FireSqlValue>& b) {
+                             return s.descending ? b[key] < a[key] : a[key] < b[key];
+                         });
+    }
+    if (result.values.size() > s.limit) result.values.resize(s.limit);
+}
+
+static void selectRows(const FireSqlStatement& s, FireColumns&& c, std::vector<uint32_t>&& rows,
+                       ParallelStrategy strategy, FireSqlResult& result) {
+    if (s.hasOrderBy) {
+        SqlColumnRef ref = columnRef(c, s.orderBy.column);
+        if (ref.text) {
+            const StringColumn& values = *ref.text;
+            parallelMergeSort(rows, [&](uint32_t a, uint32_t b) {
+                return s.descending ? values[b] < values[a] : values[a] < values[b];
+            }, strategy);
+        } else {
+            // flipped keys sort descending and stay stable, like orderBy of the query methods
+            std::vector<uint64_t> keys(rows.size());
+            for (size_t i = 0; i < rows.size(); ++i) {
+                uint64_t key = ref.doubles ? radixKey(ref.doubles[rows[i]]) : radixKey(ref.ints[rows[i]]);
+                keys[i] = s.descending ? ~key : key;
+            }
+            parallelRadixSort(keys, rows, strategy);
+        }
+    }
+    if (rows.size() > s.limit) rows.resize(s.limit);
+    for (const FireSqlItem& item : s.items) result.itemColumns.push_back(item.column);
+    result.rowIds = std::move(rows);
+    result.data = std::move(c);
+}
+
+std::string FireSqlResult::cell(size_t row, size_t column) const {
+    if (aggregated) return values[row][column].toString();
+    SqlColumnRef ref = columnRef(data, itemColumns[column]);
+    uint32_t id = rowIds[row];
+    if (ref.text) return std::string((*ref.text)[id]);
+    return formatSqlNumber(ref.number(id));
+}
+
+FireSqlResult executeFireSql(const FireData& data, const std::string& text, ParallelStrategy strategy,
+                             const QueryOptions& options) {
+    return executeFireSql(data, FireSqlPlan::build(FireSqlStatement::parse(text)), strategy, options);
+}
+
+FireSqlResult executeFireSql(const FireData& data, const FireSqlPlan& plan, ParallelStrategy strategy,
+                             const QueryOptions& options) {
+    TraceSpan span("sql", "query");
+    static QueryMetrics metrics("fire", "sql");
+    const FireSqlStatement& s = plan.statement;
+    FireSqlResult result;
+    result.plan = plan.toString();
+    for (const FireSqlItem& item : s.items) result.header.push_back(item.toString());
+    result.explain = s.explain;
+    if (s.explain) return result;
+
+    StopScope stop(options.stop);
+    uint64_t start = steadyNowNs();
+    FireColumns columns = data.project(plan.filters, plan.columns, plan.scanLimit(), strategy, options);
+    std::vector<uint32_t> rows;
+    if (plan.residual.empty()) {
+        rows.resize(columns.rows);
+        for (size_t i = 0; i < rows.size(); ++i) rows[i] = static_cast<uint32_t>(i);
+    } else {
+        rows = filterRows(columns, plan.residual, strategy);
+    }
+    size_t rowsMatched = rows.size();
+    // the matching row ids on top of the projected columns
+    if (options.stop.memory) options.stop.memory->charge(rows.size() * sizeof(uint32_t));
+    if (s.isAggregate()) {
+        aggregateRows(s, columns, rows, strategy, result);
+    } else {
+        selectRows(s, std::move(columns), std::move(rows), strategy, result);
+    }
+
+    uint64_t elapsed = steadyNowNs() - start;
+    metrics.record(strategy, elapsed / 1e9, result.rows());
+    if (options.profile) {
+        QueryProfile& profile = *options.profile;
+        profile.query = s.text;
+        profile.totalNs = elapsed;
+        if (!plan.residual.empty()) profile.accessPath += " + filter";
+        if (s.isAggregate()) profile.accessPath += " + aggregate";
+        if (s.hasOrderBy) profile.accessPath += " + sort";
+        profile.rowsMatched = rowsMatched;
+        if (options.stop.memory) profile.peakBytes = options.stop.memory->peakBytes();
+    }
+    return result;
+}
@@ -0,0 +1,166 @@
+// A small SQL-like query language over the fire records, for ad-hoc questions without compiling C++
+//
+//   SELECT site, avg(concentration), count(*) FROM fire
+//   WHERE pollutant = 'PM2.5' AND time BETWEEN '2020-08-04T00:00' AND '2020-08-05T23:00'
+//   GROUP BY site ORDER BY avg(concentration) DESC LIMIT 10
+//
+// grammar (keywords in any case, strings in single quotes, '' for a quote inside one):
+//
+//   statement := [EXPLAIN] SELECT items FROM fire [WHERE condition] [GROUP BY column {, column}]
+//                [ORDER BY item [ASC | DESC]] [LIMIT n] [;]
+//   items     := * | item {, item}
+//   item      := column | count(*) | count(column) | sum(column) | avg(column) | min(column) | max(column)
+//   condition := term {OR term}
+//   term      := factor {AND factor}
+//   factor    := NOT factor | ( condition ) | column op literal
+//              | column [NOT] BETWEEN literal AND literal | column [NOT] IN (literal {, literal})
+//   op        := = | != | <> | < | <= | > | >=
+//
+// columns are the FireColumn names (latitude, longitude, utc, pollutant, concentration, unit,
+// rawConcentration, aqi, category, site, agency, aqsId, fullAqsId), time is another name for utc.
+// numbers compare with numbers, strings with strings (utc as text, its ISO form sorts by time).
+//
+// the planner lowers what it can onto the library: the top-level AND terms that match a FireQuery
+// filter (pollutant = goes through the index, concentration and latitude / longitude comparisons
+// become one valueRange and one geographicBounds, category = and site = their filters) run inside
+// FireData::project, which only copies out the columns the statement reads. the rest of the WHERE
+// clause runs over those columns in batches as SIMD masks, grouping is a hash aggregate per worker,
+// ORDER BY the parallel radix / merge sorts. a LIMIT on a plain select without ORDER BY or residual
+// filter goes into the projection, whose scan stops once it has found the first n rows. parse and plan
+// errors throw std::runtime_error
+#ifndef FIRE_SQL_HPP
+#define FIRE_SQL_HPP
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include "firedata/fireData.hpp"
+
+// a literal in a statement, or one cell of a result
+struct FireSqlValue {
+    bool isText = false;
+    bool isNull = false;    // aggregates over no rows
+    double number = 0.0;
+    std::string text;
+
+    static FireSqlValue ofNumber(double value) {
+        FireSqlValue v;
+        v.number = value;
+        return v;
+    }
+    static FireSqlValue ofText(std::string value) {
+        FireSqlValue v;
+        v.isText = true;
+        v.text = std::move(value);
+        return v;
+    }
+    static FireSqlValue null() {
+        FireSqlValue v;
+        v.isNull = true;
+        return v;
+    }
+
+    // nulls first, numbers by value, strings bytewise
+    bool operator<(const FireSqlValue& other) const;
+    // text of a result cell: strings as they are, integers without decimals, null
+    std::string toString() const;
+};
+
+enum class FireSqlOp { EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL };
+
+// one node of a WHERE clause
+struct FireSqlCondition {
+    enum class Kind { AND, OR, NOT, COMPARE, BETWEEN, IN };
+    Kind kind = Kind::COMPARE;
+    std::vector<FireSqlCondition> children;   // AND, OR (two or more), NOT (one)
+    uint32_t column = 0;                      // FireColumn, the leaves
+    FireSqlOp op = FireSqlOp::EQUAL;          // COMPARE
+    std::vector<FireSqlValue> values;         // COMPARE one, BETWEEN low and high, IN the list
+
+    // FireColumn bits of every column the condition reads
+    uint32_t columns() const;
+    std::string toString() const;
+};
+
+// one item of the select list, or the ORDER BY key
+struct FireSqlItem {
+    enum class Function { NONE, COUNT, SUM, AVG, MIN, MAX };
+    Function function = Function::NONE;
+    uint32_t column = 0;   // 0 for count(*)
+
+    bool isAggregate() const { return function != Function::NONE; }
+    bool operator==(const FireSqlItem& other) const {
+        return function == other.function && column == other.column;
+    }
+    // "site", "avg(concentration)", "count(*)"
+    std::string toString() const;
+};
+
+struct FireSqlStatement {
+    std::string text;                  // as given, for the profile
+    bool explain = false;
+    std::vector<FireSqlItem> items;    // * is expanded to every column
+    bool hasWhere = false;
+    FireSqlCondition where;
+    std::vector<uint32_t> groupBy;     // FireColumns
+    bool hasOrderBy = false;
+    FireSqlItem orderBy;
+    bool descending = false;
+    size_t limit = std::numeric_limits<size_t>::max();
+
+    bool isAggregate() const;
+
+    // throws std::runtime_error on syntax errors, with the position they were found at
+    static FireSqlStatement parse(const std::string& text);
+};
+
+// how a statement runs: the filters project() applies, what is left for the masks and which columns
+// have to be copied out for it
+struct FireSqlPlan {
+    FireSqlStatement statement;
+    std::vector<FireQuery> filters;              // pushed down into FireData::project
+    std::vector<FireSqlCondition> residual;      // ANDed, evaluated on the projected columns
+    uint32_t columns = 0;                        // projected (FireColumn bits)
+
+    // checks the statement (types, grouping) and lowers its WHERE clause, throws std::runtime_error
+    static FireSqlPlan build(const FireSqlStatement& statement);
+
+    // the LIMIT project() stops its scan at, 0 when every match is needed: a plain select without ORDER
+    // BY or residual filter returns the first rows in load order, which are the first matches
+    size_t scanLimit() const;
+
+    // the plan as EXPLAIN prints it, one step per line
+    std::string toString() const;
+};
+
+// rows of a statement. plain selects keep the projected columns and the output order of their rows
+// and format cells on demand (a select of every matching row doesn't turn into strings), aggregates
+// keep their values
+struct FireSqlResult {
+    std::vector<std::string> header;
+    std::string plan;                  // FireSqlPlan::toString
+    bool explain = false;              // an EXPLAIN statement, it didn't run and plan is its only output
+    bool aggregated = false;
+    // plain selects
+    FireColumns data;
+    std::vector<uint32_t> rowIds;      // rows of data in output order, cut to the LIMIT
+    std::vector<uint32_t> itemColumns; // the FireColumn of every output column
+    // aggregates, one row per group
+    std::vector<std::vector<FireSqlValue>> values;
+
+    size_t rows() const { return aggregated ? values.size() : rowIds.size(); }
+    std::string cell(size_t row, size_t column) const;
+};
+
+// parses, plans and runs text against data. EXPLAIN statements return their plan without running.
+// options.profile gets the projection's profile, with the statement as its query and the time of
+// the whole statement. throws std::runtime_error on parse and plan errors
+FireSqlResult executeFireSql(const FireData& data, const std::string& text,
+                             ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                             const QueryOptions& options = QueryOptions());
+FireSqlResult executeFireSql(const FireData& data, const FireSqlPlan& plan,
+                             ParallelStrategy strategy = ParallelStrategy::OPENMP,
+                             const QueryOptions& options = QueryOptions());
+
+#endif
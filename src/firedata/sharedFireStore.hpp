@@ -0,0 +1,385 @@
+// Read-only columnar image of the fire data for sharing between processes
+//
+// one process builds the image into a POSIX shared memory object or a memory-mapped file, any
+// number of processes on the host attach it read-only and query it in place, so the data exists
+// once instead of once per process. everything inside the region is addressed by byte offsets
+// from its start (never raw pointers), which stay valid whatever address each process maps it at.
+//
+// layout: header, then one array per column, the string pool and the pollutant index
+//   latitude, longitude, concentration, rawConcentration   double[rows]
+//   aqi, category                                          int32[rows]
+//   7 string columns                                       SharedString[rows], point into the pool
+//   string pool                                            every distinct string once
+//   pollutant index                                        keys sorted by name, each a run of row ids
+#ifndef SHARED_FIRE_STORE_HPP
+#define SHARED_FIRE_STORE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "firedata/fireRecord.hpp"
+#include "common/parallelSort.hpp"
+
+// string inside the pool
+struct SharedString {
+    uint32_t offset;  // from the start of the pool
+    uint32_t length;
+};
+
+// one pollutant of the index, its rows are indexRows[first, first + count)
+struct SharedIndexKey {
+    SharedString name;
+    uint64_t first;
+    uint64_t count;
+};
+
+enum SharedStringColumn {
+    COLUMN_UTC, COLUMN_POLLUTANT, COLUMN_UNIT, COLUMN_SITE, COLUMN_AGENCY, COLUMN_AQS_ID, COLUMN_FULL_AQS_ID,
+    STRING_COLUMNS
+};
+
+// first bytes of the region, every field after magic is an offset from the region start or a count
+struct SharedFireHeader {
+    char magic[8];        // written last, a reader never sees a half built image as valid
+    uint64_t totalBytes;
+    uint64_t rowCount;
+    uint64_t latitude, longitude, concentration, rawConcentration;
+    uint64_t aqi, category;
+    uint64_t strings[STRING_COLUMNS];
+    uint64_t pool, poolBytes;
+    uint64_t indexKeys, indexKeyCount;
+    uint64_t indexRows;   // uint32 row ids, rowCount of them
+};
+
+// magic carries the format version, bump it when the layout changes
+static const char SHARED_FIRE_MAGIC[8] = {'F', 'I', 'R', 'E', 'S', 'H', 'M', '1'};
+
+class SharedFireStore;
+
+// one row of an attached image, same getters as FireRecord but strings are views into the mapping
+class SharedFireRow {
+private:
+    const SharedFireStore* store;
+    size_t row;
+
+public:
+    SharedFireRow(const SharedFireStore* s, size_t r) : store(s), row(r) {}
+
+    double getLatitude() const;
+    double getLongitude() const;
+    double getConcentration() const;
+    double getRawConcentration() const;
+    int getAqi() const;
+    int getCategory() const;
+    std::string_view getUTC() const;
+    std::string_view getPollutantType() const;
+    std::string_view getUnit() const;
+    std::string_view getSiteName() const;
+    std::string_view getAgencyName() const;
+    std::string_view getAqsId() const;
+    std::string_view getFullAqsId() const;
+
+    // copies the row out, this is where query results get materialized
+    operator FireRecord() const {
+        return FireRecord(getLatitude(), getLongitude(), std::string(getUTC()), std::string(getPollutantType()),
+                          getConcentration(), std::string(getUnit()), getRawConcentration(), getAqi(),
+                          getCategory(), std::string(getSiteName()), std::string(getAgencyName()),
+                          std::string(getAqsId()), std::string(getFullAqsId()));
+    }
+};
+
+class SharedFireStore {
+private:
+    const char* base;
+    size_t mappedBytes;
+    const SharedFireHeader* header;
+
+    SharedFireStore(const char* region, size_t bytes)
+        : base(region), mappedBytes(bytes), header(reinterpret_cast<const SharedFireHeader*>(region)) {}
+
+    template<typename T>
+    const T* at(uint64_t offset) const { return reinterpret_cast<const T*>(base + offset); }
+
+    // "/name" is a POSIX shared memory object, anything else (a path with more slashes, or no
+    // leading slash) is a regular file that gets memory mapped
+    static bool isShmName(const std::string& target) {
+        return target.size() > 1 && target[0] == '/' && target.find('/', 1) == std::string::npos;
+    }
+
+    static int openTarget(const std::string& target, int flags, mode_t mode) {
+        if (isShmName(target)) return shm_open(target.c_str(), flags, mode);
+        return open(target.c_str(), flags, mode);
+    }
+
+    static size_t alignUp(size_t n) { return (n + 63) & ~size_t(63); }  // every array starts on a cache line
+
+    // count Ts at offset lie inside a region of bytes, aligned for T. written so that no sum or product
+    // of the (untrusted) header fields can overflow
+    template<typename T>
+    static bool fits(uint64_t offset, uint64_t count, size_t bytes) {
+        return offset % alignof(T) == 0 && offset <= bytes && count <= (bytes - offset) / sizeof(T);
+    }
+
+    static bool inPool(const SharedString& s, uint64_t poolBytes) {
+        return s.offset <= poolBytes && s.length <= poolBytes - s.offset;
+    }
+
+public:
+    ~SharedFireStore() { munmap(const_cast<char*>(base), mappedBytes); }
+
+    SharedFireStore(const SharedFireStore&) = delete;
+    SharedFireStore& operator=(const SharedFireStore&) = delete;
+
+    size_t size() const { return header->rowCount; }
+    size_t bytes() const { return mappedBytes; }
+    SharedFireRow operator[](size_t row) const { return SharedFireRow(this, row); }
+
+    const double* latitude() const { return at<double>(header->latitude); }
+    const double* longitude() const { return at<double>(header->longitude); }
+    const double* concentration() const { return at<double>(header->concentration); }
+    const double* rawConcentration() const { return at<double>(header->rawConcentration); }
+    const int32_t* aqi() const { return at<int32_t>(header->aqi); }
+    const int32_t* category() const { return at<int32_t>(header->category); }
+
+    std::string_view string(SharedStringColumn column, size_t row) const {
+        const SharedString& s = at<SharedString>(header->strings[column])[row];
+        return std::string_view(at<char>(header->pool) + s.offset, s.length);
+    }
+
+    // row ids of one pollutant in load order, FireData::pollutantRows reads them from here while attached
+    std::pair<const uint32_t*, const uint32_t*> pollutantRows(const std::string& pollutant) const {
+        const SharedIndexKey* keys = at<SharedIndexKey>(header->indexKeys);
+        const SharedIndexKey* end = keys + header->indexKeyCount;
+        const char* pool = at<char>(header->pool);
+        const SharedIndexKey* key = std::lower_bound(keys, end, pollutant,
+            [&](const SharedIndexKey& k, const std::string& name) {
+                return std::string_view(pool + k.name.offset, k.name.length) < name;
+            });
+        const uint32_t* rows = at<uint32_t>(header->indexRows);
+        if (key == end || std::string_view(pool + key->name.offset, key->name.length) != pollutant) {
+            return {rows, rows};
+        }
+        return {rows + key->first, rows + key->first + key->count};
+    }
+
+    // ========================================================================
+    // building: writes records and the pollutant index as an image at target
+    // ========================================================================
+    static void build(const std::vector<FireRecord>& records, const std::string& target) {
+        if (records.size() > UINT32_MAX) throw std::runtime_error("too many rows for a shared image");
+        size_t rows = records.size();
+
+        // every distinct string goes into the pool once, most columns repeat a handful of values
+        std::string pool;
+        std::unordered_map<std::string, SharedString> interned;
+        std::vector<SharedString> strings[STRING_COLUMNS];
+        auto intern = [&](const std::string& s) {
+            auto it = interned.find(s);
+            if (it != interned.end()) return it->second;
+            if (pool.size() + s.size() > UINT32_MAX) throw std::runtime_error("string pool too large");
+            SharedString ref = {static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(s.size())};
+            pool += s;
+            interned.emplace(s, ref);
+            return ref;
+        };
+        for (auto& column : strings) column.reserve(rows);
+        for (const FireRecord& r : records) {
+            strings[COLUMN_UTC].push_back(intern(r.getUTC()));
+            strings[COLUMN_POLLUTANT].push_back(intern(r.getPollutantType()));
+            strings[COLUMN_UNIT].push_back(intern(r.getUnit()));
+            strings[COLUMN_SITE].push_back(intern(r.getSiteName()));
+            strings[COLUMN_AGENCY].push_back(intern(r.getAgencyName()));
+            strings[COLUMN_AQS_ID].push_back(intern(r.getAqsId()));
+            strings[COLUMN_FULL_AQS_ID].push_back(intern(r.getFullAqsId()));
+        }
+
+        // pollutant index: row ids radix sorted by their interned pollutant (offset and length are the
+        // same for every row of one pollutant), stable so ids stay ascending inside a pollutant. the runs
+        // of one pollutant then go into the image in name order
+        std::vector<uint64_t> pollutantKeys(rows);
+        std::vector<uint32_t> pollutantRows(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            const SharedString& ref = strings[COLUMN_POLLUTANT][i];
+            pollutantKeys[i] = (static_cast<uint64_t>(ref.offset) << 32) | ref.length;
+            pollutantRows[i] = static_cast<uint32_t>(i);
+        }
+        parallelRadixSort(pollutantKeys, pollutantRows);
+        struct Run {
+            std::string_view name;
+            SharedString ref;
+            size_t first, count;
+        };
+        std::vector<Run> runs;
+        for (size_t i = 0; i < rows; ++i) {
+            if (i == 0 || pollutantKeys[i] != pollutantKeys[i - 1]) {
+                const SharedString& ref = strings[COLUMN_POLLUTANT][pollutantRows[i]];
+                runs.push_back(Run{std::string_view(pool).substr(ref.offset, ref.length), ref, i, 0});
+            }
+            runs.back().count++;
+        }
+        std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.name < b.name; });
+
+        SharedFireHeader layout;
+        std::memset(&layout, 0, sizeof(layout));
+        size_t offset = alignUp(sizeof(SharedFireHeader));
+        auto place = [&](uint64_t& field, size_t bytes) {
+            field = offset;
+            offset = alignUp(offset + bytes);
+        };
+        place(layout.latitude, rows * sizeof(double));
+        place(layout.longitude, rows * sizeof(double));
+        place(layout.concentration, rows * sizeof(double));
+        place(layout.rawConcentration, rows * sizeof(double));
+        place(layout.aqi, rows * sizeof(int32_t));
+        place(layout.category, rows * sizeof(int32_t));
+        for (int c = 0; c < STRING_COLUMNS; ++c) place(layout.strings[c], rows * sizeof(SharedString));
+        place(layout.pool, pool.size());
+        place(layout.indexKeys, runs.size() * sizeof(SharedIndexKey));
+        place(layout.indexRows, rows * sizeof(uint32_t));
+        layout.totalBytes = offset;
+        layout.rowCount = rows;
+        layout.poolBytes = pool.size();
+        layout.indexKeyCount = runs.size();
+
+        // a new object instead of truncating the old one: processes still attached to a previous
+        // image keep their mapping (truncating it under them would crash them with SIGBUS)
+        remove(target);
+        int fd = openTarget(target, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) throw std::runtime_error("could not create " + target + ": " + strerror(errno));
+        if (ftruncate(fd, static_cast<off_t>(layout.totalBytes)) != 0) {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("could not size " + target + ": " + strerror(error));
+        }
+        void* mapped = mmap(nullptr, layout.totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("could not map " + target + ": " + strerror(errno));
+        char* region = static_cast<char*>(mapped);
+
+        double* latitude = reinterpret_cast<double*>(region + layout.latitude);
+        double* longitude = reinterpret_cast<double*>(region + layout.longitude);
+        double* concentration = reinterpret_cast<double*>(region + layout.concentration);
+        double* rawConcentration = reinterpret_cast<double*>(region + layout.rawConcentration);
+        int32_t* aqi = reinterpret_cast<int32_t*>(region + layout.aqi);
+        int32_t* category = reinterpret_cast<int32_t*>(region + layout.category);
+        for (size_t i = 0; i < rows; ++i) {
+            const FireRecord& r = records[i];
+            latitude[i] = r.getLatitude();
+            longitude[i] = r.getLongitude();
+            concentration[i] = r.getConcentration();
+            rawConcentration[i] = r.getRawConcentration();
+            aqi[i] = r.getAqi();
+            category[i] = r.getCategory();
+        }
+        for (int c = 0; c < STRING_COLUMNS; ++c) {
+            std::memcpy(region + layout.strings[c], strings[c].data(), rows * sizeof(SharedString));
+        }
+        std::memcpy(region + layout.pool, pool.data(), pool.size());
+
+        SharedIndexKey* keys = reinterpret_cast<SharedIndexKey*>(region + layout.indexKeys);
+        uint32_t* indexRows = reinterpret_cast<uint32_t*>(region + layout.indexRows);
+        uint64_t next = 0;
+        for (const Run& run : runs) {
+            *keys++ = SharedIndexKey{run.ref, next, run.count};
+            std::memcpy(indexRows + next, pollutantRows.data() + run.first, run.count * sizeof(uint32_t));
+            next += run.count;
+        }
+
+        // header without the magic first, the magic only once everything else is in place
+        std::memcpy(region, &layout, sizeof(layout));
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(region, SHARED_FIRE_MAGIC, sizeof(SHARED_FIRE_MAGIC));
+        if (!isShmName(target)) msync(region, layout.totalBytes, MS_ASYNC);
+        munmap(region, layout.totalBytes);
+    }
+
+    // ========================================================================
+    // attaching: maps an image read-only, throws std::runtime_error when it isn't a valid one
+    // ========================================================================
+    static std::unique_ptr<SharedFireStore> attach(const std::string& target) {
+        int fd = openTarget(target, O_RDONLY, 0);
+        if (fd < 0) throw std::runtime_error("could not open " + target + ": " + strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SharedFireHeader)) {
+            close(fd);
+            throw std::runtime_error(target + " is not a fire data image");
+        }
+        size_t bytes = static_cast<size_t>(info.st_size);
+        void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("could not map " + target + ": " + strerror(errno));
+
+        std::unique_ptr<SharedFireStore> store(new SharedFireStore(static_cast<const char*>(mapped), bytes));
+        const SharedFireHeader& h = *store->header;
+        if (std::memcmp(h.magic, SHARED_FIRE_MAGIC, sizeof(SHARED_FIRE_MAGIC)) != 0) {
+            throw std::runtime_error(target + " is not a fire data image (or is still being built)");
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // offsets come from another process, check them before anything dereferences one: the arrays
+        // have to lie inside the mapping, and the strings, index runs and row ids they hold inside the
+        // pool, the index rows and the rows. reads every reference once, attaching is linear in the rows
+        uint64_t rows = h.rowCount;
+        bool valid = h.totalBytes == bytes && fits<char>(h.pool, h.poolBytes, bytes) &&
+                     fits<uint32_t>(h.indexRows, rows, bytes) &&
+                     fits<SharedIndexKey>(h.indexKeys, h.indexKeyCount, bytes);
+        for (uint64_t column : {h.latitude, h.longitude, h.concentration, h.rawConcentration}) {
+            valid = valid && fits<double>(column, rows, bytes);
+        }
+        for (uint64_t column : {h.aqi, h.category}) {
+            valid = valid && fits<int32_t>(column, rows, bytes);
+        }
+        for (uint64_t column : h.strings) {
+            valid = valid && fits<SharedString>(column, rows, bytes);
+        }
+        for (int c = 0; valid && c < STRING_COLUMNS; ++c) {
+            const SharedString* strings = store->at<SharedString>(h.strings[c]);
+            for (uint64_t i = 0; valid && i < rows; ++i) valid = inPool(strings[i], h.poolBytes);
+        }
+        if (valid) {
+            const SharedIndexKey* keys = store->at<SharedIndexKey>(h.indexKeys);
+            for (uint64_t k = 0; valid && k < h.indexKeyCount; ++k) {
+                valid = inPool(keys[k].name, h.poolBytes) && keys[k].first <= rows &&
+                        keys[k].count <= rows - keys[k].first;
+            }
+            const uint32_t* indexRows = store->at<uint32_t>(h.indexRows);
+            for (uint64_t i = 0; valid && i < rows; ++i) valid = indexRows[i] < rows;
+        }
+        if (!valid) throw std::runtime_error(target + " is truncated or corrupt");
+        return store;
+    }
+
+    // removes the image, processes that are attached keep their mapping until they detach
+    static bool remove(const std::string& target) {
+        if (isShmName(target)) return shm_unlink(target.c_str()) == 0;
+        return unlink(target.c_str()) == 0;
+    }
+};
+
+inline double SharedFireRow::getLatitude() const { return store->latitude()[row]; }
+inline double SharedFireRow::getLongitude() const { return store->longitude()[row]; }
+inline double SharedFireRow::getConcentration() const { return store->concentration()[row]; }
+inline double SharedFireRow::getRawConcentration() const { return store->rawConcentration()[row]; }
+inline int SharedFireRow::getAqi() const { return store->aqi()[row]; }
+inline int SharedFireRow::getCategory() const { return store->category()[row]; }
+inline std::string_view SharedFireRow::getUTC() const { return store->string(COLUMN_UTC, row); }
+inline std::string_view SharedFireRow::getPollutantType() const { return store->string(COLUMN_POLLUTANT, row); }
+inline std::string_view SharedFireRow::getUnit() const { return store->string(COLUMN_UNIT, row); }
+inline std::string_view SharedFireRow::getSiteName() const { return store->string(COLUMN_SITE, row); }
+inline std::string_view SharedFireRow::getAgencyName() const { return store->string(COLUMN_AGENCY, row); }
+inline std::string_view SharedFireRow::getAqsId() const { return store->string(COLUMN_AQS_ID, row); }
+inline std::string_view SharedFireRow::getFullAqsId() const { return store->string(COLUMN_FULL_AQS_ID, row); }
+
+#endif
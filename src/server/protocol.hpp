@@ -0,0 +1,385 @@
+// Wire protocol of the query server
+//
+// every message is a frame: uint32 payload length followed by the payload, all integers and
+// doubles little endian (the byte order of every machine we run on, so they are copied as is).
+//
+// request payload:
+//   uint32 requestId   echoed in the response, clients may pipeline and match responses by id
+//   uint8  dataset     0 = fire, 1 = population
+//   uint8  flags       bit 0: count only, the response carries the row count instead of rows
+//                      bit 1: partial, aggregates come back as mergeable state (sum and count
+//                      instead of the average), what a shard coordinator asks its shards for
+//   bytes  query       text form of FireQuery / PopulationQuery, runs to the end of the payload
+//
+// response payload:
+//   uint32 requestId
+//   uint8  status      0 = ok, 1 = error, 2 = cancelled (the query ran out of the server's time
+//                      budget). both non-ok statuses continue with the message string
+//   uint8  kind        what follows, see ResponseKind
+//   uint32 serverUs    time the server spent executing the query
+//   ...    body
+//
+// strings are uint16 length + bytes. responses can come back in a different order than the
+// requests were sent, the worker pool answers whichever query finishes first.
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "firedata/fireRecord.hpp"
+#include "firedata/fireQuery.hpp"
+#include "PopulationData/populationRecord.hpp"
+
+namespace protocol {
+
+const uint32_t MAX_FRAME_BYTES = 256u * 1024u * 1024u;  // larger frames mean a broken peer
+
+enum class Dataset : uint8_t { FIRE = 0, POPULATION = 1 };
+
+enum Flags : uint8_t { COUNT_ONLY = 1, PARTIAL = 2 };
+
+enum class Status : uint8_t { OK = 0, ERROR = 1, CANCELLED = 2 };
+
+enum class ResponseKind : uint8_t {
+    NONE = 0,               // errors
+    COUNT = 1,              // uint64 rows
+    FIRE_RECORDS = 2,       // uint32 n, n fire records
+    AVERAGE = 3,            // double
+    CATEGORY_COUNTS = 4,    // uint32 n, n x (int32 category, uint64 count)
+    POPULATION_RECORDS = 5, // uint32 n, n population records
+    AVERAGE_STATE = 6       // double sum, uint64 count
+};
+
+// ============================================================================
+// appends fields to a byte buffer
+// ============================================================================
+class Writer {
+private:
+    std::string& out;
+
+    template<typename T>
+    void raw(const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+public:
+    explicit Writer(std::string& buffer) : out(buffer) {}
+
+    void u8(uint8_t v) { raw(v); }
+    void u16(uint16_t v) { raw(v); }
+    void u32(uint32_t v) { raw(v); }
+    void u64(uint64_t v) { raw(v); }
+    void i32(int32_t v) { raw(v); }
+    void f64(double v) { raw(v); }
+
+    void str(const std::string& s) {
+        size_t n = s.size() > 0xFFFF ? 0xFFFF : s.size();
+        u16(static_cast<uint16_t>(n));
+        out.append(s.data(), n);
+    }
+
+    void bytes(const std::string& s) { out += s; }
+};
+
+// ============================================================================
+// reads fields back, throws std::runtime_error when the payload is too short
+// ============================================================================
+class Reader {
+private:
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+
+    template<typename T>
+    T raw() {
+        if (pos + sizeof(T) > size) throw std::runtime_error("truncated message");
+        T value;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+public:
+    Reader(const char* payload, size_t length) : data(payload), size(length) {}
+
+    uint8_t u8() { return raw<uint8_t>(); }
+    uint16_t u16() { return raw<uint16_t>(); }
+    uint32_t u32() { return raw<uint32_t>(); }
+    uint64_t u64() { return raw<uint64_t>(); }
+    int32_t i32() { return raw<int32_t>(); }
+    double f64() { return raw<double>(); }
+
+    std::string str() {
+        uint16_t n = u16();
+        if (pos + n > size) throw std::runtime_error("truncated string");
+        std::string s(data + pos, n);
+        pos += n;
+        return s;
+    }
+
+    // everything left in the payload
+    std::string rest() {
+        std::string s(data + pos, size - pos);
+        pos = size;
+        return s;
+    }
+};
+
+// ============================================================================
+// frames
+// ============================================================================
+// wraps a payload into a frame (length prefix)
+inline std::string frame(const std::string& payload) {
+    std::string out;
+    Writer w(out);
+    w.u32(static_cast<uint32_t>(payload.size()));
+    out += payload;
+    return out;
+}
+
+// if buffer starts with a complete frame, moves its payload out and returns true
+inline bool takeFrame(std::string& buffer, std::string& payload) {
+    if (buffer.size() < sizeof(uint32_t)) return false;
+    uint32_t length;
+    std::memcpy(&length, buffer.data(), sizeof(length));
+    if (length > MAX_FRAME_BYTES) throw std::runtime_error("frame too large");
+    if (buffer.size() < sizeof(uint32_t) + length) return false;
+    payload.assign(buffer, sizeof(uint32_t), length);
+    buffer.erase(0, sizeof(uint32_t) + length);
+    return true;
+}
+
+// ============================================================================
+// requests
+// ============================================================================
+struct Request {
+    uint32_t id = 0;
+    Dataset dataset = Dataset::FIRE;
+    uint8_t flags = 0;
+    std::string query;
+};
+
+inline std::string encodeRequest(const Request& request) {
+    std::string payload;
+    Writer w(payload);
+    w.u32(request.id);
+    w.u8(static_cast<uint8_t>(request.dataset));
+    w.u8(request.flags);
+    w.bytes(request.query);
+    return frame(payload);
+}
+
+inline Request decodeRequest(const std::string& payload) {
+    Reader r(payload.data(), payload.size());
+    Request request;
+    request.id = r.u32();
+    uint8_t dataset = r.u8();
+    if (dataset > static_cast<uint8_t>(Dataset::POPULATION)) throw std::runtime_error("unknown dataset");
+    request.dataset = static_cast<Dataset>(dataset);
+    request.flags = r.u8();
+    request.query = r.rest();
+    return request;
+}
+
+// ============================================================================
+// responses, the server writes the header and then one of the bodies
+// ============================================================================
+inline void writeResponseHeader(Writer& w, uint32_t id, Status status, ResponseKind kind, uint32_t serverUs) {
+    w.u32(id);
+    w.u8(static_cast<uint8_t>(status));
+    w.u8(static_cast<uint8_t>(kind));
+    w.u32(serverUs);
+}
+
+inline std::string encodeError(uint32_t id, const std::string& message, Status status = Status::ERROR) {
+    std::string payload;
+    Writer w(payload);
+    writeResponseHeader(w, id, status, ResponseKind::NONE, 0);
+    w.str(message);
+    return frame(payload);
+}
+
+inline void writeFireRecord(Writer& w, const FireRecord& r) {
+    w.f64(r.getLatitude());
+    w.f64(r.getLongitude());
+    w.f64(r.getConcentration());
+    w.f64(r.getRawConcentration());
+    w.i32(r.getAqi());
+    w.i32(r.getCategory());
+    w.str(r.getUTC());
+    w.str(r.getPollutantType());
+    w.str(r.getUnit());
+    w.str(r.getSiteName());
+    w.str(r.getAgencyName());
+    w.str(r.getAqsId());
+    w.str(r.getFullAqsId());
+}
+
+inline FireRecord readFireRecord(Reader& r) {
+    double lat = r.f64();
+    double lon = r.f64();
+    double concentration = r.f64();
+    double raw = r.f64();
+    int aqi = r.i32();
+    int category = r.i32();
+    std::string utc = r.str();
+    std::string pollutant = r.str();
+    std::string unit = r.str();
+    std::string site = r.str();
+    std::string agency = r.str();
+    std::string aqsId = r.str();
+    std::string fullAqsId = r.str();
+    return FireRecord(lat, lon, utc, pollutant, concentration, unit, raw, aqi, category,
+                      site, agency, aqsId, fullAqsId);
+}
+
+inline void writePopulationRecord(Writer& w, const PopulationRecord& r) {
+    w.str(r.getCountryName());
+    w.str(r.getCountryCode());
+    w.str(r.getIndicatorName());
+    w.str(r.getIndicatorCode());
+    w.str(r.getRegion());
+    w.str(r.getIncomeGroup());
+    const std::vector<double>& values = r.getYearlyValues();
+    w.u16(static_cast<uint16_t>(values.size()));
+    for (double v : values) w.f64(v);
+}
+
+inline PopulationRecord readPopulationRecord(Reader& r) {
+    std::string name = r.str();
+    std::string code = r.str();
+    std::string indicator = r.str();
+    std::string indicatorCode = r.str();
+    std::string region = r.str();
+    std::string income = r.str();
+    std::vector<double> values(r.u16());
+    for (double& v : values) v = r.f64();
+    return PopulationRecord(name, code, indicator, indicatorCode, values, region, income);
+}
+
+// decoded response, the member matching kind is filled
+struct Response {
+    uint32_t id = 0;
+    Status status = Status::OK;
+    ResponseKind kind = ResponseKind::NONE;
+    uint32_t serverUs = 0;
+    std::string error;
+    uint64_t count = 0;
+    double average = 0.0;
+    AverageState averageState;
+    std::vector<FireRecord> fireRecords;
+    std::map<int, size_t> categoryCounts;
+    std::vector<PopulationRecord> populationRecords;
+
+    // number of result rows whatever the kind
+    uint64_t rows() const {
+        switch (kind) {
+            case ResponseKind::COUNT: return count;
+            case ResponseKind::FIRE_RECORDS: return fireRecords.size();
+            case ResponseKind::AVERAGE: return 1;
+            case ResponseKind::AVERAGE_STATE: return 1;
+            case ResponseKind::CATEGORY_COUNTS: return categoryCounts.size();
+            case ResponseKind::POPULATION_RECORDS: return populationRecords.size();
+            default: return 0;
+        }
+    }
+};
+
+inline Response decodeResponse(const std::string& payload) {
+    Reader r(payload.data(), payload.size());
+    Response response;
+    response.id = r.u32();
+    response.status = static_cast<Status>(r.u8());
+    response.kind = static_cast<ResponseKind>(r.u8());
+    response.serverUs = r.u32();
+    if (response.status != Status::OK) {
+        response.error = r.str();
+        return response;
+    }
+    switch (response.kind) {
+        case ResponseKind::COUNT:
+            response.count = r.u64();
+            break;
+        case ResponseKind::FIRE_RECORDS: {
+            uint32_t n = r.u32();
+            response.fireRecords.reserve(n);
+            for (uint32_t i = 0; i < n; ++i) response.fireRecords.push_back(readFireRecord(r));
+            break;
+        }
+        case ResponseKind::AVERAGE:
+            response.average = r.f64();
+            break;
+        case ResponseKind::AVERAGE_STATE:
+            response.averageState.sum = r.f64();
+            response.averageState.count = r.u64();
+            response.average = response.averageState.value();
+            break;
+        case ResponseKind::CATEGORY_COUNTS: {
+            uint32_t n = r.u32();
+            for (uint32_t i = 0; i < n; ++i) {
+                int category = r.i32();
+                response.categoryCounts[category] = r.u64();
+            }
+            break;
+        }
+        case ResponseKind::POPULATION_RECORDS: {
+            uint32_t n = r.u32();
+            response.populationRecords.reserve(n);
+            for (uint32_t i = 0; i < n; ++i) response.populationRecords.push_back(readPopulationRecord(r));
+            break;
+        }
+        default:
+            break;
+    }
+    return response;
+}
+
+// ============================================================================
+// fire results, shared by the server and the shard coordinator
+// ============================================================================
+inline std::string encodeFireResult(uint32_t id, uint8_t flags, const FireQuery& query,
+                                    const FireQueryResult& result, uint32_t serverUs) {
+    std::string payload;
+    Writer w(payload);
+    if (flags & COUNT_ONLY) {
+        writeResponseHeader(w, id, Status::OK, ResponseKind::COUNT, serverUs);
+        w.u64(result.rows(query.type));
+    } else if (query.type == FireQueryType::AVERAGE_CONCENTRATION && (flags & PARTIAL)) {
+        writeResponseHeader(w, id, Status::OK, ResponseKind::AVERAGE_STATE, serverUs);
+        w.f64(result.averageState.sum);
+        w.u64(result.averageState.count);
+    } else if (query.type == FireQueryType::AVERAGE_CONCENTRATION) {
+        writeResponseHeader(w, id, Status::OK, ResponseKind::AVERAGE, serverUs);
+        w.f64(result.average);
+    } else if (query.type == FireQueryType::COUNT_BY_CATEGORY) {
+        writeResponseHeader(w, id, Status::OK, ResponseKind::CATEGORY_COUNTS, serverUs);
+        w.u32(static_cast<uint32_t>(result.categoryCounts.size()));
+        for (const auto& pair : result.categoryCounts) {
+            w.i32(pair.first);
+            w.u64(pair.second);
+        }
+    } else {
+        writeResponseHeader(w, id, Status::OK, ResponseKind::FIRE_RECORDS, serverUs);
+        w.u32(static_cast<uint32_t>(result.records.size()));
+        for (const auto& record : result.records) writeFireRecord(w, record);
+    }
+    return frame(payload);
+}
+
+// the fire result a decoded response carries (moves the records out)
+inline FireQueryResult takeFireResult(Response& response) {
+    FireQueryResult result;
+    result.records.swap(response.fireRecords);
+    result.average = response.average;
+    result.averageState = response.averageState;
+    result.categoryCounts.swap(response.categoryCounts);
+    return result;
+}
+
+}  // namespace protocol
+
+#endif
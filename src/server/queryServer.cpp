@@ -0,0 +1,337 @@
+// implementation of the query server event loop and worker pool
+
+#include "server/queryServer.hpp"
+#include "common/metrics.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace protocol;
+
+// a client that hung up must not kill the server with SIGPIPE (main also ignores the signal,
+// macOS has no MSG_NOSIGNAL)
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+QueryServer::QueryServer(const FireData& fire, const PopulationData& population,
+                         const ServerConfig& serverConfig)
+    : fireData(fire), populationData(population), config(serverConfig) {
+    if (config.workers == 0) config.workers = getOptimalThreadCount();
+}
+
+QueryServer::~QueryServer() {
+    jobs.markFinished();
+    for (auto& worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
+    for (auto& pair : connections) close(pair.first);
+    if (listenFd >= 0) close(listenFd);
+    if (wakePipe[0] >= 0) close(wakePipe[0]);
+    if (wakePipe[1] >= 0) close(wakePipe[1]);
+    if (!config.socketPath.empty()) unlink(config.socketPath.c_str());
+}
+
+// ============================================================================
+// sockets
+// ============================================================================
+void QueryServer::openListener() {
+    if (!config.socketPath.empty()) {
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) throw std::runtime_error("socket() failed: " + std::string(strerror(errno)));
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (config.socketPath.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("socket path too long: " + config.socketPath);
+        }
+        std::strcpy(addr.sun_path, config.socketPath.c_str());
+        // a stale socket file from an earlier run would make bind fail
+        unlink(config.socketPath.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("bind(" + config.socketPath + ") failed: " + strerror(errno));
+        }
+    } else {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) throw std::runtime_error("socket() failed: " + std::string(strerror(errno)));
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(config.port));
+        if (inet_pton(AF_INET, config.bindAddress.c_str(), &addr.sin_addr) != 1) {
+            throw std::runtime_error("not an ipv4 address: " + config.bindAddress);
+        }
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("bind(" + config.bindAddress + ":" + std::to_string(config.port) +
+                                     ") failed: " + strerror(errno));
+        }
+    }
+    if (listen(listenFd, 128) != 0) throw std::runtime_error("listen() failed: " + std::string(strerror(errno)));
+    setNonBlocking(listenFd);
+
+    if (pipe(wakePipe) != 0) throw std::runtime_error("pipe() failed: " + std::string(strerror(errno)));
+    setNonBlocking(wakePipe[0]);
+    setNonBlocking(wakePipe[1]);
+}
+
+void QueryServer::acceptClients() {
+    static Counter& accepted = MetricsRegistry::instance().counter(
+        "server_connections_total", "Client connections accepted");
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) return;  // EAGAIN, nothing more to accept
+        setNonBlocking(fd);
+        if (config.socketPath.empty()) {
+            // responses are written in one go, don't let nagle hold back the tail
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+        std::shared_ptr<Connection> connection(new Connection());
+        connection->fd = fd;
+        connections[fd] = connection;
+        accepted.add();
+    }
+}
+
+bool QueryServer::readFrom(const std::shared_ptr<Connection>& connection) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            connection->in.append(buffer, n);
+            continue;
+        }
+        if (n == 0) return false;  // peer closed
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno == EINTR) continue;
+        return false;
+    }
+
+    // hand every complete request to the pool
+    std::string payload;
+    try {
+        while (takeFrame(connection->in, payload)) {
+            Job job;
+            job.connection = connection;
+            try {
+                job.request = decodeRequest(payload);
+            } catch (const std::exception& e) {
+                // answer malformed requests instead of dropping the client
+                std::lock_guard<std::mutex> lock(connection->outMutex);
+                connection->out += encodeError(0, e.what());
+                continue;
+            }
+            jobs.push(job);
+        }
+    } catch (const std::exception&) {
+        return false;  // frame length makes no sense, the stream can't be resynchronized
+    }
+    return true;
+}
+
+bool QueryServer::writeTo(const std::shared_ptr<Connection>& connection) {
+    std::lock_guard<std::mutex> lock(connection->outMutex);
+    size_t sent = 0;
+    while (sent < connection->out.size()) {
+        ssize_t n = send(connection->fd, connection->out.data() + sent, connection->out.size() - sent,
+                         SEND_FLAGS);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    connection->out.erase(0, sent);
+    return true;
+}
+
+void QueryServer::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+    {
+        // workers still holding the connection see closed and drop their response
+        std::lock_guard<std::mutex> lock(it->second->outMutex);
+        it->second->closed = true;
+    }
+    close(fd);
+    connections.erase(it);
+}
+
+// ============================================================================
+// event loop
+// ============================================================================
+void QueryServer::run(const std::atomic<bool>& stop) {
+    openListener();
+    for (unsigned int i = 0; i < config.workers; ++i) {
+        workers.emplace_back(&QueryServer::workerLoop, this);
+    }
+    if (config.socketPath.empty()) {
+        printf("Query server listening on %s:%d with %u workers\n", config.bindAddress.c_str(), config.port,
+               config.workers);
+    } else {
+        printf("Query server listening on %s with %u workers\n", config.socketPath.c_str(), config.workers);
+    }
+    fflush(stdout);
+
+    std::vector<pollfd> fds;
+    while (!stop.load()) {
+        fds.clear();
+        fds.push_back({listenFd, POLLIN, 0});
+        fds.push_back({wakePipe[0], POLLIN, 0});
+        for (const auto& pair : connections) {
+            short events = 0;
+            std::lock_guard<std::mutex> lock(pair.second->outMutex);
+            // back pressure: a client that doesn't read its responses doesn't get to send more
+            if (pair.second->out.size() < config.maxPendingBytes) events |= POLLIN;
+            if (!pair.second->out.empty()) events |= POLLOUT;
+            fds.push_back({pair.first, events, 0});
+        }
+
+        // the timeout only bounds how long a stop request can go unnoticed
+        int ready = poll(fds.data(), fds.size(), 200);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("poll() failed: " + std::string(strerror(errno)));
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[256];
+            while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        if (fds[0].revents & POLLIN) acceptClients();
+
+        for (size_t i = 2; i < fds.size(); ++i) {
+            auto it = connections.find(fds[i].fd);
+            if (it == connections.end()) continue;
+            std::shared_ptr<Connection> connection = it->second;
+            bool alive = true;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) alive = readFrom(connection);
+            // responses may have been queued while we polled, try to send them right away
+            if (alive) alive = writeTo(connection);
+            if (!alive) closeConnection(fds[i].fd);
+        }
+    }
+}
+
+// ============================================================================
+// worker pool
+// ============================================================================
+void QueryServer::workerLoop() {
+    Job job;
+    while (jobs.pop(job)) {
+        std::string response = execute(job.request);
+        {
+            std::lock_guard<std::mutex> lock(job.connection->outMutex);
+            if (job.connection->closed) continue;
+            job.connection->out += response;
+        }
+        // wake the loop so it polls for POLLOUT on this connection
+        char wake = 1;
+        ssize_t ignored = write(wakePipe[1], &wake, 1);
+        (void)ignored;
+        job.connection.reset();
+    }
+}
+
+std::string QueryServer::execute(const Request& request) const {
+    static Histogram& latency = MetricsRegistry::instance().histogram(
+        "server_request_seconds", "Time from request decode to encoded response");
+    static Counter& errors = MetricsRegistry::instance().counter(
+        "server_request_errors_total", "Requests answered with an error");
+    static Counter& cancelled = MetricsRegistry::instance().counter(
+        "server_request_cancelled_total", "Requests stopped at their time or memory budget");
+    static Histogram& peakBytes = MetricsRegistry::instance().histogram(
+        "server_request_peak_bytes", "Most memory a request's query held at once", {},
+        {1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10});
+
+    uint64_t start = steadyNowNs();
+    QueryOptions options;
+    if (config.queryTimeoutMs > 0) options.stop = StopCondition::timeout(config.queryTimeoutMs);
+    // every request is accounted, the limit only applies when one is configured
+    QueryMemory memory(config.queryMemoryBytes);
+    options.stop.memory = &memory;
+    // the encoded response is one more copy of the result, over the limit it isn't sent
+    auto chargeResponse = [&](const std::string& response) {
+        if (!memory.charge(response.size())) {
+            throw QueryCancelled(StopReason::MEMORY_LIMIT, 0, 0);
+        }
+        peakBytes.observe(static_cast<double>(memory.peakBytes()));
+    };
+    std::string payload;
+    Writer w(payload);
+    bool countOnly = (request.flags & COUNT_ONLY) != 0;
+
+    try {
+        if (request.dataset == Dataset::FIRE) {
+            std::string response;
+            if (coordinator) {
+                // no fire data here, the shards have it
+                response = coordinator->execute(request);
+            } else {
+                FireQuery query = FireQuery::parse(request.query);
+                if (countOnly && FireData::canStream(query.type) && query.limit == 0) {
+                    // the rows are only counted, so they stream through a batch at a time instead of
+                    // being copied out (and cached) all together
+                    query.orderBy = 0;
+                    size_t rows = fireData.stream(query, [](const std::vector<FireRecord>&) {}, options);
+                    uint32_t serverUs = static_cast<uint32_t>((steadyNowNs() - start) / 1000);
+                    writeResponseHeader(w, request.id, Status::OK, ResponseKind::COUNT, serverUs);
+                    w.u64(rows);
+                    response = frame(payload);
+                } else {
+                    // repeated queries come straight from the result cache when it is enabled
+                    std::shared_ptr<const FireQueryResult> result = fireData.executeCached(query, options);
+                    uint32_t serverUs = static_cast<uint32_t>((steadyNowNs() - start) / 1000);
+                    response = encodeFireResult(request.id, request.flags, query, *result, serverUs);
+                }
+                chargeResponse(response);
+            }
+            latency.observe((steadyNowNs() - start) / 1e9);
+            return response;
+        } else {
+            PopulationQuery query = PopulationQuery::parse(request.query);
+            std::vector<PopulationRecord> records = populationData.execute(query, options);
+            uint32_t serverUs = static_cast<uint32_t>((steadyNowNs() - start) / 1000);
+
+            if (countOnly) {
+                writeResponseHeader(w, request.id, Status::OK, ResponseKind::COUNT, serverUs);
+                w.u64(records.size());
+            } else {
+                writeResponseHeader(w, request.id, Status::OK, ResponseKind::POPULATION_RECORDS, serverUs);
+                w.u32(static_cast<uint32_t>(records.size()));
+                for (const auto& record : records) writePopulationRecord(w, record);
+            }
+            chargeResponse(payload);
+        }
+    } catch (const QueryCancelled& e) {
+        // only this request stops, the worker goes on with the next one
+        cancelled.add();
+        return encodeError(request.id, e.what(), Status::CANCELLED);
+    } catch (const std::exception& e) {
+        errors.add();
+        return encodeError(request.id, e.what());
+    }
+
+    latency.observe((steadyNowNs() - start) / 1e9);
+    return frame(payload);
+}
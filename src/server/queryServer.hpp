@@ -0,0 +1,92 @@
+// Long-running query server keeping FireData and PopulationData resident
+//
+// one event loop thread multiplexes every client with poll(): it accepts connections, reads
+// request frames and hands complete requests to a shared pool of worker threads through a
+// TaskQueue. workers run the query, encode the response into the connection's outgoing buffer
+// and wake the loop through a pipe, the loop then writes it out when the socket is writable.
+// clients can pipeline requests on one connection, responses carry the request id.
+#ifndef QUERY_SERVER_HPP
+#define QUERY_SERVER_HPP
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "firedata/fireData.hpp"
+#include "PopulationData/populationData.hpp"
+#include "common/parallelStrategy.hpp"
+#include "server/protocol.hpp"
+#include "server/shardCoordinator.hpp"
+
+struct ServerConfig {
+    std::string socketPath;      // unix domain socket, used when set
+    int port = 7070;             // otherwise tcp on bindAddress:port
+    std::string bindAddress = "127.0.0.1";  // local clients only unless shards run on other hosts
+    unsigned int workers = 0;    // 0 = one per hardware thread
+    // time budget of a request from decode to response, a query over it is stopped at its next chunk
+    // and answered with Status::CANCELLED. 0 = none
+    double queryTimeoutMs = 0;
+    // memory a request may hold (its result, worker scratch and the encoded response), a query over
+    // it is stopped and answered with Status::CANCELLED. 0 = no limit, the usage is counted either way
+    size_t queryMemoryBytes = 0;
+    // stop reading from a client while this many response bytes are still waiting to be sent
+    size_t maxPendingBytes = 64u * 1024u * 1024u;
+};
+
+class QueryServer {
+private:
+    struct Connection {
+        int fd;
+        std::string in;          // bytes read but not yet a complete frame (loop thread only)
+        std::mutex outMutex;     // guards out and closed, workers append, the loop sends
+        std::string out;
+        bool closed = false;
+    };
+
+    struct Job {
+        std::shared_ptr<Connection> connection;
+        protocol::Request request;
+    };
+
+    const FireData& fireData;
+    const PopulationData& populationData;
+    ServerConfig config;
+    // answers fire queries by fanning out to shards when set, not owned (see setCoordinator)
+    ShardCoordinator* coordinator = nullptr;
+
+    int listenFd = -1;
+    int wakePipe[2] = {-1, -1};
+    std::map<int, std::shared_ptr<Connection>> connections;
+    TaskQueue<Job> jobs;
+    std::vector<std::thread> workers;
+
+    void openListener();
+    void acceptClients();
+    // false when the peer closed the connection or sent garbage
+    bool readFrom(const std::shared_ptr<Connection>& connection);
+    bool writeTo(const std::shared_ptr<Connection>& connection);
+    void closeConnection(int fd);
+
+    void workerLoop();
+    // runs the query and returns the framed response, errors become error responses
+    std::string execute(const protocol::Request& request) const;
+
+public:
+    QueryServer(const FireData& fire, const PopulationData& population, const ServerConfig& serverConfig);
+    ~QueryServer();
+
+    // fire requests go to the coordinator's shards instead of fireData, has to outlive the server
+    void setCoordinator(ShardCoordinator* shardCoordinator) { coordinator = shardCoordinator; }
+
+    // serves until stop becomes true (checked a few times a second), throws std::runtime_error
+    // when the socket can't be set up
+    void run(const std::atomic<bool>& stop);
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+};
+
+#endif
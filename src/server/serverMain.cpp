@@ -0,0 +1,175 @@
+// query server executable: loads the datasets once and answers queries until interrupted
+// usage: query_server [--fire <path> [--shard i/n] [--cluster]] [--fire-shared <name>]
+//                     [--coordinator <shards>] [--population <path>]
+//                     [--socket <path> | --port 7070 [--bind <ipv4>]] [--timeout-ms N]
+//                     [--query-memory-mb N] [--cache-mb N] [--metrics-port <port>]
+//
+// --shard loads only the i-th of n date ranges of the fire files. --coordinator holds no fire data
+// itself, it answers fire queries by fanning them out to the shard servers listed (comma separated
+// unix socket paths, ports or host:port) and merging their partial results. --cache-mb keeps up to
+// N MB of fire query results for repeated queries (dashboards), off by default. --cluster reorders
+// the loaded fire records along a Z-order curve of their location, so bounding box queries skip most
+// of the data. --timeout-ms gives every request a time budget, a query still running when it runs
+// out stops at its next chunk and is answered as cancelled, the server and its workers carry on.
+// --query-memory-mb does the same for the memory a request holds (result rows, worker scratch and
+// the encoded response). count-only filter queries stream their rows and never hold more than a
+// batch per worker.
+//
+// --fire-shared shares the fire data between server processes on one host: together with --fire
+// the data is loaded, published as a shared image under name and served from it (the image is
+// removed again on shutdown), without --fire the server only attaches to an image another server
+// published.
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "server/queryServer.hpp"
+#include "common/metrics.hpp"
+
+static std::atomic<bool> stopRequested{false};
+
+static void handleSignal(int) {
+    stopRequested = true;
+}
+
+int main(int argc, char** argv) {
+    std::string firePath, fireShared, populationPath;
+    bool sharded = false;
+    bool cluster = false;
+    size_t shardIndex = 0, shardCount = 0;
+    std::vector<std::string> shardEndpoints;
+    ServerConfig config;
+    int metricsPort = 0;
+    size_t cacheMb = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--fire" && i + 1 < argc) {
+            firePath = argv[++i];
+        } else if (arg == "--shard" && i + 1 < argc) {
+            std::string shard = argv[++i];
+            size_t slash = shard.find('/');
+            if (slash == std::string::npos) {
+                printf("error: --shard takes index/count, e.g. 0/4\n");
+                return 2;
+            }
+            sharded = true;
+            shardIndex = static_cast<size_t>(std::atoi(shard.substr(0, slash).c_str()));
+            shardCount = static_cast<size_t>(std::atoi(shard.substr(slash + 1).c_str()));
+        } else if (arg == "--cluster") {
+            cluster = true;
+        } else if (arg == "--coordinator" && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string endpoint;
+            while (std::getline(list, endpoint, ',')) {
+                if (!endpoint.empty()) shardEndpoints.push_back(endpoint);
+            }
+        } else if (arg == "--bind" && i + 1 < argc) {
+            config.bindAddress = argv[++i];
+        } else if (arg == "--fire-shared" && i + 1 < argc) {
+            fireShared = argv[++i];
+        } else if (arg == "--population" && i + 1 < argc) {
+            populationPath = argv[++i];
+        } else if (arg == "--socket" && i + 1 < argc) {
+            config.socketPath = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            config.port = std::atoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            config.workers = static_cast<unsigned int>(std::atoi(argv[++i]));
+        } else if (arg == "--timeout-ms" && i + 1 < argc) {
+            config.queryTimeoutMs = std::atof(argv[++i]);
+        } else if (arg == "--query-memory-mb" && i + 1 < argc) {
+            config.queryMemoryBytes = static_cast<size_t>(std::atof(argv[++i]) * 1024 * 1024);
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cacheMb = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = std::atoi(argv[++i]);
+        } else {
+            printf("usage: %s [--fire <path> [--shard i/n] [--cluster]] [--fire-shared <name>]\n"
+                   "       [--coordinator <shards>] [--population <path>]\n"
+                   "       [--socket <path> | --port 7070 [--bind <ipv4>]]\n"
+                   "       [--workers N] [--timeout-ms N] [--query-memory-mb N] [--cache-mb N]\n"
+                   "       [--metrics-port <port>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (firePath.empty() && fireShared.empty() && shardEndpoints.empty() && populationPath.empty()) {
+        printf("error: give at least one dataset (--fire / --fire-shared / --coordinator / --population)\n");
+        return 2;
+    }
+    if (!shardEndpoints.empty() && (!firePath.empty() || !fireShared.empty())) {
+        printf("error: a coordinator doesn't load fire data, its shards do\n");
+        return 2;
+    }
+
+    // loaded once, every request after this only queries
+    FireData fireData;
+    PopulationData populationData;
+    bool publishedFire = false;
+    try {
+        if (!firePath.empty()) {
+            if (sharded) {
+                fireData.loadShard(firePath, shardIndex, shardCount);
+            } else {
+                fireData.loadFromDirectory(firePath);
+            }
+            printf("Loaded %zu fire records\n", fireData.size());
+            if (cluster) {
+                // before publishing, the shared image keeps the order
+                fireData.clusterByLocation();
+                printf("Clustered fire records by location\n");
+            }
+            if (!fireShared.empty()) {
+                fireData.exportShared(fireShared);
+                publishedFire = true;
+                printf("Published fire data as shared image %s\n", fireShared.c_str());
+            }
+        }
+        if (!fireShared.empty()) {
+            fireData.attachShared(fireShared);
+            printf("Attached shared fire image %s (%zu records)\n", fireShared.c_str(), fireData.size());
+        }
+    } catch (const std::exception& e) {
+        printf("error: %s\n", e.what());
+        return 1;
+    }
+    if (cacheMb > 0) {
+        fireData.enableResultCache(cacheMb * 1024 * 1024);
+        printf("Caching up to %zu MB of fire query results\n", cacheMb);
+    }
+    if (!populationPath.empty()) {
+        populationData.loadFromDirectory(populationPath);
+        printf("Loaded %zu population records\n", populationData.size());
+    }
+
+    if (metricsPort > 0 && MetricsRegistry::instance().startHttpServer(metricsPort)) {
+        printf("Serving metrics on http://127.0.0.1:%d/metrics\n", metricsPort);
+    }
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        std::unique_ptr<ShardCoordinator> coordinator;
+        if (!shardEndpoints.empty()) {
+            coordinator.reset(new ShardCoordinator(shardEndpoints));
+            printf("Coordinating %zu fire shards\n", coordinator->shardCount());
+        }
+        QueryServer server(fireData, populationData, config);
+        server.setCoordinator(coordinator.get());
+        server.run(stopRequested);
+    } catch (const std::exception& e) {
+        printf("error: %s\n", e.what());
+        if (publishedFire) FireData::removeShared(fireShared);
+        return 1;
+    }
+    if (publishedFire) FireData::removeShared(fireShared);
+    printf("Query server stopped\n");
+    return 0;
+}
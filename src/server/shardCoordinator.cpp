@@ -0,0 +1,232 @@
+// implementation of the scatter-gather coordinator
+
+#include "server/shardCoordinator.hpp"
+#include "common/metrics.hpp"
+#include "common/parallelStrategy.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace protocol;
+
+// a shard that went away must not kill the coordinator with SIGPIPE (see queryServer.cpp)
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static int connectEndpoint(const std::string& endpoint, int timeoutMs) {
+    int fd = -1;
+    if (endpoint.find('/') != std::string::npos) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (endpoint.size() >= sizeof(addr.sun_path)) throw std::runtime_error("socket path too long: " + endpoint);
+        std::strcpy(addr.sun_path, endpoint.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        // "port" means a shard on this host
+        size_t colon = endpoint.rfind(':');
+        std::string host = colon == std::string::npos ? "127.0.0.1" : endpoint.substr(0, colon);
+        std::string port = colon == std::string::npos ? endpoint : endpoint.substr(colon + 1);
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+            throw std::runtime_error("can't resolve shard " + endpoint);
+        }
+        for (addrinfo* a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd >= 0) {
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+    }
+    if (fd < 0) throw std::runtime_error("shard " + endpoint + " unreachable: " + strerror(errno));
+
+    // blocking socket with timeouts, a hung shard fails the query instead of a worker forever
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static bool recvAll(int fd, char* out, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        ssize_t n = recv(fd, out + received, length - received, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+// one whole frame, false on timeout or a closed connection
+static bool readFrame(int fd, std::string& payload) {
+    uint32_t length;
+    if (!recvAll(fd, reinterpret_cast<char*>(&length), sizeof(length))) return false;
+    if (length > MAX_FRAME_BYTES) return false;
+    payload.resize(length);
+    return length == 0 || recvAll(fd, &payload[0], length);
+}
+
+ShardCoordinator::ShardCoordinator(const std::vector<std::string>& endpoints, int timeout)
+    : timeoutMs(timeout) {
+    if (endpoints.empty()) throw std::runtime_error("coordinator needs at least one shard");
+    for (const std::string& endpoint : endpoints) {
+        std::unique_ptr<Shard> shard(new Shard());
+        shard->endpoint = endpoint;
+        shards.push_back(std::move(shard));
+    }
+}
+
+ShardCoordinator::~ShardCoordinator() {
+    for (auto& shard : shards) {
+        for (int fd : shard->idle) close(fd);
+    }
+}
+
+// a shard answering CANCELLED only sends QueryCancelled's message, the reason is read back from it
+static StopReason shardStopReason(const std::string& error) {
+    if (error.compare(0, 17, "deadline exceeded") == 0) return StopReason::DEADLINE;
+    if (error.compare(0, 21, "memory limit exceeded") == 0) return StopReason::MEMORY_LIMIT;
+    return StopReason::CANCELLED;
+}
+
+int ShardCoordinator::acquire(Shard& shard) const {
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.idle.empty()) {
+            int fd = shard.idle.back();
+            shard.idle.pop_back();
+            return fd;
+        }
+    }
+    return connectEndpoint(shard.endpoint, timeoutMs);
+}
+
+void ShardCoordinator::release(Shard& shard, int fd) const {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.idle.push_back(fd);
+}
+
+std::string ShardCoordinator::execute(const Request& request) {
+    static Histogram& queryTime = MetricsRegistry::instance().histogram(
+        "coordinator_query_seconds", "Time to fan a query out to every shard and merge the answers");
+    static Counter& shardErrors = MetricsRegistry::instance().counter(
+        "coordinator_shard_errors_total", "Queries failed by an unreachable or failing shard");
+
+    uint64_t start = steadyNowNs();
+    // parsed here too: the merge depends on the query type (and k), and a bad query never fans out
+    FireQuery query = FireQuery::parse(request.query);
+
+    // row counts of plain filters simply add up, top-k and aggregates have to be merged first
+    bool additiveCount = (request.flags & COUNT_ONLY) && query.type != FireQueryType::TOP_CONCENTRATION &&
+                         query.type != FireQueryType::AVERAGE_CONCENTRATION &&
+                         query.type != FireQueryType::COUNT_BY_CATEGORY;
+    Request shardRequest = request;
+    shardRequest.id = 1;  // one request in flight per connection
+    shardRequest.flags = PARTIAL | (additiveCount ? COUNT_ONLY : 0);
+    std::string frameBytes = encodeRequest(shardRequest);
+
+    std::vector<int> fds(shards.size(), -1);
+    FireQueryResult merged;
+    uint64_t count = 0;
+    try {
+        // scatter: every shard gets the query before any answer is read, so they all run at once
+        for (size_t i = 0; i < shards.size(); ++i) {
+            fds[i] = acquire(*shards[i]);
+            if (!sendAll(fds[i], frameBytes)) {
+                // a pooled connection the shard closed meanwhile (restart), one retry on a fresh one
+                close(fds[i]);
+                fds[i] = -1;
+                fds[i] = connectEndpoint(shards[i]->endpoint, timeoutMs);
+                if (!sendAll(fds[i], frameBytes)) {
+                    throw std::runtime_error("shard " + shards[i]->endpoint + " closed the connection");
+                }
+            }
+        }
+        // gather in shard order. the shards hold contiguous ranges of the files sorted by name and load
+        // them in that order, so shard order followed by each shard's load order is the load order of
+        // one server holding every file: a PREFIX limit's first matches stay the first ones after the
+        // cut. that doesn't hold with --cluster (rows regrouped by site inside every shard), and
+        // unlimited, unordered filter results keep no particular order within a shard anyway
+        std::string payload;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (!readFrame(fds[i], payload)) {
+                throw std::runtime_error("shard " + shards[i]->endpoint + " did not answer");
+            }
+            Response response = decodeResponse(payload);
+            release(*shards[i], fds[i]);
+            fds[i] = -1;
+            if (response.status == Status::CANCELLED) {
+                // a shard over its time or memory budget stops the query, it didn't fail: the client
+                // gets CANCELLED too
+                throw QueryCancelled(shardStopReason(response.error),
+                                     "shard " + shards[i]->endpoint + ": " + response.error);
+            }
+            if (response.status != Status::OK) {
+                throw std::runtime_error("shard " + shards[i]->endpoint + ": " + response.error);
+            }
+            if (additiveCount) {
+                count += response.count;
+            } else {
+                merged.merge(query, takeFireResult(response));
+            }
+        }
+    } catch (const std::exception& e) {
+        // connections with an answer still in flight can't be reused
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+        if (dynamic_cast<const QueryCancelled*>(&e) == nullptr) shardErrors.add();
+        throw;
+    }
+
+    uint32_t serverUs = static_cast<uint32_t>((steadyNowNs() - start) / 1000);
+    queryTime.observe((steadyNowNs() - start) / 1e9);
+    if (additiveCount) {
+        // every shard counted up to the limit on its own
+        if (query.limit != 0) count = std::min<uint64_t>(count, query.limit);
+        std::string payload;
+        Writer w(payload);
+        writeResponseHeader(w, request.id, Status::OK, ResponseKind::COUNT, serverUs);
+        w.u64(count);
+        return frame(payload);
+    }
+    return encodeFireResult(request.id, request.flags, query, merged, serverUs);
+}
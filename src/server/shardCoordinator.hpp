@@ -0,0 +1,48 @@
+// Scatter-gather execution of fire queries over shard servers
+//
+// every shard is a query_server holding one date range of the fire data (query_server --shard i/n).
+// the coordinator sends each query to all shards at once, asks them for partial results (aggregates
+// as mergeable state) and merges the answers with FireQueryResult::merge: filter results are
+// concatenated, top-k lists merged, counts and average states added up.
+#ifndef SHARD_COORDINATOR_HPP
+#define SHARD_COORDINATOR_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "server/protocol.hpp"
+
+class ShardCoordinator {
+private:
+    // one shard endpoint with a pool of idle connections, workers borrow one per query
+    struct Shard {
+        std::string endpoint;
+        std::mutex mutex;
+        std::vector<int> idle;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    int timeoutMs;
+
+    // throws std::runtime_error when the shard can't be reached
+    int acquire(Shard& shard) const;
+    void release(Shard& shard, int fd) const;
+
+public:
+    // endpoints are unix socket paths (anything containing a '/') or host:port / port for tcp
+    // a shard that doesn't answer within timeoutMs fails the query
+    explicit ShardCoordinator(const std::vector<std::string>& endpoints, int timeoutMs = 30000);
+    ~ShardCoordinator();
+
+    // runs a fire request on every shard and returns the framed, merged response
+    // throws std::runtime_error when a shard is unreachable or answers with an error
+    std::string execute(const protocol::Request& request);
+
+    size_t shardCount() const { return shards.size(); }
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+};
+
+#endif
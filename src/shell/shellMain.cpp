@@ -0,0 +1,225 @@
+// interactive query shell: loads the fire data once and runs statements of the query language
+// (firedata/fireSql.hpp) against it, timing every one
+// usage: query_shell (--fire <path> [--cluster] | --fire-shared <name>) [--strategy <label>]
+//                    [--max-rows N] [--timeout-ms N] [--memory-mb N] [-c <statement>]...
+//
+// statements end with ';' and can span lines. -c runs the given statements and exits instead of
+// reading stdin. ctrl-c stops the running statement (at its next chunk) instead of the shell,
+// --timeout-ms stops every statement that runs longer, --memory-mb every one holding more than N MB
+// (the peak of each is printed with its time). shell commands start with a backslash:
+//   \profile          toggles printing the query profile after every statement
+//   \strategy <label> openmp, centralized_queue or round_robin
+//   \help             the grammar
+//   \q                quits (so does the end of input)
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "firedata/fireSql.hpp"
+
+struct ShellSettings {
+    ParallelStrategy strategy = ParallelStrategy::OPENMP;
+    size_t maxRows = 100;     // printed per result, the row count is always the full one
+    bool profile = false;
+    double timeoutMs = 0;     // 0 = none
+    size_t memoryBytes = 0;   // 0 = no limit
+};
+
+// ctrl-c cancels the statement that is running, between statements it quits as usual
+static CancellationToken interrupt;
+static std::atomic<bool> statementRunning{false};
+
+static void onInterrupt(int) {
+    if (!statementRunning.load()) _exit(130);
+    interrupt.cancel();
+}
+
+static bool parseStrategy(const std::string& label, ParallelStrategy& strategy) {
+    const ParallelStrategy all[] = {ParallelStrategy::OPENMP, ParallelStrategy::CENTRALIZED_QUEUE,
+                                    ParallelStrategy::ROUND_ROBIN};
+    for (ParallelStrategy s : all) {
+        if (label == strategyLabel(s)) {
+            strategy = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+// columns padded to their widest cell among the printed rows
+static void printResult(const FireSqlResult& result, size_t maxRows) {
+    size_t shown = std::min(result.rows(), maxRows);
+    std::vector<size_t> widths;
+    for (const std::string& name : result.header) widths.push_back(name.size());
+    std::vector<std::vector<std::string>> cells(shown);
+    for (size_t row = 0; row < shown; ++row) {
+        for (size_t column = 0; column < widths.size(); ++column) {
+            cells[row].push_back(result.cell(row, column));
+            widths[column] = std::max(widths[column], cells[row].back().size());
+        }
+    }
+    auto printRow = [&](const std::vector<std::string>& values) {
+        for (size_t column = 0; column < values.size(); ++column) {
+            printf("%s%-*s", column > 0 ? " | " : "", static_cast<int>(widths[column]), values[column].c_str());
+        }
+        printf("\n");
+    };
+    printRow(result.header);
+    for (size_t column = 0; column < widths.size(); ++column) {
+        printf("%s%s", column > 0 ? "-+-" : "", std::string(widths[column], '-').c_str());
+    }
+    printf("\n");
+    for (const std::vector<std::string>& row : cells) printRow(row);
+    if (shown < result.rows()) printf("... %zu more rows\n", result.rows() - shown);
+}
+
+static void runStatement(const FireData& fireData, const std::string& text, const ShellSettings& settings) {
+    QueryProfile profile;
+    QueryOptions options;
+    if (settings.profile) options.profile = &profile;
+    if (settings.timeoutMs > 0) options.stop = StopCondition::timeout(settings.timeoutMs);
+    options.stop.token = &interrupt;
+    QueryMemory memory(settings.memoryBytes);
+    options.stop.memory = &memory;
+    interrupt.reset();
+    statementRunning = true;
+    try {
+        uint64_t start = steadyNowNs();
+        FireSqlResult result = executeFireSql(fireData, text, settings.strategy, options);
+        uint64_t elapsed = steadyNowNs() - start;
+        statementRunning = false;
+        if (result.explain) {
+            printf("%s", result.plan.c_str());
+            return;
+        }
+        printResult(result, settings.maxRows);
+        printf("(%zu row%s, %.3f ms, peak %.2f MB)\n", result.rows(), result.rows() == 1 ? "" : "s",
+               elapsed / 1e6, memory.peakBytes() / (1024.0 * 1024.0));
+        if (settings.profile) profile.print();
+    } catch (const std::exception& e) {
+        statementRunning = false;
+        printf("error: %s\n", e.what());
+    }
+}
+
+static void printHelp() {
+    printf("SELECT items FROM fire [WHERE condition] [GROUP BY column, ...]\n"
+           "       [ORDER BY item [ASC | DESC]] [LIMIT n];\n"
+           "items:      *, columns, count(*), sum/avg/min/max(column)\n"
+           "conditions: column = != < <= > >= literal, column [NOT] BETWEEN a AND b,\n"
+           "            column [NOT] IN (a, b, ...), AND, OR, NOT, parentheses\n"
+           "columns:    latitude longitude utc (or time) pollutant concentration unit rawConcentration\n"
+           "            aqi category site agency aqsId fullAqsId\n"
+           "EXPLAIN SELECT ... shows the plan without running it\n"
+           "\\profile  \\strategy <label>  \\help  \\q\n");
+}
+
+// true to keep going, false on \q
+static bool runCommand(const std::string& line, ShellSettings& settings) {
+    std::string command = line.substr(0, line.find(' '));
+    std::string argument = command.size() < line.size() ? line.substr(command.size() + 1) : "";
+    if (command == "\\q") return false;
+    if (command == "\\profile") {
+        settings.profile = !settings.profile;
+        printf("profile %s\n", settings.profile ? "on" : "off");
+    } else if (command == "\\strategy") {
+        if (parseStrategy(argument, settings.strategy)) {
+            printf("strategy %s\n", strategyToString(settings.strategy));
+        } else {
+            printf("error: unknown strategy %s (openmp, centralized_queue, round_robin)\n", argument.c_str());
+        }
+    } else if (command == "\\help") {
+        printHelp();
+    } else {
+        printf("error: unknown command %s, \\help lists them\n", command.c_str());
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string firePath, fireShared;
+    bool cluster = false;
+    std::vector<std::string> statements;
+    ShellSettings settings;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--fire" && i + 1 < argc) {
+            firePath = argv[++i];
+        } else if (arg == "--fire-shared" && i + 1 < argc) {
+            fireShared = argv[++i];
+        } else if (arg == "--cluster") {
+            cluster = true;
+        } else if (arg == "--strategy" && i + 1 < argc) {
+            if (!parseStrategy(argv[++i], settings.strategy)) {
+                printf("error: unknown strategy %s\n", argv[i]);
+                return 2;
+            }
+        } else if (arg == "--max-rows" && i + 1 < argc) {
+            settings.maxRows = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--timeout-ms" && i + 1 < argc) {
+            settings.timeoutMs = std::atof(argv[++i]);
+        } else if (arg == "--memory-mb" && i + 1 < argc) {
+            settings.memoryBytes = static_cast<size_t>(std::atof(argv[++i]) * 1024 * 1024);
+        } else if (arg == "-c" && i + 1 < argc) {
+            statements.push_back(argv[++i]);
+        } else {
+            printf("usage: %s (--fire <path> [--cluster] | --fire-shared <name>) [--strategy <label>]\n"
+                   "       [--max-rows N] [--timeout-ms N] [--memory-mb N] [-c <statement>]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (firePath.empty() == fireShared.empty()) {
+        printf("error: give the fire data, --fire <path> or --fire-shared <name>\n");
+        return 2;
+    }
+
+    FireData fireData;
+    try {
+        if (!firePath.empty()) {
+            fireData.loadFromDirectory(firePath);
+            if (cluster) fireData.clusterByLocation();
+        } else {
+            fireData.attachShared(fireShared);
+        }
+    } catch (const std::exception& e) {
+        printf("error: %s\n", e.what());
+        return 1;
+    }
+
+    std::signal(SIGINT, onInterrupt);
+    if (!statements.empty()) {
+        for (const std::string& statement : statements) runStatement(fireData, statement, settings);
+        return 0;
+    }
+
+    bool interactive = isatty(STDIN_FILENO);
+    if (interactive) printf("%zu fire records loaded, \\help for the syntax, \\q to quit\n", fireData.size());
+    std::string pending, line;
+    while (true) {
+        if (interactive) {
+            printf(pending.empty() ? "fire> " : " ...> ");
+            fflush(stdout);
+        }
+        if (!std::getline(std::cin, line)) break;
+        if (pending.empty() && line.find_first_not_of(" \t") == std::string::npos) continue;
+        if (pending.empty() && line[line.find_first_not_of(" \t")] == '\\') {
+            if (!runCommand(line.substr(line.find_first_not_of(" \t")), settings)) return 0;
+            continue;
+        }
+        pending += line + "\n";
+        // a statement runs once a line ends with ';'
+        size_t last = line.find_last_not_of(" \t\r");
+        if (last != std::string::npos && line[last] == ';') {
+            runStatement(fireData, pending, settings);
+            pending.clear();
+        }
+    }
+    if (pending.find_first_not_of(" \t\r\n") != std::string::npos) runStatement(fireData, pending, settings);
+    return 0;
+}
@@ -0,0 +1,331 @@
+// benchmark regression gate
+// compares a --json output of test_fire / test_population against a stored baseline
+// usage: bench_compare <baseline.json> <current.json> [--alpha 0.05] [--threshold 0.05] [--update]
+//
+// per benchmark (matched by name) it runs a two-sided Mann-Whitney U test on the raw samples
+// and reports the median change and Cliff's delta as effect sizes. a benchmark only counts as a
+// regression/improvement when the test is significant AND the median moved by more than the
+// threshold, so tiny but real shifts don't fail the build. with too few samples for the test we
+// fall back to checking whether the bootstrap confidence intervals of the median overlap.
+// exit code: 0 = no regressions, 1 = at least one regression, 2 = bad input
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "test/benchmark.hpp"
+
+// ============================================================================
+// minimal json reader, just enough for the files BenchmarkReport writes
+// ============================================================================
+struct JsonValue {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::map<std::string, JsonValue> fields;
+
+    const JsonValue* get(const std::string& key) const {
+        auto it = fields.find(key);
+        return it == fields.end() ? nullptr : &it->second;
+    }
+};
+
+class JsonParser {
+private:
+    const std::string& src;
+    size_t pos;
+
+    void skipSpace() {
+        while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos]))) pos++;
+    }
+
+    char peek() {
+        skipSpace();
+        if (pos >= src.size()) throw std::runtime_error("unexpected end of json");
+        return src[pos];
+    }
+
+    void expect(char c) {
+        if (peek() != c) {
+            throw std::runtime_error(std::string("expected '") + c + "' at offset " + std::to_string(pos));
+        }
+        pos++;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string out;
+        while (pos < src.size() && src[pos] != '"') {
+            if (src[pos] == '\\' && pos + 1 < src.size()) pos++;
+            out += src[pos++];
+        }
+        expect('"');
+        return out;
+    }
+
+public:
+    JsonParser(const std::string& text) : src(text), pos(0) {}
+
+    JsonValue parse() {
+        JsonValue value;
+        char c = peek();
+        if (c == '{') {
+            value.type = JsonValue::OBJECT;
+            pos++;
+            if (peek() == '}') { pos++; return value; }
+            while (true) {
+                std::string key = parseString();
+                expect(':');
+                value.fields[key] = parse();
+                if (peek() == ',') { pos++; continue; }
+                expect('}');
+                break;
+            }
+        } else if (c == '[') {
+            value.type = JsonValue::ARRAY;
+            pos++;
+            if (peek() == ']') { pos++; return value; }
+            while (true) {
+                value.items.push_back(parse());
+                if (peek() == ',') { pos++; continue; }
+                expect(']');
+                break;
+            }
+        } else if (c == '"') {
+            value.type = JsonValue::STRING;
+            value.text = parseString();
+        } else if (src.compare(pos, 4, "true") == 0 || src.compare(pos, 5, "false") == 0) {
+            value.type = JsonValue::BOOL;
+            value.boolean = src[pos] == 't';
+            pos += value.boolean ? 4 : 5;
+        } else if (src.compare(pos, 4, "null") == 0) {
+            pos += 4;
+        } else {
+            value.type = JsonValue::NUMBER;
+            size_t used = 0;
+            value.number = std::stod(src.substr(pos, 32), &used);
+            pos += used;
+        }
+        return value;
+    }
+};
+
+// one benchmark entry from a report file
+struct BenchmarkSamples {
+    std::string name;
+    std::vector<double> samples;
+    double medianLow = 0.0;
+    double medianHigh = 0.0;
+};
+
+std::map<std::string, BenchmarkSamples> loadReport(const std::string& path, std::string& suite) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+    JsonValue root = JsonParser(text).parse();
+
+    const JsonValue* suiteValue = root.get("suite");
+    suite = suiteValue ? suiteValue->text : "";
+
+    std::map<std::string, BenchmarkSamples> result;
+    const JsonValue* benchmarks = root.get("benchmarks");
+    if (!benchmarks || benchmarks->type != JsonValue::ARRAY) {
+        throw std::runtime_error(path + " has no benchmarks array");
+    }
+    for (const auto& entry : benchmarks->items) {
+        BenchmarkSamples bench;
+        const JsonValue* name = entry.get("name");
+        const JsonValue* samples = entry.get("samples");
+        const JsonValue* ci = entry.get("median_ci95");
+        if (!name || !samples) continue;
+        bench.name = name->text;
+        for (const auto& s : samples->items) {
+            bench.samples.push_back(s.number);
+        }
+        if (ci && ci->items.size() == 2) {
+            bench.medianLow = ci->items[0].number;
+            bench.medianHigh = ci->items[1].number;
+        }
+        result[bench.name] = bench;
+    }
+    return result;
+}
+
+// ============================================================================
+// statistics
+// ============================================================================
+struct MannWhitneyResult {
+    double u;          // U statistic of the current sample
+    double pValue;     // two-sided, normal approximation with tie correction
+    double cliffDelta; // P(cur > base) - P(cur < base), in [-1, 1]
+};
+
+MannWhitneyResult mannWhitney(const std::vector<double>& base, const std::vector<double>& cur) {
+    // rank the pooled samples, ties get the average rank
+    std::vector<std::pair<double, int>> pooled;
+    for (double v : base) pooled.push_back({v, 0});
+    for (double v : cur) pooled.push_back({v, 1});
+    std::sort(pooled.begin(), pooled.end());
+
+    double n1 = base.size();
+    double n2 = cur.size();
+    double rankSumCur = 0.0;
+    double tieTerm = 0.0;
+    size_t i = 0;
+    while (i < pooled.size()) {
+        size_t j = i;
+        while (j < pooled.size() && pooled[j].first == pooled[i].first) j++;
+        double avgRank = (i + 1 + j) / 2.0;  // ranks are 1-based
+        double ties = j - i;
+        tieTerm += ties * ties * ties - ties;
+        for (size_t k = i; k < j; ++k) {
+            if (pooled[k].second == 1) rankSumCur += avgRank;
+        }
+        i = j;
+    }
+
+    MannWhitneyResult result;
+    result.u = rankSumCur - n2 * (n2 + 1) / 2.0;
+    result.cliffDelta = 2.0 * result.u / (n1 * n2) - 1.0;
+
+    double n = n1 + n2;
+    double meanU = n1 * n2 / 2.0;
+    double varU = n1 * n2 / 12.0 * ((n + 1) - tieTerm / (n * (n - 1)));
+    if (varU <= 0.0) {
+        result.pValue = 1.0;
+        return result;
+    }
+    // continuity correction of 0.5 towards the mean
+    double z = (std::fabs(result.u - meanU) - 0.5) / std::sqrt(varU);
+    if (z < 0.0) z = 0.0;
+    result.pValue = std::erfc(z / std::sqrt(2.0));
+    return result;
+}
+
+double sampleMedian(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return percentileSorted(values, 50.0);
+}
+
+// ============================================================================
+// main
+// ============================================================================
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        printf("usage: %s <baseline.json> <current.json> [--alpha 0.05] [--threshold 0.05] [--update]\n", argv[0]);
+        return 2;
+    }
+
+    std::string baselinePath = argv[1];
+    std::string currentPath = argv[2];
+    double alpha = 0.05;      // significance level of the test
+    double threshold = 0.05;  // minimum relative change of the median that we care about
+    bool update = false;      // overwrite the baseline when the gate passes
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--alpha" && i + 1 < argc) {
+            alpha = std::atof(argv[++i]);
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else if (arg == "--update") {
+            update = true;
+        } else {
+            printf("unknown argument: %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    std::map<std::string, BenchmarkSamples> baseline;
+    std::map<std::string, BenchmarkSamples> current;
+    std::string baselineSuite, currentSuite;
+    try {
+        baseline = loadReport(baselinePath, baselineSuite);
+        current = loadReport(currentPath, currentSuite);
+    } catch (const std::exception& e) {
+        printf("error: %s\n", e.what());
+        return 2;
+    }
+
+    if (baselineSuite != currentSuite) {
+        printf("warning: comparing suite '%s' against baseline suite '%s'\n",
+               currentSuite.c_str(), baselineSuite.c_str());
+    }
+
+    printf("\n%-60s %10s %10s %8s %8s %8s  %s\n",
+           "Benchmark", "base p50", "cur p50", "change", "p-value", "delta", "verdict");
+
+    int regressions = 0;
+    int improvements = 0;
+    for (const auto& pair : current) {
+        const BenchmarkSamples& cur = pair.second;
+        auto it = baseline.find(pair.first);
+        if (it == baseline.end()) {
+            printf("%-60s %10s %10.3f %8s %8s %8s  new\n",
+                   cur.name.c_str(), "-", sampleMedian(cur.samples), "-", "-", "-");
+            continue;
+        }
+        const BenchmarkSamples& base = it->second;
+        if (base.samples.empty() || cur.samples.empty()) continue;
+
+        double baseMedian = sampleMedian(base.samples);
+        double curMedian = sampleMedian(cur.samples);
+        double change = baseMedian > 0.0 ? (curMedian - baseMedian) / baseMedian : 0.0;
+
+        bool significant;
+        double pValue = NAN;
+        double delta = NAN;
+        // the normal approximation is poor below ~5 samples per side, use CI overlap there
+        if (base.samples.size() >= 5 && cur.samples.size() >= 5) {
+            MannWhitneyResult test = mannWhitney(base.samples, cur.samples);
+            pValue = test.pValue;
+            delta = test.cliffDelta;
+            significant = pValue < alpha;
+        } else {
+            significant = cur.medianLow > base.medianHigh || cur.medianHigh < base.medianLow;
+        }
+
+        const char* verdict = "same";
+        if (significant && change > threshold) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (significant && change < -threshold) {
+            verdict = "improvement";
+            improvements++;
+        }
+
+        printf("%-60s %10.3f %10.3f %+7.1f%% %8.4f %+8.3f  %s\n",
+               cur.name.c_str(), baseMedian, curMedian, change * 100.0, pValue, delta, verdict);
+    }
+
+    for (const auto& pair : baseline) {
+        if (current.find(pair.first) == current.end()) {
+            printf("%-60s missing from current run\n", pair.first.c_str());
+        }
+    }
+
+    printf("\n%d regression(s), %d improvement(s) (alpha %.3f, threshold %.1f%%)\n",
+           regressions, improvements, alpha, threshold * 100.0);
+
+    if (update && regressions == 0) {
+        std::ifstream src(currentPath, std::ios::binary);
+        std::ofstream dst(baselinePath, std::ios::binary);
+        dst << src.rdbuf();
+        printf("Baseline %s updated from %s\n", baselinePath.c_str(), currentPath.c_str());
+    }
+
+    return regressions > 0 ? 1 : 0;
+}
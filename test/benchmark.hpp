@@ -5,10 +5,30 @@
 
 #include <chrono>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <numeric>
 #include <algorithm>
+#include <random>
 #include <cmath>
+#include <cstdio>
+#include "common/allocTracker.hpp"
+
+// names and keys as json strings: quotes and backslashes become '/' like in the trace writer, control
+// characters a space, so names built from query text (site names, ...) can't break the document
+inline std::string jsonSafeName(const std::string& name) {
+    std::string out = name;
+    for (char& c : out) {
+        if (c == '"' || c == '\\') {
+            c = '/';
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            c = ' ';
+        }
+    }
+    return out;
+}
 
 class Timer {
 private:
@@ -43,20 +63,175 @@ public:
     }
 };
 
+// Controls how many times a benchmark body is run
+// warmup runs are executed but not recorded (cold caches, page faults, lazy allocations)
+// after minIterations we keep going until the 95% confidence interval of the mean is
+// within targetRelativeCI of the mean, or we hit maxIterations / maxTotalMs
+struct BenchmarkConfig {
+    int warmupIterations = 1;
+    int minIterations = 5;
+    int maxIterations = 50;
+    double targetRelativeCI = 0.02;  // +-2% of the mean
+    double maxTotalMs = 60000.0;     // stop adding iterations after this much measured time
+};
+
+// Two-sided 95% critical values of Student's t for 1..30 degrees of freedom
+inline double studentT95(size_t degreesOfFreedom) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (degreesOfFreedom == 0) return INFINITY;
+    if (degreesOfFreedom <= 30) return table[degreesOfFreedom - 1];
+    return 1.96;  // close enough to the normal distribution past 30
+}
+
+// Percentile of an already sorted vector using linear interpolation between closest ranks
+// p is in [0, 100]
+inline double percentileSorted(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    double rank = (p / 100.0) * (sorted.size() - 1);
+    size_t lower = static_cast<size_t>(std::floor(rank));
+    size_t upper = static_cast<size_t>(std::ceil(rank));
+    double frac = rank - lower;
+    return sorted[lower] + (sorted[upper] - sorted[lower]) * frac;
+}
+
 class BenchmarkStats {
 private:
     // Dynamic array storing all timing measurements in milliseconds
     std::vector<double> timings;
     std::string name;
+    int warmups;
+
+    // Creates a sorted copy so percentile/median/min/max can be read off directly
+    std::vector<double> sortedTimings() const {
+        std::vector<double> sorted = timings;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
 
 public:
     // Constructor takes const reference to avoid copying the string (more efficient)
-    BenchmarkStats(const std::string& benchName) : name(benchName) {}
+    BenchmarkStats(const std::string& benchName) : name(benchName), warmups(0) {}
 
     void addTiming(double ms) {
         timings.push_back(ms);
     }
 
+    // warmup timings are only counted, never used in the statistics
+    void addWarmup() { warmups++; }
+
+    const std::string& getName() const { return name; }
+    const std::vector<double>& getTimings() const { return timings; }
+    size_t count() const { return timings.size(); }
+
+    double mean() const {
+        if (timings.empty()) return 0.0;
+        // std::accumulate sums all values in the range, starting from 0.0
+        return std::accumulate(timings.begin(), timings.end(), 0.0) / timings.size();
+    }
+
+    // Sample standard deviation (n - 1 in the denominator since timings are a sample)
+    double stddev() const {
+        if (timings.size() < 2) return 0.0;
+        double m = mean();
+        double variance = 0.0;
+        for (double t : timings) {
+            variance += (t - m) * (t - m);
+        }
+        return std::sqrt(variance / (timings.size() - 1));
+    }
+
+    double percentile(double p) const {
+        return percentileSorted(sortedTimings(), p);
+    }
+
+    double median() const { return percentile(50.0); }
+
+    // Median absolute deviation, a spread estimate that a few outliers can't blow up
+    double mad() const {
+        if (timings.empty()) return 0.0;
+        double med = median();
+        std::vector<double> deviations;
+        deviations.reserve(timings.size());
+        for (double t : timings) {
+            deviations.push_back(std::fabs(t - med));
+        }
+        std::sort(deviations.begin(), deviations.end());
+        return percentileSorted(deviations, 50.0);
+    }
+
+    // Mean absolute deviation from the median
+    double meanAbsoluteDeviation() const {
+        if (timings.empty()) return 0.0;
+        double med = median();
+        double sum = 0.0;
+        for (double t : timings) {
+            sum += std::fabs(t - med);
+        }
+        return sum / timings.size();
+    }
+
+    // Timings whose modified z-score (0.6745 * |x - median| / MAD) is above 3.5. MAD is 0 once more than
+    // half the timings are the same (cached or ms-quantized runs), then the score uses the mean absolute
+    // deviation instead (0.7979 * |x - median| / meanAD, Iglewicz and Hoaglin). if that is 0 as well,
+    // every timing off the median counts
+    std::vector<double> outliers() const {
+        std::vector<double> result;
+        double med = median();
+        double scale = 0.6745;
+        double spread = mad();
+        if (spread == 0.0) {
+            scale = 0.7979;
+            spread = meanAbsoluteDeviation();
+        }
+        for (double t : timings) {
+            double deviation = std::fabs(t - med);
+            if (spread == 0.0 ? deviation > 0.0 : scale * deviation / spread > 3.5) {
+                result.push_back(t);
+            }
+        }
+        return result;
+    }
+
+    // Half width of the t-based 95% confidence interval of the mean, relative to the mean
+    double relativeCIHalfWidth() const {
+        if (timings.size() < 2) return INFINITY;
+        double m = mean();
+        if (m == 0.0) return 0.0;
+        double halfWidth = studentT95(timings.size() - 1) * stddev() / std::sqrt((double)timings.size());
+        return halfWidth / m;
+    }
+
+    // Percentile bootstrap confidence interval for the mean (useMedian=false) or median
+    // resamples the timings with replacement, fixed seed so reruns print the same interval
+    std::pair<double, double> bootstrapCI(bool useMedian, double confidence = 0.95,
+                                          int resamples = 2000) const {
+        if (timings.empty()) return {0.0, 0.0};
+        std::mt19937_64 rng(12345);
+        std::uniform_int_distribution<size_t> pick(0, timings.size() - 1);
+        std::vector<double> estimates;
+        estimates.reserve(resamples);
+        std::vector<double> sample(timings.size());
+
+        for (int r = 0; r < resamples; ++r) {
+            for (size_t i = 0; i < sample.size(); ++i) {
+                sample[i] = timings[pick(rng)];
+            }
+            if (useMedian) {
+                std::sort(sample.begin(), sample.end());
+                estimates.push_back(percentileSorted(sample, 50.0));
+            } else {
+                estimates.push_back(std::accumulate(sample.begin(), sample.end(), 0.0) / sample.size());
+            }
+        }
+        std::sort(estimates.begin(), estimates.end());
+        double tail = (1.0 - confidence) / 2.0 * 100.0;
+        return {percentileSorted(estimates, tail), percentileSorted(estimates, 100.0 - tail)};
+    }
+
     void printStatistics() const {
         if (timings.empty()) {
             // .c_str() converts C++ string to C-style char* for printf
@@ -64,40 +239,138 @@ public:
             return;
         }
 
-        // std::accumulate sums all values in the range, starting from 0.0
-        double sum = std::accumulate(timings.begin(), timings.end(), 0.0);
-        double mean = sum / timings.size();
-
-        // Creates a copy to sort 
-        std::vector<double> sorted = timings;
-        // Sorts in ascending order for median/min/max calculations
-        std::sort(sorted.begin(), sorted.end());
-        double median = sorted[sorted.size() / 2];
-        // .front() gets first element, .back() gets last element
-        double min = sorted.front();
-        double max = sorted.back();
-
-        // Calculate variance (average of squared differences from mean)
-        double variance = 0.0;
-        // Range-based for loop iterates through each timing value
-        for (double t : timings) {
-            variance += (t - mean) * (t - mean);
-        }
-        variance /= timings.size();
-        // Standard deviation is square root of variance
-        double stddev = std::sqrt(variance);
+        std::vector<double> sorted = sortedTimings();
+        auto meanCI = bootstrapCI(false);
+        auto medianCI = bootstrapCI(true);
+        std::vector<double> outlierValues = outliers();
 
         printf("\n=== %s ===\n", name.c_str());
         // %zu is the format specifier for size_t type
-        printf("Iterations: %zu\n", timings.size());
+        printf("Iterations: %zu (+%d warmup)\n", timings.size(), warmups);
         // %.3f formats double with 3 decimal places
-        printf("Mean:       %.3f ms\n", mean);
-        printf("Median:     %.3f ms\n", median);
-        printf("Min:        %.3f ms\n", min);
-        printf("Max:        %.3f ms\n", max);
-        printf("Std Dev:    %.3f ms\n", stddev);
+        printf("Mean:       %.3f ms  [95%% CI %.3f - %.3f]\n", mean(), meanCI.first, meanCI.second);
+        printf("Median:     %.3f ms  [95%% CI %.3f - %.3f]\n",
+               percentileSorted(sorted, 50.0), medianCI.first, medianCI.second);
+        printf("p90/p99:    %.3f / %.3f ms\n",
+               percentileSorted(sorted, 90.0), percentileSorted(sorted, 99.0));
+        printf("p99.9:      %.3f ms\n", percentileSorted(sorted, 99.9));
+        // .front() gets first element, .back() gets last element
+        printf("Min:        %.3f ms\n", sorted.front());
+        printf("Max:        %.3f ms\n", sorted.back());
+        printf("Std Dev:    %.3f ms\n", stddev());
+        printf("MAD:        %.3f ms\n", mad());
+        printf("Outliers:   %zu\n", outlierValues.size());
         printf("================================\n\n");
     }
+
+    // Serializes the summary plus raw samples, the samples are what the compare tool tests on
+    std::string toJson() const {
+        std::ostringstream out;
+        out.precision(6);
+        out << std::fixed;
+        std::vector<double> sorted = sortedTimings();
+        auto meanCI = bootstrapCI(false);
+        auto medianCI = bootstrapCI(true);
+
+        out << "{\"name\": \"" << jsonSafeName(name) << "\", "
+            << "\"iterations\": " << timings.size() << ", "
+            << "\"warmup\": " << warmups << ", "
+            << "\"mean\": " << mean() << ", "
+            << "\"stddev\": " << stddev() << ", "
+            << "\"min\": " << (sorted.empty() ? 0.0 : sorted.front()) << ", "
+            << "\"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << ", "
+            << "\"p50\": " << percentileSorted(sorted, 50.0) << ", "
+            << "\"p90\": " << percentileSorted(sorted, 90.0) << ", "
+            << "\"p99\": " << percentileSorted(sorted, 99.0) << ", "
+            << "\"p999\": " << percentileSorted(sorted, 99.9) << ", "
+            << "\"mad\": " << mad() << ", "
+            << "\"outliers\": " << outliers().size() << ", "
+            << "\"mean_ci95\": [" << meanCI.first << ", " << meanCI.second << "], "
+            << "\"median_ci95\": [" << medianCI.first << ", " << medianCI.second << "], "
+            << "\"samples\": [";
+        for (size_t i = 0; i < timings.size(); ++i) {
+            if (i > 0) out << ", ";
+            out << timings[i];
+        }
+        out << "]}";
+        return out.str();
+    }
+};
+
+// Runs body() warmup + adaptive number of times, body returns the elapsed ms of one iteration
+// (the caller times it so setup work like constructing a new FireData isn't measured)
+template<typename Body>
+void runBenchmark(BenchmarkStats& stats, const BenchmarkConfig& config, Body body) {
+    for (int i = 0; i < config.warmupIterations; ++i) {
+        body(-1);  // negative iteration number marks a warmup run
+        stats.addWarmup();
+    }
+
+    double totalMs = 0.0;
+    for (int i = 0; i < config.maxIterations; ++i) {
+        double elapsed = body(i);
+        stats.addTiming(elapsed);
+        totalMs += elapsed;
+
+        if (i + 1 < config.minIterations) continue;
+        if (stats.relativeCIHalfWidth() <= config.targetRelativeCI) break;
+        if (totalMs >= config.maxTotalMs) break;
+    }
+}
+
+// Runs body once more inside an AllocPhase and prints allocations per unit, body returns how
+// many units (rows, queries) it processed. does nothing unless the allocation hooks are linked in
+template<typename Body>
+void reportAllocations(const std::string& name, const char* unitName, Body body) {
+    if (!AllocTracker::installed()) return;
+    AllocPhase phase(name);
+    size_t units = body();
+    phase.stop();
+    phase.print(units, unitName);
+}
+
+// Collects every benchmark of one executable run and writes them as a single JSON document
+class BenchmarkReport {
+private:
+    std::string suite;
+    std::vector<std::string> entries;
+    // extra scalar values of the run (memory footprint, peak rss, ...)
+    std::vector<std::pair<std::string, double>> values;
+
+public:
+    BenchmarkReport(const std::string& suiteName) : suite(suiteName) {}
+
+    void add(const BenchmarkStats& stats) {
+        entries.push_back(stats.toJson());
+    }
+
+    void addValue(const std::string& key, double value) {
+        values.push_back({key, value});
+    }
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << std::fixed;
+        out.precision(3);
+        out << "{\"suite\": \"" << jsonSafeName(suite) << "\", \"values\": {";
+        for (size_t i = 0; i < values.size(); ++i) {
+            out << (i > 0 ? ", " : "") << "\"" << jsonSafeName(values[i].first) << "\": " << values[i].second;
+        }
+        out << "}, \"benchmarks\": [\n";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            out << "  " << entries[i] << (i + 1 < entries.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+        return out.str();
+    }
+
+    // returns false if the file couldn't be opened so the caller can report it
+    bool writeToFile(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) return false;
+        file << toJson();
+        return true;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,174 @@
+// command line client of query_server
+// usage: query_client [--socket <path> | --port 7070] [--count-only] [--show N] [<dataset> <query>]...
+//
+// without query arguments it reads queries from stdin, one per line as "dataset <tab> query"
+// (the slow-query log / workload format works too, the last field is the query). all requests
+// are sent up front on one connection (pipelined) and the responses are printed as they arrive.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server/protocol.hpp"
+#include "common/parallelStrategy.hpp"
+
+using namespace protocol;
+
+static int connectTo(const std::string& socketPath, int port) {
+    int fd;
+    if (!socketPath.empty()) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return -1;
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static void printResponse(const Response& response, const std::string& query, double clientMs, size_t show) {
+    if (response.status != Status::OK) {
+        printf("#%u %s: %s  (%s)\n", response.id, response.status == Status::CANCELLED ? "cancelled" : "error",
+               response.error.c_str(), query.c_str());
+        return;
+    }
+    printf("#%u %llu rows, server %.3f ms, round trip %.3f ms  (%s)\n", response.id,
+           (unsigned long long)response.rows(), response.serverUs / 1000.0, clientMs, query.c_str());
+
+    if (response.kind == ResponseKind::AVERAGE) {
+        printf("    average: %.6f\n", response.average);
+    } else if (response.kind == ResponseKind::CATEGORY_COUNTS) {
+        for (const auto& pair : response.categoryCounts) {
+            printf("    category %d: %zu\n", pair.first, pair.second);
+        }
+    }
+    for (size_t i = 0; i < response.fireRecords.size() && i < show; ++i) {
+        const FireRecord& r = response.fireRecords[i];
+        printf("    %s %s %.3f %s (%.4f, %.4f)\n", r.getUTC().c_str(), r.getPollutantType().c_str(),
+               r.getConcentration(), r.getSiteName().c_str(), r.getLatitude(), r.getLongitude());
+    }
+    for (size_t i = 0; i < response.populationRecords.size() && i < show; ++i) {
+        const PopulationRecord& r = response.populationRecords[i];
+        printf("    %s %s 2020: %.0f\n", r.getCountryCode().c_str(), r.getCountryName().c_str(),
+               r.getPopulationForYear(2020));
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string socketPath;
+    int port = 7070;
+    bool countOnly = false;
+    size_t show = 3;  // records printed per response
+    std::vector<Request> requests;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if (arg == "--count-only") {
+            countOnly = true;
+        } else if (arg == "--show" && i + 1 < argc) {
+            show = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if ((arg == "fire" || arg == "population") && i + 1 < argc) {
+            Request request;
+            request.dataset = arg == "fire" ? Dataset::FIRE : Dataset::POPULATION;
+            request.query = argv[++i];
+            requests.push_back(request);
+        } else {
+            printf("usage: %s [--socket <path> | --port 7070] [--count-only] [--show N] [<dataset> <query>]...\n",
+                   argv[0]);
+            return 2;
+        }
+    }
+
+    if (requests.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::vector<std::string> fields;
+            std::stringstream in(line);
+            std::string field;
+            while (std::getline(in, field, '\t')) fields.push_back(field);
+            if (fields.size() < 2) continue;
+            Request request;
+            const std::string& dataset = fields.size() == 2 ? fields[0] : fields[1];
+            request.dataset = dataset == "population" ? Dataset::POPULATION : Dataset::FIRE;
+            request.query = fields.back();
+            requests.push_back(request);
+        }
+    }
+
+    int fd = connectTo(socketPath, port);
+    if (fd < 0) {
+        printf("error: could not connect to %s\n",
+               socketPath.empty() ? ("127.0.0.1:" + std::to_string(port)).c_str() : socketPath.c_str());
+        return 1;
+    }
+
+    uint64_t start = steadyNowNs();
+    std::string out;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        requests[i].id = static_cast<uint32_t>(i + 1);
+        if (countOnly) requests[i].flags |= COUNT_ONLY;
+        out += encodeRequest(requests[i]);
+    }
+    if (!sendAll(fd, out)) {
+        printf("error: send failed\n");
+        return 1;
+    }
+
+    std::string buffer, payload;
+    char chunk[64 * 1024];
+    size_t received = 0;
+    while (received < requests.size()) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            printf("error: connection closed after %zu of %zu responses\n", received, requests.size());
+            return 1;
+        }
+        buffer.append(chunk, n);
+        while (takeFrame(buffer, payload)) {
+            Response response = decodeResponse(payload);
+            double clientMs = (steadyNowNs() - start) / 1e6;
+            std::string query = response.id >= 1 && response.id <= requests.size()
+                                    ? requests[response.id - 1].query : "?";
+            printResponse(response, query, clientMs, show);
+            received++;
+        }
+    }
+    close(fd);
+
+    double totalMs = (steadyNowNs() - start) / 1e6;
+    printf("%zu queries in %.3f ms (%.1f queries/s)\n", requests.size(), totalMs,
+           totalMs > 0 ? requests.size() * 1000.0 / totalMs : 0.0);
+    return 0;
+}
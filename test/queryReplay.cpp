@@ -0,0 +1,344 @@
+// workload replay / load generator
+// fires the queries of a workload file at resident FireData / PopulationData from many client
+// threads and reports throughput and latency percentiles for every concurrency level
+//
+// usage: query_replay --workload <file> [--fire <path>] [--population <path>]
+//                     [--mode closed|open|both] [--clients 1,2,4,8] [--duration 10]
+//                     [--rate <qps>] [--speed 1.0] [--json <file>]
+//
+// the workload is the slow-query log format (capture one with --slow-log and --slow-ms 0):
+//   timestamp_ms <tab> dataset <tab> ... <tab> query
+// only the first two fields and the last one are read, "dataset <tab> query" lines work too.
+//
+// closed loop: every client runs the next query as soon as its previous one finished, so the
+//              offered load adapts to the service time (max throughput at that concurrency)
+// open loop:   queries arrive on a schedule no matter how busy the clients are, either at the
+//              workload's own timestamps (scaled by --speed) or as a poisson process at --rate.
+//              latency is measured from the scheduled arrival, queueing included, so a backlog
+//              shows up in the percentiles instead of silently lowering the load.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <stdexcept>
+#include "firedata/fireData.hpp"
+#include "PopulationData/populationData.hpp"
+#include "common/parallelStrategy.hpp"
+#include "test/benchmark.hpp"
+
+struct WorkloadEntry {
+    uint64_t offsetMs = 0;   // arrival relative to the first entry
+    bool fire = true;        // which dataset the query goes to
+    FireQuery fireQuery;
+    PopulationQuery populationQuery;
+};
+
+static std::vector<std::string> splitTabs(const std::string& line) {
+    std::vector<std::string> fields;
+    std::stringstream in(line);
+    std::string field;
+    while (std::getline(in, field, '\t')) fields.push_back(field);
+    return fields;
+}
+
+static std::vector<WorkloadEntry> loadWorkload(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) throw std::runtime_error("could not open workload " + path);
+
+    std::vector<WorkloadEntry> entries;
+    std::string line;
+    uint64_t firstTimestamp = 0;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') continue;
+        std::vector<std::string> fields = splitTabs(line);
+        if (fields.size() < 2) {
+            throw std::runtime_error("line " + std::to_string(lineNumber) + ": expected dataset and query");
+        }
+
+        WorkloadEntry entry;
+        std::string dataset = fields.size() == 2 ? fields[0] : fields[1];
+        if (fields.size() > 2) {
+            uint64_t timestamp = std::strtoull(fields[0].c_str(), nullptr, 10);
+            if (entries.empty()) firstTimestamp = timestamp;
+            entry.offsetMs = timestamp >= firstTimestamp ? timestamp - firstTimestamp : 0;
+        }
+        try {
+            if (dataset == "fire") {
+                entry.fire = true;
+                entry.fireQuery = FireQuery::parse(fields.back());
+            } else if (dataset == "population") {
+                entry.fire = false;
+                entry.populationQuery = PopulationQuery::parse(fields.back());
+            } else {
+                throw std::runtime_error("unknown dataset " + dataset);
+            }
+        } catch (const std::exception& e) {
+            throw std::runtime_error("line " + std::to_string(lineNumber) + ": " + e.what());
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// results of one concurrency level
+struct LevelResult {
+    std::string mode;
+    unsigned int clients = 0;
+    double seconds = 0.0;
+    double offeredRate = 0.0;         // open loop only
+    std::vector<double> latenciesMs;
+    size_t maxBacklog = 0;            // open loop only, most queries waiting for a client
+
+    double throughput() const { return seconds > 0 ? latenciesMs.size() / seconds : 0.0; }
+};
+
+class Replayer {
+private:
+    const std::vector<WorkloadEntry>& entries;
+    const FireData& fireData;
+    const PopulationData& populationData;
+
+    size_t run(const WorkloadEntry& entry) const {
+        if (entry.fire) {
+            return fireData.execute(entry.fireQuery).rows(entry.fireQuery.type);
+        }
+        return populationData.execute(entry.populationQuery).size();
+    }
+
+public:
+    Replayer(const std::vector<WorkloadEntry>& workload, const FireData& fire,
+             const PopulationData& population)
+        : entries(workload), fireData(fire), populationData(population) {}
+
+    // every client runs queries back to back, walking the workload in order, until time is up
+    LevelResult closedLoop(unsigned int clients, double durationSeconds) const {
+        LevelResult result;
+        result.mode = "closed";
+        result.clients = clients;
+
+        std::atomic<size_t> next{0};
+        std::vector<std::vector<double>> perClient(clients);
+        uint64_t start = steadyNowNs();
+        uint64_t deadline = start + static_cast<uint64_t>(durationSeconds * 1e9);
+
+        std::vector<std::thread> threads;
+        for (unsigned int c = 0; c < clients; ++c) {
+            threads.emplace_back([&, c]() {
+                while (steadyNowNs() < deadline) {
+                    const WorkloadEntry& entry = entries[next.fetch_add(1) % entries.size()];
+                    uint64_t queryStart = steadyNowNs();
+                    run(entry);
+                    perClient[c].push_back((steadyNowNs() - queryStart) / 1e6);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        result.seconds = (steadyNowNs() - start) / 1e9;
+        for (const auto& latencies : perClient) {
+            result.latenciesMs.insert(result.latenciesMs.end(), latencies.begin(), latencies.end());
+        }
+        return result;
+    }
+
+    // the leader releases queries at their arrival times into a TaskQueue the clients pull from
+    // rate > 0: poisson arrivals at that rate, cycling through the workload
+    // rate = 0: the workload's own timestamps divided by speed, one pass
+    LevelResult openLoop(unsigned int clients, double durationSeconds, double rate, double speed) const {
+        LevelResult result;
+        result.mode = "open";
+        result.clients = clients;
+
+        // arrival schedule in ns after start
+        std::vector<std::pair<uint64_t, size_t>> schedule;  // <arrival, entry>
+        if (rate > 0) {
+            std::mt19937_64 rng(12345);
+            std::exponential_distribution<double> gap(rate);
+            double t = 0.0;
+            for (size_t i = 0; ; ++i) {
+                t += gap(rng);
+                if (t >= durationSeconds) break;
+                schedule.push_back({static_cast<uint64_t>(t * 1e9), i % entries.size()});
+            }
+        } else {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                double t = entries[i].offsetMs / 1000.0 / speed;
+                if (t < durationSeconds) schedule.push_back({static_cast<uint64_t>(t * 1e9), i});
+            }
+            // lines without a timestamp arrive at 0, keep the release loop in time order
+            std::stable_sort(schedule.begin(), schedule.end(),
+                             [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+                                 return a.first < b.first;
+                             });
+        }
+        if (schedule.empty()) return result;
+
+        TaskQueue<std::pair<uint64_t, size_t>> queue;  // <scheduled time, entry>
+        std::vector<std::vector<double>> perClient(clients);
+        uint64_t start = steadyNowNs();
+
+        std::vector<std::thread> threads;
+        for (unsigned int c = 0; c < clients; ++c) {
+            threads.emplace_back([&, c]() {
+                std::pair<uint64_t, size_t> task;
+                while (queue.pop(task)) {
+                    run(entries[task.second]);
+                    perClient[c].push_back((steadyNowNs() - task.first) / 1e6);
+                }
+            });
+        }
+
+        for (const auto& arrival : schedule) {
+            uint64_t due = start + arrival.first;
+            uint64_t now = steadyNowNs();
+            if (due > now) std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+            queue.push({due, arrival.second});
+        }
+        queue.markFinished();
+        for (auto& t : threads) t.join();
+
+        result.seconds = (steadyNowNs() - start) / 1e9;
+        result.offeredRate = schedule.size() / ((schedule.back().first + 1) / 1e9);
+        result.maxBacklog = queue.stats().maxDepth;
+        for (const auto& latencies : perClient) {
+            result.latenciesMs.insert(result.latenciesMs.end(), latencies.begin(), latencies.end());
+        }
+        return result;
+    }
+};
+
+static void printHeader() {
+    printf("%-6s %7s %9s %10s %10s %10s %10s %10s %10s %8s\n", "mode", "clients", "queries", "qps",
+           "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms", "backlog");
+}
+
+static void printRow(const LevelResult& r) {
+    std::vector<double> sorted = r.latenciesMs;
+    std::sort(sorted.begin(), sorted.end());
+    printf("%-6s %7u %9zu %10.1f %10.3f %10.3f %10.3f %10.3f %10.3f", r.mode.c_str(), r.clients,
+           sorted.size(), r.throughput(), percentileSorted(sorted, 50), percentileSorted(sorted, 90),
+           percentileSorted(sorted, 99), percentileSorted(sorted, 99.9),
+           sorted.empty() ? 0.0 : sorted.back());
+    if (r.mode == "open") printf(" %8zu", r.maxBacklog);
+    printf("\n");
+}
+
+static std::vector<unsigned int> parseClientList(const std::string& list) {
+    std::vector<unsigned int> clients;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        int n = std::atoi(item.c_str());
+        if (n > 0) clients.push_back(static_cast<unsigned int>(n));
+    }
+    return clients;
+}
+
+int main(int argc, char** argv) {
+    std::string workloadPath, firePath, populationPath, jsonPath;
+    std::string mode = "closed";
+    std::vector<unsigned int> clientLevels = {1, 2, 4, 8};
+    double duration = 10.0;   // seconds per concurrency level
+    double rate = 0.0;        // open loop arrivals per second, 0 = use the workload timestamps
+    double speed = 1.0;       // open loop timestamp speedup
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--workload" && i + 1 < argc) {
+            workloadPath = argv[++i];
+        } else if (arg == "--fire" && i + 1 < argc) {
+            firePath = argv[++i];
+        } else if (arg == "--population" && i + 1 < argc) {
+            populationPath = argv[++i];
+        } else if (arg == "--mode" && i + 1 < argc) {
+            mode = argv[++i];
+        } else if (arg == "--clients" && i + 1 < argc) {
+            clientLevels = parseClientList(argv[++i]);
+        } else if (arg == "--duration" && i + 1 < argc) {
+            duration = std::atof(argv[++i]);
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = std::atof(argv[++i]);
+        } else if (arg == "--speed" && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            printf("unknown argument: %s\n", arg.c_str());
+            return 2;
+        }
+    }
+    if (workloadPath.empty() || clientLevels.empty() || speed <= 0 ||
+        (mode != "closed" && mode != "open" && mode != "both")) {
+        printf("usage: %s --workload <file> [--fire <path>] [--population <path>] [--mode closed|open|both]\n"
+               "       [--clients 1,2,4,8] [--duration 10] [--rate <qps>] [--speed 1.0] [--json <file>]\n",
+               argv[0]);
+        return 2;
+    }
+
+    std::vector<WorkloadEntry> entries;
+    try {
+        entries = loadWorkload(workloadPath);
+    } catch (const std::exception& e) {
+        printf("error: %s\n", e.what());
+        return 2;
+    }
+    if (entries.empty()) {
+        printf("error: workload %s has no queries\n", workloadPath.c_str());
+        return 2;
+    }
+
+    size_t fireQueries = std::count_if(entries.begin(), entries.end(),
+                                       [](const WorkloadEntry& e) { return e.fire; });
+    if ((fireQueries > 0 && firePath.empty()) || (fireQueries < entries.size() && populationPath.empty())) {
+        printf("error: the workload queries a dataset that wasn't given (--fire / --population)\n");
+        return 2;
+    }
+
+    FireData fireData;
+    PopulationData populationData;
+    if (!firePath.empty()) fireData.loadFromDirectory(firePath);
+    if (!populationPath.empty()) populationData.loadFromDirectory(populationPath);
+    printf("\nReplaying %zu queries (%zu fire, %zu population), %.1f s per level\n\n", entries.size(),
+           fireQueries, entries.size() - fireQueries, duration);
+
+    Replayer replayer(entries, fireData, populationData);
+    BenchmarkReport report("replay");
+    printHeader();
+
+    std::vector<std::string> modes;
+    if (mode == "closed" || mode == "both") modes.push_back("closed");
+    if (mode == "open" || mode == "both") modes.push_back("open");
+
+    for (const auto& m : modes) {
+        for (unsigned int clients : clientLevels) {
+            LevelResult r = m == "closed" ? replayer.closedLoop(clients, duration)
+                                          : replayer.openLoop(clients, duration, rate, speed);
+            printRow(r);
+
+            std::string key = m + "_" + std::to_string(clients);
+            BenchmarkStats stats("Replay " + m + " loop / " + std::to_string(clients) + " clients");
+            for (double latency : r.latenciesMs) stats.addTiming(latency);
+            report.add(stats);
+            report.addValue(key + "_qps", r.throughput());
+            if (m == "open") report.addValue(key + "_offered_qps", r.offeredRate);
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        if (report.writeToFile(jsonPath)) {
+            printf("\nWrote replay results to %s\n", jsonPath.c_str());
+        } else {
+            printf("\nCould not write replay results to %s\n", jsonPath.c_str());
+        }
+    }
+    return 0;
+}
@@ -7,14 +7,39 @@
 
 #include <cstdio>
 #include <string>
+#include <algorithm>
+#include <map>
 #include "firedata/fireData.hpp"
+#include "firedata/fireSql.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/memoryUsage.hpp"
+#include "common/trace.hpp"
+#include "common/metrics.hpp"
+#include "common/slowQueryLog.hpp"
+#include <memory>
 #include "test/benchmark.hpp"
 #include "utils.hpp"
 
-// number of iterations for averaging
-const int LOAD_ITERATIONS = 3;
-const int QUERY_ITERATIONS = 5;
+// iteration policy, loads are slow so they get fewer runs
+// queries keep running until the 95% CI of the mean is within +-2% (or the cap is hit)
+BenchmarkConfig makeLoadConfig() {
+    BenchmarkConfig config;
+    config.warmupIterations = 1;
+    config.minIterations = 3;
+    config.maxIterations = 10;
+    config.targetRelativeCI = 0.05;
+    return config;
+}
+
+BenchmarkConfig makeQueryConfig() {
+    BenchmarkConfig config;
+    config.warmupIterations = 2;
+    config.minIterations = 10;
+    config.maxIterations = 200;
+    config.targetRelativeCI = 0.02;
+    config.maxTotalMs = 10000.0;
+    return config;
+}
 
 // test all three strategies
 const ParallelStrategy STRATEGIES[] = {
@@ -33,12 +58,65 @@ int main(int argc, char** argv) {
 
     // default path to data
     std::string dataPath = "../datasets/2020-fire/data";
-    if (argc > 1) {
-        dataPath = argv[1];
+    // optional machine readable output: --json results.json
+    std::string jsonPath;
+    // optional chrome trace of one load + query per strategy: --trace trace.json
+    std::string tracePath;
+    // optional prometheus metrics: --metrics metrics.prom writes a file at the end,
+    // --metrics-port 9464 serves them on localhost while the benchmark runs
+    std::string metricsPath;
+    int metricsPort = 0;
+    // print the plan and an execution profile of one lookup and one scan per strategy: --explain
+    bool explainQueries = false;
+    // optional slow-query log of the query benchmarks: --slow-log slow.tsv [--slow-ms 50] [--slow-sample 0.01]
+    std::string slowLogPath;
+    SlowQueryConfig slowConfig;
+    // run the query benchmarks against a shared image instead of the private copy: --shared /fire_data
+    // (a POSIX shared memory name, or a file path to memory map)
+    std::string sharedTarget;
+    // result cache budget for the cached dashboard queries: --cache-mb 64 (0 skips them)
+    size_t cacheMb = 64;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--slow-log" && i + 1 < argc) {
+            slowLogPath = argv[++i];
+        } else if (arg == "--slow-ms" && i + 1 < argc) {
+            slowConfig.thresholdMs = std::stod(argv[++i]);
+        } else if (arg == "--slow-sample" && i + 1 < argc) {
+            slowConfig.sampleRate = std::stod(argv[++i]);
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cacheMb = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--shared" && i + 1 < argc) {
+            sharedTarget = argv[++i];
+        } else if (arg == "--explain") {
+            explainQueries = true;
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = std::stoi(argv[++i]);
+        } else {
+            dataPath = arg;
+        }
     }
 
     printf("Data path: %s\n\n", dataPath.c_str());
 
+    if (metricsPort > 0) {
+        if (MetricsRegistry::instance().startHttpServer(metricsPort)) {
+            printf("Serving metrics on http://127.0.0.1:%d/metrics\n\n", metricsPort);
+        } else {
+            printf("Could not listen on port %d for metrics\n\n", metricsPort);
+        }
+    }
+
+    BenchmarkConfig loadConfig = makeLoadConfig();
+    BenchmarkConfig queryConfig = makeQueryConfig();
+    BenchmarkReport report("fire");
+
     // ========================================================================
     // benchmark loading with each strategy
     // ========================================================================
@@ -50,8 +128,8 @@ int main(int argc, char** argv) {
         printf("========================================\n\n");
 
         // benchmark load times
-        BenchmarkStats loadStats("Load");
-        for (int i = 0; i < LOAD_ITERATIONS; ++i) {
+        BenchmarkStats loadStats(std::string("Load / ") + strategyToString(strategy));
+        runBenchmark(loadStats, loadConfig, [&](int i) {
             // new object each iteration
             FireData fireData;
             Timer timer;
@@ -61,10 +139,23 @@ int main(int argc, char** argv) {
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            loadStats.addTiming(elapsed);
-            printf("Load %d: %.3f ms (%zu records)\n", i + 1, elapsed, fireData.size());
-        }
+            if (i < 0) {
+                printf("Warmup load: %.3f ms (%zu records)\n", elapsed, fireData.size());
+            } else {
+                printf("Load %d: %.3f ms (%zu records)\n", i + 1, elapsed, fireData.size());
+            }
+            return elapsed;
+        });
         loadStats.printStatistics();
+        // queue contention and worker busy/idle of the last timed iteration
+        lastParallelRun().print();
+        report.add(loadStats);
+
+        reportAllocations("load", "row", [&]() {
+            FireData fireData;
+            fireData.loadFromDirectory(dataPath, strategy);
+            return fireData.size();
+        });
     }
 
     // ========================================================================
@@ -74,44 +165,737 @@ int main(int argc, char** argv) {
     printf("Query Performance Tests\n");
     printf("========================================\n\n");
 
+    // created before the query dataset so it outlives it
+    std::unique_ptr<SlowQueryLog> slowLog;
+    if (!slowLogPath.empty()) {
+        slowLog.reset(new SlowQueryLog(slowLogPath, slowConfig));
+    }
+
     // load once for all query tests
     FireData fireData;
     fireData.loadFromDirectory(dataPath, ParallelStrategy::OPENMP);
     printf("Loaded %zu records for query tests\n\n", fireData.size());
 
+    if (!sharedTarget.empty()) {
+        Timer timer;
+        timer.start();
+        fireData.exportShared(sharedTarget);
+        timer.stop();
+        printf("Exported shared image %s in %.3f ms\n", sharedTarget.c_str(), timer.elapsed_ms());
+        // from here on this process reads the image like any other attached process would
+        fireData.attachShared(sharedTarget);
+        printf("Attached shared image (%zu records)\n\n", fireData.size());
+    }
+
+    if (slowLog) {
+        fireData.setSlowQueryLog(slowLog.get());
+    }
+
+    // memory footprint of the resident dataset, used for sizing query nodes
+    MemoryUsage usage = fireData.memoryUsage();
+    usage.print("FireData");
+    printf("Current RSS: %.2f MB, peak RSS: %.2f MB\n\n",
+           currentRSSBytes() / (1024.0 * 1024.0), peakRSSBytes() / (1024.0 * 1024.0));
+    report.addValue("dataset_bytes", static_cast<double>(usage.total()));
+    report.addValue("bytes_per_record", usage.bytesPerRecord());
+    for (const auto& component : usage.components) {
+        std::string key = "bytes_" + component.first;
+        std::replace(key.begin(), key.end(), ' ', '_');
+        report.addValue(key, static_cast<double>(component.second));
+    }
+
     // test each query with each strategy
     for (int s = 0; s < NUM_STRATEGIES; ++s) {
         ParallelStrategy strategy = STRATEGIES[s];
+        std::string suffix = std::string(" / ") + strategyToString(strategy);
 
         printf("\n--- Strategy: %s ---\n\n", strategyToString(strategy));
 
         // pollutant query test
-        BenchmarkStats pollutantStats("Pollutant Query (PM2.5)");
-        for (int i = 0; i < QUERY_ITERATIONS; ++i) {
+        BenchmarkStats pollutantStats("Pollutant Query (PM2.5)" + suffix);
+        runBenchmark(pollutantStats, queryConfig, [&](int i) {
             Timer timer;
             timer.start();
             auto results = fireData.queryByPollutant("PM2.5");
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            pollutantStats.addTiming(elapsed);
-            printf("Pollutant query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
-        }
+            if (i >= 0) {
+                printf("Pollutant query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
+            }
+            return elapsed;
+        });
         pollutantStats.printStatistics();
+        report.add(pollutantStats);
+        reportAllocations("pollutant query", "query", [&]() {
+            auto results = fireData.queryByPollutant("PM2.5");
+            return size_t(1);
+        });
 
         // value range query test
-        BenchmarkStats rangeStats("Value Range Query (5.0-15.0)");
-        for (int i = 0; i < QUERY_ITERATIONS; ++i) {
+        BenchmarkStats rangeStats("Value Range Query (5.0-15.0)" + suffix);
+        runBenchmark(rangeStats, queryConfig, [&](int i) {
             Timer timer;
             timer.start();
             auto results = fireData.queryByValueRange(5.0, 15.0, strategy);
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            rangeStats.addTiming(elapsed);
-            printf("Value range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
-        }
+            if (i >= 0) {
+                printf("Value range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
+            }
+            return elapsed;
+        });
         rangeStats.printStatistics();
+        // queue contention and worker busy/idle of the last timed iteration
+        lastParallelRun().print();
+        report.add(rangeStats);
+        reportAllocations("value range query", "query", [&]() {
+            auto results = fireData.queryByValueRange(5.0, 15.0, strategy);
+            return size_t(1);
+        });
+    }
+
+    // ========================================================================
+    // openmp result merge: the per-strategy query loops that parallelScan replaced entered a critical
+    // section for every hit, parallelScan fills one buffer per thread and merges each once. both run
+    // here on the same copy of the rows so the change is measured apart from everything else
+    // ========================================================================
+    {
+        printf("\n--- OpenMP result merge: critical section per hit vs per-thread buffers (5.0-15.0) ---\n\n");
+        const std::vector<FireRecord> rows = fireData.queryByValueRange(-1e9, 1e9);
+        auto inRange = [](const FireRecord& r) {
+            return r.getConcentration() >= 5.0 && r.getConcentration() <= 15.0;
+        };
+        size_t criticalRows = 0, bufferedRows = 0;
+
+        BenchmarkStats criticalStats("OpenMP merge / critical per hit");
+        runBenchmark(criticalStats, queryConfig, [&](int) {
+            Timer timer;
+            timer.start();
+            std::vector<FireRecord> results;
+#ifdef _OPENMP
+            #pragma omp parallel for
+#endif
+            for (size_t i = 0; i < rows.size(); ++i) {
+                if (inRange(rows[i])) {
+#ifdef _OPENMP
+                    #pragma omp critical
+#endif
+                    {
+                        results.push_back(rows[i]);
+                    }
+                }
+            }
+            timer.stop();
+            criticalRows = results.size();
+            return timer.elapsed_ms();
+        });
+        criticalStats.printStatistics();
+        report.add(criticalStats);
+
+        BenchmarkStats bufferedStats("OpenMP merge / per-thread buffers");
+        runBenchmark(bufferedStats, queryConfig, [&](int) {
+            Timer timer;
+            timer.start();
+            // joined the way collectMatching does: the buffers are taken at the merge, moved into one
+            // reserved vector afterwards
+            std::vector<std::vector<FireRecord>> parts;
+            size_t total = 0;
+            parallelScan<std::vector<FireRecord>>(rows.size(), defaultChunkSize(rows.size()),
+                ParallelStrategy::OPENMP,
+                [&](std::vector<FireRecord>& local, size_t start, size_t end) {
+                    for (size_t i = start; i < end; ++i) {
+                        if (inRange(rows[i])) local.push_back(rows[i]);
+                    }
+                },
+                [&](std::vector<FireRecord>& local) {
+                    total += local.size();
+                    parts.push_back(std::move(local));
+                });
+            std::vector<FireRecord> results;
+            results.reserve(total);
+            for (auto& part : parts) {
+                results.insert(results.end(), std::make_move_iterator(part.begin()),
+                               std::make_move_iterator(part.end()));
+            }
+            timer.stop();
+            bufferedRows = results.size();
+            return timer.elapsed_ms();
+        });
+        bufferedStats.printStatistics();
+        report.add(bufferedStats);
+        printf("critical per hit %.3f ms, per-thread buffers %.3f ms (%zu and %zu rows)\n", criticalStats.mean(),
+               bufferedStats.mean(), criticalRows, bufferedRows);
+    }
+
+    // ========================================================================
+    // dashboard queries through the result cache: the warmup fills it, every timed run is a hit
+    // ========================================================================
+    if (cacheMb > 0) {
+        printf("\n--- Cached dashboard queries (%zu MB result cache) ---\n\n", cacheMb);
+        fireData.enableResultCache(cacheMb * 1024 * 1024);
+        const FireQuery dashboard[] = {FireQuery::pollutant("PM2.5"), FireQuery::aqiCategory(3),
+                                       FireQuery::countByCategory()};
+        for (const FireQuery& query : dashboard) {
+            BenchmarkStats cachedStats("Cached " + query.toString());
+            runBenchmark(cachedStats, queryConfig, [&](int i) {
+                Timer timer;
+                timer.start();
+                auto result = fireData.executeCached(query);
+                timer.stop();
+
+                double elapsed = timer.elapsed_ms();
+                if (i >= 0) {
+                    printf("Cached query %d: %.6f ms (%zu rows)\n", i + 1, elapsed, result->rows(query.type));
+                }
+                return elapsed;
+            });
+            cachedStats.printStatistics();
+            report.add(cachedStats);
+        }
+        const ResultCache<FireQueryResult>& cache = *fireData.resultCache();
+        printf("Result cache: %zu entries, %.2f MB, %llu hits, %llu misses\n", cache.size(),
+               cache.bytes() / (1024.0 * 1024.0), (unsigned long long)cache.hitCount(),
+               (unsigned long long)cache.missCount());
+        fireData.enableResultCache(0);
+    }
+
+    // ========================================================================
+    // 50 dashboard widgets: one scan each vs one shared scan for the whole batch
+    // ========================================================================
+    {
+        printf("\n--- Dashboard batch: 50 range and bounding box queries ---\n\n");
+        std::vector<FireQuery> widgets;
+        for (int i = 0; i < 25; ++i) widgets.push_back(FireQuery::valueRange(i * 8.0, i * 8.0 + 0.5));
+        for (int i = 0; i < 25; ++i) {
+            widgets.push_back(FireQuery::geographicBounds(25.0 + i, 25.5 + i, -125.0 + i, -124.0 + i));
+        }
+
+        BenchmarkStats separateStats("Dashboard / 50 separate scans");
+        runBenchmark(separateStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            size_t rows = 0;
+            for (const FireQuery& widget : widgets) rows += fireData.execute(widget).records.size();
+            timer.stop();
+            if (i >= 0) printf("Separate scans %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows);
+            return timer.elapsed_ms();
+        });
+        separateStats.printStatistics();
+        report.add(separateStats);
+
+        BenchmarkStats batchStats("Dashboard / one shared scan");
+        runBenchmark(batchStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            std::vector<FireQueryResult> results = fireData.executeBatch(widgets);
+            timer.stop();
+            size_t rows = 0;
+            for (const auto& result : results) rows += result.records.size();
+            if (i >= 0) printf("Shared scan %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows);
+            return timer.elapsed_ms();
+        });
+        batchStats.printStatistics();
+        report.add(batchStats);
+    }
+
+    // ========================================================================
+    // map view: the three columns a map draws vs whole records for the same box
+    // ========================================================================
+    {
+        printf("\n--- Map view: PM2.5 readings in the continental US, 3 columns vs whole records ---\n\n");
+        const std::vector<FireQuery> mapFilters = {FireQuery::pollutant("PM2.5"),
+                                                   FireQuery::geographicBounds(25.0, 50.0, -125.0, -65.0)};
+        const uint32_t mapColumns = FIRE_LATITUDE | FIRE_LONGITUDE | FIRE_CONCENTRATION;
+
+        BenchmarkStats recordStats("Map view / whole records");
+        runBenchmark(recordStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            std::vector<FireRecord> inBox = fireData.queryByGeographicBounds(25.0, 50.0, -125.0, -65.0);
+            size_t rows = 0;
+            for (const FireRecord& r : inBox) rows += r.getPollutantType() == "PM2.5";
+            timer.stop();
+            if (i >= 0) printf("Whole records %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows);
+            return timer.elapsed_ms();
+        });
+        recordStats.printStatistics();
+        report.add(recordStats);
+
+        BenchmarkStats projectStats("Map view / projected columns");
+        runBenchmark(projectStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            FireColumns points = fireData.project(mapFilters, mapColumns);
+            timer.stop();
+            if (i >= 0) {
+                printf("Projection %d: %.3f ms (%zu rows, %.2f MB)\n", i + 1, timer.elapsed_ms(), points.rows,
+                       points.bytes() / (1024.0 * 1024.0));
+            }
+            return timer.elapsed_ms();
+        });
+        projectStats.printStatistics();
+        report.add(projectStats);
+    }
+
+    // ========================================================================
+    // predicate throughput: row ids only, no records copied. the compares and the compaction cost the
+    // same whatever passes (no branches on the data), what grows is writing out and sorting the ids
+    // ========================================================================
+    {
+        printf("\n--- Predicate throughput: concentration <= x, row ids only ---\n\n");
+        const double upperBounds[] = {0.5, 5.0, 15.0, 40.0, 1e9};
+        for (double upper : upperBounds) {
+            const std::vector<FireQuery> filter = {FireQuery::valueRange(-1e9, upper)};
+            size_t passed = 0;
+            BenchmarkStats selectStats("Select concentration <= " + formatQueryNumber(upper));
+            runBenchmark(selectStats, queryConfig, [&](int) {
+                Timer timer;
+                timer.start();
+                passed = fireData.project(filter, 0).rows;
+                timer.stop();
+                return timer.elapsed_ms();
+            });
+            printf("concentration <= %-6g %7zu rows pass (%5.1f%%)  %8.3f ms  %7.1f M rows/s\n", upper, passed,
+                   100.0 * passed / fireData.size(), selectStats.mean(),
+                   fireData.size() / (selectStats.mean() * 1000.0));
+            report.add(selectStats);
+        }
+    }
+
+    // ========================================================================
+    // custom predicates: compiled fire:: expressions vs a fixed query method plus filtering its result
+    // ========================================================================
+    {
+        using namespace fire;
+        printf("\n--- Custom predicates: concentration > 35 && aqi > 100 && latitude in [30, 45] ---\n\n");
+        const auto smoky = concentration > 35.0 && aqi > 100 && latitude.between(30.0, 45.0);
+
+        BenchmarkStats fixedStats("Smoky rows / valueRange then filter");
+        runBenchmark(fixedStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            std::vector<FireRecord> candidates = fireData.queryByValueRange(35.0, 1e9);
+            size_t rows = 0;
+            for (const FireRecord& r : candidates) {
+                rows += r.getConcentration() > 35.0 && r.getAqi() > 100 && r.getLatitude() >= 30.0 &&
+                        r.getLatitude() <= 45.0;
+            }
+            timer.stop();
+            if (i >= 0) printf("Fixed query %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows);
+            return timer.elapsed_ms();
+        });
+        fixedStats.printStatistics();
+        report.add(fixedStats);
+
+        BenchmarkStats countStats("Smoky rows / countWhere");
+        runBenchmark(countStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            size_t rows = fireData.countWhere(smoky);
+            timer.stop();
+            if (i >= 0) printf("countWhere %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows);
+            return timer.elapsed_ms();
+        });
+        countStats.printStatistics();
+        report.add(countStats);
+
+        BenchmarkStats selectStats("Smoky rows / selectWhere");
+        runBenchmark(selectStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            std::vector<FireRecord> rows = fireData.selectWhere(smoky);
+            timer.stop();
+            if (i >= 0) printf("selectWhere %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), rows.size());
+            return timer.elapsed_ms();
+        });
+        selectStats.printStatistics();
+        report.add(selectStats);
+
+        FireAggregate pm = fireData.aggregateWhere(smoky && pollutant == "PM2.5", concentration);
+        printf("PM2.5 among them: %zu rows, average %.3f, max %.3f\n", pm.count, pm.average(), pm.max);
+    }
+
+    // ========================================================================
+    // query language: a grouped statement vs the same question written against the query methods
+    // ========================================================================
+    {
+        const std::string statement =
+            "SELECT site, avg(concentration), count(*) FROM fire WHERE pollutant = 'PM2.5' "
+            "AND time BETWEEN '2020-08-04T00:00' AND '2020-08-05T23:00' GROUP BY site "
+            "ORDER BY avg(concentration) DESC LIMIT 3";
+        printf("\n--- Query language: %s ---\n\n", statement.c_str());
+        printf("%s\n", FireSqlPlan::build(FireSqlStatement::parse(statement)).toString().c_str());
+
+        BenchmarkStats handStats("PM2.5 by site / query method plus std::map");
+        runBenchmark(handStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            std::map<std::string, AverageState> sites;
+            for (const FireRecord& r : fireData.queryByPollutant("PM2.5")) {
+                if (r.getUTC() < "2020-08-04T00:00" || r.getUTC() > "2020-08-05T23:00") continue;
+                AverageState& site = sites[r.getSiteName()];
+                site.sum += r.getConcentration();
+                site.count++;
+            }
+            timer.stop();
+            if (i >= 0) printf("Hand-written %d: %.3f ms (%zu sites)\n", i + 1, timer.elapsed_ms(), sites.size());
+            return timer.elapsed_ms();
+        });
+        handStats.printStatistics();
+        report.add(handStats);
+
+        FireSqlResult result;
+        BenchmarkStats sqlStats("PM2.5 by site / statement");
+        runBenchmark(sqlStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            result = executeFireSql(fireData, statement);
+            timer.stop();
+            if (i >= 0) printf("Statement %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(), result.rows());
+            return timer.elapsed_ms();
+        });
+        sqlStats.printStatistics();
+        report.add(sqlStats);
+        for (size_t row = 0; row < result.rows(); ++row) {
+            printf("%s: average %s over %s readings\n", result.cell(row, 0).c_str(), result.cell(row, 1).c_str(),
+                   result.cell(row, 2).c_str());
+        }
+    }
+
+    // ========================================================================
+    // cancellation: a wide query stopped by a deadline and by a token cancelled from another thread
+    // ========================================================================
+    {
+        printf("\n--- Cancellation: valueRange over every row with a deadline and a cancel ---\n\n");
+        const ParallelStrategy strategies[] = {ParallelStrategy::OPENMP, ParallelStrategy::CENTRALIZED_QUEUE,
+                                               ParallelStrategy::ROUND_ROBIN};
+        for (ParallelStrategy strategy : strategies) {
+            Timer timer;
+            timer.start();
+            size_t rows = fireData.queryByValueRange(-1e9, 1e9, strategy).size();
+            timer.stop();
+            double fullMs = timer.elapsed_ms();
+            printf("%s: full query %.3f ms (%zu rows)\n", strategyToString(strategy), fullMs, rows);
+
+            // a budget of a tenth of the full run, and a cancel a quarter of the way in
+            QueryOptions deadline;
+            deadline.stop = StopCondition::timeout(fullMs / 10);
+            CancellationToken token;
+            QueryOptions cancellable;
+            cancellable.stop.token = &token;
+            const char* labels[] = {"deadline", "cancel"};
+            const QueryOptions* runs[] = {&deadline, &cancellable};
+            for (int run = 0; run < 2; ++run) {
+                double budgetMs = run == 0 ? fullMs / 10 : fullMs / 4;
+                std::thread canceller;
+                if (run == 1) {
+                    canceller = std::thread([&]() {
+                        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(budgetMs * 1000)));
+                        token.cancel();
+                    });
+                }
+                timer.start();
+                try {
+                    rows = fireData.queryByValueRange(-1e9, 1e9, strategy, *runs[run]).size();
+                    timer.stop();
+                    printf("  %-8s finished before the stop, %.3f ms (%zu rows)\n", labels[run], timer.elapsed_ms(),
+                           rows);
+                } catch (const QueryCancelled& e) {
+                    timer.stop();
+                    printf("  %-8s stopped after %.3f ms (stop at %.3f ms): %s\n", labels[run], timer.elapsed_ms(),
+                           budgetMs, e.what());
+                }
+                if (canceller.joinable()) canceller.join();
+            }
+        }
+    }
+
+    // ========================================================================
+    // memory limits: peak of a broad query, the same query over a limit, and streamed instead
+    // ========================================================================
+    {
+        printf("\n--- Memory limits: pollutant=PM2.5 and valueRange over every row ---\n\n");
+        const FireQuery broad[] = {FireQuery::pollutant("PM2.5"), FireQuery::valueRange(-1e9, 1e9)};
+        for (const FireQuery& query : broad) {
+            QueryMemory counted;
+            QueryOptions options;
+            options.stop.memory = &counted;
+            Timer timer;
+            timer.start();
+            size_t rows = fireData.execute(query, options).records.size();
+            timer.stop();
+            printf("%s: %zu rows in %.3f ms, peak %.2f MB\n", query.toString().c_str(), rows, timer.elapsed_ms(),
+                   counted.peakBytes() / (1024.0 * 1024.0));
+
+            // a tenth of that peak as the limit fails the query long before it copied everything
+            QueryMemory limited(counted.peakBytes() / 10);
+            options.stop.memory = &limited;
+            timer.start();
+            try {
+                fireData.execute(query, options);
+                timer.stop();
+                printf("  limit %.2f MB: finished?\n", limited.limitBytes() / (1024.0 * 1024.0));
+            } catch (const QueryCancelled& e) {
+                timer.stop();
+                printf("  limit %.2f MB: failed after %.3f ms holding %.2f MB (%s)\n",
+                       limited.limitBytes() / (1024.0 * 1024.0), timer.elapsed_ms(),
+                       limited.peakBytes() / (1024.0 * 1024.0), e.what());
+            }
+
+            // streamed under the same limit: only a batch per worker is held at a time
+            QueryMemory streamed(counted.peakBytes() / 10);
+            options.stop.memory = &streamed;
+            double concentration = 0.0;
+            timer.start();
+            try {
+                rows = fireData.stream(query, [&](const std::vector<FireRecord>& batch) {
+                    for (const FireRecord& record : batch) concentration += record.getConcentration();
+                }, options);
+                timer.stop();
+                printf("  streamed: %zu rows in %.3f ms, peak %.2f MB (average concentration %.3f)\n", rows,
+                       timer.elapsed_ms(), streamed.peakBytes() / (1024.0 * 1024.0),
+                       rows > 0 ? concentration / rows : 0.0);
+            } catch (const QueryCancelled& e) {
+                timer.stop();
+                printf("  streamed: failed after %.3f ms holding %.2f MB (%s)\n", timer.elapsed_ms(),
+                       streamed.peakBytes() / (1024.0 * 1024.0), e.what());
+            }
+        }
+    }
+
+    // ========================================================================
+    // LIMIT probes: the first 20 matches against the whole result, the scans stop once they have them
+    // ========================================================================
+    {
+        printf("\n--- LIMIT probes: 20 readings of valueRange 150+ and of PM2.5 ---\n\n");
+        const FireQuery probes[] = {FireQuery::valueRange(150.0, 1e9), FireQuery::pollutant("PM2.5")};
+        for (const FireQuery& probe : probes) {
+            const FireQuery variants[] = {probe, probe.limitedTo(20), probe.limitedTo(20, LimitMode::PREFIX)};
+            for (const FireQuery& query : variants) {
+                BenchmarkStats limitStats("Limit " + query.toString());
+                runBenchmark(limitStats, queryConfig, [&](int) {
+                    Timer timer;
+                    timer.start();
+                    FireQueryResult result = fireData.execute(query);
+                    timer.stop();
+                    return timer.elapsed_ms();
+                });
+                QueryProfile profile;
+                QueryOptions options;
+                options.profile = &profile;
+                size_t rows = fireData.execute(query, options).records.size();
+                printf("%s: %zu rows, %zu of %zu rows scanned\n", query.toString().c_str(), rows,
+                       profile.rowsScanned, fireData.size());
+                limitStats.printStatistics();
+                report.add(limitStats);
+            }
+            // PREFIX has to be the first 20 rows of the unlimited result, the projection lists every
+            // match in load order
+            FireColumns all = fireData.project({probe}, FIRE_UTC | FIRE_SITE | FIRE_CONCENTRATION);
+            for (ParallelStrategy strategy : STRATEGIES) {
+                FireQuery query = probe.limitedTo(20, LimitMode::PREFIX);
+                query.strategy = strategy;
+                FireQueryResult prefix = fireData.execute(query);
+                size_t expected = std::min<size_t>(20, all.rows);
+                bool same = prefix.records.size() == expected;
+                for (size_t i = 0; same && i < expected; ++i) {
+                    const FireRecord& r = prefix.records[i];
+                    same = r.getUTC() == all.utc[i] && r.getSiteName() == all.site[i] &&
+                           r.getConcentration() == all.concentration[i];
+                }
+                printf("%s prefix vs first %zu of the full result (%s): %s\n", probe.toString().c_str(),
+                       expected, strategyToString(strategy), same ? "same" : "MISMATCH");
+            }
+        }
+    }
+
+    // ========================================================================
+    // ordered results: the query sorts positions in parallel vs sorting the returned records
+    // ========================================================================
+    {
+        printf("\n--- Ordered results: valueRange 5-60 by concentration and by time ---\n\n");
+        const FireQuery ordered[] = {FireQuery::valueRange(5.0, 60.0).orderedBy(FIRE_CONCENTRATION, true),
+                                     FireQuery::valueRange(5.0, 60.0).orderedBy(FIRE_UTC)};
+        for (const FireQuery& query : ordered) {
+            BenchmarkStats orderStats("Ordered " + query.toString());
+            runBenchmark(orderStats, queryConfig, [&](int i) {
+                Timer timer;
+                timer.start();
+                FireQueryResult result = fireData.execute(query);
+                timer.stop();
+                if (i >= 0) {
+                    printf("Ordered query %d: %.3f ms (%zu rows)\n", i + 1, timer.elapsed_ms(),
+                           result.records.size());
+                }
+                return timer.elapsed_ms();
+            });
+            orderStats.printStatistics();
+            report.add(orderStats);
+        }
+    }
+
+    // ========================================================================
+    // approximate aggregates: time of the sampled answer and how far it is from the exact one
+    // ========================================================================
+    {
+        printf("\n--- Approximate aggregates (%zu row samples, 95%% confidence) ---\n\n", fireData.sampleSize());
+        BenchmarkStats approximateStats("Approximate average (PM2.5)");
+        runBenchmark(approximateStats, queryConfig, [&](int i) {
+            Timer timer;
+            timer.start();
+            Estimate estimate = fireData.approximateAverageConcentration("PM2.5");
+            timer.stop();
+            if (i >= 0) {
+                printf("Approximate average %d: %.6f ms (%.3f +- %.3f)\n", i + 1, timer.elapsed_ms(),
+                       estimate.value, estimate.halfWidth());
+            }
+            return timer.elapsed_ms();
+        });
+        approximateStats.printStatistics();
+        report.add(approximateStats);
+
+        const char* pollutants[] = {"PM2.5", "PM10", "OZONE", "NO2", "CO", "SO2"};
+        for (const char* pollutant : pollutants) {
+            double exact = fireData.calculateAverageConcentrationByPollutant(pollutant);
+            Estimate estimate = fireData.approximateAverageConcentration(pollutant);
+            if (estimate.populationRows == 0) continue;
+            printf("average %-6s exact %10.4f  approx %10.4f +- %.4f (%.2f%%) from %zu of %zu rows %s\n",
+                   pollutant, exact, estimate.value, estimate.halfWidth(), estimate.relativeError() * 100.0,
+                   estimate.sampleRows, estimate.populationRows,
+                   exact >= estimate.lower && exact <= estimate.upper ? "" : "(outside interval)");
+        }
+        std::map<int, size_t> counts = fireData.countRecordsByCategory();
+        std::map<int, Estimate> countEstimates = fireData.approximateCountByCategory();
+        for (const auto& pair : countEstimates) {
+            const Estimate& estimate = pair.second;
+            size_t exact = counts[pair.first];
+            printf("category %d   exact %10zu  approx %10.0f +- %.0f %s\n", pair.first, exact, estimate.value,
+                   estimate.halfWidth(), exact >= estimate.lower && exact <= estimate.upper ? "" : "(outside interval)");
+        }
+    }
+
+    // ========================================================================
+    // Z-order clustering: a small box and a pollutant lookup before and after, runs last since it
+    // reorders the records (the plans below show the clustered zone maps)
+    // ========================================================================
+    {
+        printf("\n--- Z-order clustering: Bay Area box and PM2.5 lookup, file order vs clustered ---\n\n");
+        QueryProfile boxProfile;
+        QueryOptions boxOptions;
+        boxOptions.profile = &boxProfile;
+        for (int clustered = 0; clustered < 2; ++clustered) {
+            const char* order = clustered ? "clustered" : "file order";
+            if (clustered) {
+                Timer clusterTimer;
+                clusterTimer.start();
+                fireData.clusterByLocation();
+                clusterTimer.stop();
+                printf("Clustered %zu records in %.3f ms\n", fireData.size(), clusterTimer.elapsed_ms());
+                report.addValue("cluster_by_location_ms", clusterTimer.elapsed_ms());
+            }
+
+            BenchmarkStats boxStats(std::string("Bay Area box / ") + order);
+            runBenchmark(boxStats, queryConfig, [&](int i) {
+                Timer timer;
+                timer.start();
+                std::vector<FireRecord> inBox = fireData.queryByGeographicBounds(
+                    37.0, 38.5, -123.0, -121.5, ParallelStrategy::OPENMP, boxOptions);
+                timer.stop();
+                if (i >= 0) {
+                    printf("Box %s %d: %.3f ms (%zu rows, %zu of %zu blocks skipped)\n", order, i + 1,
+                           timer.elapsed_ms(), inBox.size(), boxProfile.blocksSkipped,
+                           boxProfile.blocksScanned + boxProfile.blocksSkipped);
+                }
+                return timer.elapsed_ms();
+            });
+            boxStats.printStatistics();
+            report.add(boxStats);
+
+            BenchmarkStats lookupStats(std::string("PM2.5 lookup / ") + order);
+            runBenchmark(lookupStats, queryConfig, [&](int i) {
+                Timer timer;
+                timer.start();
+                std::vector<FireRecord> matches = fireData.queryByPollutant("PM2.5");
+                timer.stop();
+                if (i >= 0) {
+                    printf("Lookup %s %d: %.3f ms (%zu rows)\n", order, i + 1, timer.elapsed_ms(), matches.size());
+                }
+                return timer.elapsed_ms();
+            });
+            lookupStats.printStatistics();
+            report.add(lookupStats);
+        }
+    }
+
+    if (explainQueries) {
+        printf("\n========================================\n");
+        printf("Query Plans and Profiles\n");
+        printf("========================================\n\n");
+        QueryProfile profile;
+        QueryOptions options;
+        options.profile = &profile;
+
+        printf("%s", fireData.explain(FireQuery::pollutant("PM2.5")).c_str());
+        fireData.queryByPollutant("PM2.5", options);
+        profile.print();
+        printf("\n");
+        for (int s = 0; s < NUM_STRATEGIES; ++s) {
+            ParallelStrategy strategy = STRATEGIES[s];
+            printf("%s", fireData.explain(FireQuery::valueRange(5.0, 15.0, strategy)).c_str());
+            fireData.queryByValueRange(5.0, 15.0, strategy, options);
+            profile.print();
+            printf("\n");
+        }
+    }
+
+    // peak covers the load benchmarks too, where several copies may have been alive
+    printf("Peak RSS: %.2f MB\n", peakRSSBytes() / (1024.0 * 1024.0));
+    report.addValue("peak_rss_bytes", static_cast<double>(peakRSSBytes()));
+
+    // traced runs happen after the timed ones so tracing can't skew the numbers
+    if (!tracePath.empty()) {
+        Tracer::clear();
+        Tracer::enable();
+        for (int s = 0; s < NUM_STRATEGIES; ++s) {
+            ParallelStrategy strategy = STRATEGIES[s];
+            FireData traced;
+            traced.loadFromDirectory(dataPath, strategy);
+            traced.queryByValueRange(5.0, 15.0, strategy);
+        }
+        Tracer::disable();
+        if (Tracer::writeChromeJson(tracePath)) {
+            printf("Wrote trace to %s (open in ui.perfetto.dev)\n", tracePath.c_str());
+        } else {
+            printf("Could not write trace to %s\n", tracePath.c_str());
+        }
+    }
+
+    if (!sharedTarget.empty()) {
+        FireData::removeShared(sharedTarget);
+    }
+
+    if (slowLog) {
+        printf("Slow-query log: %llu entries written to %s (%llu dropped)\n",
+               (unsigned long long)slowLog->loggedCount(), slowLogPath.c_str(),
+               (unsigned long long)slowLog->droppedCount());
+    }
+
+    if (!metricsPath.empty()) {
+        if (MetricsRegistry::instance().writeToFile(metricsPath)) {
+            printf("Wrote metrics to %s\n", metricsPath.c_str());
+        } else {
+            printf("Could not write metrics to %s\n", metricsPath.c_str());
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        if (report.writeToFile(jsonPath)) {
+            printf("Wrote benchmark results to %s\n", jsonPath.c_str());
+        } else {
+            printf("Could not write benchmark results to %s\n", jsonPath.c_str());
+        }
     }
 
     printf("========================================\n");
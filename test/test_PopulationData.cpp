@@ -7,14 +7,37 @@
 
 #include <cstdio>
 #include <string>
+#include <algorithm>
 #include "PopulationData/populationData.hpp"
 #include "common/parallelStrategy.hpp"
+#include "common/memoryUsage.hpp"
+#include "common/trace.hpp"
+#include "common/metrics.hpp"
+#include "common/slowQueryLog.hpp"
+#include <memory>
 #include "test/benchmark.hpp"
 #include "utils.hpp"
 
-// number of iterations for averaging
-const int LOAD_ITERATIONS = 3;
-const int QUERY_ITERATIONS = 5;
+// iteration policy, loads are slow so they get fewer runs
+// queries keep running until the 95% CI of the mean is within +-2% (or the cap is hit)
+BenchmarkConfig makeLoadConfig() {
+    BenchmarkConfig config;
+    config.warmupIterations = 1;
+    config.minIterations = 3;
+    config.maxIterations = 10;
+    config.targetRelativeCI = 0.05;
+    return config;
+}
+
+BenchmarkConfig makeQueryConfig() {
+    BenchmarkConfig config;
+    config.warmupIterations = 2;
+    config.minIterations = 10;
+    config.maxIterations = 200;
+    config.targetRelativeCI = 0.02;
+    config.maxTotalMs = 10000.0;
+    return config;
+}
 
 // test all three strategies
 const ParallelStrategy STRATEGIES[] = {
@@ -33,12 +56,56 @@ int main(int argc, char** argv) {
 
     // default path to data
     std::string dataPath = "/Users/khushnaidu/mini1/API_SP.POP.TOTL_DS2_en_csv_v2_3401680.csv";
-    if (argc > 1) {
-        dataPath = argv[1];
+    // optional machine readable output: --json results.json
+    std::string jsonPath;
+    // optional chrome trace of one load + query per strategy: --trace trace.json
+    std::string tracePath;
+    // optional prometheus metrics: --metrics metrics.prom writes a file at the end,
+    // --metrics-port 9464 serves them on localhost while the benchmark runs
+    std::string metricsPath;
+    int metricsPort = 0;
+    // print the plan and an execution profile of one lookup and one scan per strategy: --explain
+    bool explainQueries = false;
+    // optional slow-query log of the query benchmarks: --slow-log slow.tsv [--slow-ms 50] [--slow-sample 0.01]
+    std::string slowLogPath;
+    SlowQueryConfig slowConfig;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--slow-log" && i + 1 < argc) {
+            slowLogPath = argv[++i];
+        } else if (arg == "--slow-ms" && i + 1 < argc) {
+            slowConfig.thresholdMs = std::stod(argv[++i]);
+        } else if (arg == "--slow-sample" && i + 1 < argc) {
+            slowConfig.sampleRate = std::stod(argv[++i]);
+        } else if (arg == "--explain") {
+            explainQueries = true;
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = std::stoi(argv[++i]);
+        } else {
+            dataPath = arg;
+        }
     }
 
     printf("Data path: %s\n\n", dataPath.c_str());
 
+    if (metricsPort > 0) {
+        if (MetricsRegistry::instance().startHttpServer(metricsPort)) {
+            printf("Serving metrics on http://127.0.0.1:%d/metrics\n\n", metricsPort);
+        } else {
+            printf("Could not listen on port %d for metrics\n\n", metricsPort);
+        }
+    }
+
+    BenchmarkConfig loadConfig = makeLoadConfig();
+    BenchmarkConfig queryConfig = makeQueryConfig();
+    BenchmarkReport report("population");
+
     // ========================================================================
     // benchmark loading with each strategy
     // ========================================================================
@@ -50,8 +117,8 @@ int main(int argc, char** argv) {
         printf("========================================\n\n");
 
         // benchmark load times
-        BenchmarkStats loadStats("Load");
-        for (int i = 0; i < LOAD_ITERATIONS; ++i) {
+        BenchmarkStats loadStats(std::string("Load / ") + strategyToString(strategy));
+        runBenchmark(loadStats, loadConfig, [&](int i) {
             // new object each iteration
             PopulationData populationData;
             Timer timer;
@@ -61,10 +128,23 @@ int main(int argc, char** argv) {
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            loadStats.addTiming(elapsed);
-            printf("Load %d: %.3f ms (%zu records)\n", i + 1, elapsed, populationData.size());
-        }
+            if (i < 0) {
+                printf("Warmup load: %.3f ms (%zu records)\n", elapsed, populationData.size());
+            } else {
+                printf("Load %d: %.3f ms (%zu records)\n", i + 1, elapsed, populationData.size());
+            }
+            return elapsed;
+        });
         loadStats.printStatistics();
+        // queue contention and worker busy/idle of the last timed iteration
+        lastParallelRun().print();
+        report.add(loadStats);
+
+        reportAllocations("load", "row", [&]() {
+            PopulationData populationData;
+            populationData.loadFromDirectory(dataPath, strategy);
+            return populationData.size();
+        });
     }
 
     // ========================================================================
@@ -74,44 +154,152 @@ int main(int argc, char** argv) {
     printf("Query Performance Tests\n");
     printf("========================================\n\n");
 
+    // created before the query dataset so it outlives it
+    std::unique_ptr<SlowQueryLog> slowLog;
+    if (!slowLogPath.empty()) {
+        slowLog.reset(new SlowQueryLog(slowLogPath, slowConfig));
+    }
+
     // load once for all query tests
     PopulationData populationData;
     populationData.loadFromDirectory(dataPath, ParallelStrategy::OPENMP);
     printf("Loaded %zu records for query tests\n\n", populationData.size());
 
+    if (slowLog) {
+        populationData.setSlowQueryLog(slowLog.get());
+    }
+
+    // memory footprint of the resident dataset, used for sizing query nodes
+    MemoryUsage usage = populationData.memoryUsage();
+    usage.print("PopulationData");
+    printf("Current RSS: %.2f MB, peak RSS: %.2f MB\n\n",
+           currentRSSBytes() / (1024.0 * 1024.0), peakRSSBytes() / (1024.0 * 1024.0));
+    report.addValue("dataset_bytes", static_cast<double>(usage.total()));
+    report.addValue("bytes_per_record", usage.bytesPerRecord());
+    for (const auto& component : usage.components) {
+        std::string key = "bytes_" + component.first;
+        std::replace(key.begin(), key.end(), ' ', '_');
+        report.addValue(key, static_cast<double>(component.second));
+    }
+
     // test each query with each strategy
     for (int s = 0; s < NUM_STRATEGIES; ++s) {
         ParallelStrategy strategy = STRATEGIES[s];
+        std::string suffix = std::string(" / ") + strategyToString(strategy);
         
         printf("\n--- Strategy: %s ---\n\n", strategyToString(strategy));
         
         // year range query test
-        BenchmarkStats yearRangeStats("Year Range Query (1960-2020)");
-        for (int i = 0; i < QUERY_ITERATIONS; ++i) {
+        BenchmarkStats yearRangeStats("Year Range Query (1960-2020)" + suffix);
+        runBenchmark(yearRangeStats, queryConfig, [&](int i) {
             Timer timer;
             timer.start();
             auto results = populationData.queryByYearRange(1960, 2020, strategy);
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            yearRangeStats.addTiming(elapsed);
-            printf("Year range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
-        }
+            if (i >= 0) {
+                printf("Year range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
+            }
+            return elapsed;
+        });
         yearRangeStats.printStatistics();
+        // queue contention and worker busy/idle of the last timed iteration
+        lastParallelRun().print();
+        report.add(yearRangeStats);
+        reportAllocations("year range query", "query", [&]() {
+            auto results = populationData.queryByYearRange(1960, 2020, strategy);
+            return size_t(1);
+        });
 
         // population range query test
-        BenchmarkStats rangeStats("Population Range Query (100M-1B in 2020)");
-        for (int i = 0; i < QUERY_ITERATIONS; ++i) {
+        BenchmarkStats rangeStats("Population Range Query (100M-1B in 2020)" + suffix);
+        runBenchmark(rangeStats, queryConfig, [&](int i) {
             Timer timer;
             timer.start();
             auto results = populationData.queryByPopulationRange(100000000, 1000000000, 2020, strategy);
             timer.stop();
 
             double elapsed = timer.elapsed_ms();
-            rangeStats.addTiming(elapsed);
-            printf("Population range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
-        }
+            if (i >= 0) {
+                printf("Population range query %d: %.3f ms (%zu results)\n", i + 1, elapsed, results.size());
+            }
+            return elapsed;
+        });
         rangeStats.printStatistics();
+        // queue contention and worker busy/idle of the last timed iteration
+        lastParallelRun().print();
+        report.add(rangeStats);
+        reportAllocations("population range query", "query", [&]() {
+            auto results = populationData.queryByPopulationRange(100000000, 1000000000, 2020, strategy);
+            return size_t(1);
+        });
+    }
+
+    if (explainQueries) {
+        printf("\n========================================\n");
+        printf("Query Plans and Profiles\n");
+        printf("========================================\n\n");
+        QueryProfile profile;
+        QueryOptions options;
+        options.profile = &profile;
+
+        printf("%s", populationData.explain(PopulationQuery::country("USA")).c_str());
+        populationData.queryByCountry("USA", options);
+        profile.print();
+        printf("\n");
+        for (int s = 0; s < NUM_STRATEGIES; ++s) {
+            ParallelStrategy strategy = STRATEGIES[s];
+            PopulationQuery query = PopulationQuery::populationRange(100000000, 1000000000, 2020, strategy);
+            printf("%s", populationData.explain(query).c_str());
+            populationData.queryByPopulationRange(100000000, 1000000000, 2020, strategy, options);
+            profile.print();
+            printf("\n");
+        }
+    }
+
+    // peak covers the load benchmarks too, where several copies may have been alive
+    printf("Peak RSS: %.2f MB\n", peakRSSBytes() / (1024.0 * 1024.0));
+    report.addValue("peak_rss_bytes", static_cast<double>(peakRSSBytes()));
+
+    // traced runs happen after the timed ones so tracing can't skew the numbers
+    if (!tracePath.empty()) {
+        Tracer::clear();
+        Tracer::enable();
+        for (int s = 0; s < NUM_STRATEGIES; ++s) {
+            ParallelStrategy strategy = STRATEGIES[s];
+            PopulationData traced;
+            traced.loadFromDirectory(dataPath, strategy);
+            traced.queryByPopulationRange(100000000, 1000000000, 2020, strategy);
+        }
+        Tracer::disable();
+        if (Tracer::writeChromeJson(tracePath)) {
+            printf("Wrote trace to %s (open in ui.perfetto.dev)\n", tracePath.c_str());
+        } else {
+            printf("Could not write trace to %s\n", tracePath.c_str());
+        }
+    }
+
+    if (slowLog) {
+        printf("Slow-query log: %llu entries written to %s (%llu dropped)\n",
+               (unsigned long long)slowLog->loggedCount(), slowLogPath.c_str(),
+               (unsigned long long)slowLog->droppedCount());
+    }
+
+    if (!metricsPath.empty()) {
+        if (MetricsRegistry::instance().writeToFile(metricsPath)) {
+            printf("Wrote metrics to %s\n", metricsPath.c_str());
+        } else {
+            printf("Could not write metrics to %s\n", metricsPath.c_str());
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        if (report.writeToFile(jsonPath)) {
+            printf("Wrote benchmark results to %s\n", jsonPath.c_str());
+        } else {
+            printf("Could not write benchmark results to %s\n", jsonPath.c_str());
+        }
     }
 
     printf("========================================\n");